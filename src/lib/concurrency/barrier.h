@@ -22,11 +22,19 @@
 
 #include <atomic>
 #include <cassert>
-#include <condition_variable>
-#include <mutex>
+#include <cstdint>
+
+#include "lib/concurrency/spin_wait.h"
 
 namespace Rayni
 {
+	// Generation (upper 32 bits) and number of arrived threads (lower 32 bits)
+	// are kept in one atomic. A thread arrives with a compare and swap, last
+	// thread to arrive resets the count and increases the generation in the
+	// same operation. Waiting threads wait for the generation they arrived in
+	// to change, so a thread that arrives in the next generation before others
+	// have noticed the change can not be mistaken for one in the previous. See
+	// spin_wait_while_equal() for how threads wait.
 	class Barrier
 	{
 	public:
@@ -42,41 +50,55 @@ namespace Rayni
 
 		void arrive_and_wait()
 		{
-			std::unique_lock<std::mutex> lock(mutex_);
+			std::uint32_t generation;
 
-			arrived_++;
+			if (arrive(generation))
+				return;
 
-			if (arrived_ == num_threads_) {
-				arrived_ = 0;
-				generation_++;
-				condition_.notify_all();
-			} else {
-				unsigned int current_generation = generation_;
+			std::uint64_t state = state_.load(std::memory_order_acquire);
 
-				while (current_generation == generation_)
-					condition_.wait(lock);
-			}
+			while (generation_of(state) == generation)
+				state = spin_wait_while_equal(state_, state);
 		}
 
 		void arrive()
 		{
-			std::unique_lock<std::mutex> lock(mutex_);
-
-			arrived_++;
+			std::uint32_t generation;
 
-			if (arrived_ == num_threads_) {
-				arrived_ = 0;
-				generation_++;
-				condition_.notify_all();
-			}
+			arrive(generation);
 		}
 
 	private:
-		std::mutex mutex_;
-		std::condition_variable condition_;
-		unsigned int num_threads_;
-		unsigned int arrived_ = 0;
-		unsigned int generation_ = 0;
+		static std::uint32_t generation_of(std::uint64_t state)
+		{
+			return std::uint32_t(state >> 32);
+		}
+
+		// Returns true if calling thread was last to arrive. Generation that
+		// thread arrived in is stored in generation.
+		bool arrive(std::uint32_t &generation)
+		{
+			std::uint64_t state = state_.load(std::memory_order_relaxed);
+			bool last;
+			std::uint64_t new_state;
+
+			do {
+				generation = generation_of(state);
+				last = std::uint32_t(state) + 1 == num_threads_;
+				new_state = last ? std::uint64_t(generation + 1) << 32 : state + 1;
+			} while (!state_.compare_exchange_weak(state,
+			                                       new_state,
+			                                       std::memory_order_acq_rel,
+			                                       std::memory_order_relaxed));
+
+			if (last)
+				state_.notify_all();
+
+			return last;
+		}
+
+		const unsigned int num_threads_;
+		std::atomic<std::uint64_t> state_ = 0;
 	};
 }
 
@@ -0,0 +1,84 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/concurrency/cancellable.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace Rayni
+{
+	Cancellable::Cancellable(const Cancellable *parent) : parent_(parent)
+	{
+		if (parent)
+			parent_callback_ = std::make_unique<Callback>(*parent, [this] { cancel(); });
+	}
+
+	Cancellable::~Cancellable()
+	{
+		parent_callback_.reset();
+
+		assert(callbacks_.empty());
+	}
+
+	void Cancellable::cancel()
+	{
+		// Callbacks are run with lock held so that a Callback can not be
+		// destroyed while its function is running in another thread.
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (cancelled_.load(std::memory_order_relaxed))
+			return;
+
+		cancelled_.store(true, std::memory_order_relaxed);
+
+		for (const Callback *callback : callbacks_)
+			callback->function_();
+	}
+
+	void Cancellable::reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		// Parent is read with lock held. If parent is cancelled concurrently, its
+		// callback cancels this again after lock is released.
+		cancelled_.store(parent_ && parent_->cancelled(), std::memory_order_relaxed);
+	}
+
+	Cancellable::Callback::Callback(const Cancellable &cancellable, std::function<void()> &&function) :
+	        cancellable_(cancellable),
+	        function_(std::move(function))
+	{
+		std::lock_guard<std::mutex> lock(cancellable_.mutex_);
+
+		cancellable_.callbacks_.push_back(this);
+
+		if (cancellable_.cancelled())
+			function_();
+	}
+
+	Cancellable::Callback::~Callback()
+	{
+		std::lock_guard<std::mutex> lock(cancellable_.mutex_);
+
+		auto &callbacks = cancellable_.callbacks_;
+		callbacks.erase(std::find(callbacks.cbegin(), callbacks.cend(), this));
+	}
+}
@@ -21,29 +21,84 @@
 #define RAYNI_LIB_CONCURRENCY_CANCELLABLE_H
 
 #include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace Rayni
 {
+	// Cooperative cancellation. Work polls cancelled(), which is a relaxed load
+	// and cheap enough to call often.
+	//
+	// A Cancellable created with a parent is cancelled when parent is, but
+	// cancelling it does not cancel parent. Can be used to cancel a part of a
+	// larger job, e.g. one build among several. Parent must outlive child.
+	//
+	// Cancellable::Callback can be used to react to cancellation directly
+	// instead of polling, e.g. to wake up something that waits.
 	class Cancellable
 	{
 	public:
-		void cancel()
-		{
-			cancelled_.store(true, std::memory_order_relaxed);
-		}
+		class Callback;
 
-		void reset()
+		Cancellable() : Cancellable(nullptr)
 		{
-			cancelled_.store(false, std::memory_order_relaxed);
 		}
 
+		explicit Cancellable(const Cancellable *parent);
+
+		~Cancellable();
+
+		Cancellable(const Cancellable &other) = delete;
+		Cancellable(Cancellable &&other) = delete;
+		Cancellable &operator=(const Cancellable &other) = delete;
+		Cancellable &operator=(Cancellable &&other) = delete;
+
+		// Runs callbacks, and cancels children, in calling thread if not
+		// already cancelled.
+		void cancel();
+
+		// Does not affect parent or children, stays cancelled if parent is
+		// cancelled. Callbacks stay registered and are run again on next cancel().
+		void reset();
+
 		bool cancelled() const
 		{
 			return cancelled_.load(std::memory_order_relaxed);
 		}
 
 	private:
+		mutable std::mutex mutex_;
+		mutable std::vector<const Callback *> callbacks_;
 		std::atomic<bool> cancelled_{false};
+		const Cancellable *const parent_;
+
+		// Cancels this when parent is cancelled. Destroyed, and unregistered
+		// from parent, before other members.
+		std::unique_ptr<Callback> parent_callback_;
+	};
+
+	// Function is run when cancellable is cancelled, directly in constructor if
+	// it already is. Destructor unregisters callback and waits for function to
+	// return if it is running in another thread. Function must not register
+	// or unregister callbacks with the same Cancellable.
+	class Cancellable::Callback
+	{
+	public:
+		Callback(const Cancellable &cancellable, std::function<void()> &&function);
+		~Callback();
+
+		Callback(const Callback &other) = delete;
+		Callback(Callback &&other) = delete;
+		Callback &operator=(const Callback &other) = delete;
+		Callback &operator=(Callback &&other) = delete;
+
+	private:
+		friend class Cancellable;
+
+		const Cancellable &cancellable_;
+		std::function<void()> function_;
 	};
 }
 
@@ -20,18 +20,20 @@
 #ifndef RAYNI_LIB_CONCURRENCY_LATCH_H
 #define RAYNI_LIB_CONCURRENCY_LATCH_H
 
+#include <atomic>
 #include <cassert>
-#include <condition_variable>
-#include <mutex>
+
+#include "lib/concurrency/spin_wait.h"
 
 namespace Rayni
 {
+	// See spin_wait_while_equal() for how threads wait.
 	class Latch
 	{
 	public:
 		explicit Latch(unsigned int count) : count_(count)
 		{
-			assert(count_ > 0);
+			assert(count > 0);
 		}
 
 		Latch(const Latch &other) = delete;
@@ -41,27 +43,24 @@ namespace Rayni
 
 		void count_down()
 		{
-			std::lock_guard<std::mutex> lock(mutex_);
+			unsigned int previous = count_.fetch_sub(1, std::memory_order_acq_rel);
 
-			assert(count_ > 0);
-			count_--;
+			assert(previous > 0);
 
-			if (count_ == 0)
-				condition_.notify_one();
+			if (previous == 1)
+				count_.notify_all();
 		}
 
 		void wait()
 		{
-			std::unique_lock<std::mutex> lock(mutex_);
+			unsigned int count = count_.load(std::memory_order_acquire);
 
-			while (count_ != 0)
-				condition_.wait(lock);
+			while (count != 0)
+				count = spin_wait_while_equal(count_, count);
 		}
 
 	private:
-		std::mutex mutex_;
-		std::condition_variable condition_;
-		unsigned int count_ = 0;
+		std::atomic<unsigned int> count_;
 	};
 }
 
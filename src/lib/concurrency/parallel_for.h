@@ -0,0 +1,157 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_CONCURRENCY_PARALLEL_FOR_H
+#define RAYNI_LIB_CONCURRENCY_PARALLEL_FOR_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "lib/concurrency/latch.h"
+#include "lib/concurrency/thread_pool.h"
+
+// Calling thread never runs unrelated tasks and never waits for a chunk that
+// has not been started. Chunks not yet started by another thread are run by
+// calling thread instead. So it is safe to call from tasks regardless of how
+// many threads in pool are busy, and code that keeps per thread state can
+// rely on that state not being touched by something else during the call.
+
+namespace Rayni
+{
+	// Splits [start, end) into chunks of (almost) equal size and calls
+	// function(chunk, chunk_start, chunk_end) for each chunk. Chunk i is added to
+	// thread i % size() in pool (Affinity::PREFERRED) so the same part of a range
+	// is handled by the same thread in consecutive calls if it is not busy. Last
+	// chunk is handled by calling thread. With a pool pinned to CPUs of one NUMA
+	// node (see CPUTopology::node_cpu_ids()), chunks stay on that node.
+	template <typename Index, typename Function>
+	void parallel_for_chunks(ThreadPool &thread_pool,
+	                         std::type_identity_t<Index> start,
+	                         Index end,
+	                         unsigned int chunks,
+	                         Function &&function)
+	{
+		static_assert(std::is_integral_v<Index>);
+		assert(start <= end);
+		assert(chunks > 0);
+
+		auto run_chunk = [&, start, end, chunks](unsigned int chunk) {
+			std::uint64_t count = end - start;
+			auto chunk_start = Index(start + (std::uint64_t(chunk) * count) / chunks);
+			auto chunk_end = Index(start + (std::uint64_t(chunk + 1) * count) / chunks);
+
+			function(chunk, chunk_start, chunk_end);
+		};
+
+		if (chunks == 1) {
+			run_chunk(0);
+			return;
+		}
+
+		// Tasks that no thread has started are taken back and run by calling
+		// thread, so no task refers to finished after return.
+		Latch finished(chunks);
+
+		for (unsigned int chunk = 0; chunk < chunks - 1; chunk++)
+			thread_pool.add_task_to(
+			        chunk % thread_pool.size(),
+			        [&finished, chunk, &run_chunk] {
+				        run_chunk(chunk);
+				        finished.count_down();
+			        },
+			        ThreadPool::Affinity::PREFERRED,
+			        &finished);
+
+		run_chunk(chunks - 1);
+		finished.count_down();
+
+		for (unsigned int chunk = chunks - 1; chunk-- > 0;)
+			thread_pool.run_tagged_task(chunk % thread_pool.size(), &finished);
+
+		finished.wait();
+	}
+
+	// At most one chunk per thread in pool and at least grain_size indices per
+	// chunk (unless range is smaller).
+	template <typename Index>
+	unsigned int parallel_for_num_chunks(const ThreadPool &thread_pool, Index count, Index grain_size)
+	{
+		assert(grain_size > 0);
+
+		Index chunks = std::max(count / grain_size, Index(1));
+
+		return unsigned(std::min(std::uint64_t(chunks), std::uint64_t(thread_pool.size())));
+	}
+
+	// Calls function(chunk_start, chunk_end) for chunks of [start, end), see
+	// parallel_for_chunks() and parallel_for_num_chunks().
+	template <typename Index, typename Function>
+	void parallel_for(ThreadPool &thread_pool,
+	                  std::type_identity_t<Index> start,
+	                  Index end,
+	                  std::type_identity_t<Index> grain_size,
+	                  Function &&function)
+	{
+		unsigned int chunks = parallel_for_num_chunks<Index>(thread_pool, end - start, grain_size);
+
+		auto call_function = [&](unsigned int, Index chunk_start, Index chunk_end) {
+			function(chunk_start, chunk_end);
+		};
+
+		parallel_for_chunks(thread_pool, start, end, chunks, call_function);
+	}
+
+	// Calls map(chunk_start, chunk_end) for chunks of [start, end), like
+	// parallel_for(), and combines results with reduce(T, T). Results are
+	// reduced in chunk order, so result only depends on number of threads in
+	// pool even if reduce is not associative (e.g. floating point addition).
+	template <typename T, typename Index, typename Map, typename Reduce>
+	T parallel_reduce(ThreadPool &thread_pool,
+	                  std::type_identity_t<Index> start,
+	                  Index end,
+	                  std::type_identity_t<Index> grain_size,
+	                  const T &identity,
+	                  Map &&map,
+	                  Reduce &&reduce)
+	{
+		unsigned int chunks = parallel_for_num_chunks<Index>(thread_pool, end - start, grain_size);
+		std::vector<T> results(chunks, identity);
+
+		parallel_for_chunks(thread_pool,
+		                    start,
+		                    end,
+		                    chunks,
+		                    [&](unsigned int chunk, Index chunk_start, Index chunk_end) {
+			                    results[chunk] = map(chunk_start, chunk_end);
+		                    });
+
+		T result = identity;
+
+		for (T &chunk_result : results)
+			result = reduce(std::move(result), std::move(chunk_result));
+
+		return result;
+	}
+}
+
+#endif // RAYNI_LIB_CONCURRENCY_PARALLEL_FOR_H
@@ -0,0 +1,68 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_CONCURRENCY_SPIN_WAIT_H
+#define RAYNI_LIB_CONCURRENCY_SPIN_WAIT_H
+
+#include <atomic>
+#include <thread>
+
+#if defined __x86_64__ || defined __i386__
+#	include <immintrin.h>
+#endif
+
+namespace Rayni
+{
+	inline void cpu_relax()
+	{
+#if defined __x86_64__ || defined __i386__
+		_mm_pause();
+#elif defined __aarch64__
+		asm volatile("yield");
+#endif
+	}
+
+	// Waits until atomic no longer has value old. Spins for a short while first
+	// since waits are often short when threads do similar amounts of work. Then
+	// blocks in std::atomic::wait() (futex on Linux). No spinning if there is
+	// only one hardware thread, other thread can not make progress while
+	// spinning anyway.
+	template <typename T>
+	T spin_wait_while_equal(const std::atomic<T> &atomic, T old)
+	{
+		constexpr unsigned int SPIN_ITERATIONS = 512;
+		static const bool spin = std::thread::hardware_concurrency() > 1;
+
+		T value = atomic.load(std::memory_order_acquire);
+
+		for (unsigned int i = 0; spin && value == old && i < SPIN_ITERATIONS; i++) {
+			cpu_relax();
+			value = atomic.load(std::memory_order_acquire);
+		}
+
+		while (value == old) {
+			atomic.wait(old, std::memory_order_acquire);
+			value = atomic.load(std::memory_order_acquire);
+		}
+
+		return value;
+	}
+}
+
+#endif // RAYNI_LIB_CONCURRENCY_SPIN_WAIT_H
@@ -0,0 +1,169 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_CONCURRENCY_TASK_H
+#define RAYNI_LIB_CONCURRENCY_TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Rayni
+{
+	// Move-only void() callable. Unlike std::function, function object does not
+	// have to be copyable and it is stored in a buffer inside Task if it fits,
+	// which is the case for lambdas that capture a few references or values.
+	// Larger function objects are heap allocated. Buffer size is chosen so that
+	// a Task is 64 bytes.
+	class Task
+	{
+	public:
+		static constexpr std::size_t BUFFER_SIZE = 56;
+
+		Task() = default;
+
+		template <typename Function,
+		          typename = std::enable_if_t<!std::is_same_v<std::decay_t<Function>, Task>>>
+		// NOLINTNEXTLINE(google-explicit-constructor, hicpp-explicit-conversions) Like std::function.
+		Task(Function &&function)
+		{
+			emplace<std::decay_t<Function>>(std::forward<Function>(function));
+		}
+
+		~Task()
+		{
+			reset();
+		}
+
+		Task(const Task &other) = delete;
+		Task &operator=(const Task &other) = delete;
+
+		Task(Task &&other) noexcept
+		{
+			move_from(other);
+		}
+
+		Task &operator=(Task &&other) noexcept
+		{
+			if (this != &other) {
+				reset();
+				move_from(other);
+			}
+
+			return *this;
+		}
+
+		// Returns stored function object. Reference is valid until Task is reset,
+		// moved from or destroyed.
+		template <typename Function, typename... Args>
+		Function &emplace(Args &&...args)
+		{
+			reset();
+
+			Function *function;
+
+			if constexpr (stored_in_buffer<Function>()) {
+				function = new (buffer_) Function(std::forward<Args>(args)...);
+			} else {
+				function = new Function(std::forward<Args>(args)...);
+				new (buffer_) Function *(function);
+			}
+
+			operations_ = &OPERATIONS<Function>;
+
+			return *function;
+		}
+
+		void reset()
+		{
+			if (operations_) {
+				operations_->destroy(buffer_);
+				operations_ = nullptr;
+			}
+		}
+
+		explicit operator bool() const
+		{
+			return operations_ != nullptr;
+		}
+
+		void operator()()
+		{
+			operations_->invoke(buffer_);
+		}
+
+		template <typename Function>
+		static constexpr bool stored_in_buffer()
+		{
+			return sizeof(Function) <= BUFFER_SIZE && alignof(Function) <= alignof(std::max_align_t) &&
+			       std::is_nothrow_move_constructible_v<Function>;
+		}
+
+	private:
+		struct Operations
+		{
+			void (*invoke)(std::byte *buffer);
+			void (*move)(std::byte *from, std::byte *to);
+			void (*destroy)(std::byte *buffer);
+		};
+
+		template <typename Function>
+		static Function *function_in(std::byte *buffer)
+		{
+			if constexpr (stored_in_buffer<Function>())
+				return std::launder(reinterpret_cast<Function *>(buffer));
+			else
+				return *std::launder(reinterpret_cast<Function **>(buffer));
+		}
+
+		template <typename Function>
+		static constexpr Operations OPERATIONS = {
+		        [](std::byte *buffer) { (*function_in<Function>(buffer))(); },
+		        [](std::byte *from, std::byte *to) {
+			        if constexpr (stored_in_buffer<Function>()) {
+				        Function *function = function_in<Function>(from);
+				        new (to) Function(std::move(*function));
+				        function->~Function();
+			        } else {
+				        new (to) Function *(function_in<Function>(from));
+			        }
+		        },
+		        [](std::byte *buffer) {
+			        if constexpr (stored_in_buffer<Function>())
+				        function_in<Function>(buffer)->~Function();
+			        else
+				        delete function_in<Function>(buffer);
+		        }};
+
+		void move_from(Task &other)
+		{
+			if (other.operations_) {
+				other.operations_->move(other.buffer_, buffer_);
+				operations_ = other.operations_;
+				other.operations_ = nullptr;
+			}
+		}
+
+		alignas(std::max_align_t) std::byte buffer_[BUFFER_SIZE];
+		const Operations *operations_ = nullptr;
+	};
+}
+
+#endif // RAYNI_LIB_CONCURRENCY_TASK_H
@@ -0,0 +1,104 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_CONCURRENCY_TASK_GROUP_H
+#define RAYNI_LIB_CONCURRENCY_TASK_GROUP_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include "lib/concurrency/thread_pool.h"
+
+namespace Rayni
+{
+	// Tasks run in a group can be waited for without blocking the waiting thread.
+	// wait() runs other tasks from pool (including those in group) until all
+	// tasks in group have finished. Safe to use from tasks running in pool,
+	// recursively, regardless of number of threads in pool. A thread not in pool
+	// only blocks in wait(), it never runs tasks, so tasks can keep state per
+	// thread in pool (see ThreadPool::current_thread_index()) and one more for
+	// the thread that started the work.
+	class TaskGroup
+	{
+	public:
+		explicit TaskGroup(ThreadPool &thread_pool) : thread_pool_(thread_pool)
+		{
+		}
+
+		~TaskGroup()
+		{
+			wait();
+		}
+
+		TaskGroup(const TaskGroup &other) = delete;
+		TaskGroup(TaskGroup &&other) = delete;
+		TaskGroup &operator=(const TaskGroup &other) = delete;
+		TaskGroup &operator=(TaskGroup &&other) = delete;
+
+		template <typename Function>
+		void run(Function &&function)
+		{
+			thread_pool_.add_task(group_task(std::forward<Function>(function)));
+		}
+
+		// Like run() but task is added to given thread, see ThreadPool::add_task_to().
+		template <typename Function>
+		void run_on(unsigned int thread_index, Function &&function, ThreadPool::Affinity affinity)
+		{
+			thread_pool_.add_task_to(thread_index, group_task(std::forward<Function>(function)), affinity);
+		}
+
+		void wait();
+
+	private:
+		template <typename Function>
+		Task group_task(Function &&function)
+		{
+			unfinished_++;
+
+			// Group may be destroyed as soon as unfinished_ reaches 0, do not use this after.
+			return [&unfinished = unfinished_,
+			        &thread_pool = thread_pool_,
+			        function = std::forward<Function>(function)]() mutable {
+				function();
+
+				if (--unfinished == 0)
+					thread_pool.task_group_finished();
+			};
+		}
+
+		ThreadPool &thread_pool_;
+		std::atomic<std::size_t> unfinished_ = 0;
+	};
+
+	// Runs function2 as a task in pool and function1 in calling thread. Returns
+	// when both have finished, see TaskGroup.
+	template <typename Function1, typename Function2>
+	void parallel_invoke(ThreadPool &thread_pool, Function1 &&function1, Function2 &&function2)
+	{
+		TaskGroup task_group(thread_pool);
+
+		task_group.run(std::forward<Function2>(function2));
+		std::forward<Function1>(function1)();
+		task_group.wait();
+	}
+}
+
+#endif // RAYNI_LIB_CONCURRENCY_TASK_GROUP_H
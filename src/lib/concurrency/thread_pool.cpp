@@ -19,14 +19,91 @@
 
 #include "lib/concurrency/thread_pool.h"
 
-#include <iterator>
+#include <pthread.h>
+#include <sched.h>
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
 #include <thread>
 #include <utility>
 
+#include "config.h"
+#include "lib/concurrency/work_stealing_deque.h"
 #include "lib/log.h"
 
 namespace Rayni
 {
+	namespace
+	{
+		constexpr std::size_t TASK_NODE_CACHE_MAX_SIZE = 1024;
+
+		struct CurrentWorker
+		{
+			const ThreadPool *thread_pool = nullptr;
+			void *worker = nullptr;
+		};
+
+		thread_local CurrentWorker current_worker_;
+
+		void pin_current_thread(unsigned int cpu_id)
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu_id, &set);
+
+			if (int error = pthread_setaffinity_np(pthread_self(), sizeof set, &set); error != 0) {
+				std::string message = std::error_code(error, std::system_category()).message();
+				log_warning("Failed to pin thread in thread pool to CPU %u: %s",
+				            cpu_id,
+				            message.c_str());
+			}
+		}
+	}
+
+	struct ThreadPool::TaskNodeCache
+	{
+		~TaskNodeCache()
+		{
+			while (nodes) {
+				TaskNode *node = nodes;
+				nodes = node->next;
+				delete node;
+			}
+		}
+
+		TaskNodeCache() = default;
+		TaskNodeCache(const TaskNodeCache &other) = delete;
+		TaskNodeCache(TaskNodeCache &&other) = delete;
+		TaskNodeCache &operator=(const TaskNodeCache &other) = delete;
+		TaskNodeCache &operator=(TaskNodeCache &&other) = delete;
+
+		TaskNode *nodes = nullptr;
+		std::size_t size = 0;
+	};
+
+	thread_local ThreadPool::TaskNodeCache ThreadPool::task_node_cache_;
+
+	struct alignas(RAYNI_L1_CACHE_LINE_SIZE) ThreadPool::Worker
+	{
+		explicit Worker(unsigned int i) : index(i)
+		{
+		}
+
+		const unsigned int index;
+
+		WorkStealingDeque<TaskNode *> deque;
+
+		// Tasks added with add_task_to().
+		std::mutex mutex;
+		TaskNodeQueue preferred_tasks;
+		TaskNodeQueue only_tasks;
+		std::atomic<std::size_t> only_tasks_pending = 0;
+	};
+
 	ThreadPool::ThreadPool() : ThreadPool(default_size())
 	{
 	}
@@ -38,8 +115,18 @@ namespace Rayni
 			log_warning("Number of threads in thread pool too small (<1), using default (%u)", size);
 		}
 
-		for (unsigned int i = 0; i < size; i++)
-			threads_.emplace_back(&ThreadPool::work, this);
+		start_threads(size);
+	}
+
+	ThreadPool::ThreadPool(const std::vector<unsigned int> &cpu_ids) : cpu_ids_(cpu_ids)
+	{
+		if (cpu_ids_.empty()) {
+			unsigned int size = default_size();
+			log_warning("No CPUs given for thread pool, using default size (%u) without pinning", size);
+			start_threads(size);
+		} else {
+			start_threads(cpu_ids_.size());
+		}
 	}
 
 	ThreadPool::~ThreadPool()
@@ -51,10 +138,26 @@ namespace Rayni
 
 		for (std::thread &t : threads_)
 			t.join();
+
+		while (TaskNode *node = shared_tasks_.pop_front())
+			release_task_node(node);
+
+		for (auto &worker : workers_) {
+			while (auto node = worker->deque.pop())
+				release_task_node(*node);
+			while (TaskNode *node = worker->preferred_tasks.pop_front())
+				release_task_node(node);
+			while (TaskNode *node = worker->only_tasks.pop_front())
+				release_task_node(node);
+		}
 	}
 
 	unsigned int ThreadPool::default_size()
 	{
+		// Process may be restricted to fewer CPUs than there are (e.g. taskset, cgroups).
+		if (cpu_set_t set; sched_getaffinity(0, sizeof set, &set) == 0 && CPU_COUNT(&set) > 0)
+			return unsigned(CPU_COUNT(&set));
+
 		unsigned int size = std::thread::hardware_concurrency();
 
 		if (size == 0) {
@@ -65,66 +168,333 @@ namespace Rayni
 		return size;
 	}
 
-	void ThreadPool::add_task(std::function<void()> &&task)
+	void ThreadPool::add_task(Task &&task, Priority priority)
 	{
-		std::lock_guard<std::mutex> lock(mutex_);
+		TaskNode *node = allocate_task_node();
+		node->task = std::move(task);
 
-		tasks_.emplace_back(std::move(task));
+		tasks_unfinished_++;
+		push_task(node, priority);
+	}
+
+	void ThreadPool::add_tasks(std::vector<Task> &&tasks, Priority priority)
+	{
+		tasks_unfinished_ += tasks.size();
 
-		work_condition_.notify_one();
+		for (Task &task : tasks) {
+			TaskNode *node = allocate_task_node();
+			node->task = std::move(task);
+			push_task(node, priority);
+		}
+
+		tasks.clear();
 	}
 
-	void ThreadPool::add_tasks(std::vector<std::function<void()>> &&tasks)
+	void ThreadPool::add_task_to(unsigned int thread_index, Task &&task, Affinity affinity, const void *tag)
 	{
+		assert(thread_index < workers_.size());
+		assert(!tag || affinity == Affinity::PREFERRED);
+
+		Worker &worker = *workers_[thread_index];
+		TaskNode *node = allocate_task_node();
+		node->task = std::move(task);
+		node->tag = tag;
+
+		tasks_unfinished_++;
+
 		{
-			std::lock_guard<std::mutex> lock(mutex_);
+			std::lock_guard<std::mutex> lock(worker.mutex);
 
-			tasks_.insert(tasks_.end(),
-			              std::make_move_iterator(tasks.begin()),
-			              std::make_move_iterator(tasks.end()));
+			if (affinity == Affinity::ONLY) {
+				worker.only_tasks.push_back(node);
+				worker.only_tasks_pending++;
+			} else {
+				worker.preferred_tasks.push_back(node);
+				tasks_pending_++;
+			}
+		}
 
+		// Condition is shared, can not wake up a specific thread.
+		if (threads_sleeping_ > 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
 			work_condition_.notify_all();
 		}
+	}
 
-		tasks.clear();
+	bool ThreadPool::run_tagged_task(unsigned int thread_index, const void *tag)
+	{
+		assert(thread_index < workers_.size());
+		assert(tag);
+
+		Worker &worker = *workers_[thread_index];
+		TaskNode *node;
+
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			node = worker.preferred_tasks.remove(tag);
+		}
+
+		if (!node)
+			return false;
+
+		tasks_pending_--;
+		run_task(node);
+
+		return true;
 	}
 
 	void ThreadPool::wait()
 	{
 		std::unique_lock<std::mutex> lock(mutex_);
 
-		threads_waiting_++;
-
-		while (!tasks_.empty() || threads_working_ > 0)
+		while (tasks_unfinished_ > 0)
 			wait_condition_.wait(lock);
+	}
+
+	ThreadPool::TaskNode *ThreadPool::allocate_task_node()
+	{
+		TaskNodeCache &cache = task_node_cache_;
+		TaskNode *node = cache.nodes;
+
+		if (!node)
+			return new TaskNode;
+
+		cache.nodes = std::exchange(node->next, nullptr);
+		cache.size--;
 
-		threads_waiting_--;
+		return node;
 	}
 
-	void ThreadPool::work()
+	void ThreadPool::release_task_node(TaskNode *node)
 	{
-		std::unique_lock<std::mutex> lock(mutex_);
+		if (--node->references > 0)
+			return;
+
+		TaskNodeCache &cache = task_node_cache_;
+
+		if (cache.size == TASK_NODE_CACHE_MAX_SIZE) {
+			delete node;
+			return;
+		}
+
+		node->task.reset();
+		node->references = 1;
+		node->tag = nullptr;
+		node->next = cache.nodes;
+		cache.nodes = node;
+		cache.size++;
+	}
+
+	std::optional<unsigned int> ThreadPool::current_thread_index() const
+	{
+		if (Worker *worker = current_worker())
+			return worker->index;
+
+		return std::nullopt;
+	}
+
+	ThreadPool::Worker *ThreadPool::current_worker() const
+	{
+		if (current_worker_.thread_pool != this)
+			return nullptr;
+
+		return static_cast<Worker *>(current_worker_.worker);
+	}
+
+	void ThreadPool::push_task(TaskNode *node, Priority priority)
+	{
+		Worker *worker = current_worker();
+
+		// Increase before pushing so count is never less than number of tasks that
+		// can be found. Would wrap around if a thief got to task first otherwise.
+		tasks_pending_++;
+
+		if (priority == Priority::HIGH) {
+			// Not pushed to deque of worker even if added by thread in pool. Would
+			// be run after tasks already in deque by all threads except owner.
+			high_priority_tasks_pending_++;
+			std::lock_guard<std::mutex> lock(mutex_);
+			high_priority_tasks_.push_back(node);
+		} else if (worker) {
+			worker->deque.push(node);
+		} else {
+			std::lock_guard<std::mutex> lock(mutex_);
+			shared_tasks_.push_back(node);
+		}
+
+		if (threads_sleeping_ > 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			work_condition_.notify_one();
+		}
+	}
+
+	ThreadPool::TaskNode *ThreadPool::find_task(Worker *worker)
+	{
+		if (high_priority_tasks_pending_ > 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (TaskNode *node = high_priority_tasks_.pop_front()) {
+				high_priority_tasks_pending_--;
+				tasks_pending_--;
+				return node;
+			}
+		}
+
+		if (worker) {
+			if (auto node = worker->deque.pop()) {
+				tasks_pending_--;
+				return *node;
+			}
+
+			if (worker->only_tasks_pending > 0 || tasks_pending_ > 0) {
+				std::lock_guard<std::mutex> lock(worker->mutex);
+
+				if (TaskNode *node = worker->only_tasks.pop_front()) {
+					worker->only_tasks_pending--;
+					return node;
+				}
+
+				if (TaskNode *node = worker->preferred_tasks.pop_front()) {
+					tasks_pending_--;
+					return node;
+				}
+			}
+		}
+
+		if (tasks_pending_ > 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (TaskNode *node = shared_tasks_.pop_front()) {
+				tasks_pending_--;
+				return node;
+			}
+		}
+
+		return steal_task(worker);
+	}
+
+	// Thief is nullptr if calling thread is not in pool.
+	ThreadPool::TaskNode *ThreadPool::steal_task(const Worker *thief)
+	{
+		auto num_workers = unsigned(workers_.size());
+		unsigned int first = thief ? 1 : 0;
+		unsigned int offset = thief ? thief->index : 0;
+
+		for (unsigned int i = first; i < num_workers && tasks_pending_ > 0; i++) {
+			Worker &victim = *workers_[(offset + i) % num_workers];
+
+			if (auto node = victim.deque.steal()) {
+				tasks_pending_--;
+				return *node;
+			}
+		}
+
+		for (unsigned int i = first; i < num_workers && tasks_pending_ > 0; i++) {
+			Worker &victim = *workers_[(offset + i) % num_workers];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+
+			if (TaskNode *node = victim.preferred_tasks.pop_front()) {
+				tasks_pending_--;
+				return node;
+			}
+		}
+
+		return nullptr;
+	}
+
+	void ThreadPool::run_task(TaskNode *node)
+	{
+		node->task();
+		release_task_node(node);
+
+		if (--tasks_unfinished_ == 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			wait_condition_.notify_all();
+		}
+	}
+
+	void ThreadPool::start_threads(unsigned int size)
+	{
+		for (unsigned int i = 0; i < size; i++)
+			workers_.push_back(std::make_unique<Worker>(i));
+
+		for (unsigned int i = 0; i < size; i++)
+			threads_.emplace_back(&ThreadPool::work, this, i);
+	}
+
+	void ThreadPool::work(unsigned int index)
+	{
+		Worker &worker = *workers_[index];
+
+		if (!cpu_ids_.empty())
+			pin_current_thread(cpu_ids_[index]);
+
+		current_worker_ = {this, &worker};
 
 		while (true) {
-			while (!stop_ && tasks_.empty())
+			if (TaskNode *node = find_task(&worker)) {
+				run_task(node);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex_);
+
+			threads_sleeping_++;
+
+			while (!stop_ && tasks_pending_ == 0 && worker.only_tasks_pending == 0)
 				work_condition_.wait(lock);
 
+			threads_sleeping_--;
+
 			if (stop_)
 				break;
+		}
+	}
+
+	void ThreadPool::help_until_finished(const std::atomic<std::size_t> &unfinished)
+	{
+		Worker *worker = current_worker();
+
+		// Threads not in pool do not run tasks. Tasks that keep state per thread
+		// have one state for all threads not in pool, meant for the thread that
+		// started the work.
+		if (!worker) {
+			std::unique_lock<std::mutex> lock(mutex_);
+
+			waiters_sleeping_++;
+
+			while (unfinished > 0)
+				group_condition_.wait(lock);
+
+			waiters_sleeping_--;
 
-			std::function<void()> task = std::move(tasks_.front());
-			tasks_.pop_front();
+			return;
+		}
+
+		while (unfinished > 0) {
+			if (TaskNode *node = find_task(worker)) {
+				run_task(node);
+				continue;
+			}
 
-			threads_working_++;
-			lock.unlock();
+			std::unique_lock<std::mutex> lock(mutex_);
 
-			task();
+			threads_sleeping_++;
 
-			lock.lock();
-			threads_working_--;
+			while (unfinished > 0 && tasks_pending_ == 0 && worker->only_tasks_pending == 0)
+				work_condition_.wait(lock);
 
-			if (threads_waiting_ > 0 && tasks_.empty() && threads_working_ == 0)
-				wait_condition_.notify_all();
+			threads_sleeping_--;
+		}
+	}
+
+	void ThreadPool::task_group_finished()
+	{
+		// Do not know which thread that waits for group, wake up all that sleep.
+		if (threads_sleeping_ > 0 || waiters_sleeping_ > 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			work_condition_.notify_all();
+			group_condition_.notify_all();
 		}
 	}
 }
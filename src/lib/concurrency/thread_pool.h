@@ -20,25 +20,173 @@
 #ifndef RAYNI_LIB_CONCURRENCY_THREAD_POOL_H
 #define RAYNI_LIB_CONCURRENCY_THREAD_POOL_H
 
+#include <atomic>
+#include <cassert>
 #include <condition_variable>
-#include <deque>
-#include <functional>
-#include <future>
+#include <cstddef>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "lib/concurrency/task.h"
+
 namespace Rayni
 {
+	// Each thread in pool has a work stealing deque. Tasks added by a thread in
+	// pool are pushed to its own deque and are run in LIFO order by that thread,
+	// or stolen in FIFO order by other threads that run out of work. Tasks added
+	// by other threads are put in a shared queue. A task can also be added to a
+	// specific thread, see add_task_to().
+	//
+	// Tasks with Priority::HIGH are put in a separate shared queue that threads
+	// check before looking anywhere else. A running task is never interrupted,
+	// so latency for a high priority task is bounded by the shortest running
+	// normal task. Normal tasks are not run while there are high priority tasks
+	// left, so high priority should only be used for short tasks.
+	//
+	// Tasks are stored in nodes that are reused (cached per thread) and Task
+	// stores small function objects inline, so adding a task does not allocate
+	// in the common case.
 	class ThreadPool
 	{
+	private:
+		struct TaskNode;
+
+		template <typename Result>
+		struct AsyncState
+		{
+			AsyncState() = default;
+
+			// Only moved (with Task) before task is added to pool.
+			AsyncState(AsyncState &&other) noexcept :
+			        unfinished(other.unfinished.load(std::memory_order_relaxed)),
+			        result(std::move(other.result))
+			{
+			}
+
+			std::atomic<std::size_t> unfinished = 1;
+			std::optional<Result> result;
+		};
+
 	public:
+		friend class TaskGroup;
+
+		enum class Priority
+		{
+			NORMAL,
+			HIGH
+		};
+
+		enum class Affinity
+		{
+			// Task is run by given thread unless another thread runs out of work
+			// before given thread gets to it.
+			PREFERRED,
+
+			// Task is only run by given thread.
+			ONLY
+		};
+
+		// Returned by async(). Refers to state stored in node of task, node is
+		// not reused until both task has run and Future is destroyed. Must not
+		// outlive ThreadPool. get() and wait() run other tasks in pool while
+		// waiting, see TaskGroup.
+		template <typename Result>
+		class Future
+		{
+		public:
+			Future() = default;
+
+			~Future()
+			{
+				release();
+			}
+
+			Future(const Future &other) = delete;
+			Future &operator=(const Future &other) = delete;
+
+			Future(Future &&other) noexcept :
+			        thread_pool_(std::exchange(other.thread_pool_, nullptr)),
+			        node_(std::exchange(other.node_, nullptr)),
+			        state_(std::exchange(other.state_, nullptr))
+			{
+			}
+
+			Future &operator=(Future &&other) noexcept
+			{
+				if (this != &other) {
+					release();
+					thread_pool_ = std::exchange(other.thread_pool_, nullptr);
+					node_ = std::exchange(other.node_, nullptr);
+					state_ = std::exchange(other.state_, nullptr);
+				}
+
+				return *this;
+			}
+
+			bool valid() const
+			{
+				return node_ != nullptr;
+			}
+
+			void wait() const
+			{
+				assert(valid());
+				thread_pool_->help_until_finished(state_->unfinished);
+			}
+
+			// Future is not valid after get() has returned.
+			Result get()
+			{
+				wait();
+
+				if constexpr (std::is_void_v<Result>) {
+					release();
+				} else {
+					Result result = std::move(*state_->result);
+					release();
+					return result;
+				}
+			}
+
+		private:
+			friend class ThreadPool;
+
+			using State = AsyncState<std::conditional_t<std::is_void_v<Result>, bool, Result>>;
+
+			Future(ThreadPool &thread_pool, TaskNode &node, State &state) :
+			        thread_pool_(&thread_pool),
+			        node_(&node),
+			        state_(&state)
+			{
+			}
+
+			void release()
+			{
+				if (node_) {
+					release_task_node(node_);
+					thread_pool_ = nullptr;
+					node_ = nullptr;
+					state_ = nullptr;
+				}
+			}
+
+			ThreadPool *thread_pool_ = nullptr;
+			TaskNode *node_ = nullptr;
+			State *state_ = nullptr;
+		};
+
 		ThreadPool();
 		explicit ThreadPool(unsigned int size);
 
+		// One thread per CPU, thread i is pinned to cpu_ids[i]. See CPUTopology
+		// for how to e.g. only use physical cores or CPUs in one NUMA node.
+		explicit ThreadPool(const std::vector<unsigned int> &cpu_ids);
+
 		~ThreadPool();
 
 		ThreadPool(const ThreadPool &other) = delete;
@@ -48,55 +196,198 @@ namespace Rayni
 
 		static unsigned int default_size();
 
-		void add_task(std::function<void()> &&task);
-		void add_tasks(std::vector<std::function<void()>> &&tasks);
+		unsigned int size() const
+		{
+			return threads_.size();
+		}
+
+		// Index of calling thread in pool. Empty if calling thread is not in pool.
+		std::optional<unsigned int> current_thread_index() const;
+
+		void add_task(Task &&task, Priority priority = Priority::NORMAL);
+		void add_tasks(std::vector<Task> &&tasks, Priority priority = Priority::NORMAL);
+
+		// thread_index must be less than size(). A task with Affinity::PREFERRED
+		// can be given a tag, see run_tagged_task().
+		void add_task_to(unsigned int thread_index,
+		                 Task &&task,
+		                 Affinity affinity = Affinity::PREFERRED,
+		                 const void *tag = nullptr);
+
+		// Takes a task with tag, that no thread has started yet, from tasks added
+		// to thread thread_index and runs it in calling thread. Returns false if
+		// there is no such task.
+		bool run_tagged_task(unsigned int thread_index, const void *tag);
 
 		void wait();
 
 		// Like std::async() but always runs in a thread from pool.
 		template <typename Function>
-		auto async(Function &&function)
+		auto async(Function &&function, Priority priority = Priority::NORMAL)
 		{
-			using Result = std::result_of_t<std::decay_t<Function>()>;
-			// Have to wrap std::promise in std::shared_ptr to make it possible to
-			// store it in a std::function (must be copyable).
-			auto promise = std::make_shared<std::promise<Result>>();
+			using Result = std::invoke_result_t<std::decay_t<Function>>;
+			using State = typename Future<Result>::State;
 
-			add_task([promise, function = std::forward<Function>(function)]() mutable {
-				if constexpr (std::is_void_v<Result>) {
-					function();
-					promise->set_value();
-				} else {
-					promise->set_value(function());
+			struct AsyncTask
+			{
+				AsyncTask(ThreadPool &tp, Function &&f) :
+				        thread_pool(tp),
+				        function(std::forward<Function>(f))
+				{
 				}
-			});
 
-			return promise->get_future();
-		}
+				void operator()()
+				{
+					if constexpr (std::is_void_v<Result>)
+						function();
+					else
+						state.result.emplace(function());
 
-		// NOTE: Number of available threads may change after this method has returned.
-		// Other threads can add tasks and tasks can finish. Only call this if it is known
-		// at call site not to change until value has been used or if it can be quaranteed
-		// not to change in a way that affects call site.
-		unsigned int threads_available() const
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			return threads_.size() - threads_working_;
+					if (--state.unfinished == 0)
+						thread_pool.task_group_finished();
+				}
+
+				ThreadPool &thread_pool;
+				std::decay_t<Function> function;
+				State state;
+			};
+
+			TaskNode *node = allocate_task_node();
+			auto &async_task = node->task.emplace<AsyncTask>(*this, std::forward<Function>(function));
+
+			// One for running task and one for Future.
+			node->references = 2;
+
+			Future<Result> future(*this, *node, async_task.state);
+
+			tasks_unfinished_++;
+			push_task(node, priority);
+
+			return future;
 		}
 
 	private:
-		void work();
+		struct TaskNode
+		{
+			Task task;
+			std::atomic<unsigned int> references = 1;
+			TaskNode *next = nullptr;
+			const void *tag = nullptr;
+		};
+
+		// Intrusive FIFO, nodes are linked through TaskNode::next.
+		class TaskNodeQueue
+		{
+		public:
+			bool empty() const
+			{
+				return !head_;
+			}
+
+			void push_back(TaskNode *node)
+			{
+				node->next = nullptr;
+
+				if (tail_)
+					tail_->next = node;
+				else
+					head_ = node;
+
+				tail_ = node;
+			}
+
+			TaskNode *pop_front()
+			{
+				TaskNode *node = head_;
+
+				if (node) {
+					head_ = node->next;
+					if (!head_)
+						tail_ = nullptr;
+				}
 
+				return node;
+			}
+
+			TaskNode *remove(const void *tag)
+			{
+				TaskNode *previous = nullptr;
+
+				for (TaskNode *node = head_; node; previous = node, node = node->next) {
+					if (node->tag != tag)
+						continue;
+
+					if (previous)
+						previous->next = node->next;
+					else
+						head_ = node->next;
+
+					if (tail_ == node)
+						tail_ = previous;
+
+					return node;
+				}
+
+				return nullptr;
+			}
+
+		private:
+			TaskNode *head_ = nullptr;
+			TaskNode *tail_ = nullptr;
+		};
+
+		struct TaskNodeCache;
+		struct Worker;
+
+		// Nodes are reused by thread that releases them.
+		static thread_local TaskNodeCache task_node_cache_;
+
+		static TaskNode *allocate_task_node();
+		static void release_task_node(TaskNode *node);
+
+		Worker *current_worker() const;
+
+		void push_task(TaskNode *node, Priority priority);
+		TaskNode *find_task(Worker *worker);
+		TaskNode *steal_task(const Worker *thief);
+		void run_task(TaskNode *node);
+
+		void start_threads(unsigned int size);
+		void work(unsigned int index);
+
+		// Used by TaskGroup. Runs tasks in calling thread, or sleeps until more
+		// tasks are added, until unfinished is 0. Threads not in pool only sleep.
+		// task_group_finished() must be called after unfinished has been
+		// decreased to 0.
+		void help_until_finished(const std::atomic<std::size_t> &unfinished);
+		void task_group_finished();
+
+		std::vector<std::unique_ptr<Worker>> workers_;
 		std::vector<std::thread> threads_;
+		std::vector<unsigned int> cpu_ids_;
 
 		mutable std::mutex mutex_;
 		std::condition_variable work_condition_;
 		std::condition_variable wait_condition_;
+		std::condition_variable group_condition_;
+
+		TaskNodeQueue shared_tasks_;
+		TaskNodeQueue high_priority_tasks_;
+
+		// Tasks that any thread may run, i.e. in shared queue, in deques or added to
+		// a thread with Affinity::PREFERRED.
+		std::atomic<std::size_t> tasks_pending_ = 0;
+
+		// Subset of tasks_pending_ that are in high_priority_tasks_.
+		std::atomic<std::size_t> high_priority_tasks_pending_ = 0;
+
+		// Tasks added and not yet run.
+		std::atomic<std::size_t> tasks_unfinished_ = 0;
 
-		std::deque<std::function<void()>> tasks_;
+		std::atomic<unsigned int> threads_sleeping_ = 0;
 
-		unsigned int threads_working_ = 0;
-		unsigned int threads_waiting_ = 0;
+		// Threads not in pool that wait for a TaskGroup (or Future).
+		std::atomic<unsigned int> waiters_sleeping_ = 0;
 		bool stop_ = false;
 	};
 }
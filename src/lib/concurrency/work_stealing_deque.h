@@ -0,0 +1,199 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_CONCURRENCY_WORK_STEALING_DEQUE_H
+#define RAYNI_LIB_CONCURRENCY_WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+
+// Chase-Lev deque with memory orderings from:
+//
+// Lê, N. M., Pop, A., Cohen, A. and Zappa Nardelli, F., 2013, Correct and
+// Efficient Work-Stealing for Weak Memory Models
+// https://doi.org/10.1145/2442516.2442524
+//
+// Arrays are never shrunk. Old arrays are kept until deque is destroyed since a
+// thief may still be reading from one after owner has grown the deque.
+
+namespace Rayni
+{
+	// Owner thread pushes and pops at the bottom (LIFO), other threads steal from
+	// the top (FIFO). T must be trivially copyable, typically a pointer.
+	template <typename T>
+	class WorkStealingDeque
+	{
+	public:
+		static_assert(std::is_trivially_copyable_v<T>);
+
+		explicit WorkStealingDeque(std::size_t capacity = 256)
+		{
+			assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+			arrays_.push_back(std::make_unique<Array>(capacity));
+			array_.store(arrays_.back().get(), std::memory_order_relaxed);
+		}
+
+		WorkStealingDeque(const WorkStealingDeque &other) = delete;
+		WorkStealingDeque(WorkStealingDeque &&other) = delete;
+
+		WorkStealingDeque &operator=(const WorkStealingDeque &other) = delete;
+		WorkStealingDeque &operator=(WorkStealingDeque &&other) = delete;
+
+		// Only owner may call.
+		void push(T item)
+		{
+			std::int64_t bottom = bottom_.load(std::memory_order_relaxed);
+			std::int64_t top = top_.load(std::memory_order_acquire);
+			Array *array = array_.load(std::memory_order_relaxed);
+
+			if (bottom - top > std::int64_t(array->capacity()) - 1)
+				array = grow(array, top, bottom);
+
+			array->put(bottom, item);
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom_.store(bottom + 1, std::memory_order_relaxed);
+		}
+
+		// Only owner may call.
+		std::optional<T> pop()
+		{
+			std::int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+			Array *array = array_.load(std::memory_order_relaxed);
+			bottom_.store(bottom, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			std::int64_t top = top_.load(std::memory_order_relaxed);
+
+			if (top > bottom) {
+				bottom_.store(bottom + 1, std::memory_order_relaxed);
+				return std::nullopt;
+			}
+
+			T item = array->get(bottom);
+
+			if (top == bottom) {
+				// Last item, race against thieves.
+				bool won = top_.compare_exchange_strong(top,
+				                                        top + 1,
+				                                        std::memory_order_seq_cst,
+				                                        std::memory_order_relaxed);
+				bottom_.store(bottom + 1, std::memory_order_relaxed);
+
+				if (!won)
+					return std::nullopt;
+			}
+
+			return item;
+		}
+
+		// May be called by any thread. Can fail even if deque is not empty if there
+		// is contention, caller should retry or try another deque.
+		std::optional<T> steal()
+		{
+			std::int64_t top = top_.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			std::int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+			if (top >= bottom)
+				return std::nullopt;
+
+			Array *array = array_.load(std::memory_order_acquire);
+			T item = array->get(top);
+
+			if (!top_.compare_exchange_strong(top,
+			                                  top + 1,
+			                                  std::memory_order_seq_cst,
+			                                  std::memory_order_relaxed))
+				return std::nullopt;
+
+			return item;
+		}
+
+		// Approximate if called while other threads are modifying deque.
+		std::size_t size() const
+		{
+			std::int64_t bottom = bottom_.load(std::memory_order_relaxed);
+			std::int64_t top = top_.load(std::memory_order_relaxed);
+
+			return bottom > top ? std::size_t(bottom - top) : 0;
+		}
+
+	private:
+		class Array
+		{
+		public:
+			explicit Array(std::size_t capacity) :
+			        mask_(capacity - 1),
+			        items_(std::make_unique<std::atomic<T>[]>(capacity))
+			{
+			}
+
+			std::size_t capacity() const
+			{
+				return mask_ + 1;
+			}
+
+			T get(std::int64_t i) const
+			{
+				return items_[std::size_t(i) & mask_].load(std::memory_order_relaxed);
+			}
+
+			void put(std::int64_t i, T item)
+			{
+				items_[std::size_t(i) & mask_].store(item, std::memory_order_relaxed);
+			}
+
+		private:
+			std::size_t mask_;
+			std::unique_ptr<std::atomic<T>[]> items_;
+		};
+
+		Array *grow(Array *array, std::int64_t top, std::int64_t bottom)
+		{
+			arrays_.push_back(std::make_unique<Array>(array->capacity() * 2));
+			Array *new_array = arrays_.back().get();
+
+			for (std::int64_t i = top; i < bottom; i++)
+				new_array->put(i, array->get(i));
+
+			array_.store(new_array, std::memory_order_release);
+
+			return new_array;
+		}
+
+		// Thieves only write top, owner mostly writes bottom.
+		alignas(RAYNI_L1_CACHE_LINE_SIZE) std::atomic<std::int64_t> top_ = 0;
+		alignas(RAYNI_L1_CACHE_LINE_SIZE) std::atomic<std::int64_t> bottom_ = 0;
+		std::atomic<Array *> array_ = nullptr;
+
+		// Only accessed by owner.
+		std::vector<std::unique_ptr<Array>> arrays_;
+	};
+}
+
+#endif // RAYNI_LIB_CONCURRENCY_WORK_STEALING_DEQUE_H
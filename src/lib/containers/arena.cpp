@@ -0,0 +1,82 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/containers/arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+
+namespace Rayni
+{
+	std::size_t Arena::capacity() const
+	{
+		std::size_t capacity = 0;
+
+		for (const Block &block : blocks_)
+			capacity += block.size;
+
+		return capacity;
+	}
+
+	void Arena::rewind(const Marker &marker)
+	{
+		assert(marker.block < current_block_ || (marker.block == current_block_ && marker.offset <= offset_));
+
+		current_block_ = marker.block;
+		offset_ = marker.offset;
+
+		std::size_t first_unused = offset_ == 0 ? current_block_ : current_block_ + 1;
+
+		if (first_unused < blocks_.size()) {
+			auto unused = std::next(blocks_.begin(), std::ptrdiff_t(first_unused));
+			auto large = [this](const Block &block) { return block.size > block_size_; };
+			blocks_.erase(std::remove_if(unused, blocks_.end(), large), blocks_.end());
+		}
+	}
+
+	void *Arena::allocate_bytes(std::size_t size, std::size_t alignment)
+	{
+		if (current_block_ < blocks_.size()) {
+			std::size_t offset = (offset_ + alignment - 1) & ~(alignment - 1);
+
+			if (offset + size <= blocks_[current_block_].size) {
+				offset_ = offset + size;
+				return &blocks_[current_block_].data[offset];
+			}
+
+			current_block_++;
+		}
+
+		// Start of block is aligned to __STDCPP_DEFAULT_NEW_ALIGNMENT__. Blocks that
+		// are too small for allocation are skipped, but kept for later reuse, by
+		// inserting a new block in front of them.
+		if (current_block_ == blocks_.size() || blocks_[current_block_].size < size) {
+			std::size_t block_size = std::max(block_size_, size);
+			auto block = std::next(blocks_.begin(), std::ptrdiff_t(current_block_));
+			blocks_.insert(block, {std::make_unique_for_overwrite<std::byte[]>(block_size), block_size});
+		}
+
+		offset_ = size;
+
+		return blocks_[current_block_].data.get();
+	}
+}
@@ -0,0 +1,118 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_CONTAINERS_ARENA_H
+#define RAYNI_LIB_CONTAINERS_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace Rayni
+{
+	// Bump allocator for arrays of trivially destructible elements. Memory is
+	// allocated in blocks that are kept when arena is rewound, to be reused by
+	// later allocations. Blocks larger than block size, made for a single large
+	// allocation, are freed when rewound though, so that an arena used for a few
+	// large allocations does not hold on to the memory. Allocations are not freed
+	// individually. Either all allocations after a marker are freed with rewind()
+	// (i.e. arena can be used like a stack) or all memory is released at once
+	// with release() or when arena is destroyed.
+	class Arena
+	{
+	public:
+		static constexpr std::size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+		struct Marker
+		{
+			std::size_t block = 0;
+			std::size_t offset = 0;
+		};
+
+		explicit Arena(std::size_t block_size = DEFAULT_BLOCK_SIZE) : block_size_(block_size)
+		{
+		}
+
+		Arena(const Arena &other) = delete;
+		Arena(Arena &&other) = default;
+
+		Arena &operator=(const Arena &other) = delete;
+		Arena &operator=(Arena &&other) = default;
+
+		// Elements are not initialized.
+		template <typename T>
+		T *allocate(std::size_t count)
+		{
+			static_assert(std::is_trivially_destructible_v<T>);
+			static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+			return static_cast<T *>(allocate_bytes(count * sizeof(T), alignof(T)));
+		}
+
+		Marker marker() const
+		{
+			return {current_block_, offset_};
+		}
+
+		// Shrinks last allocation, that starts at data, to count elements. Memory
+		// after it is reused by later allocations.
+		template <typename T>
+		void shrink_last(T *data, std::size_t count)
+		{
+			const std::byte *end = reinterpret_cast<const std::byte *>(data + count);
+
+			assert(current_block_ < blocks_.size());
+			assert(end >= blocks_[current_block_].data.get());
+			assert(end <= blocks_[current_block_].data.get() + offset_);
+
+			offset_ = std::size_t(end - blocks_[current_block_].data.get());
+		}
+
+		void rewind(const Marker &marker);
+
+		void release()
+		{
+			blocks_.clear();
+			current_block_ = 0;
+			offset_ = 0;
+		}
+
+		// Total size of all blocks.
+		std::size_t capacity() const;
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<std::byte[]> data;
+			std::size_t size;
+		};
+
+		void *allocate_bytes(std::size_t size, std::size_t alignment);
+
+		std::size_t block_size_;
+		std::vector<Block> blocks_;
+		std::size_t current_block_ = 0;
+		std::size_t offset_ = 0;
+	};
+}
+
+#endif // RAYNI_LIB_CONTAINERS_ARENA_H
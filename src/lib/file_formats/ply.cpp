@@ -646,7 +646,7 @@ namespace Rayni
 
 			auto max_index = data.points.size() - 1;
 
-			for (auto &indices : data.indices)
+			for (const TriangleMeshData::Indices indices : data.indices)
 				if (indices.index1 > max_index || indices.index2 > max_index ||
 				    indices.index3 > max_index)
 					return Error(reader.position(),
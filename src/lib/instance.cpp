@@ -0,0 +1,88 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2013-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/instance.h"
+
+#include <memory>
+#include <utility>
+
+namespace Rayni
+{
+	namespace
+	{
+		void intersection_to_world_space(Intersection &intersection, const Transform &transform)
+		{
+			intersection.point_error =
+			        transform.transform_point_error(intersection.point, intersection.point_error);
+			intersection.point = transform.transform_point(intersection.point);
+			intersection.normal = transform.transform_normal(intersection.normal);
+			intersection.incident = transform.transform_direction(intersection.incident);
+		}
+	}
+
+	Instance::Instance(std::shared_ptr<const Intersectable> intersectable, const Transform &transform) :
+	        intersectable_(std::move(intersectable)),
+	        transform_(transform),
+	        inverse_transform_(transform.inverse()),
+	        aabb_(transform.transform_aabb(intersectable_->aabb()))
+	{
+	}
+
+	bool Instance::intersect(const Ray &ray) const
+	{
+		return intersectable_->intersect(inverse_transform_.transform_ray(ray));
+	}
+
+	bool Instance::intersect(const Ray &ray, Intersection &intersection) const
+	{
+		if (!intersectable_->intersect(inverse_transform_.transform_ray(ray), intersection))
+			return false;
+
+		intersection_to_world_space(intersection, transform_);
+
+		return true;
+	}
+
+	AnimatedInstance::AnimatedInstance(std::shared_ptr<const Intersectable> intersectable,
+	                                   const AnimatedTransform &animated_transform) :
+	        intersectable_(std::move(intersectable)),
+	        animated_transform_(animated_transform),
+	        aabb_(animated_transform.motion_bounds(intersectable_->aabb()))
+	{
+	}
+
+	bool AnimatedInstance::intersect(const Ray &ray) const
+	{
+		Transform transform = animated_transform_.interpolate(ray.time);
+
+		return intersectable_->intersect(transform.inverse().transform_ray(ray));
+	}
+
+	bool AnimatedInstance::intersect(const Ray &ray, Intersection &intersection) const
+	{
+		Transform transform = animated_transform_.interpolate(ray.time);
+
+		if (!intersectable_->intersect(transform.inverse().transform_ray(ray), intersection))
+			return false;
+
+		intersection_to_world_space(intersection, transform);
+
+		return true;
+	}
+}
@@ -0,0 +1,87 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2013-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_INSTANCE_H
+#define RAYNI_LIB_INSTANCE_H
+
+#include <memory>
+
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/math/aabb.h"
+#include "lib/math/animated_transform.h"
+#include "lib/math/ray.h"
+#include "lib/math/transform.h"
+
+namespace Rayni
+{
+	// Places an intersectable, usually an intersection structure built for a mesh,
+	// in the scene with a transform from object space to world space. Any number
+	// of instances can share the same intersectable, so memory usage is
+	// proportional to the amount of unique geometry. An intersection structure
+	// built from instances (see intersection_structure_build()) is then the top
+	// level of a two-level acceleration structure.
+	//
+	// Rays are transformed to object space instead of transforming intersectable.
+	// Since transform is affine and ray direction is not normalized, t is the same
+	// in both spaces. Geometric data in Intersection is transformed back to world
+	// space when intersectable is hit.
+	class Instance : public Intersectable
+	{
+	public:
+		Instance(std::shared_ptr<const Intersectable> intersectable, const Transform &transform);
+
+		AABB aabb() const override
+		{
+			return aabb_;
+		}
+
+		bool intersect(const Ray &ray) const override;
+		bool intersect(const Ray &ray, Intersection &intersection) const override;
+
+	private:
+		std::shared_ptr<const Intersectable> intersectable_;
+		Transform transform_;
+		Transform inverse_transform_;
+		AABB aabb_;
+	};
+
+	// Like Instance but transform depends on time of ray.
+	class AnimatedInstance : public Intersectable
+	{
+	public:
+		AnimatedInstance(std::shared_ptr<const Intersectable> intersectable,
+		                 const AnimatedTransform &animated_transform);
+
+		AABB aabb() const override
+		{
+			return aabb_;
+		}
+
+		bool intersect(const Ray &ray) const override;
+		bool intersect(const Ray &ray, Intersection &intersection) const override;
+
+	private:
+		std::shared_ptr<const Intersectable> intersectable_;
+		AnimatedTransform animated_transform_;
+		AABB aabb_;
+	};
+}
+
+#endif // RAYNI_LIB_INSTANCE_H
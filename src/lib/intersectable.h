@@ -20,6 +20,8 @@
 #ifndef RAYNI_LIB_INTERSECTABLE_H
 #define RAYNI_LIB_INTERSECTABLE_H
 
+#include <cstddef>
+
 #include "lib/intersection.h"
 #include "lib/math/aabb.h"
 #include "lib/math/ray.h"
@@ -35,6 +37,25 @@ namespace Rayni
 
 		virtual bool intersect(const Ray &ray) const = 0;
 		virtual bool intersect(const Ray &ray, Intersection &intersection) const = 0;
+
+		// Same result as calling intersect() for each ray. Intersection structures
+		// override these to traverse rays together (coherent rays, e.g. camera rays or
+		// shadow rays from the same tile, share node fetches) with one virtual call for
+		// all rays instead of one per ray.
+		virtual void intersect_batch(const Ray *rays, bool *hits, std::size_t count) const
+		{
+			for (std::size_t i = 0; i < count; i++)
+				hits[i] = intersect(rays[i]);
+		}
+
+		virtual void intersect_batch(const Ray *rays,
+		                             Intersection *intersections,
+		                             bool *hits,
+		                             std::size_t count) const
+		{
+			for (std::size_t i = 0; i < count; i++)
+				hits[i] = intersect(rays[i], intersections[i]);
+		}
 	};
 }
 
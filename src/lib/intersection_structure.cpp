@@ -19,15 +19,70 @@
 
 #include "lib/intersection_structure.h"
 
+#include <cinttypes>
+#include <cstdint>
 #include <string>
 #include <utility>
 
 #include "lib/containers/variant.h"
 #include "lib/intersection_structures/bvh.h"
 #include "lib/intersection_structures/kdtree.h"
+#include "lib/log.h"
+#include "lib/math/aabb.h"
+#include "lib/math/hash.h"
+#include "lib/string/string.h"
 
 namespace Rayni
 {
+	namespace
+	{
+		BVHBuildOptions bvh_build_options(IntersectionStructureType type)
+		{
+			switch (type) {
+			case IntersectionStructureType::BVH:
+			case IntersectionStructureType::KDTREE:
+				break;
+			case IntersectionStructureType::BVH4:
+				return {.node_layout = BVHNodeLayout::WIDE4};
+			case IntersectionStructureType::BVH8:
+				return {.node_layout = BVHNodeLayout::WIDE8};
+			case IntersectionStructureType::BVH4_QUANTIZED:
+				return {.node_layout = BVHNodeLayout::WIDE4_QUANTIZED};
+			case IntersectionStructureType::BVH8_QUANTIZED:
+				return {.node_layout = BVHNodeLayout::WIDE8_QUANTIZED};
+			case IntersectionStructureType::BVH_ALL_AXES:
+				return {.build_method = BVHBuildMethod::BINNED_SAH_ALL_AXES};
+			case IntersectionStructureType::LBVH:
+				return {.build_method = BVHBuildMethod::LBVH};
+			case IntersectionStructureType::SBVH:
+				return {.build_method = BVHBuildMethod::SBVH};
+			}
+
+			return {};
+		}
+
+		// Hash of type and AABBs of intersectables. AABBs are not exactly the
+		// geometry but they are what the build depends on.
+		std::uint64_t cache_key(IntersectionStructureType type,
+		                        const std::vector<const Intersectable *> &intersectables)
+		{
+			std::size_t hash = hash_combine_for(int(type), intersectables.size());
+
+			for (const Intersectable *intersectable : intersectables) {
+				AABB aabb = intersectable->aabb();
+				hash = hash_combine(hash,
+				                    hash_combine_for(aabb.minimum().x(),
+				                                     aabb.minimum().y(),
+				                                     aabb.minimum().z(),
+				                                     aabb.maximum().x(),
+				                                     aabb.maximum().y(),
+				                                     aabb.maximum().z()));
+			}
+
+			return hash;
+		}
+	}
+
 	Result<IntersectionStructureType> intersection_structure_type_from_variant(const Variant &v)
 	{
 		if (v.is_string()) {
@@ -35,6 +90,20 @@ namespace Rayni
 
 			if (str == "bvh")
 				return IntersectionStructureType::BVH;
+			if (str == "bvh4")
+				return IntersectionStructureType::BVH4;
+			if (str == "bvh8")
+				return IntersectionStructureType::BVH8;
+			if (str == "bvh4_quantized")
+				return IntersectionStructureType::BVH4_QUANTIZED;
+			if (str == "bvh8_quantized")
+				return IntersectionStructureType::BVH8_QUANTIZED;
+			if (str == "bvh_all_axes")
+				return IntersectionStructureType::BVH_ALL_AXES;
+			if (str == "lbvh")
+				return IntersectionStructureType::LBVH;
+			if (str == "sbvh")
+				return IntersectionStructureType::SBVH;
 			if (str == "kdtree")
 				return IntersectionStructureType::KDTREE;
 			if (str == "default")
@@ -49,17 +118,56 @@ namespace Rayni
 	                                                            const Cancellable &cancellable,
 	                                                            ThreadPool &thread_pool)
 	{
-		std::unique_ptr<Intersectable> intersection_structure;
-
-		switch (type) {
-		case IntersectionStructureType::BVH:
-			intersection_structure = bvh_build(std::move(intersectables), cancellable, thread_pool);
-			break;
-		case IntersectionStructureType::KDTREE:
-			intersection_structure = kdtree_build(std::move(intersectables), cancellable, thread_pool);
-			break;
+		if (type == IntersectionStructureType::KDTREE)
+			return kdtree_build(std::move(intersectables), cancellable, thread_pool);
+
+		return bvh_build(std::move(intersectables), cancellable, thread_pool, bvh_build_options(type));
+	}
+
+	std::unique_ptr<Intersectable>
+	intersection_structure_build_cached(IntersectionStructureType type,
+	                                    std::vector<const Intersectable *> &&intersectables,
+	                                    const std::string &cache_dir,
+	                                    const Cancellable &cancellable,
+	                                    ThreadPool &thread_pool)
+	{
+		std::uint64_t key = cache_key(type, intersectables);
+		std::string path = cache_dir + "/" + string_printf("%016" PRIx64 ".cache", key);
+
+		if (type == IntersectionStructureType::KDTREE) {
+			auto kdtree = kdtree_load(path, key, intersectables);
+			if (kdtree) {
+				log_info("Loaded kd-tree from %s", path.c_str());
+				return std::move(*kdtree);
+			}
+
+			log_info("Building kd-tree, %s", kdtree.error().message().c_str());
+
+			auto new_kdtree = kdtree_build(std::move(intersectables), cancellable, thread_pool);
+
+			if (new_kdtree)
+				if (auto r = new_kdtree->save(path, key); !r)
+					log_warning("Failed to save kd-tree: %s", r.error().message().c_str());
+
+			return new_kdtree;
 		}
 
-		return intersection_structure;
+		BVHBuildOptions options = bvh_build_options(type);
+		auto bvh = bvh_load(path, key, intersectables, options.node_layout);
+		if (bvh) {
+			log_info("Loaded BVH from %s", path.c_str());
+			return std::move(*bvh);
+		}
+
+		log_info("Building BVH, %s", bvh.error().message().c_str());
+
+		// Intersectables are needed when saving, build gets a copy.
+		auto new_bvh = bvh_build(std::vector(intersectables), cancellable, thread_pool, options);
+
+		if (new_bvh)
+			if (auto r = new_bvh->save(path, key, intersectables); !r)
+				log_warning("Failed to save BVH: %s", r.error().message().c_str());
+
+		return new_bvh;
 	}
 }
@@ -21,6 +21,7 @@
 #define RAYNI_LIB_INTERSECTION_STRUCTURE_H
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "lib/concurrency/cancellable.h"
@@ -34,6 +35,13 @@ namespace Rayni
 	enum class IntersectionStructureType
 	{
 		BVH,
+		BVH4,
+		BVH8,
+		BVH4_QUANTIZED,
+		BVH8_QUANTIZED,
+		BVH_ALL_AXES,
+		LBVH,
+		SBVH,
 		KDTREE,
 
 		DEFAULT = BVH
@@ -41,10 +49,23 @@ namespace Rayni
 
 	Result<IntersectionStructureType> intersection_structure_type_from_variant(const Variant &v);
 
+	// Returns nullptr if cancelled.
 	std::unique_ptr<Intersectable> intersection_structure_build(IntersectionStructureType type,
 	                                                            std::vector<const Intersectable *> &&intersectables,
 	                                                            const Cancellable &cancellable,
 	                                                            ThreadPool &thread_pool);
+
+	// Like intersection_structure_build() but if structure has been built before
+	// for the same type and intersectables (hash of their AABBs), it is loaded
+	// from a cache file in cache_dir instead. Otherwise it is built and saved to
+	// cache_dir. Loading memory maps nodes, build is skipped entirely. Returns
+	// nullptr, and saves nothing, if cancelled.
+	std::unique_ptr<Intersectable>
+	intersection_structure_build_cached(IntersectionStructureType type,
+	                                    std::vector<const Intersectable *> &&intersectables,
+	                                    const std::string &cache_dir,
+	                                    const Cancellable &cancellable,
+	                                    ThreadPool &thread_pool);
 }
 
 #endif // RAYNI_LIB_INTERSECTION_STRUCTURE_H
@@ -20,28 +20,39 @@
 #include "lib/intersection_structures/bvh.h"
 
 #include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <limits>
 #include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "config.h"
-#include "lib/concurrency/barrier.h"
+#include "lib/concurrency/parallel_for.h"
+#include "lib/concurrency/task_group.h"
 #include "lib/containers/cache_line_aligned_vector.h"
 #include "lib/intersection.h"
 #include "lib/intersection_structures/bvh.h"
+#include "lib/io/cache_file.h"
 #include "lib/log.h"
 #include "lib/math/aabb.h"
 #include "lib/math/hash.h"
 #include "lib/math/math.h"
+#include "lib/math/morton.h"
 #include "lib/math/ray.h"
 #include "lib/math/vector3.h"
 #include "lib/stopwatch.h"
 #include "lib/string/duration_format.h"
+#include "lib/string/string.h"
 
 // For algorithm used to build BVH, see:
 //
@@ -50,19 +61,44 @@
 //
 // An effort has been made to be cache friendly when building the BVH and when
 // intersecting. Threads could be used better when building. See TODO below.
-
-// TODO: Make it so same thread operates on same range of info data when
-//       threading horizontally.
 //
-// And so that a thread used for horizontal threading can not be used to do
-// vertical threading at the same time. Should reduce cache misses when
-// threading horizontally and perhaps also help with TODO for
-// RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING (copying for
-// partitioning will go faster).
+// A linear BVH (intersectables sorted by Morton code of centroid, split at
+// highest differing bit) can be built instead when build time matters more
+// than tree quality, see:
+//
+// Lauterbach, C., Garland, M., Sengupta, S., Luebke, D. and Manocha, D., 2009,
+// Fast BVH Construction on GPUs
+// https://doi.org/10.1111/j.1467-8659.2009.01377.x
+//
+// A BVH with spatial splits, where references to intersectables are duplicated
+// and their AABBs clipped (like in the kd-tree), can also be built, see:
+//
+// Stich, M., Friedrich, H. and Dietrich, A., 2009, Spatial Splits in Bounding
+// Volume Hierarchies
+// https://doi.org/10.1145/1572769.1572771
+//
+// Binary BVH can optionally be collapsed into a BVH with 4 or 8 children per
+// node, see:
+//
+// Dammertz, H., Hanika, J. and Keller, A., 2008, Shallow Bounding Volume
+// Hierarchies for Fast SIMD Ray Tracing of Incoherent Rays
+// https://doi.org/10.1111/j.1467-8659.2008.01261.x
+//
+// Wald, I., Benthin, C. and Boulos, S., 2008, Getting Rid of Packets - Efficient
+// SIMD Single-Ray Traversal using Multi-branching BVHs
+// https://doi.org/10.1109/RT.2008.4634620
+//
+// Child AABBs of wide nodes can also be quantized to 8 bits per plane, see
+// QuantizedWideNode.
+
+// TODO: Make it so a thread used for horizontal threading can not be used to
+//       do vertical threading at the same time.
 //
-// Add separate work queues for each thread to ThreadPool and make it possible
-// to schedule a job to a thread with a specific index in the pool. Work in the
-// thread specific queue should have higher priority than the global queue.
+// parallel_for_chunks() adds chunk i to thread i in pool (preferred, may be
+// stolen) so same thread usually operates on same range of info data when
+// threading horizontally. Should reduce cache misses and perhaps also help
+// with TODO for RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING (copying
+// for partitioning will go faster).
 //
 // To prevent vertical work to be interleaved with horizontal work, there needs
 // to be a way to say "only look for work in thread specific queue for thread
@@ -103,20 +139,53 @@ namespace Rayni
 	{
 		constexpr unsigned int ABSOLUTE_MAX_DEPTH = 64;
 
-		constexpr unsigned int NUM_BUCKETS = 16;
+		constexpr std::size_t RAY_PACKET_SIZE = 64;
+
 		constexpr unsigned int MAX_LEAF_INTERSECTABLES = 4;
 
+		// Nodes store number of intersectables in a leaf in 8 bits.
+		constexpr std::uint32_t MAX_NODE_INTERSECTABLES = std::numeric_limits<std::uint8_t>::max();
+
 		constexpr unsigned int THREAD_HORIZONTALLY_MIN_THREADS = 2;
-		constexpr unsigned int THREAD_MIN_INTERSECTABLES = 10000;
+
+		// Fewer intersectables per thread are not worth threading horizontally for.
+		constexpr std::uint32_t THREAD_HORIZONTALLY_MIN_CHUNK_INTERSECTABLES = 5000;
+
+		// Smaller sub-trees are built in calling thread, cheaper than a task.
+		constexpr unsigned int TASK_MIN_INTERSECTABLES = 1000;
+
+		constexpr unsigned int MORTON_RADIX_SORT_BITS = 11;
+		constexpr unsigned int MORTON_RADIX_SORT_BUCKETS = 1 << MORTON_RADIX_SORT_BITS;
+		constexpr unsigned int MORTON_30_BIT_BITS_PER_AXIS = 10;
+		constexpr std::uint32_t MORTON_63_BIT_MIN_INTERSECTABLES = 1 << 20;
+
+		// Smaller subtrees are flattened in calling thread.
+		constexpr std::uint32_t FLATTEN_TASK_MIN_NODES = 4096;
+
+		constexpr unsigned int REFIT_SUBTREES_PER_THREAD = 4;
+		constexpr std::uint32_t REFIT_MIN_SUBTREE_NODES = 1024;
+
+		constexpr unsigned int NUM_SPATIAL_BINS = 32;
+		constexpr real_t SPATIAL_SPLIT_MIN_OVERLAP = real_t(1e-5);
+
+		constexpr std::uint32_t CACHE_FILE_VERSION = 1;
+
+		constexpr int QUANTIZATION_MIN_EXPONENT = std::numeric_limits<float>::min_exponent - 1;
+		constexpr int QUANTIZATION_MAX_EXPONENT = std::numeric_limits<float>::max_exponent - 1;
 
 		class Node
 		{
 		public:
-			Node(const AABB &aabb, std::uint32_t intersectable_offset, std::uint8_t intersectable_count) :
+			static constexpr const char *CACHE_FILE_TYPE = "bvh";
+
+			Node() = default;
+
+			Node(const AABB &aabb, std::uint32_t intersectable_offset, std::uint32_t intersectable_count) :
 			        aabb_(aabb),
 			        offset_(intersectable_offset),
-			        intersectable_count_(intersectable_count)
+			        intersectable_count_(std::uint8_t(intersectable_count))
 			{
+				assert(intersectable_count <= MAX_NODE_INTERSECTABLES);
 			}
 
 			Node(const AABB &aabb, std::uint8_t axis) : aabb_(aabb), axis_(axis)
@@ -163,6 +232,11 @@ namespace Rayni
 				return axis_;
 			}
 
+			void set_aabb(const AABB &aabb)
+			{
+				aabb_ = aabb;
+			}
+
 			void set_right_offset(std::uint32_t right_offset)
 			{
 				assert(!is_leaf());
@@ -178,293 +252,1502 @@ namespace Rayni
 
 		static_assert(sizeof(Node) <= sizeof(AABB) + 8);
 
-		class BVH : public Intersectable
+		// Per ray data that is the same for all wide nodes. Index of near plane of
+		// AABB (minimum or maximum) depends on sign of ray direction.
+		struct WideNodeRayData
 		{
-		public:
-			BVH(std::vector<const Intersectable *> &&intersectables, std::vector<Node> &&nodes) :
-			        intersectables_(std::move(intersectables)),
-			        nodes_(std::move(nodes))
+			explicit WideNodeRayData(const Ray &ray) :
+			        origin(ray.origin),
+			        inv_dir(1 / ray.direction.x(), 1 / ray.direction.y(), 1 / ray.direction.z())
 			{
+				for (unsigned int axis = 0; axis < 3; axis++)
+					near[axis] = inv_dir[axis] < 0 ? 1 : 0;
 			}
 
-			AABB aabb() const override
-			{
-				return nodes_[0].aabb();
+			Vector3 origin;
+			Vector3 inv_dir;
+			unsigned int near[3];
+		};
+
+		// Slab test against WIDTH AABBs stored as a structure of arrays. Returns bit
+		// mask with bit i set if AABB i is intersected. Distance to near intersection
+		// with each AABB is stored in t_near.
+		//
+		// Ray is copied to locals and only local arrays are written in the loop over
+		// AABBs. Otherwise the compiler must assume that stores to t_near can modify
+		// ray and bounds, and the loop is not vectorized.
+		template <unsigned int WIDTH>
+		unsigned int intersect_wide_bounds(const real_t (&bounds)[2][3][WIDTH],
+		                                   const WideNodeRayData &ray,
+		                                   real_t ray_t_max,
+		                                   real_t (&t_near)[WIDTH])
+		{
+			constexpr real_t T_FAR_SCALE = 1 + 2 * error_bound_gamma(3);
+
+			const real_t *x_near = bounds[ray.near[0]][0];
+			const real_t *y_near = bounds[ray.near[1]][1];
+			const real_t *z_near = bounds[ray.near[2]][2];
+			const real_t *x_far = bounds[1 - ray.near[0]][0];
+			const real_t *y_far = bounds[1 - ray.near[1]][1];
+			const real_t *z_far = bounds[1 - ray.near[2]][2];
+			const real_t origin_x = ray.origin.x();
+			const real_t origin_y = ray.origin.y();
+			const real_t origin_z = ray.origin.z();
+			const real_t inv_dir_x = ray.inv_dir.x();
+			const real_t inv_dir_y = ray.inv_dir.y();
+			const real_t inv_dir_z = ray.inv_dir.z();
+			real_t t_min[WIDTH];
+			real_t t_max[WIDTH];
+
+			for (unsigned int i = 0; i < WIDTH; i++) {
+				real_t tx_min = (x_near[i] - origin_x) * inv_dir_x;
+				real_t ty_min = (y_near[i] - origin_y) * inv_dir_y;
+				real_t tz_min = (z_near[i] - origin_z) * inv_dir_z;
+				real_t tx_max = (x_far[i] - origin_x) * inv_dir_x * T_FAR_SCALE;
+				real_t ty_max = (y_far[i] - origin_y) * inv_dir_y * T_FAR_SCALE;
+				real_t tz_max = (z_far[i] - origin_z) * inv_dir_z * T_FAR_SCALE;
+
+				t_min[i] = std::max(std::max(tx_min, ty_min), std::max(tz_min, real_t(0)));
+				t_max[i] = std::min(std::min(tx_max, ty_max), std::min(tz_max, ray_t_max));
 			}
 
-			bool intersect(const Ray &ray) const override
-			{
-				Vector3 inv_dir(1 / ray.direction.x(), 1 / ray.direction.y(), 1 / ray.direction.z());
-				const Node *node = &nodes_[0];
-				const Node *stack[ABSOLUTE_MAX_DEPTH];
-				unsigned int stack_pos = 0;
+			unsigned int hit_mask = 0;
 
-				while (node) {
-					if (node->aabb().intersects(ray, inv_dir)) {
-						if (node->is_leaf()) {
-							for (unsigned int i = 0; i < node->intersectable_count(); i++) {
-								std::uint32_t o = node->intersectable_offset() + i;
-								if (intersectables_[o]->intersect(ray))
-									return true;
-							}
-							node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
-						} else if (inv_dir[node->axis()] < 0) {
-							stack[stack_pos++] = node->left();
-							node = node->right();
-						} else {
-							stack[stack_pos++] = node->right();
-							node = node->left();
-						}
-					} else {
-						node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
+			for (unsigned int i = 0; i < WIDTH; i++) {
+				t_near[i] = t_min[i];
+				hit_mask |= unsigned(t_min[i] <= t_max[i]) << i;
+			}
+
+			return hit_mask;
+		}
+
+		// Child AABBs are stored as a structure of arrays so that a ray can be tested
+		// against all children with one slab test per axis (loops over children are
+		// vectorized by the compiler). Leaf children are stored in parent to avoid
+		// fetching a node only to find out that it is a leaf. Unused children have an
+		// empty AABB that can never be intersected.
+		template <unsigned int WIDTH>
+		class alignas(RAYNI_L1_CACHE_LINE_SIZE) WideNode
+		{
+		public:
+			static constexpr unsigned int NUM_CHILDREN = WIDTH;
+			static constexpr const char *CACHE_FILE_TYPE = WIDTH == 4 ? "bvh4" : "bvh8";
+
+			using RayData = WideNodeRayData;
+
+			WideNode()
+			{
+				for (unsigned int axis = 0; axis < 3; axis++) {
+					for (unsigned int i = 0; i < WIDTH; i++) {
+						bounds_[0][axis][i] = REAL_INFINITY;
+						bounds_[1][axis][i] = -REAL_INFINITY;
 					}
 				}
-
-				return false;
 			}
 
-			bool intersect(const Ray &ray, Intersection &intersection) const override
+			void set_child_node(unsigned int i, const AABB &aabb, std::uint32_t node_index)
 			{
-				Vector3 inv_dir(1 / ray.direction.x(), 1 / ray.direction.y(), 1 / ray.direction.z());
-				const Node *node = &nodes_[0];
-				const Node *stack[ABSOLUTE_MAX_DEPTH];
-				unsigned int stack_pos = 0;
-				bool hit = false;
+				set_child_aabb(i, aabb);
+				offset_[i] = node_index;
+				count_[i] = 0;
+			}
 
-				while (node) {
-					if (node->aabb().intersects(ray, inv_dir, intersection.t)) {
-						if (node->is_leaf()) {
-							for (unsigned int i = 0; i < node->intersectable_count(); i++) {
-								std::uint32_t o = node->intersectable_offset() + i;
-								if (intersectables_[o]->intersect(ray, intersection))
-									hit = true;
-							}
-							node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
-						} else if (inv_dir[node->axis()] < 0) {
-							stack[stack_pos++] = node->left();
-							node = node->right();
-						} else {
-							stack[stack_pos++] = node->right();
-							node = node->left();
-						}
-					} else {
-						node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
-					}
-				}
+			void set_child_leaf(unsigned int i,
+			                    const AABB &aabb,
+			                    std::uint32_t intersectable_offset,
+			                    std::uint32_t intersectable_count)
+			{
+				assert(intersectable_count > 0);
+				set_child_aabb(i, aabb);
+				offset_[i] = intersectable_offset;
+				count_[i] = intersectable_count;
+			}
 
-				return hit;
+			bool child_is_empty(unsigned int i) const
+			{
+				return bounds_[0][0][i] > bounds_[1][0][i];
 			}
 
-		private:
-			const std::vector<const Intersectable *> intersectables_;
-			const std::vector<Node> nodes_;
-		};
+			bool child_is_leaf(unsigned int i) const
+			{
+				return count_[i] > 0;
+			}
 
-		struct IntersectableInfo
-		{
-			std::uint32_t index = 0;
-			AABB aabb{{0, 0, 0}, {0, 0, 0}};
-			Vector3 centroid;
-		};
+			std::uint32_t child_node(unsigned int i) const
+			{
+				assert(!child_is_leaf(i));
+				return offset_[i];
+			}
 
-		struct BuildNode
-		{
-			AABB aabb{{0, 0, 0}, {0, 0, 0}};
-			std::uint8_t split_axis = 0;
+			std::uint32_t child_intersectable_offset(unsigned int i) const
+			{
+				assert(child_is_leaf(i));
+				return offset_[i];
+			}
 
-			union
+			std::uint32_t child_intersectable_count(unsigned int i) const
 			{
-				struct
-				{
-					const BuildNode *left;
-					const BuildNode *right;
-				} split;
+				assert(child_is_leaf(i));
+				return count_[i];
+			}
 
-				struct
-				{
-					std::uint32_t start;
-					std::uint32_t end;
-				} leaf;
-			};
-		};
+			AABB child_aabb(unsigned int i) const
+			{
+				return {{bounds_[0][0][i], bounds_[0][1][i], bounds_[0][2][i]},
+				        {bounds_[1][0][i], bounds_[1][1][i], bounds_[1][2][i]}};
+			}
 
-		struct BuildNodeBlock
-		{
-			static constexpr unsigned int SIZE = 4096;
-			unsigned int used = 0;
-			BuildNode nodes[SIZE];
-			std::unique_ptr<BuildNodeBlock> next;
-		};
+			// Returns bit mask with bit i set if child i is intersected. Distance to
+			// near intersection with each child is stored in t_near.
+			unsigned int intersect(const RayData &ray, real_t ray_t_max, real_t (&t_near)[WIDTH]) const
+			{
+				return intersect_wide_bounds(bounds_, ray, ray_t_max, t_near);
+			}
 
-		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) BuildThreadState
-		{
-			BuildNodeBlock build_node_block_root;
-			BuildNodeBlock *build_node_block_current = &build_node_block_root;
-		};
+			void set_child_aabb(unsigned int i, const AABB &aabb)
+			{
+				for (unsigned int axis = 0; axis < 3; axis++) {
+					bounds_[0][axis][i] = aabb.minimum()[axis];
+					bounds_[1][axis][i] = aabb.maximum()[axis];
+				}
+			}
 
-		struct BuildContext
-		{
-			BuildContext(std::vector<const Intersectable *> &&is, const Cancellable &c, ThreadPool &tp) :
-			        intersectables(std::move(is)),
-			        cancellable(c),
-			        thread_pool(tp)
+			void set_child_aabbs(const AABB (&aabbs)[WIDTH])
 			{
+				for (unsigned int i = 0; i < WIDTH; i++)
+					set_child_aabb(i, aabbs[i]);
 			}
 
-			std::vector<const Intersectable *> intersectables;
-			const Cancellable &cancellable;
-			ThreadPool &thread_pool;
+			AABB aabb() const
+			{
+				AABB aabb;
 
-			static thread_local BuildThreadState *thread_state;
-			CacheLineAlignedVector<BuildThreadState> thread_states;
+				for (unsigned int i = 0; i < WIDTH; i++)
+					aabb.merge(child_aabb(i));
 
-			std::vector<IntersectableInfo> infos;
-#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
-			std::vector<IntersectableInfo> infos_copy;
-#endif
+				return aabb;
+			}
+
+		private:
+			real_t bounds_[2][3][WIDTH]; // [minimum/maximum][axis][child]
+			std::uint32_t offset_[WIDTH] = {};
+			std::uint32_t count_[WIDTH] = {};
 		};
 
-		thread_local BuildThreadState *BuildContext::thread_state = nullptr;
+		static_assert(sizeof(WideNode<4>) % RAYNI_L1_CACHE_LINE_SIZE == 0);
+		static_assert(sizeof(WideNode<8>) % RAYNI_L1_CACHE_LINE_SIZE == 0);
 
-		struct Bucket
+		// 2^exponent. Exponent must be in range of normal floats (so also doubles).
+		inline real_t power_of_two(int exponent)
 		{
-			std::uint32_t count = 0;
-			AABB aabb;
-		};
+			constexpr int BIAS = std::numeric_limits<real_t>::max_exponent - 1;
+			constexpr int MANTISSA_BITS = std::numeric_limits<real_t>::digits - 1;
 
-		struct BucketSplit
-		{
-			real_t cost;
-			unsigned int bucket;
-		};
+			assert(exponent >= QUANTIZATION_MIN_EXPONENT && exponent <= QUANTIZATION_MAX_EXPONENT);
 
-		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) HorizontalChunkState
+			return std::bit_cast<real_t>(real_uint_t(exponent + BIAS) << MANTISSA_BITS);
+		}
+
+		// Wide node where planes of child AABBs are quantized to 8 bits relative to
+		// AABB of node (union of children), see:
+		//
+		// Ylitie, H., Karras, T. and Laine, S., 2017, Efficient Incoherent Ray
+		// Traversal on GPUs Through Compressed Wide BVHs
+		// https://doi.org/10.1145/3105762.3105773
+		//
+		// Size of a grid cell along an axis is a power of two so that dequantization
+		// is exact (same result with and without FMA). Planes are rounded outwards so
+		// that a dequantized AABB always contains the original AABB. Half the size of
+		// WideNode (4 wide node fits in a 64 byte cache line when real_t is float) at
+		// the cost of dequantization and some false positive child intersections.
+		template <unsigned int WIDTH>
+		class alignas(RAYNI_L1_CACHE_LINE_SIZE) QuantizedWideNode
 		{
-			AABB aabb;
-			AABB centroids_aabb;
-			Bucket buckets[NUM_BUCKETS];
+		public:
+			static constexpr unsigned int NUM_CHILDREN = WIDTH;
+			static constexpr const char *CACHE_FILE_TYPE = WIDTH == 4 ? "bvh4_quantized" : "bvh8_quantized";
 
-#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
-			std::uint32_t partition_left_start = 0;
-			std::uint32_t partition_right_start = 0;
-#endif
-		};
+			using RayData = WideNodeRayData;
 
-		void prepare_build_context(BuildContext &context, unsigned int threads)
-		{
-			std::uint32_t count = context.intersectables.size();
-			Barrier barrier(threads);
+			QuantizedWideNode() = default;
 
-			context.thread_states.resize(threads + 1);
-			context.thread_state = &context.thread_states[0];
-			context.infos.resize(count);
+			explicit QuantizedWideNode(const WideNode<WIDTH> &node)
+			{
+				AABB aabbs[WIDTH];
 
-			for (unsigned int t = 0; t < threads; t++) {
-				context.thread_pool.add_task([&, count, t] {
-					context.thread_state = &context.thread_states[t + 1];
+				for (unsigned int i = 0; i < WIDTH; i++) {
+					if (node.child_is_empty(i))
+						continue;
 
-					std::uint32_t start = (std::uint64_t(t) * count) / threads;
-					std::uint32_t end = (std::uint64_t(t + 1) * count) / threads;
+					aabbs[i] = node.child_aabb(i);
+					child_mask_ |= std::uint8_t(1U << i);
 
-					for (std::uint32_t i = start; i < end; i++) {
-						context.infos[i].index = i;
-						context.infos[i].aabb = context.intersectables[i]->aabb();
-						context.infos[i].centroid = context.infos[i].aabb.centroid();
+					if (node.child_is_leaf(i)) {
+						std::uint32_t count = node.child_intersectable_count(i);
+						assert(count <= MAX_NODE_INTERSECTABLES);
+						offset_[i] = node.child_intersectable_offset(i);
+						count_[i] = std::uint8_t(count);
+					} else {
+						offset_[i] = node.child_node(i);
 					}
+				}
 
-					barrier.arrive_and_wait();
-				});
+				set_child_aabbs(aabbs);
 			}
 
-#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
-			context.infos_copy.resize(count);
-#endif
-			context.thread_pool.wait();
-		}
+			bool child_is_empty(unsigned int i) const
+			{
+				return (child_mask_ & (1U << i)) == 0;
+			}
 
-		BuildNode *next_build_node(BuildContext &context)
-		{
-			BuildNodeBlock *block = context.thread_state->build_node_block_current;
+			bool child_is_leaf(unsigned int i) const
+			{
+				return count_[i] > 0;
+			}
 
-			if (block->used == BuildNodeBlock::SIZE) {
-				block->next = std::make_unique<BuildNodeBlock>();
-				block = block->next.get();
-				context.thread_state->build_node_block_current = block;
+			std::uint32_t child_node(unsigned int i) const
+			{
+				assert(!child_is_leaf(i));
+				return offset_[i];
 			}
 
-			return &block->nodes[block->used++];
-		}
+			std::uint32_t child_intersectable_offset(unsigned int i) const
+			{
+				assert(child_is_leaf(i));
+				return offset_[i];
+			}
 
-		unsigned int build_nodes_used(const BuildContext &context)
-		{
-			unsigned int nodes_used = 0;
+			std::uint32_t child_intersectable_count(unsigned int i) const
+			{
+				assert(child_is_leaf(i));
+				return count_[i];
+			}
 
-			for (const auto &state : context.thread_states) {
-				const BuildNodeBlock *node_block = &state.build_node_block_root;
-				while (node_block) {
-					nodes_used += node_block->used;
-					node_block = node_block->next.get();
-				}
+			// Only false for nodes read from a corrupt cache file.
+			bool exponents_valid() const
+			{
+				for (int exponent : exponent_)
+					if (exponent < QUANTIZATION_MIN_EXPONENT ||
+					    exponent > QUANTIZATION_MAX_EXPONENT)
+						return false;
+
+				return true;
 			}
 
-			return nodes_used;
-		}
+			AABB child_aabb(unsigned int i) const
+			{
+				if (child_is_empty(i))
+					return AABB();
 
-		unsigned int bucket_index(const Vector3 &centroid, const AABB &centroids_aabb, std::uint8_t split_axis)
-		{
-			real_t pos = centroid[split_axis];
-			real_t min = centroids_aabb.minimum()[split_axis];
-			real_t max = centroids_aabb.maximum()[split_axis];
-			auto b = unsigned(NUM_BUCKETS * (pos - min) / (max - min));
-			if (b >= NUM_BUCKETS)
-				b = NUM_BUCKETS - 1;
-			return b;
-		}
+				Vector3 minimum, maximum;
 
-		BucketSplit bucket_split(const Bucket *buckets, const AABB &aabb)
-		{
-			constexpr unsigned int NUM_SPLITS = NUM_BUCKETS - 1;
-			std::uint32_t left_count[NUM_SPLITS];
-			std::uint32_t right_count[NUM_SPLITS];
-			AABB left_aabb[NUM_SPLITS];
-			AABB right_aabb[NUM_SPLITS];
+				for (unsigned int axis = 0; axis < 3; axis++) {
+					real_t scale = power_of_two(exponent_[axis]);
+					minimum[axis] = origin_[axis] + real_t(planes_[0][axis][i]) * scale;
+					maximum[axis] = origin_[axis] + real_t(planes_[1][axis][i]) * scale;
+				}
 
-			left_count[0] = buckets[0].count;
-			left_aabb[0] = buckets[0].aabb;
-			for (unsigned int i = 1; i < NUM_SPLITS; i++) {
-				left_count[i] = left_count[i - 1] + buckets[i].count;
-				left_aabb[i] = AABB(left_aabb[i - 1]).merge(buckets[i].aabb);
+				return {minimum, maximum};
 			}
 
-			right_count[NUM_SPLITS - 1] = buckets[NUM_BUCKETS - 1].count;
-			right_aabb[NUM_SPLITS - 1] = buckets[NUM_BUCKETS - 1].aabb;
-			for (int i = NUM_SPLITS - 2; i >= 0; i--) {
-				right_count[i] = right_count[i + 1] + buckets[i + 1].count;
-				right_aabb[i] = AABB(right_aabb[i + 1]).merge(buckets[i + 1].aabb);
-			}
+			// See WideNode::intersect(). Empty children are masked out since their
+			// quantized AABBs are not empty.
+			unsigned int intersect(const RayData &ray, real_t ray_t_max, real_t (&t_near)[WIDTH]) const
+			{
+				real_t bounds[2][3][WIDTH];
 
-			real_t split_cost = REAL_INFINITY;
-			unsigned int split_bucket = 0;
+				for (unsigned int axis = 0; axis < 3; axis++) {
+					real_t origin = origin_[axis];
+					real_t scale = power_of_two(exponent_[axis]);
 
-			for (unsigned int i = 0; i < NUM_SPLITS; i++) {
-				real_t cost = (left_count[i] * left_aabb[i].surface_area() +
-				               right_count[i] * right_aabb[i].surface_area());
-				if (cost < split_cost) {
-					split_cost = cost;
-					split_bucket = i;
+					for (unsigned int i = 0; i < WIDTH; i++) {
+						bounds[0][axis][i] = origin + real_t(planes_[0][axis][i]) * scale;
+						bounds[1][axis][i] = origin + real_t(planes_[1][axis][i]) * scale;
+					}
 				}
+
+				return intersect_wide_bounds(bounds, ray, ray_t_max, t_near) & child_mask_;
 			}
 
-			split_cost = real_t(0.5) + split_cost / aabb.surface_area();
+			// All AABBs must be set at once since quantization grid depends on AABB
+			// of node. AABBs of empty children are ignored.
+			void set_child_aabbs(const AABB (&aabbs)[WIDTH])
+			{
+				AABB node_aabb;
+
+				for (unsigned int i = 0; i < WIDTH; i++)
+					if (!child_is_empty(i))
+						node_aabb.merge(aabbs[i]);
+
+				for (unsigned int axis = 0; axis < 3; axis++) {
+					real_t minimum = node_aabb.minimum()[axis];
+					real_t maximum = node_aabb.maximum()[axis];
+
+					origin_[axis] = minimum;
+					exponent_[axis] = std::int8_t(quantization_exponent(minimum, maximum));
+
+					for (unsigned int i = 0; i < WIDTH; i++) {
+						if (child_is_empty(i))
+							continue;
+
+						planes_[0][axis][i] = quantize_down(axis, aabbs[i].minimum()[axis]);
+						planes_[1][axis][i] = quantize_up(axis, aabbs[i].maximum()[axis]);
+					}
+				}
+			}
+
+			AABB aabb() const
+			{
+				AABB aabb;
+
+				for (unsigned int i = 0; i < WIDTH; i++)
+					aabb.merge(child_aabb(i));
+
+				return aabb;
+			}
+
+		private:
+			static constexpr unsigned int MAX_PLANE = std::numeric_limits<std::uint8_t>::max();
+
+			// Smallest exponent such that MAX_PLANE cells cover [minimum, maximum].
+			static int quantization_exponent(real_t minimum, real_t maximum)
+			{
+				int exponent = QUANTIZATION_MIN_EXPONENT;
+
+				if (maximum > minimum) {
+					std::frexp((maximum - minimum) / MAX_PLANE, &exponent);
+					exponent = std::max(exponent, QUANTIZATION_MIN_EXPONENT);
+				}
+
+				while (minimum + MAX_PLANE * power_of_two(exponent) < maximum)
+					exponent++;
+
+				return exponent;
+			}
+
+			real_t plane(unsigned int axis, unsigned int q) const
+			{
+				return origin_[axis] + real_t(q) * power_of_two(exponent_[axis]);
+			}
+
+			// Rounding errors when calculating initial guess are corrected by comparing
+			// with dequantized value.
+			std::uint8_t quantize_down(unsigned int axis, real_t value) const
+			{
+				real_t cell = std::floor((value - origin_[axis]) / power_of_two(exponent_[axis]));
+				unsigned int q = unsigned(std::clamp(cell, real_t(0), real_t(MAX_PLANE)));
+
+				while (q > 0 && plane(axis, q) > value)
+					q--;
+
+				assert(plane(axis, q) <= value);
+
+				return std::uint8_t(q);
+			}
+
+			std::uint8_t quantize_up(unsigned int axis, real_t value) const
+			{
+				real_t cell = std::ceil((value - origin_[axis]) / power_of_two(exponent_[axis]));
+				unsigned int q = unsigned(std::clamp(cell, real_t(0), real_t(MAX_PLANE)));
+
+				while (q < MAX_PLANE && plane(axis, q) < value)
+					q++;
+
+				assert(plane(axis, q) >= value);
+
+				return std::uint8_t(q);
+			}
+
+			real_t origin_[3] = {};
+			std::int8_t exponent_[3] = {};
+			std::uint8_t child_mask_ = 0;
+			std::uint8_t planes_[2][3][WIDTH] = {}; // [minimum/maximum][axis][child]
+			std::uint32_t offset_[WIDTH] = {};
+			std::uint8_t count_[WIDTH] = {};
+		};
+
+		static_assert(sizeof(QuantizedWideNode<4>) <= sizeof(WideNode<4>) / 2);
+		static_assert(sizeof(QuantizedWideNode<8>) <= sizeof(WideNode<8>) / 2);
+
+		// Nodes are stored in depth first order, so a subtree is a contiguous range of
+		// nodes where children come after their parent. Refitting a range in reverse
+		// order is therefore bottom-up. Tree is split into subtrees that are refitted
+		// in parallel, nodes above them are then refitted by calling thread.
+		template <typename RefitNode, typename ForEachInnerChild>
+		void refit_nodes(ThreadPool &thread_pool,
+		                 std::uint32_t num_nodes,
+		                 RefitNode &&refit_node,
+		                 ForEachInnerChild &&for_each_inner_child)
+		{
+			struct Subtree
+			{
+				std::uint32_t start;
+				std::uint32_t end;
+			};
+
+			std::vector<Subtree> subtrees = {{0, num_nodes}};
+			std::vector<std::uint32_t> top_nodes;
+			std::size_t max_subtrees =
+			        std::size_t(thread_pool.size() + 1) * REFIT_SUBTREES_PER_THREAD;
+
+			while (subtrees.size() < max_subtrees) {
+				auto largest = std::max_element(subtrees.begin(),
+				                                subtrees.end(),
+				                                [](const Subtree &s1, const Subtree &s2) {
+					                                return s1.end - s1.start < s2.end - s2.start;
+				                                });
+				Subtree subtree = *largest;
+
+				if (subtree.end - subtree.start < REFIT_MIN_SUBTREE_NODES)
+					break;
+
+				subtrees.erase(largest);
+				top_nodes.push_back(subtree.start);
+
+				auto add_subtree = [&](std::uint32_t start, std::uint32_t end) {
+					subtrees.push_back({start, end});
+				};
+
+				for_each_inner_child(subtree.start, subtree.end, add_subtree);
+			}
+
+			auto refit_subtree = [&](const Subtree &subtree) {
+				for (std::uint32_t i = subtree.end; i > subtree.start; i--)
+					refit_node(i - 1);
+			};
+
+			auto refit_chunk = [&](unsigned int i, std::size_t, std::size_t) {
+				refit_subtree(subtrees[i]);
+			};
+
+			if (!subtrees.empty())
+				parallel_for_chunks(thread_pool,
+				                    0,
+				                    subtrees.size(),
+				                    unsigned(subtrees.size()),
+				                    refit_chunk);
+
+			// Subtrees are split after their ancestors, reverse order is bottom-up.
+			for (auto i = top_nodes.rbegin(); i != top_nodes.rend(); i++)
+				refit_node(*i);
+		}
+
+		AABB intersectables_aabb(const std::vector<const Intersectable *> &intersectables,
+		                         std::uint32_t offset,
+		                         std::uint32_t count)
+		{
+			AABB aabb;
+
+			for (std::uint32_t i = offset; i < offset + count; i++)
+				aabb.merge(intersectables[i]->aabb());
+
+			return aabb;
+		}
+
+		// Ordered intersectables are saved as indices into intersectables that BVH
+		// was built from since pointers are only valid in current process.
+		Result<std::vector<std::uint32_t>>
+		ordered_intersectable_indices(const std::vector<const Intersectable *> &ordered_intersectables,
+		                              const std::vector<const Intersectable *> &intersectables)
+		{
+			std::unordered_map<const Intersectable *, std::uint32_t> indices;
+			std::vector<std::uint32_t> ordered_indices;
+			ordered_indices.reserve(ordered_intersectables.size());
+
+			for (std::uint32_t i = 0; i < intersectables.size(); i++)
+				indices.emplace(intersectables[i], i);
+
+			for (const Intersectable *intersectable : ordered_intersectables) {
+				auto i = indices.find(intersectable);
+				if (i == indices.end())
+					return Error("intersectables differ from the ones BVH was built from");
+				ordered_indices.push_back(i->second);
+			}
+
+			return ordered_indices;
+		}
+
+		Result<std::vector<const Intersectable *>>
+		ordered_intersectables_from_cache_file(const CacheFile &file,
+		                                       std::size_t array_index,
+		                                       const std::vector<const Intersectable *> &intersectables)
+		{
+			const std::uint32_t *indices = file.array_data<std::uint32_t>(array_index);
+			std::vector<const Intersectable *> ordered_intersectables;
+			ordered_intersectables.reserve(file.array_size(array_index));
+
+			for (std::size_t i = 0; i < file.array_size(array_index); i++) {
+				if (indices[i] >= intersectables.size())
+					return Error("intersectable index in cache file is out of range");
+				ordered_intersectables.push_back(intersectables[indices[i]]);
+			}
+
+			return ordered_intersectables;
+		}
+
+		// Nodes in a cache file are used as is. Check that children and leaf ranges
+		// are in bounds, that children come after their parent (refit relies on
+		// it) and that depth fits in traversal stacks so that a corrupt file
+		// results in an error (and a rebuild) instead of reads out of bounds.
+		Result<void> validate_nodes(const Node *nodes, std::size_t num_nodes, std::size_t num_intersectables)
+		{
+			std::vector<unsigned int> depths(num_nodes, 0);
+
+			for (std::size_t i = 0; i < num_nodes; i++) {
+				const Node &node = nodes[i];
+
+				if (depths[i] >= ABSOLUTE_MAX_DEPTH)
+					return Error("node in cache file is too deep");
+
+				if (node.is_leaf()) {
+					std::uint64_t offset = node.intersectable_offset();
+					if (offset + node.intersectable_count() > num_intersectables)
+						return Error("leaf in cache file is out of range");
+					continue;
+				}
+
+				std::size_t right = std::size_t(node.right() - nodes);
+
+				if (node.axis() > 2 || right <= i + 1 || right >= num_nodes)
+					return Error("node in cache file is invalid");
+
+				depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+				depths[right] = std::max(depths[right], depths[i] + 1);
+			}
+
+			return {};
+		}
+
+		template <typename WideNodeType>
+		Result<void> validate_wide_nodes(const WideNodeType *nodes,
+		                                 std::size_t num_nodes,
+		                                 std::size_t num_intersectables)
+		{
+			constexpr bool QUANTIZED =
+			        std::is_same_v<WideNodeType, QuantizedWideNode<WideNodeType::NUM_CHILDREN>>;
+			std::vector<unsigned int> depths(num_nodes, 0);
+
+			for (std::size_t i = 0; i < num_nodes; i++) {
+				const WideNodeType &node = nodes[i];
+				std::size_t previous_child = i;
+
+				if (depths[i] >= ABSOLUTE_MAX_DEPTH)
+					return Error("node in cache file is too deep");
+
+				if constexpr (QUANTIZED)
+					if (!node.exponents_valid())
+						return Error("node in cache file is invalid");
+
+				for (unsigned int c = 0; c < WideNodeType::NUM_CHILDREN; c++) {
+					if (node.child_is_empty(c))
+						continue;
+
+					if (node.child_is_leaf(c)) {
+						std::uint64_t offset = node.child_intersectable_offset(c);
+						if (offset + node.child_intersectable_count(c) > num_intersectables)
+							return Error("leaf in cache file is out of range");
+						continue;
+					}
+
+					std::size_t child = node.child_node(c);
+
+					if (child <= previous_child || child >= num_nodes)
+						return Error("node in cache file is invalid");
+
+					depths[child] = std::max(depths[child], depths[i] + 1);
+					previous_child = child;
+				}
+			}
+
+			return {};
+		}
+
+		class BinaryBVH : public BVH
+		{
+		public:
+			BinaryBVH(std::vector<const Intersectable *> &&intersectables,
+			          CacheableVector<Node> &&nodes,
+			          CacheFile &&cache_file = {}) :
+			        cache_file_(std::move(cache_file)),
+			        intersectables_(std::move(intersectables)),
+			        nodes_(std::move(nodes))
+			{
+			}
+
+			Result<void> save(const std::string &path,
+			                  std::uint64_t key,
+			                  const std::vector<const Intersectable *> &intersectables) const override
+			{
+				auto indices = ordered_intersectable_indices(intersectables_, intersectables);
+				if (!indices)
+					return Error(path, indices.error().message());
+
+				return CacheFile::write(path,
+				                        Node::CACHE_FILE_TYPE,
+				                        CACHE_FILE_VERSION,
+				                        key,
+				                        {CacheFile::Array(*indices),
+				                         CacheFile::Array(nodes_.data(), nodes_.size())});
+			}
+
+			AABB aabb() const override
+			{
+				return nodes_[0].aabb();
+			}
+
+			void refit(ThreadPool &thread_pool) override
+			{
+				Node *nodes = nodes_.mutable_data();
+
+				auto refit_node = [&](std::uint32_t i) {
+					Node &node = nodes[i];
+
+					if (node.is_leaf())
+						node.set_aabb(intersectables_aabb(intersectables_,
+						                                  node.intersectable_offset(),
+						                                  node.intersectable_count()));
+					else
+						node.set_aabb(AABB(node.left()->aabb()).merge(node.right()->aabb()));
+				};
+
+				auto for_each_inner_child = [&](std::uint32_t start, std::uint32_t end, auto &&func) {
+					const Node &node = nodes[start];
+
+					if (node.is_leaf())
+						return;
+
+					std::uint32_t right_start = node.right() - nodes;
+
+					func(start + 1, right_start);
+					func(right_start, end);
+				};
+
+				refit_nodes(thread_pool, nodes_.size(), refit_node, for_each_inner_child);
+			}
+
+			bool intersect(const Ray &ray) const override
+			{
+				Vector3 inv_dir(1 / ray.direction.x(), 1 / ray.direction.y(), 1 / ray.direction.z());
+				const Node *node = &nodes_[0];
+				const Node *stack[ABSOLUTE_MAX_DEPTH];
+				unsigned int stack_pos = 0;
+
+				while (node) {
+					if (node->aabb().intersects(ray, inv_dir)) {
+						if (node->is_leaf()) {
+							for (unsigned int i = 0; i < node->intersectable_count(); i++) {
+								std::uint32_t o = node->intersectable_offset() + i;
+								if (intersectables_[o]->intersect(ray))
+									return true;
+							}
+							node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
+						} else if (inv_dir[node->axis()] < 0) {
+							stack[stack_pos++] = node->left();
+							node = node->right();
+						} else {
+							stack[stack_pos++] = node->right();
+							node = node->left();
+						}
+					} else {
+						node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
+					}
+				}
+
+				return false;
+			}
+
+			bool intersect(const Ray &ray, Intersection &intersection) const override
+			{
+				Vector3 inv_dir(1 / ray.direction.x(), 1 / ray.direction.y(), 1 / ray.direction.z());
+				const Node *node = &nodes_[0];
+				const Node *stack[ABSOLUTE_MAX_DEPTH];
+				unsigned int stack_pos = 0;
+				bool hit = false;
+
+				while (node) {
+					if (node->aabb().intersects(ray, inv_dir, intersection.t)) {
+						if (node->is_leaf()) {
+							for (unsigned int i = 0; i < node->intersectable_count(); i++) {
+								std::uint32_t o = node->intersectable_offset() + i;
+								if (intersectables_[o]->intersect(ray, intersection))
+									hit = true;
+							}
+							node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
+						} else if (inv_dir[node->axis()] < 0) {
+							stack[stack_pos++] = node->left();
+							node = node->right();
+						} else {
+							stack[stack_pos++] = node->right();
+							node = node->left();
+						}
+					} else {
+						node = stack_pos > 0 ? stack[--stack_pos] : nullptr;
+					}
+				}
+
+				return hit;
+			}
+
+			void intersect_batch(const Ray *rays, bool *hits, std::size_t count) const override
+			{
+				for (std::size_t i = 0; i < count; i += RAY_PACKET_SIZE)
+					intersect_packet(&rays[i],
+					                 nullptr,
+					                 &hits[i],
+					                 std::min(count - i, RAY_PACKET_SIZE));
+			}
+
+			void intersect_batch(const Ray *rays,
+			                     Intersection *intersections,
+			                     bool *hits,
+			                     std::size_t count) const override
+			{
+				for (std::size_t i = 0; i < count; i += RAY_PACKET_SIZE)
+					intersect_packet(&rays[i],
+					                 &intersections[i],
+					                 &hits[i],
+					                 std::min(count - i, RAY_PACKET_SIZE));
+			}
+
+		private:
+			bool intersect_leaf(const Node *node, const Ray &ray) const
+			{
+				std::uint32_t offset = node->intersectable_offset();
+
+				for (unsigned int i = 0; i < node->intersectable_count(); i++) {
+					if (intersectables_[offset + i]->intersect(ray))
+						return true;
+				}
+
+				return false;
+			}
+
+			bool intersect_leaf(const Node *node, const Ray &ray, Intersection &intersection) const
+			{
+				std::uint32_t offset = node->intersectable_offset();
+				bool hit = false;
+
+				for (unsigned int i = 0; i < node->intersectable_count(); i++) {
+					if (intersectables_[offset + i]->intersect(ray, intersection))
+						hit = true;
+				}
+
+				return hit;
+			}
+
+			// Node is visited if any ray in packet intersects it. Index of first ray
+			// that intersects node is passed down the tree since rays before it can
+			// not intersect child nodes either. Only done if rays have the same
+			// direction signs, incoherent rays are intersected one by one. See:
+			//
+			// Wald, I., Boulos, S. and Shirley, P., 2007, Ray Tracing Deformable
+			// Scenes using Dynamic Bounding Volume Hierarchies
+			// https://doi.org/10.1145/1189762.1206075
+			void intersect_packet(const Ray *rays,
+			                      Intersection *intersections,
+			                      bool *hits,
+			                      std::size_t count) const
+			{
+				if (!rays_have_same_direction_signs(rays, count)) {
+					for (std::size_t i = 0; i < count; i++) {
+						if (intersections)
+							hits[i] = intersect(rays[i], intersections[i]);
+						else
+							hits[i] = intersect(rays[i]);
+					}
+					return;
+				}
+
+				struct StackElement
+				{
+					const Node *node;
+					std::size_t first;
+				};
+
+				Vector3 inv_dirs[RAY_PACKET_SIZE];
+				bool active[RAY_PACKET_SIZE];
+				std::size_t num_active = count;
+
+				for (std::size_t i = 0; i < count; i++) {
+					const Vector3 &d = rays[i].direction;
+					inv_dirs[i] = Vector3(1 / d.x(), 1 / d.y(), 1 / d.z());
+					active[i] = true;
+					hits[i] = false;
+				}
+
+				auto ray_intersects = [&](const Node *node, std::size_t i) {
+					real_t t_max = intersections ? intersections[i].t : REAL_INFINITY;
+					return active[i] && node->aabb().intersects(rays[i], inv_dirs[i], t_max);
+				};
+
+				StackElement current = {&nodes_[0], 0};
+				StackElement stack[ABSOLUTE_MAX_DEPTH];
+				unsigned int stack_pos = 0;
+
+				while (current.node) {
+					const Node *node = current.node;
+					std::size_t first = current.first;
+
+					while (first < count && !ray_intersects(node, first))
+						first++;
+
+					if (first == count) {
+						current = stack_pos > 0 ? stack[--stack_pos] : StackElement{nullptr, 0};
+					} else if (node->is_leaf()) {
+						for (std::size_t i = first; i < count; i++) {
+							if (i != first && !ray_intersects(node, i))
+								continue;
+
+							if (intersections) {
+								if (intersect_leaf(node, rays[i], intersections[i]))
+									hits[i] = true;
+							} else if (intersect_leaf(node, rays[i])) {
+								hits[i] = true;
+								active[i] = false;
+								num_active--;
+							}
+						}
+
+						if (num_active == 0)
+							return;
+
+						current = stack_pos > 0 ? stack[--stack_pos] : StackElement{nullptr, 0};
+					} else if (inv_dirs[first][node->axis()] < 0) {
+						stack[stack_pos++] = {node->left(), first};
+						current = {node->right(), first};
+					} else {
+						stack[stack_pos++] = {node->right(), first};
+						current = {node->left(), first};
+					}
+				}
+			}
+
+			const CacheFile cache_file_;
+			const std::vector<const Intersectable *> intersectables_;
+			CacheableVector<Node> nodes_;
+		};
+
+		template <typename WideNodeType>
+		class WideBVH : public BVH
+		{
+		public:
+			using Nodes = CacheableVector<WideNodeType, CacheLineAlignedAllocator<WideNodeType>>;
+
+			WideBVH(std::vector<const Intersectable *> &&intersectables,
+			        Nodes &&nodes,
+			        const AABB &aabb,
+			        CacheFile &&cache_file = {}) :
+			        cache_file_(std::move(cache_file)),
+			        intersectables_(std::move(intersectables)),
+			        nodes_(std::move(nodes)),
+			        aabb_(aabb)
+			{
+			}
+
+			Result<void> save(const std::string &path,
+			                  std::uint64_t key,
+			                  const std::vector<const Intersectable *> &intersectables) const override
+			{
+				auto indices = ordered_intersectable_indices(intersectables_, intersectables);
+				if (!indices)
+					return Error(path, indices.error().message());
+
+				return CacheFile::write(path,
+				                        WideNodeType::CACHE_FILE_TYPE,
+				                        CACHE_FILE_VERSION,
+				                        key,
+				                        {CacheFile::Array(*indices),
+				                         CacheFile::Array(nodes_.data(), nodes_.size()),
+				                         CacheFile::Array(&aabb_, 1)});
+			}
+
+			AABB aabb() const override
+			{
+				return aabb_;
+			}
+
+			void refit(ThreadPool &thread_pool) override
+			{
+				// Exact AABBs of nodes are kept on the side since AABBs in quantized
+				// nodes are rounded outwards, using them would grow AABBs for each level.
+				std::vector<AABB> node_aabbs(nodes_.size());
+				WideNodeType *nodes = nodes_.mutable_data();
+
+				auto refit_node = [&](std::uint32_t i) {
+					WideNodeType &node = nodes[i];
+					AABB aabbs[WIDTH];
+
+					for (unsigned int c = 0; c < WIDTH; c++) {
+						if (node.child_is_empty(c))
+							continue;
+
+						if (node.child_is_leaf(c)) {
+							std::uint32_t offset = node.child_intersectable_offset(c);
+							std::uint32_t count = node.child_intersectable_count(c);
+							aabbs[c] = intersectables_aabb(intersectables_, offset, count);
+						} else {
+							aabbs[c] = node_aabbs[node.child_node(c)];
+						}
+
+						node_aabbs[i].merge(aabbs[c]);
+					}
+
+					node.set_child_aabbs(aabbs);
+				};
+
+				// Inner children are stored in child order after parent.
+				auto for_each_inner_child = [&](std::uint32_t start, std::uint32_t end, auto &&func) {
+					const WideNodeType &node = nodes_[start];
+					std::uint32_t child_start = 0;
+
+					for (unsigned int c = 0; c < WIDTH; c++) {
+						if (node.child_is_empty(c) || node.child_is_leaf(c))
+							continue;
+
+						if (child_start != 0)
+							func(child_start, node.child_node(c));
+
+						child_start = node.child_node(c);
+					}
+
+					if (child_start != 0)
+						func(child_start, end);
+				};
+
+				refit_nodes(thread_pool, nodes_.size(), refit_node, for_each_inner_child);
+
+				aabb_ = node_aabbs[0];
+			}
+
+			bool intersect(const Ray &ray) const override
+			{
+				return intersect(ray, nullptr);
+			}
+
+			bool intersect(const Ray &ray, Intersection &intersection) const override
+			{
+				return intersect(ray, &intersection);
+			}
+
+		private:
+			static constexpr unsigned int WIDTH = WideNodeType::NUM_CHILDREN;
+
+			struct StackElement
+			{
+				std::uint32_t node;
+				real_t t_near;
+			};
+
+			bool intersect(const Ray &ray, Intersection *intersection) const
+			{
+				const typename WideNodeType::RayData ray_data(ray);
+				StackElement stack[ABSOLUTE_MAX_DEPTH * (WIDTH - 1) + 1];
+				unsigned int stack_pos = 0;
+				bool hit = false;
+
+				stack[stack_pos++] = {0, 0};
+
+				while (stack_pos > 0) {
+					StackElement element = stack[--stack_pos];
+					real_t t_max = intersection ? intersection->t : REAL_INFINITY;
+
+					if (element.t_near > t_max)
+						continue;
+
+					const WideNodeType &node = nodes_[element.node];
+					real_t t_near[WIDTH];
+					unsigned int hit_mask = node.intersect(ray_data, t_max, t_near);
+
+					if (hit_mask == 0)
+						continue;
+
+					// Visit children front to back. Leafs are intersected directly and
+					// nodes are pushed in reverse order so that closest is popped first.
+					unsigned int order[WIDTH];
+					unsigned int num_hits = 0;
+
+					for (unsigned int i = 0; i < WIDTH; i++) {
+						if ((hit_mask & (1U << i)) == 0)
+							continue;
+
+						unsigned int j = num_hits++;
+						for (; j > 0 && t_near[order[j - 1]] > t_near[i]; j--)
+							order[j] = order[j - 1];
+						order[j] = i;
+					}
+
+					StackElement children[WIDTH];
+					unsigned int num_children = 0;
+
+					for (unsigned int h = 0; h < num_hits; h++) {
+						unsigned int i = order[h];
+
+						if (!node.child_is_leaf(i)) {
+							children[num_children++] = {node.child_node(i), t_near[i]};
+							continue;
+						}
+
+						if (intersection && t_near[i] > intersection->t)
+							continue;
+
+						std::uint32_t offset = node.child_intersectable_offset(i);
+						std::uint32_t count = node.child_intersectable_count(i);
+
+						for (std::uint32_t o = offset; o < offset + count; o++) {
+							if (intersection) {
+								if (intersectables_[o]->intersect(ray, *intersection))
+									hit = true;
+							} else if (intersectables_[o]->intersect(ray)) {
+								return true;
+							}
+						}
+					}
+
+					while (num_children > 0) {
+						assert(stack_pos < std::size(stack));
+						stack[stack_pos++] = children[--num_children];
+					}
+				}
+
+				return hit;
+			}
+
+			const CacheFile cache_file_;
+			const std::vector<const Intersectable *> intersectables_;
+			Nodes nodes_;
+			AABB aabb_;
+		};
+
+		Result<std::unique_ptr<BVH>> load_binary_bvh(const std::string &path,
+		                                             std::uint64_t key,
+		                                             const std::vector<const Intersectable *> &intersectables)
+		{
+			CacheFile file;
+			if (auto r = file.map(path,
+			                      Node::CACHE_FILE_TYPE,
+			                      CACHE_FILE_VERSION,
+			                      key,
+			                      {sizeof(std::uint32_t), sizeof(Node)});
+			    !r)
+				return r.error();
+
+			if (file.array_size(1) == 0)
+				return Error(path, "no nodes in cache file");
+
+			auto ordered = ordered_intersectables_from_cache_file(file, 0, intersectables);
+			if (!ordered)
+				return Error(path, ordered.error().message());
+
+			if (auto r = validate_nodes(file.array_data<Node>(1), file.array_size(1), ordered->size()); !r)
+				return Error(path, r.error().message());
+
+			CacheableVector<Node> nodes(file, 1);
+
+			return std::unique_ptr<BVH>(std::make_unique<BinaryBVH>(std::move(*ordered),
+			                                                        std::move(nodes),
+			                                                        std::move(file)));
+		}
+
+		template <typename WideNodeType>
+		Result<std::unique_ptr<BVH>> load_wide_bvh(const std::string &path,
+		                                           std::uint64_t key,
+		                                           const std::vector<const Intersectable *> &intersectables)
+		{
+			using BVHType = WideBVH<WideNodeType>;
+
+			CacheFile file;
+			if (auto r = file.map(path,
+			                      WideNodeType::CACHE_FILE_TYPE,
+			                      CACHE_FILE_VERSION,
+			                      key,
+			                      {sizeof(std::uint32_t), sizeof(WideNodeType), sizeof(AABB)});
+			    !r)
+				return r.error();
+
+			if (file.array_size(1) == 0 || file.array_size(2) != 1)
+				return Error(path, "no nodes or AABB in cache file");
+
+			auto ordered = ordered_intersectables_from_cache_file(file, 0, intersectables);
+			if (!ordered)
+				return Error(path, ordered.error().message());
+
+			if (auto r = validate_wide_nodes(file.array_data<WideNodeType>(1),
+			                                 file.array_size(1),
+			                                 ordered->size());
+			    !r)
+				return Error(path, r.error().message());
+
+			typename BVHType::Nodes nodes(file, 1);
+			AABB aabb = file.array_data<AABB>(2)[0];
+
+			return std::unique_ptr<BVH>(std::make_unique<BVHType>(std::move(*ordered),
+			                                                      std::move(nodes),
+			                                                      aabb,
+			                                                      std::move(file)));
+		}
+
+		struct IntersectableInfo
+		{
+			std::uint32_t index = 0;
+			AABB aabb{{0, 0, 0}, {0, 0, 0}};
+			Vector3 centroid;
+		};
+
+		struct BuildNode
+		{
+			void set_leaf(const AABB &leaf_aabb, std::uint32_t start, std::uint32_t end)
+			{
+				aabb = leaf_aabb;
+				split_axis = 3;
+				leaf.start = start;
+				leaf.end = end;
+				subtree_nodes = 1;
+				subtree_intersectables = end - start;
+			}
+
+			void set_split(std::uint8_t axis, const BuildNode *left, const BuildNode *right)
+			{
+				aabb = AABB(left->aabb).merge(right->aabb);
+				split_axis = axis;
+				split.left = left;
+				split.right = right;
+				subtree_nodes = 1 + left->subtree_nodes + right->subtree_nodes;
+				subtree_intersectables = left->subtree_intersectables + right->subtree_intersectables;
+			}
+
+			AABB aabb{{0, 0, 0}, {0, 0, 0}};
+			std::uint8_t split_axis = 0;
+
+			// Sizes of subtree rooted at this node, including this node. Used to
+			// know where each subtree ends up when flattening in parallel.
+			std::uint32_t subtree_nodes = 1;
+			std::uint32_t subtree_intersectables = 0;
+
+			// Number of wide nodes in subtree when collapsed to wide nodes, set by
+			// count_wide_nodes() for nodes that become wide nodes.
+			mutable std::uint32_t subtree_wide_nodes = 0;
+
+			union
+			{
+				struct
+				{
+					const BuildNode *left;
+					const BuildNode *right;
+				} split;
+
+				struct
+				{
+					std::uint32_t start;
+					std::uint32_t end;
+				} leaf;
+			};
+		};
+
+		struct BuildNodeBlock
+		{
+			static constexpr unsigned int SIZE = 4096;
+			unsigned int used = 0;
+			BuildNode nodes[SIZE];
+			std::unique_ptr<BuildNodeBlock> next;
+		};
+
+		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) BuildThreadState
+		{
+			BuildNodeBlock build_node_block_root;
+			BuildNodeBlock *build_node_block_current = &build_node_block_root;
+		};
+
+		struct BuildContext
+		{
+			BuildContext(std::vector<const Intersectable *> &&is, const Cancellable &c, ThreadPool &tp) :
+			        intersectables(std::move(is)),
+			        cancellable(c),
+			        thread_pool(tp)
+			{
+			}
+
+			std::vector<const Intersectable *> intersectables;
+			const Cancellable &cancellable;
+			ThreadPool &thread_pool;
+
+			// Index 0 is used by the thread that started the build, index i + 1
+			// by thread i in thread pool. No other thread runs build tasks, threads
+			// not in pool do not run tasks while waiting (see TaskGroup).
+			mutable CacheLineAlignedVector<BuildThreadState> thread_states;
+			const std::thread::id owner_thread = std::this_thread::get_id();
+
+			BuildThreadState &thread_state() const
+			{
+				std::optional<unsigned int> index = thread_pool.current_thread_index();
+				assert(index || std::this_thread::get_id() == owner_thread);
+				return thread_states[index ? *index + 1 : 0];
+			}
+
+			std::vector<IntersectableInfo> infos;
+#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
+			std::vector<IntersectableInfo> infos_copy;
+#endif
+		};
+
+		struct Bucket
+		{
+			std::uint32_t count = 0;
+			AABB aabb;
+		};
+
+		struct BucketSplit
+		{
+			real_t cost;
+			unsigned int bucket;
+			AABB left_aabb;
+			AABB right_aabb;
+		};
+
+		// Bin along axis with largest centroid extent. Fast, good enough in most cases.
+		struct MaxExtentAxisBinning
+		{
+			static constexpr unsigned int NUM_AXES = 1;
+			static constexpr unsigned int NUM_BUCKETS = 16;
+		};
+
+		// Bin along all axes with more buckets. Better splits for e.g. long thin
+		// geometry where axis with largest extent is not the best one to split.
+		struct AllAxesBinning
+		{
+			static constexpr unsigned int NUM_AXES = 3;
+			static constexpr unsigned int NUM_BUCKETS = 32;
+		};
+
+		template <typename Binning>
+		using Buckets = Bucket[Binning::NUM_AXES][Binning::NUM_BUCKETS];
+
+		// Maps centroids to bucket indices. Scale is precalculated so that bucket index
+		// calculation is only a subtraction and a multiplication (easy to vectorize).
+		template <typename Binning>
+		class Binner
+		{
+		public:
+			static constexpr unsigned int NUM_AXES = Binning::NUM_AXES;
+			static constexpr unsigned int NUM_BUCKETS = Binning::NUM_BUCKETS;
+
+			explicit Binner(const AABB &centroids_aabb)
+			{
+				for (unsigned int a = 0; a < NUM_AXES; a++) {
+					std::uint8_t axis = NUM_AXES == 1 ? centroids_aabb.max_extent_axis() : a;
+					real_t min = centroids_aabb.minimum()[axis];
+					real_t max = centroids_aabb.maximum()[axis];
+
+					axis_[a] = axis;
+					min_[a] = min;
+					scale_[a] = centroids_aabb.is_planar(axis) ? 0 : NUM_BUCKETS / (max - min);
+				}
+			}
+
+			std::uint8_t axis(unsigned int a) const
+			{
+				return axis_[a];
+			}
+
+			bool can_split(unsigned int a) const
+			{
+				return scale_[a] > 0;
+			}
+
+			unsigned int bucket_index(const Vector3 &centroid, unsigned int a) const
+			{
+				auto b = unsigned((centroid[axis_[a]] - min_[a]) * scale_[a]);
+				return std::min(b, NUM_BUCKETS - 1);
+			}
+
+			// Bucket indices for a block of infos are calculated before buckets are
+			// updated so that the index calculation loop can be vectorized.
+			void bin(const IntersectableInfo *infos, std::uint32_t count, Buckets<Binning> &buckets) const
+			{
+				constexpr std::uint32_t BLOCK_SIZE = 64;
+				unsigned int indices[NUM_AXES][BLOCK_SIZE];
+
+				for (std::uint32_t block = 0; block < count; block += BLOCK_SIZE) {
+					std::uint32_t block_count = std::min(count - block, BLOCK_SIZE);
+					const IntersectableInfo *block_infos = &infos[block];
+
+					for (unsigned int a = 0; a < NUM_AXES; a++)
+						for (std::uint32_t i = 0; i < block_count; i++)
+							indices[a][i] = bucket_index(block_infos[i].centroid, a);
+
+					for (std::uint32_t i = 0; i < block_count; i++) {
+						for (unsigned int a = 0; a < NUM_AXES; a++) {
+							Bucket &bucket = buckets[a][indices[a][i]];
+							bucket.count++;
+							bucket.aabb.merge(block_infos[i].aabb);
+						}
+					}
+				}
+			}
+
+		private:
+			std::uint8_t axis_[NUM_AXES];
+			real_t min_[NUM_AXES];
+			real_t scale_[NUM_AXES];
+		};
+
+		struct BinnedSplit
+		{
+			real_t cost = REAL_INFINITY;
+			unsigned int axis_index = 0;
+			unsigned int bucket = 0;
+			AABB left_aabb;
+			AABB right_aabb;
+		};
+
+		template <typename Binning>
+		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) HorizontalChunkState
+		{
+			AABB aabb;
+			AABB centroids_aabb;
+			Buckets<Binning> buckets;
+
+#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
+			std::uint32_t partition_left_start = 0;
+			std::uint32_t partition_right_start = 0;
+#endif
+		};
+
+		void prepare_build_context(BuildContext &context, unsigned int threads)
+		{
+			std::uint32_t count = context.intersectables.size();
+
+			context.thread_states.resize(context.thread_pool.size() + 1);
+			context.infos.resize(count);
+
+#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
+			context.infos_copy.resize(count);
+#endif
+
+			auto calculate_infos = [&](unsigned int /*t*/, std::uint32_t start, std::uint32_t end) {
+				for (std::uint32_t i = start; i < end; i++) {
+					context.infos[i].index = i;
+					context.infos[i].aabb = context.intersectables[i]->aabb();
+					context.infos[i].centroid = context.infos[i].aabb.centroid();
+				}
+			};
+
+			parallel_for_chunks(context.thread_pool, 0, count, std::max(threads, 1U), calculate_infos);
+		}
+
+		BuildNode *next_build_node(BuildContext &context)
+		{
+			BuildNodeBlock *block = context.thread_state().build_node_block_current;
+
+			if (block->used == BuildNodeBlock::SIZE) {
+				block->next = std::make_unique<BuildNodeBlock>();
+				block = block->next.get();
+				context.thread_state().build_node_block_current = block;
+			}
+
+			return &block->nodes[block->used++];
+		}
+
+		// Leafs are made regardless of count when centroids cannot be separated,
+		// split leafs too large to store in a node in the middle.
+		const BuildNode *set_leaf_build_node(BuildContext &context,
+		                                     BuildNode *node,
+		                                     const AABB &aabb,
+		                                     std::uint32_t start,
+		                                     std::uint32_t end)
+		{
+			if (end - start <= MAX_NODE_INTERSECTABLES || context.cancellable.cancelled()) {
+				node->set_leaf(aabb, start, end);
+				return node;
+			}
+
+			std::uint32_t mid = start + (end - start) / 2;
+			AABB left_aabb;
+			AABB right_aabb;
+
+			for (std::uint32_t i = start; i < mid; i++)
+				left_aabb.merge(context.infos[i].aabb);
+
+			for (std::uint32_t i = mid; i < end; i++)
+				right_aabb.merge(context.infos[i].aabb);
+
+			BuildNode *left = next_build_node(context);
+			BuildNode *right = next_build_node(context);
+
+			set_leaf_build_node(context, left, left_aabb, start, mid);
+			set_leaf_build_node(context, right, right_aabb, mid, end);
+
+			node->set_split(0, left, right);
+
+			return node;
+		}
+
+		template <unsigned int NUM_BUCKETS>
+		BucketSplit bucket_split(const Bucket *buckets, const AABB &aabb)
+		{
+			constexpr unsigned int NUM_SPLITS = NUM_BUCKETS - 1;
+			std::uint32_t left_count[NUM_SPLITS];
+			std::uint32_t right_count[NUM_SPLITS];
+			AABB left_aabb[NUM_SPLITS];
+			AABB right_aabb[NUM_SPLITS];
+
+			left_count[0] = buckets[0].count;
+			left_aabb[0] = buckets[0].aabb;
+			for (unsigned int i = 1; i < NUM_SPLITS; i++) {
+				left_count[i] = left_count[i - 1] + buckets[i].count;
+				left_aabb[i] = AABB(left_aabb[i - 1]).merge(buckets[i].aabb);
+			}
 
-			return {split_cost, split_bucket};
+			right_count[NUM_SPLITS - 1] = buckets[NUM_BUCKETS - 1].count;
+			right_aabb[NUM_SPLITS - 1] = buckets[NUM_BUCKETS - 1].aabb;
+			for (int i = NUM_SPLITS - 2; i >= 0; i--) {
+				right_count[i] = right_count[i + 1] + buckets[i + 1].count;
+				right_aabb[i] = AABB(right_aabb[i + 1]).merge(buckets[i + 1].aabb);
+			}
+
+			real_t split_cost = REAL_INFINITY;
+			unsigned int split_bucket = 0;
+
+			for (unsigned int i = 0; i < NUM_SPLITS; i++) {
+				real_t cost = (left_count[i] * left_aabb[i].surface_area() +
+				               right_count[i] * right_aabb[i].surface_area());
+				if (cost < split_cost) {
+					split_cost = cost;
+					split_bucket = i;
+				}
+			}
+
+			split_cost = real_t(0.5) + split_cost / aabb.surface_area();
+
+			return {split_cost, split_bucket, left_aabb[split_bucket], right_aabb[split_bucket]};
+		}
+
+		template <typename Binning>
+		BinnedSplit binned_split(const Binner<Binning> &binner,
+		                         const Buckets<Binning> &buckets,
+		                         const AABB &aabb)
+		{
+			BinnedSplit split;
+
+			for (unsigned int a = 0; a < Binning::NUM_AXES; a++) {
+				if (!binner.can_split(a))
+					continue;
+
+				BucketSplit s = bucket_split<Binning::NUM_BUCKETS>(buckets[a], aabb);
+
+				if (s.cost < split.cost)
+					split = {s.cost, a, s.bucket, s.left_aabb, s.right_aabb};
+			}
+
+			return split;
 		}
 
+		template <typename Binning>
 		const BuildNode *create_build_node(BuildContext &context,
 		                                   std::uint32_t start,
 		                                   std::uint32_t end,
 		                                   unsigned int threads);
 
+		template <typename Binning>
 		const BuildNode *create_build_node_thread_horizontally(BuildContext &context,
 		                                                       std::uint32_t start,
 		                                                       std::uint32_t end,
@@ -474,152 +1757,622 @@ namespace Rayni
 			assert(threads >= 2);
 
 			BuildNode *node = next_build_node(context);
-			Barrier barrier(threads);
 			std::uint32_t count = end - start;
 
-			// TODO: This is bad. Would like same thread to operate on specific data range
-			//       for each call to minimize cache misses. See TODO at top of this file.
-			auto parallel_for = [&](auto &&func) {
-				for (unsigned int t = 0; t < threads; t++) {
-					std::uint32_t start_t = start + (std::uint64_t(t) * count) / threads;
-					std::uint32_t end_t = start + (std::uint64_t(t + 1) * count) / threads;
-
-					if (t < threads - 1) {
-						context.thread_pool.add_task([&, t, start_t, end_t] {
-							func(t, start_t, end_t);
-							barrier.arrive();
-						});
-					} else {
-						func(t, start_t, end_t);
-						barrier.arrive_and_wait();
+			auto for_each_chunk = [&](auto &&func) {
+				parallel_for_chunks(context.thread_pool, start, end, threads, func);
+			};
+
+			CacheLineAlignedVector<HorizontalChunkState<Binning>> chunk_states(threads);
+
+			for_each_chunk([&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
+				AABB aabb;
+				AABB centroids_aabb;
+
+				for (std::uint32_t i = start_t; i < end_t; i++) {
+					aabb.merge(context.infos[i].aabb);
+					centroids_aabb.merge(context.infos[i].centroid);
+				}
+
+				chunk_states[t].aabb = aabb;
+				chunk_states[t].centroids_aabb = centroids_aabb;
+			});
+
+			AABB aabb;
+			AABB centroids_aabb;
+
+			for (unsigned int t = 0; t < threads; t++) {
+				aabb.merge(chunk_states[t].aabb);
+				centroids_aabb.merge(chunk_states[t].centroids_aabb);
+			}
+
+			if (centroids_aabb.is_planar(centroids_aabb.max_extent_axis()) ||
+			    context.cancellable.cancelled())
+				return set_leaf_build_node(context, node, aabb, start, end);
+
+			const Binner<Binning> binner(centroids_aabb);
+
+			for_each_chunk([&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
+				binner.bin(&context.infos[start_t], end_t - start_t, chunk_states[t].buckets);
+			});
+
+			Buckets<Binning> buckets;
+
+			for (unsigned int t = 0; t < threads; t++) {
+				for (unsigned int a = 0; a < Binning::NUM_AXES; a++) {
+					for (unsigned int i = 0; i < Binning::NUM_BUCKETS; i++) {
+						buckets[a][i].count += chunk_states[t].buckets[a][i].count;
+						buckets[a][i].aabb.merge(chunk_states[t].buckets[a][i].aabb);
+					}
+				}
+			}
+
+			BinnedSplit split = binned_split(binner, buckets, aabb);
+			std::uint8_t split_axis = binner.axis(split.axis_index);
+
+#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
+			std::uint32_t partition_start = start;
+
+			for (unsigned int t = 0; t < threads; t++) {
+				chunk_states[t].partition_left_start = partition_start;
+
+				for (unsigned int i = 0; i <= split.bucket; i++)
+					partition_start += chunk_states[t].buckets[split.axis_index][i].count;
+			}
+
+			for (unsigned int t = 0; t < threads; t++) {
+				chunk_states[t].partition_right_start = partition_start;
+
+				for (unsigned int i = split.bucket + 1; i < Binning::NUM_BUCKETS; i++)
+					partition_start += chunk_states[t].buckets[split.axis_index][i].count;
+			}
+
+			for_each_chunk([&](unsigned int /*t*/, std::uint32_t start_t, std::uint32_t end_t) {
+				std::copy(&context.infos[start_t], &context.infos[end_t], &context.infos_copy[start_t]);
+			});
+
+			for_each_chunk([&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
+				std::uint32_t left_i = chunk_states[t].partition_left_start;
+				std::uint32_t right_i = chunk_states[t].partition_right_start;
+
+				for (std::uint32_t i = start_t; i < end_t; i++) {
+					const auto &info = context.infos_copy[i];
+					unsigned int b = binner.bucket_index(info.centroid, split.axis_index);
+
+					if (b <= split.bucket)
+						context.infos[left_i++] = info;
+					else
+						context.infos[right_i++] = info;
+				}
+			});
+
+			std::uint32_t mid = chunk_states[0].partition_right_start;
+#else
+			IntersectableInfo *pmid =
+			        std::partition(&context.infos[start],
+			                       &context.infos[end],
+			                       [&](const IntersectableInfo &i) {
+				                       return binner.bucket_index(i.centroid, split.axis_index) <=
+				                              split.bucket;
+			                       });
+			std::uint32_t mid = pmid - &context.infos[0];
+#endif
+			unsigned threads_left =
+			        std::clamp(unsigned((std::uint64_t(mid - start) * threads) / count), 1U, threads - 1);
+			unsigned int threads_right = threads - threads_left;
+
+			const BuildNode *left;
+			const BuildNode *right;
+
+			parallel_invoke(
+			        context.thread_pool,
+			        [&] { left = create_build_node<Binning>(context, start, mid, threads_left); },
+			        [&] { right = create_build_node<Binning>(context, mid, end, threads_right); });
+
+			node->set_split(split_axis, left, right);
+
+			return node;
+		}
+
+		template <typename Binning>
+		const BuildNode *create_build_node(BuildContext &context, std::uint32_t start, std::uint32_t end)
+		{
+			assert(start < end);
+
+			BuildNode *node = next_build_node(context);
+			std::uint32_t count = end - start;
+			AABB aabb;
+			AABB centroids_aabb;
+
+			for (std::uint32_t i = start; i < end; i++) {
+				aabb.merge(context.infos[i].aabb);
+				centroids_aabb.merge(context.infos[i].centroid);
+			}
+
+			std::uint8_t split_axis = centroids_aabb.max_extent_axis();
+
+			if (count == 1 || centroids_aabb.is_planar(split_axis) || context.cancellable.cancelled())
+				return set_leaf_build_node(context, node, aabb, start, end);
+
+			std::uint32_t mid;
+
+			if (count <= 2) {
+				mid = (start + end) / 2;
+
+				if (context.infos[mid].centroid[split_axis] < context.infos[start].centroid[split_axis])
+					std::swap(context.infos[start], context.infos[mid]);
+			} else {
+				const Binner<Binning> binner(centroids_aabb);
+				Buckets<Binning> buckets;
+
+				binner.bin(&context.infos[start], count, buckets);
+
+				BinnedSplit split = binned_split(binner, buckets, aabb);
+
+				real_t leaf_cost = count;
+				if (count <= MAX_LEAF_INTERSECTABLES && split.cost >= leaf_cost) {
+					node->set_leaf(aabb, start, end);
+					return node;
+				}
+
+				auto left_of_split = [&](const IntersectableInfo &i) {
+					return binner.bucket_index(i.centroid, split.axis_index) <= split.bucket;
+				};
+
+				IntersectableInfo *pmid =
+				        std::partition(&context.infos[start], &context.infos[end], left_of_split);
+				mid = pmid - &context.infos[0];
+				split_axis = binner.axis(split.axis_index);
+			}
+
+			const BuildNode *left;
+			const BuildNode *right;
+
+			if (count > TASK_MIN_INTERSECTABLES) {
+				parallel_invoke(
+				        context.thread_pool,
+				        [&] { left = create_build_node<Binning>(context, start, mid); },
+				        [&] { right = create_build_node<Binning>(context, mid, end); });
+			} else {
+				left = create_build_node<Binning>(context, start, mid);
+				right = create_build_node<Binning>(context, mid, end);
+			}
+
+			node->set_split(split_axis, left, right);
+
+			return node;
+		}
+
+		template <typename Binning>
+		const BuildNode *create_build_node(BuildContext &context,
+		                                   std::uint32_t start,
+		                                   std::uint32_t end,
+		                                   unsigned int threads)
+		{
+			threads = std::min(threads, (end - start) / THREAD_HORIZONTALLY_MIN_CHUNK_INTERSECTABLES);
+
+			if (threads >= THREAD_HORIZONTALLY_MIN_THREADS)
+				return create_build_node_thread_horizontally<Binning>(context, start, end, threads);
+
+			return create_build_node<Binning>(context, start, end);
+		}
+
+		struct MortonPrimitive
+		{
+			std::uint64_t code;
+			std::uint32_t info_index;
+		};
+
+		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) RadixSortChunkState
+		{
+			std::uint32_t offsets[MORTON_RADIX_SORT_BUCKETS];
+		};
+
+		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) CentroidsChunkState
+		{
+			AABB centroids_aabb;
+		};
+
+		// Least significant digit radix sort. Each pass counts digits per chunk, then
+		// scatters to the other buffer. Chunk offsets are calculated so that scattering
+		// is stable without any synchronization between chunks.
+		void morton_radix_sort(BuildContext &context,
+		                       std::vector<MortonPrimitive> &primitives,
+		                       unsigned int code_bits,
+		                       unsigned int threads)
+		{
+			std::uint32_t count = primitives.size();
+			std::vector<MortonPrimitive> sorted(count);
+			CacheLineAlignedVector<RadixSortChunkState> chunk_states(threads);
+
+			for (unsigned int shift = 0; shift < code_bits; shift += MORTON_RADIX_SORT_BITS) {
+				auto digit = [shift](const MortonPrimitive &p) {
+					return unsigned(p.code >> shift) & (MORTON_RADIX_SORT_BUCKETS - 1);
+				};
+
+				auto count_digits = [&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
+					std::uint32_t *counts = chunk_states[t].offsets;
+
+					std::fill_n(counts, MORTON_RADIX_SORT_BUCKETS, 0);
+
+					for (std::uint32_t i = start_t; i < end_t; i++)
+						counts[digit(primitives[i])]++;
+				};
+
+				parallel_for_chunks(context.thread_pool, 0, count, threads, count_digits);
+
+				std::uint32_t offset = 0;
+				bool same_digit = false;
+
+				for (unsigned int b = 0; b < MORTON_RADIX_SORT_BUCKETS; b++) {
+					std::uint32_t bucket_start = offset;
+
+					for (unsigned int t = 0; t < threads; t++) {
+						std::uint32_t digit_count = chunk_states[t].offsets[b];
+						chunk_states[t].offsets[b] = offset;
+						offset += digit_count;
 					}
+
+					if (offset - bucket_start == count)
+						same_digit = true;
+				}
+
+				// Order is not changed by pass if all codes have the same digit (common for
+				// high bits), skip scattering.
+				if (same_digit)
+					continue;
+
+				auto scatter = [&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
+					std::uint32_t *offsets = chunk_states[t].offsets;
+
+					for (std::uint32_t i = start_t; i < end_t; i++)
+						sorted[offsets[digit(primitives[i])]++] = primitives[i];
+				};
+
+				parallel_for_chunks(context.thread_pool, 0, count, threads, scatter);
+
+				primitives.swap(sorted);
+			}
+		}
+
+		// Depth of subtree if count intersectables are split in the middle until
+		// there are at most MAX_LEAF_INTERSECTABLES in each leaf.
+		unsigned int lbvh_balanced_depth(std::uint32_t count)
+		{
+			unsigned int depth = 0;
+
+			for (; count > MAX_LEAF_INTERSECTABLES; count = count - count / 2)
+				depth++;
+
+			return depth;
+		}
+
+		const BuildNode *create_lbvh_node(BuildContext &context,
+		                                  const std::vector<std::uint64_t> &codes,
+		                                  std::uint32_t start,
+		                                  std::uint32_t end,
+		                                  unsigned int depth)
+		{
+			assert(start < end);
+			assert(depth + lbvh_balanced_depth(end - start) < ABSOLUTE_MAX_DEPTH);
+
+			BuildNode *node = next_build_node(context);
+			std::uint32_t count = end - start;
+			std::uint64_t differing_bits = codes[start] ^ codes[end - 1];
+
+			// Every bit of the codes may add a level. Split in the middle when needed
+			// to keep depth within size of traversal stacks.
+			bool limit_depth = depth + 1 + lbvh_balanced_depth(count) >= ABSOLUTE_MAX_DEPTH;
+			bool same_cell = differing_bits == 0;
+
+			if (count == 1 || ((same_cell || limit_depth) && count <= MAX_LEAF_INTERSECTABLES) ||
+			    context.cancellable.cancelled()) {
+				AABB aabb;
+
+				for (std::uint32_t i = start; i < end; i++)
+					aabb.merge(context.infos[i].aabb);
+
+				node->set_leaf(aabb, start, end);
+				return node;
+			}
+
+			std::uint32_t mid;
+			std::uint8_t split_axis;
+
+			if (same_cell || limit_depth) {
+				// Too many intersectables in same grid cell for a leaf, or tree would
+				// become too deep. Split in the middle.
+				mid = start + count / 2;
+				split_axis = 0;
+			} else {
+				// Codes are sorted, split where highest bit that differs in range changes.
+				unsigned int bit = 63 - unsigned(std::countl_zero(differing_bits));
+				std::uint64_t mask = std::uint64_t(1) << bit;
+				const std::uint64_t *pmid = std::partition_point(&codes[start],
+				                                                 &codes[end - 1] + 1,
+				                                                 [mask](std::uint64_t c) {
+					                                                 return !(c & mask);
+				                                                 });
+				mid = pmid - &codes[0];
+				split_axis = morton_code_bit_axis(bit);
+			}
+
+			const BuildNode *left;
+			const BuildNode *right;
+
+			if (count > TASK_MIN_INTERSECTABLES) {
+				parallel_invoke(
+				        context.thread_pool,
+				        [&] { left = create_lbvh_node(context, codes, start, mid, depth + 1); },
+				        [&] { right = create_lbvh_node(context, codes, mid, end, depth + 1); });
+			} else {
+				left = create_lbvh_node(context, codes, start, mid, depth + 1);
+				right = create_lbvh_node(context, codes, mid, end, depth + 1);
+			}
+
+			node->set_split(split_axis, left, right);
+
+			return node;
+		}
+
+		const BuildNode *create_lbvh(BuildContext &context, unsigned int threads)
+		{
+			std::uint32_t count = context.infos.size();
+			CacheLineAlignedVector<CentroidsChunkState> chunk_states(threads);
+
+			auto merge_centroids = [&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
+				AABB centroids_aabb;
+
+				for (std::uint32_t i = start_t; i < end_t; i++)
+					centroids_aabb.merge(context.infos[i].centroid);
+
+				chunk_states[t].centroids_aabb = centroids_aabb;
+			};
+
+			parallel_for_chunks(context.thread_pool, 0, count, threads, merge_centroids);
+
+			AABB centroids_aabb;
+
+			for (unsigned int t = 0; t < threads; t++)
+				centroids_aabb.merge(chunk_states[t].centroids_aabb);
+
+			unsigned int bits_per_axis = count < MORTON_63_BIT_MIN_INTERSECTABLES
+			                                     ? MORTON_30_BIT_BITS_PER_AXIS
+			                                     : MortonEncoder::MAX_BITS_PER_AXIS;
+			const MortonEncoder encoder(centroids_aabb, bits_per_axis);
+			std::vector<MortonPrimitive> primitives(count);
+
+			auto encode = [&](unsigned int /*t*/, std::uint32_t start_t, std::uint32_t end_t) {
+				for (std::uint32_t i = start_t; i < end_t; i++)
+					primitives[i] = {encoder.code(context.infos[i].centroid), i};
+			};
+
+			parallel_for_chunks(context.thread_pool, 0, count, threads, encode);
+
+			morton_radix_sort(context, primitives, bits_per_axis * 3, threads);
+
+			std::vector<IntersectableInfo> sorted_infos(count);
+			std::vector<std::uint64_t> codes(count);
+
+			auto gather = [&](unsigned int /*t*/, std::uint32_t start_t, std::uint32_t end_t) {
+				for (std::uint32_t i = start_t; i < end_t; i++) {
+					sorted_infos[i] = context.infos[primitives[i].info_index];
+					codes[i] = primitives[i].code;
 				}
 			};
 
-			CacheLineAlignedVector<HorizontalChunkState> chunk_states(threads);
+			parallel_for_chunks(context.thread_pool, 0, count, threads, gather);
 
-			parallel_for([&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
-				AABB aabb;
-				AABB centroids_aabb;
+			context.infos.swap(sorted_infos);
 
-				for (std::uint32_t i = start_t; i < end_t; i++) {
-					aabb.merge(context.infos[i].aabb);
-					centroids_aabb.merge(context.infos[i].centroid);
-				}
+			return create_lbvh_node(context, codes, 0, count, 0);
+		}
 
-				chunk_states[t].aabb = aabb;
-				chunk_states[t].centroids_aabb = centroids_aabb;
-			});
+		// Reference AABB clipped to side of split plane (or to spatial bin). Bins are
+		// determined with floating point arithmetic, so a reference may be put on a
+		// side it barely does not overlap. Clipped AABB is then made planar at the side
+		// boundary instead of becoming inverted.
+		AABB clip_reference_aabb(const AABB &reference_aabb, const AABB &side)
+		{
+			Vector3 minimum = Vector3::max(reference_aabb.minimum(), side.minimum());
+			Vector3 maximum = Vector3::min(reference_aabb.maximum(), side.maximum());
 
-			AABB aabb;
-			AABB centroids_aabb;
+			minimum = Vector3::min(minimum, side.maximum());
+			maximum = Vector3::max(maximum, minimum);
 
-			for (unsigned int t = 0; t < threads; t++) {
-				aabb.merge(chunk_states[t].aabb);
-				centroids_aabb.merge(chunk_states[t].centroids_aabb);
-			}
+			return {minimum, maximum};
+		}
 
-			std::uint8_t split_axis = centroids_aabb.max_extent_axis();
+		IntersectableInfo clip_reference(const IntersectableInfo &reference, const AABB &side)
+		{
+			IntersectableInfo clipped = reference;
+			clipped.aabb = clip_reference_aabb(reference.aabb, side);
+			clipped.centroid = clipped.aabb.centroid();
+			return clipped;
+		}
 
-			if (centroids_aabb.is_planar(split_axis) || context.cancellable.cancelled()) {
-				node->aabb = aabb;
-				node->split_axis = 3;
-				node->leaf.start = start;
-				node->leaf.end = end;
-				return node;
+		bool aabbs_overlap(const AABB &aabb1, const AABB &aabb2)
+		{
+			for (unsigned int axis = 0; axis < 3; axis++) {
+				if (aabb1.minimum()[axis] > aabb2.maximum()[axis] ||
+				    aabb2.minimum()[axis] > aabb1.maximum()[axis])
+					return false;
 			}
 
-			parallel_for([&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
-				Bucket *buckets = chunk_states[t].buckets;
+			return true;
+		}
 
-				for (std::uint32_t i = start_t; i < end_t; i++) {
-					auto b = bucket_index(context.infos[i].centroid, centroids_aabb, split_axis);
-					buckets[b].count++;
-					buckets[b].aabb.merge(context.infos[i].aabb);
-				}
-			});
+		// Bins spanning the AABB of a node along one axis. References are put in all
+		// bins they overlap, first and last bin determine if a reference is to the
+		// left and/or to the right of a split.
+		class SpatialBinner
+		{
+		public:
+			SpatialBinner(const AABB &aabb, std::uint8_t axis) :
+			        aabb_(aabb),
+			        axis_(axis),
+			        min_(aabb.minimum()[axis]),
+			        extent_(aabb.maximum()[axis] - min_),
+			        scale_(NUM_SPATIAL_BINS / extent_)
+			{
+			}
 
-			Bucket buckets[NUM_BUCKETS];
+			unsigned int first_bin(const AABB &reference_aabb) const
+			{
+				return bin_index(reference_aabb.minimum()[axis_]);
+			}
 
-			for (unsigned int t = 0; t < threads; t++) {
-				for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
-					buckets[i].count += chunk_states[t].buckets[i].count;
-					buckets[i].aabb.merge(chunk_states[t].buckets[i].aabb);
-				}
+			unsigned int last_bin(const AABB &reference_aabb) const
+			{
+				return bin_index(reference_aabb.maximum()[axis_]);
 			}
 
-			BucketSplit split = bucket_split(buckets, aabb);
+			// Position of plane between bin and bin + 1.
+			real_t split_position(unsigned int bin) const
+			{
+				if (bin + 1 == NUM_SPATIAL_BINS)
+					return aabb_.maximum()[axis_];
 
-#if RAYNI_BVH_MULTITHREAD_INTERSECTABLE_INFO_PARTITIONING
-			std::uint32_t partition_start = start;
+				return min_ + extent_ * real_t(bin + 1) / NUM_SPATIAL_BINS;
+			}
 
-			for (unsigned int t = 0; t < threads; t++) {
-				chunk_states[t].partition_left_start = partition_start;
+			AABB bin_aabb(unsigned int bin) const
+			{
+				real_t start = bin == 0 ? min_ : split_position(bin - 1);
+				return aabb_.split(axis_, start).right.split(axis_, split_position(bin)).left;
+			}
 
-				for (unsigned int i = 0; i <= split.bucket; i++)
-					partition_start += chunk_states[t].buckets[i].count;
+		private:
+			unsigned int bin_index(real_t pos) const
+			{
+				real_t b = std::max((pos - min_) * scale_, real_t(0));
+				return std::min(unsigned(b), NUM_SPATIAL_BINS - 1);
 			}
 
-			for (unsigned int t = 0; t < threads; t++) {
-				chunk_states[t].partition_right_start = partition_start;
+			AABB aabb_;
+			std::uint8_t axis_;
+			real_t min_;
+			real_t extent_;
+			real_t scale_;
+		};
 
-				for (unsigned int i = split.bucket + 1; i < NUM_BUCKETS; i++)
-					partition_start += chunk_states[t].buckets[i].count;
-			}
+		struct SpatialBin
+		{
+			AABB aabb;
+			std::uint32_t entries = 0;
+			std::uint32_t exits = 0;
+		};
 
-			parallel_for([&](unsigned int /*t*/, std::uint32_t start_t, std::uint32_t end_t) {
-				std::copy(&context.infos[start_t], &context.infos[end_t], &context.infos_copy[start_t]);
-			});
+		struct SpatialSplit
+		{
+			real_t cost = REAL_INFINITY;
+			std::uint8_t axis = 0;
+			unsigned int bin = 0;
+			std::uint32_t left_count = 0;
+			std::uint32_t right_count = 0;
+		};
 
-			parallel_for([&](unsigned int t, std::uint32_t start_t, std::uint32_t end_t) {
-				std::uint32_t left_i = chunk_states[t].partition_left_start;
-				std::uint32_t right_i = chunk_states[t].partition_right_start;
+		SpatialSplit find_spatial_split(const BuildContext &context,
+		                                std::uint32_t start,
+		                                std::uint32_t end,
+		                                const AABB &aabb)
+		{
+			constexpr unsigned int NUM_SPLITS = NUM_SPATIAL_BINS - 1;
+			SpatialSplit split;
 
-				for (std::uint32_t i = start_t; i < end_t; i++) {
-					const auto &info = context.infos_copy[i];
-					unsigned int b = bucket_index(info.centroid, centroids_aabb, split_axis);
+			for (std::uint8_t axis = 0; axis < 3; axis++) {
+				if (aabb.is_planar(axis))
+					continue;
 
-					if (b <= split.bucket)
-						context.infos[left_i++] = info;
-					else
-						context.infos[right_i++] = info;
+				const SpatialBinner binner(aabb, axis);
+				SpatialBin bins[NUM_SPATIAL_BINS];
+				AABB bin_aabbs[NUM_SPATIAL_BINS];
+
+				for (unsigned int b = 0; b < NUM_SPATIAL_BINS; b++)
+					bin_aabbs[b] = binner.bin_aabb(b);
+
+				for (std::uint32_t i = start; i < end; i++) {
+					const AABB &reference_aabb = context.infos[i].aabb;
+					unsigned int first = binner.first_bin(reference_aabb);
+					unsigned int last = binner.last_bin(reference_aabb);
+
+					bins[first].entries++;
+					bins[last].exits++;
+
+					if (first == last) {
+						bins[first].aabb.merge(reference_aabb);
+						continue;
+					}
+
+					for (unsigned int b = first; b <= last; b++)
+						bins[b].aabb.merge(clip_reference_aabb(reference_aabb, bin_aabbs[b]));
 				}
-			});
 
-			std::uint32_t mid = chunk_states[0].partition_right_start;
-#else
-			IntersectableInfo *pmid =
-			        std::partition(&context.infos[start],
-			                       &context.infos[end],
-			                       [&](const IntersectableInfo &i) {
-				                       unsigned int b =
-				                               bucket_index(i.centroid, centroids_aabb, split_axis);
-				                       return b <= split.bucket;
-			                       });
-			std::uint32_t mid = pmid - &context.infos[0];
-#endif
-			unsigned threads_left =
-			        std::clamp(unsigned((std::uint64_t(mid - start) * threads) / count), 1U, threads - 1);
-			unsigned int threads_right = threads - threads_left;
+				std::uint32_t right_count[NUM_SPLITS];
+				AABB right_aabb[NUM_SPLITS];
+
+				right_count[NUM_SPLITS - 1] = bins[NUM_SPATIAL_BINS - 1].exits;
+				right_aabb[NUM_SPLITS - 1] = bins[NUM_SPATIAL_BINS - 1].aabb;
+				for (int i = NUM_SPLITS - 2; i >= 0; i--) {
+					right_count[i] = right_count[i + 1] + bins[i + 1].exits;
+					right_aabb[i] = AABB(right_aabb[i + 1]).merge(bins[i + 1].aabb);
+				}
 
-			auto future = context.thread_pool.async(
-			        [&]() { return create_build_node(context, mid, end, threads_right); });
-			const BuildNode *left = create_build_node(context, start, mid, threads_left);
-			const BuildNode *right = future.get();
+				std::uint32_t left_count = 0;
+				AABB left_aabb;
 
-			node->aabb = AABB(left->aabb).merge(right->aabb);
-			node->split_axis = split_axis;
-			node->split.left = left;
-			node->split.right = right;
+				for (unsigned int i = 0; i < NUM_SPLITS; i++) {
+					left_count += bins[i].entries;
+					left_aabb.merge(bins[i].aabb);
 
-			return node;
+					if (left_count == 0 || right_count[i] == 0)
+						continue;
+
+					real_t cost = real_t(0.5) + (left_count * left_aabb.surface_area() +
+					                             right_count[i] * right_aabb[i].surface_area()) /
+					                                    aabb.surface_area();
+					if (cost < split.cost)
+						split = {cost, axis, i, left_count, right_count[i]};
+				}
+			}
+
+			return split;
 		}
 
-		const BuildNode *create_build_node(BuildContext &context, std::uint32_t start, std::uint32_t end)
+		// Ranges in infos have room for more references than they contain when building
+		// an SBVH. [start, end) contains the references of a node and [end, capacity_end)
+		// can be used for references duplicated by spatial splits in the subtree.
+		// Unused space is distributed among children in proportion to number of
+		// references. Leafs never have to be contiguous with each other.
+		struct SBVHRange
 		{
-			assert(start < end);
+			std::uint32_t start;
+			std::uint32_t end;
+			std::uint32_t capacity_end;
+		};
+
+		std::pair<SBVHRange, SBVHRange> sbvh_child_ranges(const SBVHRange &range,
+		                                                  std::uint32_t left_count,
+		                                                  std::uint32_t right_count)
+		{
+			std::uint32_t slack = range.capacity_end - range.start - left_count - right_count;
+			std::uint32_t left_slack =
+			        std::uint32_t((std::uint64_t(slack) * left_count) / (left_count + right_count));
+			std::uint32_t right_start = range.start + left_count + left_slack;
+
+			return {{range.start, range.start + left_count, right_start},
+			        {right_start, right_start + right_count, range.capacity_end}};
+		}
+
+		const BuildNode *create_sbvh_node(BuildContext &context,
+		                                  const SBVHRange &range,
+		                                  real_t root_surface_area)
+		{
+			assert(range.start < range.end && range.end <= range.capacity_end);
 
 			BuildNode *node = next_build_node(context);
+			std::uint32_t start = range.start;
+			std::uint32_t end = range.end;
 			std::uint32_t count = end - start;
 			AABB aabb;
 			AABB centroids_aabb;
@@ -629,146 +2382,371 @@ namespace Rayni
 				centroids_aabb.merge(context.infos[i].centroid);
 			}
 
-			std::uint8_t split_axis = centroids_aabb.max_extent_axis();
-
-			if (count == 1 || centroids_aabb.is_planar(split_axis) || context.cancellable.cancelled()) {
-				node->aabb = aabb;
-				node->split_axis = 3;
-				node->leaf.start = start;
-				node->leaf.end = end;
+			if (count == 1 || context.cancellable.cancelled()) {
+				node->set_leaf(aabb, start, end);
 				return node;
 			}
 
-			std::uint32_t mid;
+			const Binner<AllAxesBinning> binner(centroids_aabb);
+			Buckets<AllAxesBinning> buckets;
 
-			if (count <= 2) {
-				mid = (start + end) / 2;
+			binner.bin(&context.infos[start], count, buckets);
 
-				if (context.infos[mid].centroid[split_axis] < context.infos[start].centroid[split_axis])
-					std::swap(context.infos[start], context.infos[mid]);
-			} else {
-				Bucket buckets[NUM_BUCKETS];
+			BinnedSplit object_split = binned_split(binner, buckets, aabb);
+			SpatialSplit spatial_split;
 
-				for (std::uint32_t i = start; i < end; i++) {
-					const auto &info = context.infos[i];
-					unsigned int b = bucket_index(info.centroid, centroids_aabb, split_axis);
-					buckets[b].count++;
-					buckets[b].aabb.merge(info.aabb);
-				}
+			// Only look for spatial split if children of object split overlap enough.
+			bool object_split_overlaps = object_split.cost == REAL_INFINITY ||
+			                             (aabbs_overlap(object_split.left_aabb, object_split.right_aabb) &&
+			                              object_split.left_aabb.intersection(object_split.right_aabb)
+			                                              .surface_area() >
+			                                      SPATIAL_SPLIT_MIN_OVERLAP * root_surface_area);
 
-				auto split = bucket_split(buckets, aabb);
+			if (object_split_overlaps) {
+				spatial_split = find_spatial_split(context, start, end, aabb);
 
-				real_t leaf_cost = count;
-				if (count <= MAX_LEAF_INTERSECTABLES && split.cost >= leaf_cost) {
-					node->aabb = aabb;
-					node->split_axis = 3;
-					node->leaf.start = start;
-					node->leaf.end = end;
-					return node;
+				// Require progress on both sides and that duplicated references fit.
+				if (spatial_split.left_count == count || spatial_split.right_count == count ||
+				    spatial_split.left_count + spatial_split.right_count > range.capacity_end - start)
+					spatial_split = {};
+			}
+
+			real_t split_cost = std::min(object_split.cost, spatial_split.cost);
+			real_t leaf_cost = count;
+
+			if (split_cost == REAL_INFINITY ||
+			    (count <= MAX_LEAF_INTERSECTABLES && split_cost >= leaf_cost))
+				return set_leaf_build_node(context, node, aabb, start, end);
+
+			std::uint8_t split_axis;
+			std::pair<SBVHRange, SBVHRange> child_ranges;
+
+			if (spatial_split.cost < object_split.cost) {
+				const SpatialBinner spatial_binner(aabb, spatial_split.axis);
+				real_t split_pos = spatial_binner.split_position(spatial_split.bin);
+				AABB::Split sides = aabb.split(spatial_split.axis, split_pos);
+
+				// References are distributed in place. After partitioning into [left only,
+				// straddling, right only], left child range is [start, end of straddling).
+				// Right only references are moved to the end of right child range and
+				// straddling references are clipped into the start of it. Right child range
+				// never starts before end of left child range.
+				auto left_only = [&](const IntersectableInfo &i) {
+					return spatial_binner.last_bin(i.aabb) <= spatial_split.bin;
+				};
+				auto straddling = [&](const IntersectableInfo &i) {
+					return spatial_binner.first_bin(i.aabb) <= spatial_split.bin;
+				};
+
+				IntersectableInfo *first = &context.infos[start];
+				IntersectableInfo *last = &context.infos[end - 1] + 1;
+				IntersectableInfo *straddling_first = std::partition(first, last, left_only);
+				IntersectableInfo *straddling_last = std::partition(straddling_first, last, straddling);
+				auto num_straddling = std::uint32_t(straddling_last - straddling_first);
+
+				assert(std::uint32_t(straddling_last - first) == spatial_split.left_count);
+				assert(std::uint32_t(last - straddling_first) == spatial_split.right_count);
+
+				child_ranges =
+				        sbvh_child_ranges(range, spatial_split.left_count, spatial_split.right_count);
+				IntersectableInfo *right_first = &context.infos[child_ranges.second.start];
+
+				std::copy_backward(straddling_last,
+				                   last,
+				                   &context.infos[child_ranges.second.end - 1] + 1);
+
+				for (std::uint32_t i = 0; i < num_straddling; i++) {
+					right_first[i] = clip_reference(straddling_first[i], sides.right);
+					straddling_first[i] = clip_reference(straddling_first[i], sides.left);
 				}
 
+				split_axis = spatial_split.axis;
+			} else {
+				auto left_of_split = [&](const IntersectableInfo &i) {
+					unsigned int b = binner.bucket_index(i.centroid, object_split.axis_index);
+					return b <= object_split.bucket;
+				};
+
 				IntersectableInfo *pmid = std::partition(&context.infos[start],
-				                                         &context.infos[end],
-				                                         [&](const IntersectableInfo &i) {
-					                                         unsigned int b =
-					                                                 bucket_index(i.centroid,
-					                                                              centroids_aabb,
-					                                                              split_axis);
-					                                         return b <= split.bucket;
-				                                         });
-				mid = pmid - &context.infos[0];
+				                                         &context.infos[end - 1] + 1,
+				                                         left_of_split);
+				std::uint32_t mid = pmid - &context.infos[0];
+
+				child_ranges = sbvh_child_ranges(range, mid - start, end - mid);
+				std::copy_backward(&context.infos[mid],
+				                   &context.infos[end - 1] + 1,
+				                   &context.infos[child_ranges.second.end - 1] + 1);
+
+				split_axis = binner.axis(object_split.axis_index);
 			}
 
 			const BuildNode *left;
 			const BuildNode *right;
 
-			if (count > THREAD_MIN_INTERSECTABLES && context.thread_pool.threads_available() > 0) {
-				auto future = context.thread_pool.async(
-				        [&context, mid, end]() { return create_build_node(context, mid, end); });
-				left = create_build_node(context, start, mid);
-				right = future.get();
+			if (count > TASK_MIN_INTERSECTABLES) {
+				auto create_left = [&] {
+					left = create_sbvh_node(context, child_ranges.first, root_surface_area);
+				};
+				auto create_right = [&] {
+					right = create_sbvh_node(context, child_ranges.second, root_surface_area);
+				};
+
+				parallel_invoke(context.thread_pool, create_left, create_right);
 			} else {
-				left = create_build_node(context, start, mid);
-				right = create_build_node(context, mid, end);
+				left = create_sbvh_node(context, child_ranges.first, root_surface_area);
+				right = create_sbvh_node(context, child_ranges.second, root_surface_area);
 			}
 
-			node->aabb = AABB(left->aabb).merge(right->aabb);
-			node->split_axis = split_axis;
-			node->split.left = left;
-			node->split.right = right;
+			node->set_split(split_axis, left, right);
 
 			return node;
 		}
 
-		const BuildNode *create_build_node(BuildContext &context,
-		                                   std::uint32_t start,
-		                                   std::uint32_t end,
-		                                   unsigned int threads)
+		const BuildNode *create_sbvh(BuildContext &context, real_t reference_budget)
 		{
-			if (threads >= THREAD_HORIZONTALLY_MIN_THREADS && end - start > THREAD_MIN_INTERSECTABLES)
-				return create_build_node_thread_horizontally(context, start, end, threads);
+			std::uint32_t count = context.infos.size();
+			auto capacity = std::uint32_t(count + count * reference_budget);
+			AABB aabb;
+
+			for (const IntersectableInfo &info : context.infos)
+				aabb.merge(info.aabb);
 
-			return create_build_node(context, start, end);
+			context.infos.resize(capacity);
+
+			return create_sbvh_node(context, {0, count, capacity}, aabb.surface_area());
+		}
+
+		void copy_leaf_intersectables(const BuildContext &context,
+		                              std::vector<const Intersectable *> &ordered_intersectables,
+		                              const BuildNode *leaf,
+		                              std::uint32_t offset)
+		{
+			for (std::uint32_t i = leaf->leaf.start; i < leaf->leaf.end; i++)
+				ordered_intersectables[offset++] = context.intersectables[context.infos[i].index];
 		}
 
+		// Node and intersectables of a subtree are written to node_index and
+		// intersectable_offset and onward in preallocated vectors. Position of
+		// each subtree is known from sizes stored in build nodes, subtrees are
+		// flattened in parallel.
 		void build_node_to_nodes(const BuildContext &context,
 		                         std::vector<const Intersectable *> &ordered_intersectables,
 		                         std::vector<Node> &nodes,
-		                         const BuildNode *build_node)
+		                         const BuildNode *build_node,
+		                         std::uint32_t node_index,
+		                         std::uint32_t intersectable_offset)
 		{
-			if (build_node->split_axis < 3) {
-				auto pos = nodes.size();
-				nodes.emplace_back(build_node->aabb, build_node->split_axis);
+			if (build_node->split_axis >= 3) {
+				copy_leaf_intersectables(context,
+				                         ordered_intersectables,
+				                         build_node,
+				                         intersectable_offset);
+				nodes[node_index] = Node(build_node->aabb,
+				                         intersectable_offset,
+				                         build_node->leaf.end - build_node->leaf.start);
+				return;
+			}
+
+			const BuildNode *left = build_node->split.left;
+			const BuildNode *right = build_node->split.right;
+			std::uint32_t left_index = node_index + 1;
+			std::uint32_t right_index = left_index + left->subtree_nodes;
+
+			nodes[node_index] = Node(build_node->aabb, build_node->split_axis);
+			nodes[node_index].set_right_offset(right_index - node_index);
+
+			auto flatten_left = [&] {
+				build_node_to_nodes(context,
+				                    ordered_intersectables,
+				                    nodes,
+				                    left,
+				                    left_index,
+				                    intersectable_offset);
+			};
+			auto flatten_right = [&] {
+				build_node_to_nodes(context,
+				                    ordered_intersectables,
+				                    nodes,
+				                    right,
+				                    right_index,
+				                    intersectable_offset + left->subtree_intersectables);
+			};
+
+			if (build_node->subtree_nodes > FLATTEN_TASK_MIN_NODES) {
+				parallel_invoke(context.thread_pool, flatten_left, flatten_right);
+			} else {
+				flatten_left();
+				flatten_right();
+			}
+		}
+
+		// Collapse by repeatedly replacing child with largest surface area with its
+		// children. Largest surface area means highest probability of being hit.
+		template <unsigned int WIDTH>
+		unsigned int collapse_build_node(const BuildNode *build_node, const BuildNode *(&children)[WIDTH])
+		{
+			unsigned int num_children = 0;
 
-				build_node_to_nodes(context, ordered_intersectables, nodes, build_node->split.left);
-				nodes[pos].set_right_offset(nodes.size() - pos);
-				build_node_to_nodes(context, ordered_intersectables, nodes, build_node->split.right);
+			if (build_node->split_axis < 3) {
+				children[num_children++] = build_node->split.left;
+				children[num_children++] = build_node->split.right;
 			} else {
-				std::uint32_t offset = ordered_intersectables.size();
+				children[num_children++] = build_node; // Root is a leaf.
+			}
+
+			while (num_children < WIDTH) {
+				unsigned int largest = WIDTH;
+				real_t largest_surface_area = -1;
+
+				for (unsigned int i = 0; i < num_children; i++) {
+					if (children[i]->split_axis < 3 &&
+					    children[i]->aabb.surface_area() > largest_surface_area) {
+						largest = i;
+						largest_surface_area = children[i]->aabb.surface_area();
+					}
+				}
 
-				for (std::uint32_t i = build_node->leaf.start; i < build_node->leaf.end; i++)
-					ordered_intersectables.push_back(
-					        context.intersectables[context.infos[i].index]);
+				if (largest == WIDTH)
+					break;
 
-				nodes.emplace_back(build_node->aabb,
-				                   offset,
-				                   build_node->leaf.end - build_node->leaf.start);
+				const BuildNode *child = children[largest];
+				children[largest] = child->split.left;
+				children[num_children++] = child->split.right;
 			}
+
+			return num_children;
 		}
 
-		void log_build_info(const Stopwatch &stopwatch,
-		                    const std::vector<const Intersectable *> &intersectables,
-		                    const std::vector<const Intersectable *> &ordered_intersectables,
-		                    const std::vector<Node> &nodes)
+		// Sets subtree_wide_nodes of build_node and all build nodes below that
+		// become wide nodes. Needed to know where each subtree ends up before
+		// flattening in parallel.
+		template <unsigned int WIDTH>
+		std::uint32_t count_wide_nodes(const BuildContext &context, const BuildNode *build_node)
 		{
-			struct PositionInfo
+			const BuildNode *children[WIDTH];
+			unsigned int num_children = collapse_build_node<WIDTH>(build_node, children);
+			std::uint32_t child_counts[WIDTH] = {};
+
 			{
-				const Node *node;
-				unsigned int depth;
-			};
+				TaskGroup task_group(context.thread_pool);
 
-			struct SavedInfo
+				for (unsigned int i = 0; i < num_children; i++) {
+					const BuildNode *child = children[i];
+
+					if (child->split_axis >= 3)
+						continue;
+
+					if (child->subtree_nodes > FLATTEN_TASK_MIN_NODES)
+						task_group.run([&, i] {
+							child_counts[i] = count_wide_nodes<WIDTH>(context, children[i]);
+						});
+					else
+						child_counts[i] = count_wide_nodes<WIDTH>(context, child);
+				}
+			}
+
+			build_node->subtree_wide_nodes = 1;
+
+			for (unsigned int i = 0; i < num_children; i++)
+				build_node->subtree_wide_nodes += child_counts[i];
+
+			return build_node->subtree_wide_nodes;
+		}
+
+		// See build_node_to_nodes(). count_wide_nodes() must have been called.
+		// Node is first filled in with full precision AABBs since all child AABBs
+		// are needed to quantize them, quantized nodes are created directly from it.
+		template <typename WideNodeType>
+		void build_node_to_wide_nodes(const BuildContext &context,
+		                              std::vector<const Intersectable *> &ordered_intersectables,
+		                              CacheLineAlignedVector<WideNodeType> &nodes,
+		                              const BuildNode *build_node,
+		                              std::uint32_t node_index,
+		                              std::uint32_t intersectable_offset)
+		{
+			constexpr unsigned int WIDTH = WideNodeType::NUM_CHILDREN;
+
+			const BuildNode *children[WIDTH];
+			unsigned int num_children = collapse_build_node<WIDTH>(build_node, children);
+			WideNode<WIDTH> node;
+			std::uint32_t child_index = node_index + 1;
+			TaskGroup task_group(context.thread_pool);
+
+			for (unsigned int i = 0; i < num_children; i++) {
+				const BuildNode *child = children[i];
+
+				if (child->split_axis < 3) {
+					node.set_child_node(i, child->aabb, child_index);
+
+					if (child->subtree_nodes > FLATTEN_TASK_MIN_NODES) {
+						task_group.run([&, child, child_index, intersectable_offset] {
+							build_node_to_wide_nodes<WideNodeType>(context,
+							                                       ordered_intersectables,
+							                                       nodes,
+							                                       child,
+							                                       child_index,
+							                                       intersectable_offset);
+						});
+					} else {
+						build_node_to_wide_nodes<WideNodeType>(context,
+						                                       ordered_intersectables,
+						                                       nodes,
+						                                       child,
+						                                       child_index,
+						                                       intersectable_offset);
+					}
+
+					child_index += child->subtree_wide_nodes;
+				} else {
+					copy_leaf_intersectables(context,
+					                         ordered_intersectables,
+					                         child,
+					                         intersectable_offset);
+					node.set_child_leaf(i,
+					                    child->aabb,
+					                    intersectable_offset,
+					                    child->leaf.end - child->leaf.start);
+				}
+
+				intersectable_offset += child->subtree_intersectables;
+			}
+
+			nodes[node_index] = WideNodeType(node);
+		}
+
+		struct TreeInfo
+		{
+			void add_leaf(unsigned int depth, unsigned int intersectable_count)
 			{
-				Stopwatch::clock::duration total_time = {};
-				unsigned int total_count = 0;
-			};
+				min_depth = std::min(min_depth, depth);
+				max_depth = std::max(max_depth, depth);
+				leafs++;
+				unsigned int count_index = std::min(intersectable_count, 5U) - 1;
+				leaf_intersectables_count[count_index]++;
+			}
 
 			unsigned int min_depth = std::numeric_limits<unsigned int>::max();
 			unsigned int max_depth = 0;
 			unsigned int leafs = 0;
 			unsigned int leaf_intersectables_count[5] = {};
+		};
 
+		TreeInfo tree_info(const std::vector<Node> &nodes)
+		{
+			struct PositionInfo
+			{
+				const Node *node;
+				unsigned int depth;
+			};
+
+			TreeInfo info;
 			PositionInfo current = {&nodes[0], 0};
 			PositionInfo stack[ABSOLUTE_MAX_DEPTH];
 			unsigned int stack_pos = 0;
 
 			while (current.node) {
 				if (current.node->is_leaf()) {
-					min_depth = std::min(min_depth, current.depth);
-					max_depth = std::max(max_depth, current.depth);
-					leafs++;
-					int count_index = std::min(int(current.node->intersectable_count()), 5) - 1;
-					leaf_intersectables_count[count_index]++;
+					info.add_leaf(current.depth, current.node->intersectable_count());
 
 					current = stack_pos > 0 ? stack[--stack_pos] : PositionInfo{nullptr, 0};
 				} else {
@@ -779,9 +2757,66 @@ namespace Rayni
 				}
 			}
 
+			return info;
+		}
+
+		template <typename WideNodeType>
+		TreeInfo tree_info(const CacheLineAlignedVector<WideNodeType> &nodes)
+		{
+			constexpr unsigned int WIDTH = WideNodeType::NUM_CHILDREN;
+
+			struct PositionInfo
+			{
+				std::uint32_t node;
+				unsigned int depth;
+			};
+
+			TreeInfo info;
+			PositionInfo stack[ABSOLUTE_MAX_DEPTH * (WIDTH - 1) + 1];
+			unsigned int stack_pos = 0;
+
+			stack[stack_pos++] = {0, 0};
+
+			while (stack_pos > 0) {
+				PositionInfo current = stack[--stack_pos];
+				const WideNodeType &node = nodes[current.node];
+
+				for (unsigned int i = 0; i < WIDTH; i++) {
+					if (node.child_is_empty(i))
+						continue;
+
+					if (node.child_is_leaf(i)) {
+						info.add_leaf(current.depth + 1, node.child_intersectable_count(i));
+					} else {
+						assert(stack_pos < std::size(stack));
+						stack[stack_pos++] = {node.child_node(i), current.depth + 1};
+					}
+				}
+			}
+
+			return info;
+		}
+
+		template <typename NodeVector>
+		void log_build_info(const Stopwatch &stopwatch,
+		                    const std::vector<const Intersectable *> &intersectables,
+		                    const std::vector<const Intersectable *> &ordered_intersectables,
+		                    const NodeVector &nodes,
+		                    unsigned int node_width,
+		                    std::size_t unquantized_node_size,
+		                    const AABB &aabb)
+		{
+			struct SavedInfo
+			{
+				Stopwatch::clock::duration total_time = {};
+				unsigned int total_count = 0;
+			};
+
+			TreeInfo info = tree_info(nodes);
+
 			static std::unordered_map<std::size_t, SavedInfo> saved_info;
-			const AABB &aabb = nodes[0].aabb();
 			std::size_t saved_hash = hash_combine_for(intersectables.size(),
+			                                          node_width,
 			                                          aabb.minimum().x(),
 			                                          aabb.minimum().y(),
 			                                          aabb.minimum().z(),
@@ -794,14 +2829,26 @@ namespace Rayni
 
 			double ordered_intersectables_mb =
 			        double(ordered_intersectables.size() * sizeof(void *)) / (1024 * 1024);
-			double nodes_mb = double(nodes.size() * sizeof(Node)) / (1024 * 1024);
+			double nodes_mb =
+			        double(nodes.size() * sizeof(typename NodeVector::value_type)) / (1024 * 1024);
+			std::string unquantized_nodes_info;
+
+			if (unquantized_node_size != sizeof(typename NodeVector::value_type)) {
+				double mb = double(nodes.size() * unquantized_node_size) / (1024 * 1024);
+				unquantized_nodes_info =
+				        string_printf("  Nodes if not quantized      : %.2fMb (%.1f%% saved)\n",
+				                      mb,
+				                      100 * (1 - nodes_mb / mb));
+			}
 
 			log_info("BVH build information:\n"
 			         "  Time to build               : %s\n"
 			         "  Average time to build       : %s (builds: %u)\n"
 			         "  Intersectables              : %zu\n"
 			         "  Ordered intersectables      : %zu (%.2fMb)\n"
+			         "  Node width                  : %u\n"
 			         "  Nodes                       : %zu (%.2fMb)\n"
+			         "%s"
 			         "  Memory usage                : %.2fMb\n"
 			         "  Min depth                   : %u\n"
 			         "  Max depth                   : %u\n"
@@ -819,18 +2866,20 @@ namespace Rayni
 			         intersectables.size(),
 			         ordered_intersectables.size(),
 			         ordered_intersectables_mb,
+			         node_width,
 			         nodes.size(),
 			         nodes_mb,
+			         unquantized_nodes_info.c_str(),
 			         ordered_intersectables_mb + nodes_mb,
-			         min_depth,
-			         max_depth,
-			         leafs,
-			         int(std::ceil(std::log2(leafs))),
-			         leaf_intersectables_count[0],
-			         leaf_intersectables_count[1],
-			         leaf_intersectables_count[2],
-			         leaf_intersectables_count[3],
-			         leaf_intersectables_count[4],
+			         info.min_depth,
+			         info.max_depth,
+			         info.leafs,
+			         int(std::ceil(std::log2(info.leafs))),
+			         info.leaf_intersectables_count[0],
+			         info.leaf_intersectables_count[1],
+			         info.leaf_intersectables_count[2],
+			         info.leaf_intersectables_count[3],
+			         info.leaf_intersectables_count[4],
 			         double(aabb.minimum().x()),
 			         double(aabb.minimum().y()),
 			         double(aabb.minimum().z()),
@@ -838,38 +2887,132 @@ namespace Rayni
 			         double(aabb.maximum().y()),
 			         double(aabb.maximum().z()));
 		}
+
+		std::unique_ptr<BVH> create_binary_bvh(const BuildContext &context,
+		                                       const BuildNode *root,
+		                                       Stopwatch &stopwatch)
+		{
+			std::vector<const Intersectable *> ordered_intersectables(root->subtree_intersectables);
+			std::vector<Node> nodes(root->subtree_nodes);
+
+			build_node_to_nodes(context, ordered_intersectables, nodes, root, 0, 0);
+
+			stopwatch.stop();
+
+			log_build_info(stopwatch,
+			               context.intersectables,
+			               ordered_intersectables,
+			               nodes,
+			               2,
+			               sizeof(Node),
+			               nodes[0].aabb());
+
+			return std::make_unique<BinaryBVH>(std::move(ordered_intersectables),
+			                                   CacheableVector<Node>(std::move(nodes)));
+		}
+
+		template <typename WideNodeType>
+		std::unique_ptr<BVH> create_wide_bvh(const BuildContext &context,
+		                                     const BuildNode *root,
+		                                     Stopwatch &stopwatch)
+		{
+			constexpr unsigned int WIDTH = WideNodeType::NUM_CHILDREN;
+
+			std::vector<const Intersectable *> ordered_intersectables(root->subtree_intersectables);
+			CacheLineAlignedVector<WideNodeType> nodes(count_wide_nodes<WIDTH>(context, root));
+
+			build_node_to_wide_nodes<WideNodeType>(context, ordered_intersectables, nodes, root, 0, 0);
+
+			stopwatch.stop();
+
+			log_build_info(stopwatch,
+			               context.intersectables,
+			               ordered_intersectables,
+			               nodes,
+			               WIDTH,
+			               sizeof(WideNode<WIDTH>),
+			               root->aabb);
+
+			using BVHType = WideBVH<WideNodeType>;
+
+			return std::make_unique<BVHType>(std::move(ordered_intersectables),
+			                                 typename BVHType::Nodes(std::move(nodes)),
+			                                 root->aabb);
+		}
 	}
 
-	std::unique_ptr<Intersectable> bvh_build(std::vector<const Intersectable *> &&intersectables,
-	                                         const Cancellable &cancellable,
-	                                         ThreadPool &thread_pool)
+	std::unique_ptr<BVH> bvh_build(std::vector<const Intersectable *> &&intersectables,
+	                               const Cancellable &cancellable,
+	                               ThreadPool &thread_pool,
+	                               const BVHBuildOptions &options)
 	{
 		auto stopwatch = Stopwatch().start();
 
 		BuildContext context(std::move(intersectables), cancellable, thread_pool);
-		unsigned int num_threads = thread_pool.threads_available();
+		unsigned int num_threads = std::max(thread_pool.size(), 1U);
 
 		prepare_build_context(context, num_threads);
 
-		std::uint32_t num_intersectables = context.intersectables.size();
-		const BuildNode *root = create_build_node(context, 0, num_intersectables, num_threads);
-
-		unsigned int node_count = build_nodes_used(context);
-		std::vector<const Intersectable *> ordered_intersectables;
-		std::vector<Node> nodes;
-		ordered_intersectables.reserve(num_intersectables);
-		nodes.reserve(node_count);
+		if (cancellable.cancelled())
+			return nullptr;
 
-		build_node_to_nodes(context, ordered_intersectables, nodes, root);
+		std::uint32_t num_intersectables = context.intersectables.size();
+		const BuildNode *root = nullptr;
+
+		switch (options.build_method) {
+		case BVHBuildMethod::BINNED_SAH:
+			root = create_build_node<MaxExtentAxisBinning>(context, 0, num_intersectables, num_threads);
+			break;
+		case BVHBuildMethod::BINNED_SAH_ALL_AXES:
+			root = create_build_node<AllAxesBinning>(context, 0, num_intersectables, num_threads);
+			break;
+		case BVHBuildMethod::LBVH:
+			root = create_lbvh(context, num_threads);
+			break;
+		case BVHBuildMethod::SBVH:
+			root = create_sbvh(context, options.spatial_split_reference_budget);
+			break;
+		}
 
-		assert(num_intersectables == ordered_intersectables.size()); // No reallocation should have occurred.
-		assert(node_count == nodes.size());
+		// Nodes created after cancellation are leaves with whatever is left,
+		// do not bother flattening them. Build nodes are freed with context.
+		if (cancellable.cancelled())
+			return nullptr;
+
+		switch (options.node_layout) {
+		case BVHNodeLayout::BINARY:
+			break;
+		case BVHNodeLayout::WIDE4:
+			return create_wide_bvh<WideNode<4>>(context, root, stopwatch);
+		case BVHNodeLayout::WIDE8:
+			return create_wide_bvh<WideNode<8>>(context, root, stopwatch);
+		case BVHNodeLayout::WIDE4_QUANTIZED:
+			return create_wide_bvh<QuantizedWideNode<4>>(context, root, stopwatch);
+		case BVHNodeLayout::WIDE8_QUANTIZED:
+			return create_wide_bvh<QuantizedWideNode<8>>(context, root, stopwatch);
+		}
 
-		stopwatch.stop();
+		return create_binary_bvh(context, root, stopwatch);
+	}
 
-		if (!cancellable.cancelled())
-			log_build_info(stopwatch, context.intersectables, ordered_intersectables, nodes);
+	Result<std::unique_ptr<BVH>> bvh_load(const std::string &path,
+	                                      std::uint64_t key,
+	                                      const std::vector<const Intersectable *> &intersectables,
+	                                      BVHNodeLayout node_layout)
+	{
+		switch (node_layout) {
+		case BVHNodeLayout::BINARY:
+			break;
+		case BVHNodeLayout::WIDE4:
+			return load_wide_bvh<WideNode<4>>(path, key, intersectables);
+		case BVHNodeLayout::WIDE8:
+			return load_wide_bvh<WideNode<8>>(path, key, intersectables);
+		case BVHNodeLayout::WIDE4_QUANTIZED:
+			return load_wide_bvh<QuantizedWideNode<4>>(path, key, intersectables);
+		case BVHNodeLayout::WIDE8_QUANTIZED:
+			return load_wide_bvh<QuantizedWideNode<8>>(path, key, intersectables);
+		}
 
-		return std::make_unique<BVH>(std::move(ordered_intersectables), std::move(nodes));
+		return load_binary_bvh(path, key, intersectables);
 	}
 }
@@ -20,18 +20,96 @@
 #ifndef RAYNI_LIB_INTERSECTION_STRUCTURES_BVH_H
 #define RAYNI_LIB_INTERSECTION_STRUCTURES_BVH_H
 
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "lib/concurrency/cancellable.h"
 #include "lib/concurrency/thread_pool.h"
+#include "lib/function/result.h"
 #include "lib/intersectable.h"
+#include "lib/math/math.h"
 
 namespace Rayni
 {
-	std::unique_ptr<Intersectable> bvh_build(std::vector<const Intersectable *> &&intersectables,
-	                                         const Cancellable &cancellable,
-	                                         ThreadPool &thread_pool);
+	enum class BVHBuildMethod
+	{
+		// Binned SAH along axis with largest centroid extent.
+		BINNED_SAH,
+
+		// Binned SAH along all axes with more buckets. Better tree for e.g. long thin
+		// geometry at the cost of longer build time.
+		BINNED_SAH_ALL_AXES,
+
+		// Linear BVH from Morton codes of centroids. Much faster to build but tree
+		// is worse. For e.g. previews and scenes that need to be rebuilt often.
+		LBVH,
+
+		// Binned SAH with spatial splits. References to intersectables that
+		// straddle a split plane are duplicated and clipped. Less node overlap for
+		// scenes with large and long intersectables (e.g. architecture) at the cost
+		// of more memory and longer build time.
+		SBVH
+	};
+
+	enum class BVHNodeLayout
+	{
+		BINARY,
+		WIDE4,
+		WIDE8,
+
+		// Like WIDE4/WIDE8 but child AABBs are stored with 8 bits per plane
+		// relative to AABB of parent. About half the memory, more nodes fit in
+		// cache, but some rays intersect children they would otherwise miss.
+		WIDE4_QUANTIZED,
+		WIDE8_QUANTIZED
+	};
+
+	struct BVHBuildOptions
+	{
+		BVHBuildMethod build_method = BVHBuildMethod::BINNED_SAH;
+		BVHNodeLayout node_layout = BVHNodeLayout::BINARY;
+
+		// Maximum number of references to intersectables added by spatial splits
+		// with BVHBuildMethod::SBVH, as a fraction of number of intersectables.
+		real_t spatial_split_reference_budget = real_t(0.3);
+	};
+
+	class BVH : public Intersectable
+	{
+	public:
+		// Intersectables may move after BVH has been built. As long as the set of
+		// intersectables stays the same, refit() recalculates AABBs of all nodes
+		// bottom-up from current AABBs of intersectables, which is a lot faster
+		// than building a new BVH. Tree quality degrades the more intersectables
+		// move in relation to each other. Must not be called while BVH is being
+		// intersected.
+		virtual void refit(ThreadPool &thread_pool) = 0;
+
+		// Saves nodes and order of intersectables to a CacheFile that can be loaded
+		// with bvh_load() instead of building BVH again. Intersectables must be
+		// the same, in the same order, as the ones passed to bvh_build(). Key
+		// should identify them, e.g. a hash of their AABBs.
+		virtual Result<void> save(const std::string &path,
+		                          std::uint64_t key,
+		                          const std::vector<const Intersectable *> &intersectables) const = 0;
+	};
+
+	// Returns nullptr if cancelled. Memory used by build is freed before
+	// returning, nothing is done after cancellation has been noticed.
+	std::unique_ptr<BVH> bvh_build(std::vector<const Intersectable *> &&intersectables,
+	                               const Cancellable &cancellable,
+	                               ThreadPool &thread_pool,
+	                               const BVHBuildOptions &options = {});
+
+	// Loads a BVH saved with BVH::save(). Fails if file is missing, was saved
+	// with another node layout or key, or with an incompatible version. Nodes
+	// are used directly from the memory mapped file.
+	Result<std::unique_ptr<BVH>> bvh_load(const std::string &path,
+	                                      std::uint64_t key,
+	                                      const std::vector<const Intersectable *> &intersectables,
+	                                      BVHNodeLayout node_layout);
 }
 
 #endif // RAYNI_LIB_INTERSECTION_STRUCTURES_BVH_H
@@ -27,19 +27,27 @@
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "config.h"
-#include "lib/concurrency/barrier.h"
+#include "lib/concurrency/parallel_for.h"
+#include "lib/concurrency/task_group.h"
+#include "lib/containers/arena.h"
 #include "lib/containers/cache_line_aligned_vector.h"
 #include "lib/intersection.h"
 #include "lib/intersection_structures/kdtree.h"
+#include "lib/io/cache_file.h"
 #include "lib/log.h"
 #include "lib/math/aabb.h"
 #include "lib/math/hash.h"
 #include "lib/math/math.h"
+#include "lib/math/ray.h"
 #include "lib/stopwatch.h"
 #include "lib/string/duration_format.h"
 
@@ -49,40 +57,42 @@
 // http://www.cgg.cvut.cz/members/havran/ARTICLES/ingo06rtKdtree.pdf
 //
 // An effort has been made to reduce memory allocations/reallocations when
-// building and to be cache friendly when intersecting and building. There are
-// some properties of the build algorithm that makes further improvements hard
-// though. See TODO below.
-
-// TODO: Possible to use less memory (and be more cache friendly) with current
-//       build algorithm?
-//
-// E.g. not good to have separate std::vector:s in all BuildNode:s. Also
-// separate allocations for events and indices. If memory is not freed for old
-// input to split_build_input() memory usage increases quite a lot. Not sure how
-// to avoid this and also no allocate separate small allocations that can be
-// freed in each recursion step.
-
-// TODO: Better use of threads when building.
-//
-// Some problems with current implementation:
-//
-// - Finding split position for initial node (the most expensive one) only
-//   utilizes one thread.
+// building and to be cache friendly when intersecting and building.
 //
-// - ThreadPool::threads_available() has to be used to avoid indefinite blocking
-//   when all threads are used to create far right side nodes. Next right side
-//   node task will be queued to pool but no thread will ever run it. Can also
-//   currently "starve" out creation of nodes higher up in tree with lower nodes
-//   which means threads will be idle more than necessary.
+// Events and indices of input to nodes are allocated from three Arenas, used
+// like stacks, in the state of the thread that builds the node. Input to the
+// children of a node is put on top of the two arenas that input of the node is
+// not in. Input of node is then on top of its arena after split and is freed
+// right away, before children are built. Arena blocks made for large input are
+// freed when rewound, so that memory can be reused for nodes. Input of root,
+// and of right children that may be built by another thread, is kept in
+// vectors instead. Indices of leafs are allocated from a separate Arena per
+// thread that is released in bulk when build is done. Small nodes, i.e. most of
+// them, need no heap allocations.
+
+// Nodes at the top of the tree, where there are fewer nodes than threads, are
+// threaded "horizontally". Generating and sorting of initial events, sweeping
+// of events to find split plane and splitting of events are done in parallel
+// by a number of threads that is divided between the two children of a node.
+// Further down, where there are enough nodes, each sub-tree is built by a
+// single thread ("vertical" threading).
+
+// Right child is built in a TaskGroup task. A thread that waits for it runs
+// other pending tasks instead of blocking, so sub-trees are spread over all
+// threads without checking how many threads are available.
+
+// TODO: Events that straddle split plane are sorted by one thread per child
+//       when threading horizontally.
 //
-// Probably have to switch build algorithm completely to address these concerns.
+// Usually not that many but could be done in parallel as well.
 
 // TODO: "Main" thread is currently used to do work as well when building.
 //
-// Which means #logical_cores * 2 + 1 can be building a sub-tree. Easy to fix.
-// But on CPU I have been testing on (an old one) and current implementation,
-// this actually helps with performance. Should reevaluate this on a never CPU
-// with more cores and faster memory etc.
+// It builds the first child of each node it splits, and runs a chunk when
+// threading horizontally, but it does not run other tasks while waiting. So
+// #threads in pool + 1 threads can be building sub-trees near the root.
+// Should reevaluate whether the extra thread helps on a newer CPU with more
+// cores and faster memory etc.
 
 namespace Rayni
 {
@@ -93,12 +103,23 @@ namespace Rayni
 		constexpr real_t EMPTY_BONUS = 0.8;
 		constexpr unsigned int ABSOLUTE_MAX_DEPTH = 64;
 
-		constexpr unsigned int THREAD_MIN_INTERSECTABLES = 10000;
+		constexpr std::size_t RAY_PACKET_SIZE = 16;
+
+		constexpr unsigned int THREAD_HORIZONTALLY_MIN_THREADS = 2;
+
+		// Fewer intersectables per thread are not worth threading horizontally for.
+		constexpr std::uint32_t THREAD_HORIZONTALLY_MIN_CHUNK_INTERSECTABLES = 5000;
+
+		// Smaller sub-trees are built in calling thread, cheaper than a task.
+		constexpr unsigned int TASK_MIN_INTERSECTABLES = 1000;
 
 		// Max (start+end) * #axes = 2 * 3 = 6 events/intersectable. Planar events
 		// (1 event/axis) should be fairly uncommon so not that much memory is wasted.
 		constexpr unsigned int MAX_EVENTS_PER_INTERSECTABLE = 6;
 
+		constexpr const char *CACHE_FILE_TYPE = "kdtree";
+		constexpr std::uint32_t CACHE_FILE_VERSION = 1;
+
 		class Node
 		{
 		public:
@@ -189,13 +210,15 @@ namespace Rayni
 			real_t t_max;
 		};
 
-		class KdTree : public Intersectable
+		class FlatKdTree : public KdTree
 		{
 		public:
-			KdTree(std::vector<const Intersectable *> &&intersectables,
-			       std::vector<std::uint32_t> &&indices,
-			       std::vector<Node> &&nodes,
-			       const AABB &aabb) :
+			FlatKdTree(std::vector<const Intersectable *> &&intersectables,
+			           CacheableVector<std::uint32_t> &&indices,
+			           CacheableVector<Node> &&nodes,
+			           const AABB &aabb,
+			           CacheFile &&cache_file = {}) :
+			        cache_file_(std::move(cache_file)),
 			        intersectables_(std::move(intersectables)),
 			        indices_(std::move(indices)),
 			        nodes_(std::move(nodes)),
@@ -203,6 +226,17 @@ namespace Rayni
 			{
 			}
 
+			Result<void> save(const std::string &path, std::uint64_t key) const override
+			{
+				return CacheFile::write(path,
+				                        CACHE_FILE_TYPE,
+				                        CACHE_FILE_VERSION,
+				                        key,
+				                        {CacheFile::Array(indices_.data(), indices_.size()),
+				                         CacheFile::Array(nodes_.data(), nodes_.size()),
+				                         CacheFile::Array(&aabb_, 1)});
+			}
+
 			AABB aabb() const override
 			{
 				return aabb_;
@@ -218,6 +252,27 @@ namespace Rayni
 				return intersect(ray, &intersection);
 			}
 
+			void intersect_batch(const Ray *rays, bool *hits, std::size_t count) const override
+			{
+				for (std::size_t i = 0; i < count; i += RAY_PACKET_SIZE)
+					intersect_packet(&rays[i],
+					                 nullptr,
+					                 &hits[i],
+					                 std::min(count - i, RAY_PACKET_SIZE));
+			}
+
+			void intersect_batch(const Ray *rays,
+			                     Intersection *intersections,
+			                     bool *hits,
+			                     std::size_t count) const override
+			{
+				for (std::size_t i = 0; i < count; i += RAY_PACKET_SIZE)
+					intersect_packet(&rays[i],
+					                 &intersections[i],
+					                 &hits[i],
+					                 std::min(count - i, RAY_PACKET_SIZE));
+			}
+
 		private:
 			bool intersect(const Ray &ray, Intersection *intersection) const
 			{
@@ -279,6 +334,139 @@ namespace Rayni
 				return false;
 			}
 
+			// Rays in packet are traversed together with a separate [t_min, t_max] per ray.
+			// Requires all rays to have the same direction signs so that near and far child
+			// is the same for all rays. If not, rays are intersected one by one. Inactive
+			// rays (missed or already hit something) get an empty interval so that loops
+			// over rays do not have to branch. See:
+			//
+			// Wald, I., 2004, Realtime Ray Tracing and Interactive Global Illumination,
+			// Chapter 7.2, Traversal of Ray Packets
+			void intersect_packet(const Ray *rays,
+			                      Intersection *intersections,
+			                      bool *hits,
+			                      std::size_t count) const
+			{
+				if (!rays_have_same_direction_signs(rays, count)) {
+					for (std::size_t i = 0; i < count; i++) {
+						if (intersections)
+							hits[i] = intersect(rays[i], &intersections[i]);
+						else
+							hits[i] = intersect(rays[i], nullptr);
+					}
+					return;
+				}
+
+				struct PacketStackElement
+				{
+					const Node *node;
+					real_t t_min[RAY_PACKET_SIZE];
+					real_t t_max[RAY_PACKET_SIZE];
+				};
+
+				real_t origin[3][RAY_PACKET_SIZE];
+				real_t direction[3][RAY_PACKET_SIZE];
+				real_t t_min[RAY_PACKET_SIZE];
+				real_t t_max[RAY_PACKET_SIZE];
+				bool done[RAY_PACKET_SIZE];
+				std::size_t num_done = 0;
+
+				auto deactivate = [&](std::size_t i) {
+					t_min[i] = REAL_INFINITY;
+					t_max[i] = -REAL_INFINITY;
+				};
+
+				for (std::size_t i = 0; i < count; i++) {
+					for (unsigned int axis = 0; axis < 3; axis++) {
+						origin[axis][i] = rays[i].origin[axis];
+						direction[axis][i] = rays[i].direction[axis];
+					}
+
+					hits[i] = false;
+					done[i] = !aabb_.intersects(rays[i], t_min[i], t_max[i]);
+
+					if (done[i]) {
+						deactivate(i);
+						num_done++;
+					}
+				}
+
+				PacketStackElement stack[ABSOLUTE_MAX_DEPTH];
+				unsigned int stack_pos = 0;
+
+				for (const Node *node = num_done < count ? &nodes_[0] : nullptr; node;) {
+					if (!node->is_leaf()) {
+						unsigned int axis = node->split_axis();
+						real_t split_position = node->split_position();
+						const real_t *o = origin[axis];
+						const real_t *d = direction[axis];
+						bool negative = d[0] < 0;
+						const Node *node_near = negative ? node->right() : node->left();
+						const Node *node_far = negative ? node->left() : node->right();
+						real_t t[RAY_PACKET_SIZE];
+						bool any_near = false;
+						bool any_far = false;
+
+						for (std::size_t i = 0; i < count; i++) {
+							t[i] = (split_position - o[i]) / d[i];
+							any_near |= t_min[i] <= std::min(t_max[i], t[i]);
+							any_far |= std::max(t_min[i], t[i]) <= t_max[i];
+						}
+
+						if (!any_far) {
+							node = node_near;
+						} else if (!any_near) {
+							node = node_far;
+						} else {
+							PacketStackElement &element = stack[stack_pos++];
+							element.node = node_far;
+
+							for (std::size_t i = 0; i < count; i++) {
+								element.t_min[i] = std::max(t_min[i], t[i]);
+								element.t_max[i] = t_max[i];
+								t_max[i] = std::min(t_max[i], t[i]);
+							}
+
+							node = node_near;
+						}
+					} else {
+						for (std::size_t i = 0; i < count; i++) {
+							if (t_min[i] > t_max[i])
+								continue;
+
+							bool hit = false;
+
+							if (intersections)
+								hit = intersect(rays[i], intersections[i], *node);
+							else
+								hit = intersect(rays[i], *node);
+
+							if (hit) {
+								hits[i] = true;
+								done[i] = true;
+								num_done++;
+							}
+						}
+
+						node = nullptr;
+
+						while (num_done < count && stack_pos > 0 && !node) {
+							const PacketStackElement &element = stack[--stack_pos];
+
+							for (std::size_t i = 0; i < count; i++) {
+								t_min[i] = element.t_min[i];
+								t_max[i] = element.t_max[i];
+
+								if (done[i])
+									deactivate(i);
+								else if (t_min[i] <= t_max[i])
+									node = element.node;
+							}
+						}
+					}
+				}
+			}
+
 			bool intersect(const Ray &ray, const Node &node) const
 			{
 				std::uint32_t count = node.index_count();
@@ -311,9 +499,10 @@ namespace Rayni
 				return hit;
 			}
 
+			const CacheFile cache_file_;
 			const std::vector<const Intersectable *> intersectables_;
-			const std::vector<std::uint32_t> indices_;
-			const std::vector<Node> nodes_;
+			const CacheableVector<std::uint32_t> indices_;
+			const CacheableVector<Node> nodes_;
 			const AABB aabb_;
 		};
 
@@ -326,6 +515,8 @@ namespace Rayni
 				START
 			};
 
+			BuildEvent() = default;
+
 			BuildEvent(Type t, std::uint8_t a, real_t p, std::uint32_t i) :
 			        type(t),
 			        axis(a),
@@ -353,11 +544,21 @@ namespace Rayni
 			std::uint32_t index;
 		};
 
+		constexpr unsigned int NUM_INPUT_ARENAS = 3;
+
 		struct BuildInput
 		{
-			std::vector<std::uint32_t> indices;
-			std::vector<BuildEvent> events;
+			std::span<std::uint32_t> indices;
+			std::span<BuildEvent> events;
 			AABB aabb;
+
+			// Index of input arena of building thread that indices and events are
+			// on top of, starting at arena_start. Not set if they are owned by
+			// input.
+			std::optional<unsigned int> arena;
+			Arena::Marker arena_start;
+			std::vector<std::uint32_t> owned_indices;
+			std::vector<BuildEvent> owned_events;
 		};
 
 		struct BuildSplit
@@ -394,29 +595,6 @@ namespace Rayni
 
 		struct BuildNode
 		{
-			// = default can not be used due to union. Sometimes I wonder why I bother
-			// with clang-tidy. Or well... C++ is a crappy language, so I know why.
-			// But sometimes I want to strangle it. A crappy linter for a crappy
-			// language, makes sense.
-			BuildNode(){}; // NOLINT(modernize-use-equals-default)
-			BuildNode(const BuildNode &) = delete;
-			// Have no idea why move constructor can not be deleted. GCC spews out some
-			// garbage with "result type must be constructible from value type of input
-			// range" in it if it is. Should never move construct BuildNodes...
-			BuildNode(BuildNode && /*other*/) noexcept // = delete; TODO: Why does this not work. *Sigh*.
-			{
-				assert(false);
-			}
-
-			~BuildNode()
-			{
-				if (split_axis >= 3)
-					leaf.indices.~vector();
-			}
-
-			BuildNode &operator=(const BuildNode &) = delete;
-			BuildNode &operator=(BuildNode &&) = delete;
-
 			std::uint8_t split_axis = 0;
 
 			union
@@ -430,7 +608,8 @@ namespace Rayni
 
 				struct
 				{
-					std::vector<std::uint32_t> indices;
+					const std::uint32_t *indices;
+					std::uint32_t count;
 				} leaf;
 			};
 		};
@@ -447,6 +626,9 @@ namespace Rayni
 		{
 			std::vector<SideOfPlane> sides_of_plane;
 
+			Arena input_arenas[NUM_INPUT_ARENAS];
+			Arena leaf_indices_arena;
+
 			BuildNodeBlock build_node_block_root;
 			BuildNodeBlock *build_node_block_current = &build_node_block_root;
 		};
@@ -464,43 +646,55 @@ namespace Rayni
 			const Cancellable &cancellable;
 			ThreadPool &thread_pool;
 
-			static thread_local BuildThreadState *thread_state;
-			CacheLineAlignedVector<BuildThreadState> thread_states;
-		};
+			// Index 0 is used by the thread that started the build, index i + 1
+			// by thread i in thread pool. No other thread runs build tasks, threads
+			// not in pool do not run tasks while waiting (see TaskGroup).
+			mutable CacheLineAlignedVector<BuildThreadState> thread_states;
+			const std::thread::id owner_thread = std::this_thread::get_id();
 
-		thread_local BuildThreadState *BuildContext::thread_state = nullptr;
+			BuildThreadState &thread_state() const
+			{
+				std::optional<unsigned int> index = thread_pool.current_thread_index();
+				assert(index || std::this_thread::get_id() == owner_thread);
+				return thread_states[index ? *index + 1 : 0];
+			}
+		};
 
 		void prepare_build_context(BuildContext &context)
 		{
-			unsigned int threads = context.thread_pool.threads_available();
+			unsigned int threads = context.thread_pool.size();
 			auto count = context.intersectables.size();
-			Barrier barrier(threads);
 
 			context.thread_states.resize(threads + 1);
 
+			// Let each thread touch its own state first so memory is local to it.
+			// Calling thread may be in pool, it touches its state here instead.
+			std::optional<unsigned int> current = context.thread_pool.current_thread_index();
+			TaskGroup task_group(context.thread_pool);
+
 			for (unsigned int t = 0; t < threads; t++) {
-				context.thread_pool.add_task([&, count, t] {
-					context.thread_state = &context.thread_states[t + 1];
-					context.thread_state->sides_of_plane.resize(count);
+				BuildThreadState &state = context.thread_states[t + 1];
 
-					barrier.arrive_and_wait();
-				});
+				if (t != current)
+					task_group.run_on(
+					        t,
+					        [&state, count] { state.sides_of_plane.resize(count); },
+					        ThreadPool::Affinity::ONLY);
 			}
 
-			context.thread_state = &context.thread_states[0];
-			context.thread_state->sides_of_plane.resize(count);
+			context.thread_state().sides_of_plane.resize(count);
 
-			context.thread_pool.wait();
+			task_group.wait();
 		}
 
 		BuildNode *next_build_node(const BuildContext &context)
 		{
-			BuildNodeBlock *block = context.thread_state->build_node_block_current;
+			BuildNodeBlock *block = context.thread_state().build_node_block_current;
 
 			if (block->used == BuildNodeBlock::SIZE) {
 				block->next = std::make_unique<BuildNodeBlock>();
 				block = block->next.get();
-				context.thread_state->build_node_block_current = block;
+				context.thread_state().build_node_block_current = block;
 			}
 
 			return &block->nodes[block->used++];
@@ -520,8 +714,8 @@ namespace Rayni
 					for (unsigned int i = 0; i < node_block->used; i++) {
 						const BuildNode &node = node_block->nodes[i];
 
-						if (node.split_axis >= 3 && node.leaf.indices.size() > 1)
-							indices_count += node.leaf.indices.size();
+						if (node.split_axis >= 3 && node.leaf.count > 1)
+							indices_count += node.leaf.count;
 					}
 
 					node_block = node_block->next.get();
@@ -568,25 +762,42 @@ namespace Rayni
 			return std::min(cost_left, cost_right);
 		}
 
-		real_t find_plane(const BuildInput &input,
-		                  Plane &plane_best,
-		                  std::uint32_t &n_left_best,
-		                  std::uint32_t &n_plane_best,
-		                  std::uint32_t &n_right_best)
+		struct PlaneCandidate
+		{
+			real_t cost = REAL_INFINITY;
+			Plane plane;
+			std::uint32_t n_left = 0;
+			std::uint32_t n_plane = 0;
+			std::uint32_t n_right = 0;
+		};
+
+		// Number of intersectables to the left and right, per axis, of planes before
+		// a range of events.
+		struct SweepCounts
 		{
-			real_t cost_best = REAL_INFINITY;
-			real_t aabb_inv_sa = 1 / input.aabb.surface_area();
-			std::uint32_t n = input.indices.size();
 			std::uint32_t n_left[3] = {0, 0, 0};
+			std::uint32_t n_right[3] = {0, 0, 0};
+		};
+
+		// Events in [start, end) must not share a plane with events outside of range.
+		PlaneCandidate sweep_build_events(const BuildInput &input,
+		                                  std::size_t start,
+		                                  std::size_t end,
+		                                  SweepCounts counts)
+		{
+			PlaneCandidate best;
+			real_t aabb_inv_sa = 1 / input.aabb.surface_area();
+			std::uint32_t *n_left = counts.n_left;
+			std::uint32_t *n_right = counts.n_right;
 			std::uint32_t n_plane[3] = {0, 0, 0};
-			std::uint32_t n_right[3] = {n, n, n};
 
-			auto event = input.events.cbegin();
+			auto event = input.events.begin() + std::ptrdiff_t(start);
+			const auto events_end = input.events.begin() + std::ptrdiff_t(end);
 
 			auto num_events_in_plane = [&](const Plane &plane, BuildEvent::Type type) {
 				std::uint32_t num = 0;
 
-				for (; event != input.events.cend(); num++, event++)
+				for (; event != events_end; num++, event++)
 					if (event->axis != plane.axis || event->position != plane.position ||
 					    event->type != type)
 						break;
@@ -594,7 +805,7 @@ namespace Rayni
 				return num;
 			};
 
-			while (event != input.events.cend()) {
+			while (event != events_end) {
 				Plane plane(event->axis, event->position);
 				std::uint32_t p_end = num_events_in_plane(plane, BuildEvent::Type::END);
 				std::uint32_t p_planar = num_events_in_plane(plane, BuildEvent::Type::PLANAR);
@@ -609,31 +820,134 @@ namespace Rayni
 				                                     n_left[plane.axis],
 				                                     n_right[plane.axis],
 				                                     n_plane[plane.axis]);
-				if (cost < cost_best) {
-					cost_best = cost;
-					plane_best = plane;
-					n_left_best = n_left[plane.axis];
-					n_plane_best = n_plane[plane.axis];
-					n_right_best = n_right[plane.axis];
+				if (cost < best.cost) {
+					best.cost = cost;
+					best.plane = plane;
+					best.n_left = n_left[plane.axis];
+					best.n_plane = n_plane[plane.axis];
+					best.n_right = n_right[plane.axis];
 				}
 
 				n_left[plane.axis] += p_start + p_planar;
 				n_plane[plane.axis] = 0;
 			}
 
-			return cost_best;
+			return best;
 		}
 
-		const std::vector<SideOfPlane> &classify_intersectables(const BuildContext &context,
-		                                                        const BuildInput &input,
-		                                                        const Plane &plane)
+		PlaneCandidate find_plane(const BuildInput &input)
 		{
-			auto &sides_of_plane = context.thread_state->sides_of_plane;
+			std::uint32_t n = input.indices.size();
+			SweepCounts counts;
 
-			for (std::uint32_t i : input.indices)
-				sides_of_plane[i] = SideOfPlane::BOTH;
+			for (unsigned int axis = 0; axis < 3; axis++)
+				counts.n_right[axis] = n;
+
+			return sweep_build_events(input, 0, input.events.size(), counts);
+		}
+
+		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) SweepChunkState
+		{
+			std::size_t start = 0;
+			std::size_t end = 0;
+			SweepCounts counts;
+			PlaneCandidate best;
+		};
+
+		// Events are split into one range per thread. Ranges start at a new position
+		// so that all events in a plane end up in the same range. Number of
+		// intersectables to the left and right at start of each range is determined
+		// by first counting events in all ranges. All ranges are then swept in
+		// parallel. Ties are resolved in favor of the first range, which results in
+		// the same plane as find_plane().
+		PlaneCandidate find_plane_thread_horizontally(const BuildContext &context,
+		                                              const BuildInput &input,
+		                                              unsigned int threads)
+		{
+			const std::span<BuildEvent> &events = input.events;
+			CacheLineAlignedVector<SweepChunkState> chunk_states(threads);
+			std::size_t start = 0;
+
+			for (unsigned int t = 0; t < threads; t++) {
+				std::size_t end = t < threads - 1 ? (std::uint64_t(t + 1) * events.size()) / threads
+				                                  : events.size();
+				end = std::max(start, end);
+
+				while (end > 0 && end < events.size() &&
+				       events[end].position == events[end - 1].position)
+					end++;
+
+				chunk_states[t].start = start;
+				chunk_states[t].end = end;
+				start = end;
+			}
+
+			auto for_each_chunk = [&](auto &&func) {
+				parallel_for_chunks(context.thread_pool,
+				                    0,
+				                    threads,
+				                    threads,
+				                    [&](unsigned int t, auto, auto) { func(chunk_states[t]); });
+			};
+
+			for_each_chunk([&](SweepChunkState &state) {
+				for (std::size_t i = state.start; i < state.end; i++) {
+					const BuildEvent &e = events[i];
+
+					if (e.type != BuildEvent::Type::END)
+						state.counts.n_left[e.axis]++;
+					if (e.type != BuildEvent::Type::START)
+						state.counts.n_right[e.axis]++;
+				}
+			});
+
+			SweepCounts counts;
+			std::uint32_t n = input.indices.size();
+
+			for (unsigned int axis = 0; axis < 3; axis++)
+				counts.n_right[axis] = n;
+
+			for (unsigned int t = 0; t < threads; t++) {
+				SweepCounts chunk_counts = chunk_states[t].counts;
+				chunk_states[t].counts = counts;
+
+				for (unsigned int axis = 0; axis < 3; axis++) {
+					counts.n_left[axis] += chunk_counts.n_left[axis];
+					counts.n_right[axis] -= chunk_counts.n_right[axis];
+				}
+			}
+
+			for_each_chunk([&](SweepChunkState &state) {
+				state.best = sweep_build_events(input, state.start, state.end, state.counts);
+			});
+
+			PlaneCandidate best;
+
+			for (unsigned int t = 0; t < threads; t++)
+				if (chunk_states[t].best.cost < best.cost)
+					best = chunk_states[t].best;
+
+			return best;
+		}
+
+		void prepare_sides_of_plane(const BuildInput &input,
+		                            std::size_t start,
+		                            std::size_t end,
+		                            std::vector<SideOfPlane> &sides_of_plane)
+		{
+			for (std::size_t i = start; i < end; i++)
+				sides_of_plane[input.indices[i]] = SideOfPlane::BOTH;
+		}
+
+		void classify_build_events(const BuildInput &input,
+		                           std::size_t start,
+		                           std::size_t end,
+		                           const Plane &plane,
+		                           std::vector<SideOfPlane> &sides_of_plane)
+		{
+			for (std::size_t i = start; i < end; i++) {
+				const BuildEvent &e = input.events[i];
 
-			for (const BuildEvent &e : input.events) {
 				if (e.type == BuildEvent::Type::END && e.axis == plane.axis &&
 				    e.position <= plane.position) {
 					sides_of_plane[e.index] = SideOfPlane::LEFT_ONLY;
@@ -652,161 +966,578 @@ namespace Rayni
 					}
 				}
 			}
+		}
+
+		const std::vector<SideOfPlane> &classify_intersectables(const BuildContext &context,
+		                                                        const BuildInput &input,
+		                                                        const Plane &plane)
+		{
+			auto &sides_of_plane = context.thread_state().sides_of_plane;
+
+			prepare_sides_of_plane(input, 0, input.indices.size(), sides_of_plane);
+			classify_build_events(input, 0, input.events.size(), plane, sides_of_plane);
 
 			return sides_of_plane;
 		}
 
-		void generate_build_events(std::uint32_t index, const AABB &aabb, std::vector<BuildEvent> &events)
+		template <typename OutputIterator>
+		OutputIterator generate_build_events(std::uint32_t index, const AABB &aabb, OutputIterator events)
 		{
 			for (unsigned int axis = 0; axis < 3; axis++) {
 				real_t min = aabb.minimum()[axis];
 				real_t max = aabb.maximum()[axis];
 
 				if (aabb.is_planar(axis)) {
-					events.emplace_back(BuildEvent::Type::PLANAR, axis, min, index);
+					*events++ = BuildEvent(BuildEvent::Type::PLANAR, axis, min, index);
 				} else {
-					events.emplace_back(BuildEvent::Type::START, axis, min, index);
-					events.emplace_back(BuildEvent::Type::END, axis, max, index);
+					*events++ = BuildEvent(BuildEvent::Type::START, axis, min, index);
+					*events++ = BuildEvent(BuildEvent::Type::END, axis, max, index);
 				}
 			}
+
+			return events;
 		}
 
-		BuildSplit split_build_input(const BuildContext &context,
-		                             BuildInput &&input_arg,
-		                             const Plane &plane,
-		                             std::uint32_t n_left,
-		                             std::uint32_t n_plane,
-		                             std::uint32_t n_right)
-		{
-			// Move to stack of old input is important. Memory usage can get pretty steep if it
-			// is not freed before recursion in create_build_node().
-			const BuildInput input = std::move(input_arg);
-			BuildSplit split;
-
-			auto num_indices_left = n_left + (plane.side_if_in_plane == Plane::Side::LEFT ? n_plane : 0);
-			auto num_indices_right = n_right + (plane.side_if_in_plane == Plane::Side::RIGHT ? n_plane : 0);
-			auto max_num_events_left = std::uint64_t(num_indices_left) * MAX_EVENTS_PER_INTERSECTABLE;
-			auto max_num_events_right = std::uint64_t(num_indices_right) * MAX_EVENTS_PER_INTERSECTABLE;
-			split.left.indices.reserve(num_indices_left);
-			split.left.events.reserve(max_num_events_left);
-			split.right.indices.reserve(num_indices_right);
-			split.right.events.reserve(max_num_events_right);
+		// Events in [0, sorted) are sorted. Events after that are sorted and then
+		// merged with the sorted events, from the back, via a copy in arena.
+		void merge_build_events(std::span<BuildEvent> events, std::size_t sorted, Arena &arena)
+		{
+			auto unmerged_start = events.begin() + std::ptrdiff_t(sorted);
+			std::sort(unmerged_start, events.end());
+
+			Arena::Marker marker = arena.marker();
+			std::size_t j = events.size() - sorted;
+			BuildEvent *unmerged = arena.allocate<BuildEvent>(j);
+			std::copy(unmerged_start, events.end(), unmerged);
+
+			for (std::size_t i = sorted, k = events.size(); j > 0;) {
+				if (i > 0 && unmerged[j - 1] < events[i - 1])
+					events[--k] = events[--i];
+				else
+					events[--k] = unmerged[--j];
+			}
+
+			arena.rewind(marker);
+		}
 
+		// Left and right input are put on top of the two input arenas that input is
+		// not in. Room is made for max number of events, the rest is given back by
+		// resize_build_split_events() when split is done.
+		BuildSplit allocate_build_split(const BuildContext &context,
+		                                const BuildInput &input,
+		                                const PlaneCandidate &candidate)
+		{
+			const Plane &plane = candidate.plane;
 			AABB::Split aabb_split = input.aabb.split(plane.axis, plane.position);
-			split.left.aabb = aabb_split.left;
-			split.right.aabb = aabb_split.right;
+			unsigned int input_arena = input.arena.value_or(0);
+
+			auto allocate_input = [&](unsigned int arena_index, std::uint32_t num_indices, const AABB &aabb) {
+				Arena &arena = context.thread_state().input_arenas[arena_index];
+				std::size_t max_num_events = std::size_t(num_indices) * MAX_EVENTS_PER_INTERSECTABLE;
+				BuildInput child;
+				child.arena = arena_index;
+				child.arena_start = arena.marker();
+				child.indices = {arena.allocate<std::uint32_t>(num_indices), num_indices};
+				child.events = {arena.allocate<BuildEvent>(max_num_events), max_num_events};
+				child.aabb = aabb;
+				return child;
+			};
 
-			const auto &sides_of_plane = classify_intersectables(context, input, plane);
+			auto num_indices_left = candidate.n_left +
+			                        (plane.side_if_in_plane == Plane::Side::LEFT ? candidate.n_plane : 0);
+			auto num_indices_right = candidate.n_right +
+			                         (plane.side_if_in_plane == Plane::Side::RIGHT ? candidate.n_plane : 0);
+
+			return {allocate_input((input_arena + 1) % NUM_INPUT_ARENAS, num_indices_left, aabb_split.left),
+			        allocate_input((input_arena + 2) % NUM_INPUT_ARENAS, num_indices_right, aabb_split.right)};
+		}
+
+		// Gives back memory reserved for events that were not needed.
+		void resize_build_split_events(const BuildContext &context,
+		                               BuildSplit &split,
+		                               std::size_t left_size,
+		                               std::size_t right_size)
+		{
+			auto &arenas = context.thread_state().input_arenas;
+
+			split.left.events = split.left.events.first(left_size);
+			split.right.events = split.right.events.first(right_size);
+
+			arenas[*split.left.arena].shrink_last(split.left.events.data(), left_size);
+			arenas[*split.right.arena].shrink_last(split.right.events.data(), right_size);
+		}
+
+		// Input in an arena can only be freed by the thread that allocated it. Input
+		// that may be built by another thread is moved to vectors owned by it. Must
+		// be on top of its arena.
+		void own_build_input(const BuildContext &context, BuildInput &input)
+		{
+			if (!input.arena)
+				return;
+
+			input.owned_indices.assign(input.indices.begin(), input.indices.end());
+			input.owned_events.assign(input.events.begin(), input.events.end());
+			input.indices = input.owned_indices;
+			input.events = input.owned_events;
+
+			context.thread_state().input_arenas[*input.arena].rewind(input.arena_start);
+			input.arena.reset();
+		}
+
+		// Input must be on top of its arena, i.e. input of children (if any) must
+		// be in the other arenas.
+		void release_build_input(const BuildContext &context, BuildInput &input)
+		{
+			if (input.arena)
+				context.thread_state().input_arenas[*input.arena].rewind(input.arena_start);
+
+			input = BuildInput();
+		}
+
+		BuildSplit split_build_input(const BuildContext &context,
+		                             const BuildInput &input,
+		                             const PlaneCandidate &candidate)
+		{
+			BuildSplit split = allocate_build_split(context, input, candidate);
+
+			const auto &sides_of_plane = classify_intersectables(context, input, candidate.plane);
+
+			std::uint32_t *left_index = split.left.indices.data();
+			std::uint32_t *right_index = split.right.indices.data();
+			BuildEvent *left_event = split.left.events.data();
+			BuildEvent *right_event = split.right.events.data();
 
 			for (const BuildEvent &e : input.events) {
 				if (sides_of_plane[e.index] == SideOfPlane::LEFT_ONLY)
-					split.left.events.push_back(e);
+					*left_event++ = e;
 				else if (sides_of_plane[e.index] == SideOfPlane::RIGHT_ONLY)
-					split.right.events.push_back(e);
+					*right_event++ = e;
 			}
 
-			auto left_events_sorted = std::distance(split.left.events.begin(), split.left.events.end());
-			auto right_events_sorted = std::distance(split.right.events.begin(), split.right.events.end());
+			auto left_events_sorted = std::size_t(left_event - split.left.events.data());
+			auto right_events_sorted = std::size_t(right_event - split.right.events.data());
 
 			for (std::uint32_t i : input.indices) {
 				if (sides_of_plane[i] == SideOfPlane::BOTH) {
 					AABB aabb = context.intersectables[i]->aabb();
 
-					split.left.indices.push_back(i);
-					generate_build_events(i, aabb.intersection(split.left.aabb), split.left.events);
+					*left_index++ = i;
+					left_event = generate_build_events(i,
+					                                   aabb.intersection(split.left.aabb),
+					                                   left_event);
 
-					split.right.indices.push_back(i);
-					generate_build_events(i,
-					                      aabb.intersection(split.right.aabb),
-					                      split.right.events);
+					*right_index++ = i;
+					right_event = generate_build_events(i,
+					                                    aabb.intersection(split.right.aabb),
+					                                    right_event);
 				} else if (sides_of_plane[i] == SideOfPlane::LEFT_ONLY) {
-					split.left.indices.push_back(i);
+					*left_index++ = i;
 				} else if (sides_of_plane[i] == SideOfPlane::RIGHT_ONLY) {
-					split.right.indices.push_back(i);
+					*right_index++ = i;
 				}
 			}
 
-			auto left_events_middle = split.left.events.begin() + left_events_sorted;
-			std::sort(left_events_middle, split.left.events.end());
-			std::inplace_merge(split.left.events.begin(), left_events_middle, split.left.events.end());
+			assert(left_index == split.left.indices.data() + split.left.indices.size());
+			assert(right_index == split.right.indices.data() + split.right.indices.size());
+
+			auto left_events_size = std::size_t(left_event - split.left.events.data());
+			auto right_events_size = std::size_t(right_event - split.right.events.data());
+			resize_build_split_events(context, split, left_events_size, right_events_size);
+
+			auto &arenas = context.thread_state().input_arenas;
+			merge_build_events(split.left.events, left_events_sorted, arenas[*split.left.arena]);
+			merge_build_events(split.right.events, right_events_sorted, arenas[*split.right.arena]);
+
+			return split;
+		}
+
+		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) SplitChunkState
+		{
+			std::size_t left_offset = 0;
+			std::size_t right_offset = 0;
+			std::vector<BuildEvent> left_events;
+			std::vector<BuildEvent> right_events;
+		};
+
+		// Same as split_build_input() but events and indices are classified and
+		// distributed to left and right side in parallel. Each thread first counts
+		// how many elements in its range goes to each side so that all threads can
+		// then write to their own part of the output. Order, and thereby result,
+		// is the same as when not threading.
+		BuildSplit split_build_input_thread_horizontally(const BuildContext &context,
+		                                                 const BuildInput &input,
+		                                                 const PlaneCandidate &candidate,
+		                                                 unsigned int threads)
+		{
+			const Plane &plane = candidate.plane;
+			BuildSplit split = allocate_build_split(context, input, candidate);
+
+			// Each node in a sub-tree that is threaded horizontally is built by same
+			// thread so sides of plane for calling thread can be used by all threads.
+			auto &sides_of_plane = context.thread_state().sides_of_plane;
+			CacheLineAlignedVector<SplitChunkState> chunk_states(threads);
+
+			auto for_each_index_chunk = [&](auto &&func) {
+				parallel_for_chunks(context.thread_pool, 0, input.indices.size(), threads, func);
+			};
+			auto for_each_event_chunk = [&](auto &&func) {
+				parallel_for_chunks(context.thread_pool, 0, input.events.size(), threads, func);
+			};
+
+			auto assign_offsets = [&] {
+				std::size_t left_offset = 0;
+				std::size_t right_offset = 0;
+
+				for (SplitChunkState &state : chunk_states) {
+					std::size_t left_count = state.left_offset;
+					std::size_t right_count = state.right_offset;
+					state.left_offset = left_offset;
+					state.right_offset = right_offset;
+					left_offset += left_count;
+					right_offset += right_count;
+				}
+
+				return std::pair(left_offset, right_offset);
+			};
+
+			for_each_index_chunk([&](unsigned int /*t*/, std::size_t start_t, std::size_t end_t) {
+				prepare_sides_of_plane(input, start_t, end_t, sides_of_plane);
+			});
+
+			for_each_event_chunk([&](unsigned int /*t*/, std::size_t start_t, std::size_t end_t) {
+				classify_build_events(input, start_t, end_t, plane, sides_of_plane);
+			});
+
+			for_each_event_chunk([&](unsigned int t, std::size_t start_t, std::size_t end_t) {
+				for (std::size_t i = start_t; i < end_t; i++) {
+					SideOfPlane side = sides_of_plane[input.events[i].index];
+
+					if (side == SideOfPlane::LEFT_ONLY)
+						chunk_states[t].left_offset++;
+					else if (side == SideOfPlane::RIGHT_ONLY)
+						chunk_states[t].right_offset++;
+				}
+			});
+
+			auto events_sorted = assign_offsets();
+			std::size_t left_events_sorted = events_sorted.first;
+			std::size_t right_events_sorted = events_sorted.second;
 
-			auto right_events_middle = split.right.events.begin() + right_events_sorted;
-			std::sort(right_events_middle, split.right.events.end());
-			std::inplace_merge(split.right.events.begin(), right_events_middle, split.right.events.end());
+			for_each_event_chunk([&](unsigned int t, std::size_t start_t, std::size_t end_t) {
+				std::size_t left_i = chunk_states[t].left_offset;
+				std::size_t right_i = chunk_states[t].right_offset;
 
-			assert(split.left.indices.size() == num_indices_left); // No reallocation should have occurred.
-			assert(split.right.indices.size() == num_indices_right);
-			assert(split.left.events.size() <= max_num_events_left);
-			assert(split.right.events.size() <= max_num_events_right);
+				for (std::size_t i = start_t; i < end_t; i++) {
+					const BuildEvent &e = input.events[i];
+					SideOfPlane side = sides_of_plane[e.index];
+
+					if (side == SideOfPlane::LEFT_ONLY)
+						split.left.events[left_i++] = e;
+					else if (side == SideOfPlane::RIGHT_ONLY)
+						split.right.events[right_i++] = e;
+				}
+			});
+
+			for (SplitChunkState &state : chunk_states)
+				state.left_offset = state.right_offset = 0;
+
+			for_each_index_chunk([&](unsigned int t, std::size_t start_t, std::size_t end_t) {
+				for (std::size_t i = start_t; i < end_t; i++) {
+					SideOfPlane side = sides_of_plane[input.indices[i]];
+
+					if (side != SideOfPlane::RIGHT_ONLY)
+						chunk_states[t].left_offset++;
+					if (side != SideOfPlane::LEFT_ONLY)
+						chunk_states[t].right_offset++;
+				}
+			});
+
+			assign_offsets();
+
+			for_each_index_chunk([&](unsigned int t, std::size_t start_t, std::size_t end_t) {
+				SplitChunkState &state = chunk_states[t];
+				std::size_t left_i = state.left_offset;
+				std::size_t right_i = state.right_offset;
+
+				for (std::size_t i = start_t; i < end_t; i++) {
+					std::uint32_t index = input.indices[i];
+					SideOfPlane side = sides_of_plane[index];
+
+					if (side != SideOfPlane::RIGHT_ONLY)
+						split.left.indices[left_i++] = index;
+					if (side != SideOfPlane::LEFT_ONLY)
+						split.right.indices[right_i++] = index;
+
+					if (side == SideOfPlane::BOTH) {
+						AABB aabb = context.intersectables[index]->aabb();
+						generate_build_events(index,
+						                      aabb.intersection(split.left.aabb),
+						                      std::back_inserter(state.left_events));
+						generate_build_events(index,
+						                      aabb.intersection(split.right.aabb),
+						                      std::back_inserter(state.right_events));
+					}
+				}
+			});
+
+			BuildEvent *left_event = split.left.events.data() + left_events_sorted;
+			BuildEvent *right_event = split.right.events.data() + right_events_sorted;
+
+			for (const SplitChunkState &state : chunk_states) {
+				left_event = std::copy(state.left_events.cbegin(),
+				                       state.left_events.cend(),
+				                       left_event);
+				right_event = std::copy(state.right_events.cbegin(),
+				                        state.right_events.cend(),
+				                        right_event);
+			}
+
+			auto left_events_size = std::size_t(left_event - split.left.events.data());
+			auto right_events_size = std::size_t(right_event - split.right.events.data());
+			resize_build_split_events(context, split, left_events_size, right_events_size);
+
+			// Arena of thread that runs task is used for merging right events.
+			parallel_invoke(
+			        context.thread_pool,
+			        [&] {
+				        merge_build_events(split.left.events,
+				                           left_events_sorted,
+				                           context.thread_state().input_arenas[0]);
+			        },
+			        [&] {
+				        merge_build_events(split.right.events,
+				                           right_events_sorted,
+				                           context.thread_state().input_arenas[0]);
+			        });
 
 			return split;
 		}
 
+		const BuildNode *create_leaf_build_node(const BuildContext &context, BuildNode *node, BuildInput &input)
+		{
+			auto count = std::uint32_t(input.indices.size());
+			Arena &leaf_indices_arena = context.thread_state().leaf_indices_arena;
+			std::uint32_t *indices = leaf_indices_arena.allocate<std::uint32_t>(count);
+			std::copy(input.indices.begin(), input.indices.end(), indices);
+			release_build_input(context, input);
+
+			node->split_axis = 3;
+			node->leaf.indices = indices;
+			node->leaf.count = count;
+
+			return node;
+		}
+
 		const BuildNode *create_build_node(const BuildContext &context,
 		                                   unsigned int max_depth,
 		                                   BuildInput &&input)
 		{
 			BuildNode *node = next_build_node(context);
 			std::uint32_t count = input.indices.size();
-			Plane plane;
-			std::uint32_t n_left = 0;
-			std::uint32_t n_plane = 0;
-			std::uint32_t n_right = 0;
-			bool create_leaf;
 
-			if (max_depth == 0 || count <= 1 || context.cancellable.cancelled()) {
-				create_leaf = true;
-			} else {
-				real_t split_cost = find_plane(input, plane, n_left, n_plane, n_right);
-				create_leaf = split_cost >= INTERSECTION_COST * count;
-			}
+			if (max_depth == 0 || count <= 1 || context.cancellable.cancelled())
+				return create_leaf_build_node(context, node, input);
 
-			if (create_leaf) {
-				node->split_axis = 3;
-				new (&node->leaf.indices) std::vector(std::move(input.indices));
-				return node;
-			}
+			PlaneCandidate candidate = find_plane(input);
+			if (candidate.cost >= INTERSECTION_COST * count)
+				return create_leaf_build_node(context, node, input);
 
-			BuildSplit split =
-			        split_build_input(context, std::move(input), plane, n_left, n_plane, n_right);
+			BuildSplit split = split_build_input(context, input, candidate);
+			release_build_input(context, input);
 
-			node->split_axis = plane.axis;
-			node->split.position = plane.position;
+			node->split_axis = candidate.plane.axis;
+			node->split.position = candidate.plane.position;
 
-			if (count > THREAD_MIN_INTERSECTABLES && context.thread_pool.threads_available() > 0) {
-				auto future = context.thread_pool.async(
-				        [&context, max_depth, right = std::move(split.right)]() mutable {
-					        return create_build_node(context, max_depth - 1, std::move(right));
-				        });
-				node->split.left = create_build_node(context, max_depth - 1, std::move(split.left));
-				node->split.right = future.get();
-			} else {
+			auto create_left = [&] {
 				node->split.left = create_build_node(context, max_depth - 1, std::move(split.left));
+			};
+			auto create_right = [&] {
 				node->split.right = create_build_node(context, max_depth - 1, std::move(split.right));
+			};
+
+			if (count > TASK_MIN_INTERSECTABLES) {
+				own_build_input(context, split.right);
+				parallel_invoke(context.thread_pool, create_left, create_right);
+			} else {
+				create_left();
+				create_right();
 			}
 
 			return node;
 		}
 
-		BuildInput initial_build_input(const BuildContext &context)
+		const BuildNode *create_build_node(const BuildContext &context,
+		                                   unsigned int max_depth,
+		                                   BuildInput &&input,
+		                                   unsigned int threads);
+
+		const BuildNode *create_build_node_thread_horizontally(const BuildContext &context,
+		                                                       unsigned int max_depth,
+		                                                       BuildInput &&input,
+		                                                       unsigned int threads)
+		{
+			assert(threads >= 2);
+
+			BuildNode *node = next_build_node(context);
+			std::uint32_t count = input.indices.size();
+
+			if (max_depth == 0 || count <= 1 || context.cancellable.cancelled())
+				return create_leaf_build_node(context, node, input);
+
+			PlaneCandidate candidate = find_plane_thread_horizontally(context, input, threads);
+			if (candidate.cost >= INTERSECTION_COST * count)
+				return create_leaf_build_node(context, node, input);
+
+			BuildSplit split = split_build_input_thread_horizontally(context, input, candidate, threads);
+			release_build_input(context, input);
+			own_build_input(context, split.right);
+
+			node->split_axis = candidate.plane.axis;
+			node->split.position = candidate.plane.position;
+
+			std::uint64_t count_left = split.left.indices.size();
+			std::uint64_t count_right = split.right.indices.size();
+			auto threads_left_wanted = unsigned((count_left * threads) / (count_left + count_right));
+			unsigned int threads_left = std::clamp(threads_left_wanted, 1U, threads - 1);
+			unsigned int threads_right = threads - threads_left;
+
+			parallel_invoke(
+			        context.thread_pool,
+			        [&] {
+				        node->split.left = create_build_node(context,
+				                                             max_depth - 1,
+				                                             std::move(split.left),
+				                                             threads_left);
+			        },
+			        [&] {
+				        node->split.right = create_build_node(context,
+				                                              max_depth - 1,
+				                                              std::move(split.right),
+				                                              threads_right);
+			        });
+
+			return node;
+		}
+
+		const BuildNode *create_build_node(const BuildContext &context,
+		                                   unsigned int max_depth,
+		                                   BuildInput &&input,
+		                                   unsigned int threads)
+		{
+			std::uint32_t count = input.indices.size();
+			threads = std::min(threads, count / THREAD_HORIZONTALLY_MIN_CHUNK_INTERSECTABLES);
+
+			if (threads >= THREAD_HORIZONTALLY_MIN_THREADS)
+				return create_build_node_thread_horizontally(context, max_depth, std::move(input), threads);
+
+			return create_build_node(context, max_depth, std::move(input));
+		}
+
+		struct alignas(RAYNI_L1_CACHE_LINE_SIZE) InitialChunkState
+		{
+			AABB aabb;
+			std::vector<BuildEvent> events;
+		};
+
+		// Each thread generates and sorts events for a range of intersectables.
+		// Sorted ranges are then merged pairwise in parallel until one remains.
+		// Returned input owns indices and events.
+		BuildInput initial_build_input(const BuildContext &context, unsigned int threads)
 		{
 			assert(context.intersectables.size() <= std::numeric_limits<std::uint32_t>::max());
 
+			std::uint32_t count = context.intersectables.size();
 			BuildInput input;
-			input.indices.resize(context.intersectables.size());
-			input.events.reserve(context.intersectables.size() * MAX_EVENTS_PER_INTERSECTABLE);
+			std::vector<std::uint32_t> &indices = input.owned_indices;
+			std::vector<BuildEvent> &events = input.owned_events;
+			indices.resize(count);
 
-			for (std::uint32_t index = 0; index < std::uint32_t(context.intersectables.size()); index++) {
-				AABB aabb = context.intersectables[index]->aabb();
+			threads = std::clamp(count / THREAD_HORIZONTALLY_MIN_CHUNK_INTERSECTABLES, 1U, threads);
 
-				input.indices[index] = index;
-				generate_build_events(index, aabb, input.events);
-				input.aabb.merge(aabb);
+			CacheLineAlignedVector<InitialChunkState> chunk_states(threads);
+
+			auto generate_chunk_events = [&](unsigned int t, std::size_t start_t, std::size_t end_t) {
+				InitialChunkState &state = chunk_states[t];
+				state.events.reserve((end_t - start_t) * MAX_EVENTS_PER_INTERSECTABLE);
+
+				for (auto index = std::uint32_t(start_t); index < end_t; index++) {
+					AABB aabb = context.intersectables[index]->aabb();
+
+					indices[index] = index;
+					generate_build_events(index, aabb, std::back_inserter(state.events));
+					state.aabb.merge(aabb);
+				}
+
+				std::sort(state.events.begin(), state.events.end());
+			};
+
+			parallel_for_chunks(context.thread_pool, 0, count, threads, generate_chunk_events);
+
+			input.indices = indices;
+
+			if (threads == 1) {
+				events = std::move(chunk_states[0].events);
+				input.events = events;
+				input.aabb = chunk_states[0].aabb;
+				return input;
 			}
 
-			assert(input.events.size() <= context.intersectables.size() * MAX_EVENTS_PER_INTERSECTABLE);
+			std::vector<std::size_t> run_starts = {0};
+
+			for (const InitialChunkState &state : chunk_states) {
+				run_starts.push_back(run_starts.back() + state.events.size());
+				input.aabb.merge(state.aabb);
+			}
 
-			std::sort(input.events.begin(), input.events.end());
+			std::vector<BuildEvent> merged_events(run_starts.back());
+			events.resize(run_starts.back());
+
+			parallel_for_chunks(context.thread_pool,
+			                    0,
+			                    threads,
+			                    threads,
+			                    [&](unsigned int t, std::size_t /*start_t*/, std::size_t /*end_t*/) {
+				                    std::vector<BuildEvent> &chunk_events = chunk_states[t].events;
+				                    std::copy(chunk_events.cbegin(),
+				                              chunk_events.cend(),
+				                              events.begin() + std::ptrdiff_t(run_starts[t]));
+				                    chunk_events = std::vector<BuildEvent>();
+			                    });
+
+			while (run_starts.size() > 2) {
+				auto num_runs = unsigned(run_starts.size() - 1);
+				unsigned int num_merges = (num_runs + 1) / 2;
+
+				auto merge_run_pair = [&](unsigned int m, auto, auto) {
+					auto run = [&](unsigned int r) {
+						return events.begin() + std::ptrdiff_t(run_starts[r]);
+					};
+					auto out = merged_events.begin() + std::ptrdiff_t(run_starts[2 * m]);
+					unsigned int end_run = std::min(2 * m + 2, num_runs);
+					auto first = run(2 * m);
+					auto middle = run(std::min(2 * m + 1, end_run));
+					auto last = run(end_run);
+
+					if (middle == last)
+						std::copy(first, last, out);
+					else
+						std::merge(first, middle, middle, last, out);
+				};
+
+				parallel_for_chunks(context.thread_pool, 0, num_merges, num_merges, merge_run_pair);
+
+				std::vector<std::size_t> merged_run_starts;
+
+				for (std::size_t r = 0; r < run_starts.size(); r += 2)
+					merged_run_starts.push_back(run_starts[r]);
+				if (merged_run_starts.back() != run_starts.back())
+					merged_run_starts.push_back(run_starts.back());
+
+				run_starts = std::move(merged_run_starts);
+				events.swap(merged_events);
+			}
+
+			input.events = events;
 
 			return input;
 		}
@@ -835,13 +1566,13 @@ namespace Rayni
 
 				build_node_to_nodes(indices, nodes, build_node->split.right);
 			} else {
-				if (build_node->leaf.indices.size() == 1) {
+				if (build_node->leaf.count == 1) {
 					nodes.emplace_back(1, build_node->leaf.indices[0]);
 				} else {
-					nodes.emplace_back(std::uint32_t(build_node->leaf.indices.size()),
-					                   std::uint32_t(indices.size()));
-					for (std::uint32_t i : build_node->leaf.indices)
-						indices.emplace_back(i);
+					nodes.emplace_back(build_node->leaf.count, std::uint32_t(indices.size()));
+					indices.insert(indices.end(),
+					               build_node->leaf.indices,
+					               build_node->leaf.indices + build_node->leaf.count);
 				}
 			}
 		}
@@ -964,21 +1695,68 @@ namespace Rayni
 			         double(aabb.maximum().y()),
 			         double(aabb.maximum().z()));
 		}
+
+		// See validate_nodes() in bvh.cpp. Leafs may be one level deeper than
+		// ABSOLUTE_MAX_DEPTH since only inner nodes push on traversal stacks. A leaf
+		// with one index stores index of intersectable instead of offset.
+		Result<void> validate_nodes(const Node *nodes,
+		                            std::size_t num_nodes,
+		                            std::size_t num_indices,
+		                            std::size_t num_intersectables)
+		{
+			std::vector<unsigned int> depths(num_nodes, 0);
+
+			for (std::size_t i = 0; i < num_nodes; i++) {
+				const Node &node = nodes[i];
+
+				if (node.is_leaf()) {
+					std::uint64_t offset = node.index_offset();
+					bool in_range = node.index_count() == 1 ? offset < num_intersectables
+					                                        : offset + node.index_count() <= num_indices;
+					if (!in_range)
+						return Error("leaf in cache file is out of range");
+					continue;
+				}
+
+				std::size_t right = std::size_t(node.right() - nodes);
+
+				if (depths[i] >= ABSOLUTE_MAX_DEPTH)
+					return Error("node in cache file is too deep");
+
+				if (right <= i + 1 || right >= num_nodes)
+					return Error("node in cache file is invalid");
+
+				depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+				depths[right] = std::max(depths[right], depths[i] + 1);
+			}
+
+			return {};
+		}
 	}
 
-	std::unique_ptr<Intersectable> kdtree_build(std::vector<const Intersectable *> &&intersectables,
-	                                            const Cancellable &cancellable,
-	                                            ThreadPool &thread_pool)
+	std::unique_ptr<KdTree> kdtree_build(std::vector<const Intersectable *> &&intersectables,
+	                                     const Cancellable &cancellable,
+	                                     ThreadPool &thread_pool)
 	{
 		auto stopwatch = Stopwatch().start();
 
 		BuildContext context(std::move(intersectables), cancellable, thread_pool);
 		prepare_build_context(context);
 
-		BuildInput input = initial_build_input(context);
+		unsigned int threads = std::max(thread_pool.size(), 1U);
+		BuildInput input = initial_build_input(context, threads);
 		AABB aabb = input.aabb;
 		unsigned int max_depth = max_depth_limit(context.intersectables.size());
-		const BuildNode *root = create_build_node(context, max_depth, std::move(input));
+		const BuildNode *root = create_build_node(context, max_depth, std::move(input), threads);
+
+		// Nodes created after cancellation are leaves with whatever is left,
+		// do not bother flattening them. Build nodes are freed with context.
+		if (cancellable.cancelled())
+			return nullptr;
+
+		for (BuildThreadState &state : context.thread_states)
+			for (Arena &arena : state.input_arenas)
+				arena.release();
 
 		std::uint32_t indices_count;
 		std::uint32_t node_count = build_nodes_used(context, indices_count);
@@ -994,12 +1772,50 @@ namespace Rayni
 
 		stopwatch.stop();
 
-		if (!cancellable.cancelled())
-			log_build_info(stopwatch, context.intersectables, nodes, indices, aabb);
+		log_build_info(stopwatch, context.intersectables, nodes, indices, aabb);
+
+		return std::make_unique<FlatKdTree>(std::move(context.intersectables),
+		                                    CacheableVector<std::uint32_t>(std::move(indices)),
+		                                    CacheableVector<Node>(std::move(nodes)),
+		                                    aabb);
+	}
 
-		return std::make_unique<KdTree>(std::move(context.intersectables),
-		                                std::move(indices),
-		                                std::move(nodes),
-		                                aabb);
+	Result<std::unique_ptr<KdTree>> kdtree_load(const std::string &path,
+	                                            std::uint64_t key,
+	                                            const std::vector<const Intersectable *> &intersectables)
+	{
+		CacheFile file;
+		if (auto r = file.map(path,
+		                      CACHE_FILE_TYPE,
+		                      CACHE_FILE_VERSION,
+		                      key,
+		                      {sizeof(std::uint32_t), sizeof(Node), sizeof(AABB)});
+		    !r)
+			return r.error();
+
+		if (file.array_size(1) == 0 || file.array_size(2) != 1)
+			return Error(path, "no nodes or AABB in cache file");
+
+		CacheableVector<std::uint32_t> indices(file, 0);
+
+		for (std::size_t i = 0; i < indices.size(); i++)
+			if (indices[i] >= intersectables.size())
+				return Error(path, "intersectable index in cache file is out of range");
+
+		if (auto r = validate_nodes(file.array_data<Node>(1),
+		                            file.array_size(1),
+		                            indices.size(),
+		                            intersectables.size());
+		    !r)
+			return Error(path, r.error().message());
+
+		CacheableVector<Node> nodes(file, 1);
+		AABB aabb = file.array_data<AABB>(2)[0];
+
+		return std::unique_ptr<KdTree>(std::make_unique<FlatKdTree>(std::vector(intersectables),
+		                                                            std::move(indices),
+		                                                            std::move(nodes),
+		                                                            aabb,
+		                                                            std::move(file)));
 	}
 }
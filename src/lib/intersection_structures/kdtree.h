@@ -20,18 +20,39 @@
 #ifndef RAYNI_LIB_INTERSECTION_STRUCTURES_KDTREE_H
 #define RAYNI_LIB_INTERSECTION_STRUCTURES_KDTREE_H
 
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "lib/concurrency/cancellable.h"
 #include "lib/concurrency/thread_pool.h"
+#include "lib/function/result.h"
 #include "lib/intersectable.h"
 
 namespace Rayni
 {
-	std::unique_ptr<Intersectable> kdtree_build(std::vector<const Intersectable *> &&intersectables,
-	                                            const Cancellable &cancellable,
-	                                            ThreadPool &thread_pool);
+	class KdTree : public Intersectable
+	{
+	public:
+		// Saves nodes to a CacheFile that can be loaded with kdtree_load() instead
+		// of building kd-tree again. Key should identify intersectables that
+		// kd-tree was built from, e.g. a hash of their AABBs.
+		virtual Result<void> save(const std::string &path, std::uint64_t key) const = 0;
+	};
+
+	// Returns nullptr if cancelled. Memory used by build is freed before
+	// returning, nothing is done after cancellation has been noticed.
+	std::unique_ptr<KdTree> kdtree_build(std::vector<const Intersectable *> &&intersectables,
+	                                     const Cancellable &cancellable,
+	                                     ThreadPool &thread_pool);
+
+	// Loads a kd-tree saved with KdTree::save(). Intersectables must be the same,
+	// in the same order, as the ones passed to kdtree_build(). Nodes are used
+	// directly from the memory mapped file.
+	Result<std::unique_ptr<KdTree>> kdtree_load(const std::string &path,
+	                                            std::uint64_t key,
+	                                            const std::vector<const Intersectable *> &intersectables);
 }
 
 #endif // RAYNI_LIB_INTERSECTION_STRUCTURES_KDTREE_H
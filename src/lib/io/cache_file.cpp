@@ -0,0 +1,240 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2013-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/io/cache_file.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+#include "lib/function/result.h"
+#include "lib/function/scope_exit.h"
+
+namespace Rayni
+{
+	namespace
+	{
+		constexpr char MAGIC[8] = {'R', 'A', 'Y', 'N', 'I', 'C', 'F', '\0'};
+		constexpr std::uint32_t FORMAT_VERSION = 1;
+		constexpr std::size_t TYPE_SIZE = 16;
+
+		struct Header
+		{
+			char magic[sizeof(MAGIC)];
+			std::uint32_t format_version;
+			std::uint32_t num_arrays;
+			char type[TYPE_SIZE];
+			std::uint32_t version;
+			std::uint32_t padding;
+			std::uint64_t key;
+		};
+
+		// 0666 with umask applied. umask() can only be read by setting it, which
+		// affects all threads, so it is only done once.
+		mode_t file_creation_mode()
+		{
+			static const mode_t mode = [] {
+				mode_t mask = umask(0);
+				umask(mask);
+				return (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH) & ~mask;
+			}();
+
+			return mode;
+		}
+
+		std::uint64_t align_offset(std::uint64_t offset)
+		{
+			constexpr std::uint64_t ALIGNMENT = RAYNI_L1_CACHE_LINE_SIZE;
+			return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		}
+
+		// Writes zeros from pos up to offset and then data.
+		Result<void> write_at(std::FILE *file,
+		                      std::uint64_t &pos,
+		                      std::uint64_t offset,
+		                      const void *data,
+		                      std::size_t size)
+		{
+			static constexpr std::uint8_t ZEROS[RAYNI_L1_CACHE_LINE_SIZE] = {};
+
+			while (pos < offset) {
+				std::size_t padding = std::min(std::size_t(offset - pos), sizeof(ZEROS));
+				if (std::fwrite(ZEROS, 1, padding, file) != padding)
+					return Error("failed to write to file");
+				pos += padding;
+			}
+
+			if (size > 0 && std::fwrite(data, 1, size, file) != size)
+				return Error("failed to write to file");
+
+			pos += size;
+
+			return {};
+		}
+	}
+
+	Result<void> CacheFile::write(const std::string &path,
+	                              const std::string &type,
+	                              std::uint32_t version,
+	                              std::uint64_t key,
+	                              const std::vector<Array> &arrays)
+	{
+		if (type.size() >= TYPE_SIZE)
+			return Error(path, "cache file type \"" + type + "\" is too long");
+
+		Header header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.format_version = FORMAT_VERSION;
+		header.num_arrays = std::uint32_t(arrays.size());
+		std::memcpy(header.type, type.c_str(), type.size());
+		header.version = version;
+		header.key = key;
+
+		std::vector<ArrayInfo> array_infos;
+		std::uint64_t offset = sizeof(Header) + arrays.size() * sizeof(ArrayInfo);
+
+		for (const Array &array : arrays) {
+			offset = align_offset(offset);
+			array_infos.push_back({offset, array.size, array.element_size});
+			offset += array.size * array.element_size;
+		}
+
+		// Unique temporary file in same directory as path. Several processes may
+		// write a cache file for the same key at the same time (e.g. jobs that start
+		// rendering the same scene), each one must rename a complete file of its own.
+		std::string temp_path = path + ".XXXXXX";
+		int fd = mkstemp(temp_path.data());
+		if (fd == -1)
+			return Error(temp_path, "failed to create temporary file");
+
+		// mkstemp() creates file readable by owner only, give it the permissions a
+		// file created with fopen() would get.
+		std::FILE *file = fchmod(fd, file_creation_mode()) == 0 ? fdopen(fd, "wb") : nullptr;
+		if (!file) {
+			close(fd);
+			std::remove(temp_path.c_str());
+			return Error(temp_path, "failed to open file for writing");
+		}
+		auto file_close = scope_exit([&] {
+			if (file)
+				std::fclose(file);
+		});
+
+		std::uint64_t pos = 0;
+		Result<void> result = write_at(file, pos, 0, &header, sizeof(header));
+
+		for (std::size_t i = 0; i < array_infos.size() && result; i++)
+			result = write_at(file, pos, pos, &array_infos[i], sizeof(ArrayInfo));
+
+		for (std::size_t i = 0; i < arrays.size() && result; i++)
+			result = write_at(file,
+			                  pos,
+			                  array_infos[i].offset,
+			                  arrays[i].data,
+			                  arrays[i].size * arrays[i].element_size);
+
+		if (std::fclose(std::exchange(file, nullptr)) != 0 && result)
+			result = Error("failed to close file");
+
+		if (result && std::rename(temp_path.c_str(), path.c_str()) != 0)
+			result = Error("failed to rename file");
+
+		if (!result) {
+			std::remove(temp_path.c_str());
+			return Error(temp_path, result.error().message());
+		}
+
+		return {};
+	}
+
+	Result<void> CacheFile::map(const std::string &path,
+	                            const std::string &type,
+	                            std::uint32_t version,
+	                            std::uint64_t key,
+	                            const std::vector<std::size_t> &element_sizes)
+	{
+		arrays_.clear();
+
+		if (auto r = file_.map(path); !r)
+			return r.error();
+
+		auto fail = [&](const std::string &message) {
+			file_.unmap();
+			arrays_.clear();
+			return Error(path, message);
+		};
+
+		if (file_.size() < sizeof(Header))
+			return fail("cache file is too small");
+
+		const auto *bytes = static_cast<const std::uint8_t *>(file_.data());
+		Header header;
+		std::memcpy(&header, bytes, sizeof(header));
+
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+			return fail("not a cache file");
+		if (header.format_version != FORMAT_VERSION)
+			return fail("unsupported cache file format version");
+		if (header.type[TYPE_SIZE - 1] != '\0' || type != header.type)
+			return fail("cache file type is not \"" + type + "\"");
+		if (header.version != version)
+			return fail("cache file version mismatch");
+		if (header.key != key)
+			return fail("cache file key mismatch");
+		if (header.num_arrays != element_sizes.size() ||
+		    file_.size() < sizeof(Header) + header.num_arrays * sizeof(ArrayInfo))
+			return fail("unexpected number of arrays in cache file");
+
+		for (std::size_t i = 0; i < element_sizes.size(); i++) {
+			ArrayInfo array;
+			std::memcpy(&array, bytes + sizeof(Header) + i * sizeof(ArrayInfo), sizeof(array));
+
+			if (array.element_size != element_sizes[i])
+				return fail("unexpected element size in cache file");
+			if (array.offset % RAYNI_L1_CACHE_LINE_SIZE != 0 || array.offset > file_.size() ||
+			    array.size > (file_.size() - array.offset) / array.element_size)
+				return fail("array is out of bounds in cache file");
+
+			arrays_.push_back(array);
+		}
+
+		return {};
+	}
+
+	std::size_t CacheFile::array_size(std::size_t index) const
+	{
+		assert(index < arrays_.size());
+		return arrays_[index].size;
+	}
+
+	const void *CacheFile::array_data_bytes(std::size_t index) const
+	{
+		assert(index < arrays_.size());
+		return static_cast<const std::uint8_t *>(file_.data()) + arrays_[index].offset;
+	}
+}
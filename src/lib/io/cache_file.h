@@ -0,0 +1,171 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2013-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_IO_CACHE_FILE_H
+#define RAYNI_LIB_IO_CACHE_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "lib/function/result.h"
+#include "lib/system/memory_mapped_file.h"
+
+namespace Rayni
+{
+	// File with arrays of trivially copyable elements (e.g. flattened nodes of an
+	// intersection structure) that are used in place after loading since the file
+	// is memory mapped. Header has a type name and version, and a key (e.g. hash
+	// of data that arrays were derived from) that must match when mapping.
+	//
+	// Arrays are aligned to cache line size and stored in native byte order and
+	// layout. Files are meant to be used as a cache on the machine that wrote
+	// them, they are not portable.
+	class CacheFile
+	{
+	public:
+		struct Array
+		{
+			template <typename T>
+			Array(const T *data_in, std::size_t size_in) :
+			        data(data_in),
+			        size(size_in),
+			        element_size(sizeof(T))
+			{
+				static_assert(std::is_trivially_copyable_v<T>);
+			}
+
+			template <typename T, typename Allocator>
+			explicit Array(const std::vector<T, Allocator> &vector) : Array(vector.data(), vector.size())
+			{
+			}
+
+			const void *data;
+			std::size_t size;
+			std::size_t element_size;
+		};
+
+		// File is written to a unique temporary file that is then renamed, a
+		// process mapping path at the same time either sees a complete file or no
+		// file. Also when several processes write the same path concurrently.
+		static Result<void> write(const std::string &path,
+		                          const std::string &type,
+		                          std::uint32_t version,
+		                          std::uint64_t key,
+		                          const std::vector<Array> &arrays);
+
+		// Fails if type, version or key differ from when file was written or if
+		// number of arrays or size of elements in them differ from element_sizes.
+		Result<void> map(const std::string &path,
+		                 const std::string &type,
+		                 std::uint32_t version,
+		                 std::uint64_t key,
+		                 const std::vector<std::size_t> &element_sizes);
+
+		template <typename T>
+		const T *array_data(std::size_t index) const
+		{
+			return static_cast<const T *>(array_data_bytes(index));
+		}
+
+		std::size_t array_size(std::size_t index) const;
+
+	private:
+		struct ArrayInfo
+		{
+			std::uint64_t offset;
+			std::uint64_t size;
+			std::uint64_t element_size;
+		};
+
+		const void *array_data_bytes(std::size_t index) const;
+
+		MemoryMappedFile file_;
+		std::vector<ArrayInfo> arrays_;
+	};
+
+	// Elements that are either owned or stored in a CacheFile (that must outlive
+	// the vector). Used by structures that are built or loaded from a cache.
+	template <typename T, typename Allocator = std::allocator<T>>
+	class CacheableVector
+	{
+	public:
+		explicit CacheableVector(std::vector<T, Allocator> &&vector) :
+		        vector_(std::move(vector)),
+		        data_(vector_.data()),
+		        size_(vector_.size())
+		{
+		}
+
+		CacheableVector(const CacheFile &file, std::size_t array_index) :
+		        data_(file.array_data<T>(array_index)),
+		        size_(file.array_size(array_index))
+		{
+		}
+
+		CacheableVector(const CacheableVector &other) = delete;
+		CacheableVector(CacheableVector &&other) = default;
+
+		CacheableVector &operator=(const CacheableVector &other) = delete;
+		CacheableVector &operator=(CacheableVector &&other) = default;
+
+		const T &operator[](std::size_t i) const
+		{
+			return data_[i];
+		}
+
+		const T *data() const
+		{
+			return data_;
+		}
+
+		std::size_t size() const
+		{
+			return size_;
+		}
+
+		bool in_cache_file() const
+		{
+			return size_ > 0 && data_ != vector_.data();
+		}
+
+		// Elements in a cache file are read only, they are copied to an owned
+		// vector first.
+		T *mutable_data()
+		{
+			if (in_cache_file()) {
+				vector_.assign(data_, data_ + size_);
+				data_ = vector_.data();
+			}
+
+			return vector_.data();
+		}
+
+	private:
+		std::vector<T, Allocator> vector_;
+		const T *data_;
+		std::size_t size_;
+	};
+}
+
+#endif // RAYNI_LIB_IO_CACHE_FILE_H
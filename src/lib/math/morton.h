@@ -0,0 +1,97 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2015-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_MATH_MORTON_H
+#define RAYNI_LIB_MATH_MORTON_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "lib/math/aabb.h"
+#include "lib/math/math.h"
+#include "lib/math/vector3.h"
+
+namespace Rayni
+{
+	// Spreads lowest 21 bits of value so that there are 2 zero bits between each bit.
+	static constexpr inline std::uint64_t morton_expand_bits(std::uint64_t value)
+	{
+		value &= 0x1fffff;
+		value = (value | value << 32) & 0x1f00000000ffff;
+		value = (value | value << 16) & 0x1f0000ff0000ff;
+		value = (value | value << 8) & 0x100f00f00f00f00f;
+		value = (value | value << 4) & 0x10c30c30c30c30c3;
+		value = (value | value << 2) & 0x1249249249249249;
+		return value;
+	}
+
+	// Interleaves bits of x, y and z (at most 21 bits each) into a 63 bit code.
+	// Bit 3 * n + 2 is bit n of x, 3 * n + 1 is bit n of y and 3 * n is bit n of z.
+	static constexpr inline std::uint64_t morton_code(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+	{
+		return (morton_expand_bits(x) << 2) | (morton_expand_bits(y) << 1) | morton_expand_bits(z);
+	}
+
+	// Axis that bit at position bit in a code from morton_code() belongs to.
+	static constexpr inline unsigned int morton_code_bit_axis(unsigned int bit)
+	{
+		return 2 - bit % 3;
+	}
+
+	// Quantizes points inside an AABB to a grid with 2^bits_per_axis cells along
+	// each axis and returns Morton code of the cell that point is in.
+	class MortonEncoder
+	{
+	public:
+		static constexpr unsigned int MAX_BITS_PER_AXIS = 21;
+
+		MortonEncoder(const AABB &aabb, unsigned int bits_per_axis) :
+		        min_(aabb.minimum()),
+		        max_cell_((1U << bits_per_axis) - 1)
+		{
+			assert(bits_per_axis > 0 && bits_per_axis <= MAX_BITS_PER_AXIS);
+
+			real_t cells = real_t(max_cell_) + 1;
+
+			for (unsigned int axis = 0; axis < 3; axis++) {
+				real_t extent = aabb.maximum()[axis] - aabb.minimum()[axis];
+				scale_[axis] = aabb.is_planar(axis) ? 0 : cells / extent;
+			}
+		}
+
+		std::uint64_t code(const Vector3 &point) const
+		{
+			return morton_code(cell(point, 0), cell(point, 1), cell(point, 2));
+		}
+
+	private:
+		std::uint32_t cell(const Vector3 &point, unsigned int axis) const
+		{
+			real_t c = std::max((point[axis] - min_[axis]) * scale_[axis], real_t(0));
+			return std::min(std::uint32_t(c), max_cell_);
+		}
+
+		Vector3 min_;
+		real_t scale_[3];
+		std::uint32_t max_cell_;
+	};
+}
+
+#endif // RAYNI_LIB_MATH_MORTON_H
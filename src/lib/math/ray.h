@@ -20,6 +20,8 @@
 #ifndef RAYNI_LIB_MATH_RAY_H
 #define RAYNI_LIB_MATH_RAY_H
 
+#include <cstddef>
+
 #include "lib/math/math.h"
 #include "lib/math/vector3.h"
 
@@ -39,6 +41,22 @@ namespace Rayni
 		real_t time;
 	};
 
+	// True if all rays have the same (non-zero) direction sign for each axis. Used to decide if
+	// rays are coherent enough to be traversed together as a packet. Also means that near
+	// and far child of a split are the same for all rays.
+	static inline bool rays_have_same_direction_signs(const Ray *rays, std::size_t count)
+	{
+		for (unsigned int axis = 0; axis < 3; axis++) {
+			bool negative = rays[0].direction[axis] < 0;
+
+			for (std::size_t i = 0; i < count; i++)
+				if (rays[i].direction[axis] == 0 || (rays[i].direction[axis] < 0) != negative)
+					return false;
+		}
+
+		return true;
+	}
+
 	// Generate ray from origin taking error used to calculate origin into account to avoid
 	// self-intersection.
 	//
@@ -0,0 +1,302 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/shapes/triangle_mesh.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "lib/math/vector3.h"
+
+// Ray/triangle intersection algorithms, see:
+//
+// Möller, T. and Trumbore, B., 1997, Fast, Minimum Storage Ray/Triangle
+// Intersection
+// https://doi.org/10.1080/10867651.1997.10487468
+//
+// Woop, S., Benthin, C. and Wald, I., 2013, Watertight Ray/Triangle
+// Intersection
+// http://jcgt.org/published/0002/01/05/
+//
+// Both are written as loops over all triangles in a block without early exits
+// so that compiler can vectorize them. Misses get t = infinity.
+//
+// This file is compiled with -ffp-contract=off (see meson.build). If edge
+// functions in watertight algorithm are contracted into FMAs, U, V and W of a
+// degenerate triangle become rounding residuals with the same sign instead of
+// 0 and it is reported as hit.
+//
+// TODO: Watertight algorithm falls back to double precision when U, V or W is
+//       0 in paper. Not done here, edges shared by triangles in single
+//       precision are still handled consistently since U, V and W are
+//       calculated the same way for both triangles.
+
+namespace Rayni
+{
+	TriangleMesh::TriangleMesh(TriangleMeshData &&data) : data_(std::move(data))
+	{
+		std::vector<std::uint32_t> triangles = TriangleMeshData::triangles_in_morton_order(data_);
+
+		blocks_.reserve((triangles.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+		for (std::size_t i = 0; i < triangles.size(); i += BLOCK_SIZE) {
+			auto num_triangles = unsigned(std::min<std::size_t>(BLOCK_SIZE, triangles.size() - i));
+			blocks_.emplace_back(*this, &triangles[i], num_triangles);
+		}
+	}
+
+	std::vector<const Intersectable *> TriangleMesh::intersectables() const
+	{
+		std::vector<const Intersectable *> intersectables;
+		intersectables.reserve(blocks_.size());
+
+		for (const Block &block : blocks_)
+			intersectables.push_back(&block);
+
+		return intersectables;
+	}
+
+	void TriangleMesh::set_intersection(const Ray &ray,
+	                                    std::uint32_t triangle,
+	                                    const Hit &hit,
+	                                    const Intersectable &intersectable,
+	                                    Intersection &intersection) const
+	{
+		TriangleMeshData::Indices is = data_.indices[triangle];
+		const Vector3 &point1 = data_.points[is.index1];
+		const Vector3 &point2 = data_.points[is.index2];
+		const Vector3 &point3 = data_.points[is.index3];
+		Vector3 weighted_point1 = hit.b0 * point1;
+		Vector3 weighted_point2 = hit.b1 * point2;
+		Vector3 weighted_point3 = hit.b2 * point3;
+
+		intersection.t = hit.t;
+		intersection.point = weighted_point1 + weighted_point2 + weighted_point3;
+		intersection.point_error =
+		        error_bound_gamma(7) * (weighted_point1.abs() + weighted_point2.abs() + weighted_point3.abs());
+		intersection.incident = -ray.direction;
+		intersection.intersectable = &intersectable;
+
+		if (data_.normals.empty()) {
+			intersection.normal = (point2 - point1).cross(point3 - point1).normalize();
+		} else {
+			intersection.normal = (hit.b0 * data_.normals[is.index1] + hit.b1 * data_.normals[is.index2] +
+			                       hit.b2 * data_.normals[is.index3])
+			                              .normalize();
+		}
+
+		if (data_.uvs.empty()) {
+			intersection.u = hit.b1;
+			intersection.v = hit.b2;
+		} else {
+			const TriangleMeshData::UV &uv1 = data_.uvs[is.index1];
+			const TriangleMeshData::UV &uv2 = data_.uvs[is.index2];
+			const TriangleMeshData::UV &uv3 = data_.uvs[is.index3];
+
+			intersection.u = hit.b0 * uv1.u + hit.b1 * uv2.u + hit.b2 * uv3.u;
+			intersection.v = hit.b0 * uv1.v + hit.b1 * uv2.v + hit.b2 * uv3.v;
+		}
+	}
+
+	TriangleMesh::Block::Block(const TriangleMesh &mesh, const std::uint32_t *triangles, unsigned int count) :
+	        mesh_(mesh),
+	        count_(count)
+	{
+		const TriangleMeshData &data = mesh.data_;
+
+		for (unsigned int lane = 0; lane < BLOCK_SIZE; lane++) {
+			if (lane >= count) {
+				// Degenerate, all vertices are first vertex in block.
+				for (unsigned int vertex = 0; vertex < 3; vertex++)
+					for (unsigned int axis = 0; axis < 3; axis++)
+						vertices_[vertex][axis][lane] = vertices_[0][axis][0];
+
+				triangles_[lane] = triangles_[0];
+				continue;
+			}
+
+			TriangleMeshData::Indices is = data.indices[triangles[lane]];
+			const Vector3 *points[3] = {&data.points[is.index1],
+			                            &data.points[is.index2],
+			                            &data.points[is.index3]};
+
+			for (unsigned int vertex = 0; vertex < 3; vertex++) {
+				for (unsigned int axis = 0; axis < 3; axis++)
+					vertices_[vertex][axis][lane] = (*points[vertex])[axis];
+
+				aabb_.merge(*points[vertex]);
+			}
+
+			triangles_[lane] = triangles[lane];
+		}
+	}
+
+	bool TriangleMesh::Block::intersect(const Ray &ray) const
+	{
+		Hit hit;
+
+		return intersect_triangles(ray, REAL_INFINITY, hit);
+	}
+
+	bool TriangleMesh::Block::intersect(const Ray &ray, Intersection &intersection) const
+	{
+		Hit hit;
+
+		if (!intersect_triangles(ray, intersection.t, hit))
+			return false;
+
+		mesh_.set_intersection(ray, triangles_[hit.lane], hit, *this, intersection);
+
+		return true;
+	}
+
+	bool TriangleMesh::Block::intersect_triangles(const Ray &ray, real_t t_max, Hit &hit) const
+	{
+		const auto &v1 = vertices_[0];
+		const auto &v2 = vertices_[1];
+		const auto &v3 = vertices_[2];
+
+		// Lanes are computed without branches so loops are vectorized. Unused
+		// lanes and lanes with a determinant of 0 (ray parallel to or degenerate
+		// triangle) are masked out. Determinant is replaced with 1 for them
+		// before dividing, -Ofast assumes there are no infinities or NaNs.
+
+		real_t ts[BLOCK_SIZE];
+		real_t b1s[BLOCK_SIZE];
+		real_t b2s[BLOCK_SIZE];
+
+#if RAYNI_RAY_TRIANGLE_INTERSECTION == RAYNI_RAY_TRIANGLE_INTERSECTION_MOLLER_TRUMBORE
+		const Vector3 &o = ray.origin;
+		const Vector3 &d = ray.direction;
+
+		for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
+			real_t e1x = v2[0][i] - v1[0][i];
+			real_t e1y = v2[1][i] - v1[1][i];
+			real_t e1z = v2[2][i] - v1[2][i];
+			real_t e2x = v3[0][i] - v1[0][i];
+			real_t e2y = v3[1][i] - v1[1][i];
+			real_t e2z = v3[2][i] - v1[2][i];
+
+			real_t px = d.y() * e2z - d.z() * e2y;
+			real_t py = d.z() * e2x - d.x() * e2z;
+			real_t pz = d.x() * e2y - d.y() * e2x;
+
+			real_t det = e1x * px + e1y * py + e1z * pz;
+			bool valid = (i < count_) & (det != 0);
+			real_t inv_det = 1 / (valid ? det : 1);
+
+			real_t sx = o.x() - v1[0][i];
+			real_t sy = o.y() - v1[1][i];
+			real_t sz = o.z() - v1[2][i];
+
+			real_t qx = sy * e1z - sz * e1y;
+			real_t qy = sz * e1x - sx * e1z;
+			real_t qz = sx * e1y - sy * e1x;
+
+			real_t b1 = (sx * px + sy * py + sz * pz) * inv_det;
+			real_t b2 = (d.x() * qx + d.y() * qy + d.z() * qz) * inv_det;
+			real_t t = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+
+			bool inside = (b1 >= 0) & (b2 >= 0) & (b1 + b2 <= 1);
+
+			ts[i] = valid & inside & (t > 0) ? t : REAL_INFINITY;
+			b1s[i] = b1;
+			b2s[i] = b2;
+		}
+#elif RAYNI_RAY_TRIANGLE_INTERSECTION == RAYNI_RAY_TRIANGLE_INTERSECTION_WATERTIGHT
+		// Ray is transformed so that it starts in origin and points along
+		// positive z (kz is axis with largest direction component). Triangle is
+		// then tested in 2D (x and y) with edge functions.
+		unsigned int kz = ray.direction.max_extent_axis();
+		unsigned int kx = (kz + 1) % 3;
+		unsigned int ky = (kx + 1) % 3;
+
+		if (ray.direction[kz] < 0)
+			std::swap(kx, ky); // Preserve winding.
+
+		real_t shear_x = ray.direction[kx] / ray.direction[kz];
+		real_t shear_y = ray.direction[ky] / ray.direction[kz];
+		real_t shear_z = 1 / ray.direction[kz];
+		real_t ox = ray.origin[kx];
+		real_t oy = ray.origin[ky];
+		real_t oz = ray.origin[kz];
+
+		for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
+			real_t az = v1[kz][i] - oz;
+			real_t bz = v2[kz][i] - oz;
+			real_t cz = v3[kz][i] - oz;
+			real_t ax = v1[kx][i] - ox - shear_x * az;
+			real_t ay = v1[ky][i] - oy - shear_y * az;
+			real_t bx = v2[kx][i] - ox - shear_x * bz;
+			real_t by = v2[ky][i] - oy - shear_y * bz;
+			real_t cx = v3[kx][i] - ox - shear_x * cz;
+			real_t cy = v3[ky][i] - oy - shear_y * cz;
+
+			real_t u = cx * by - cy * bx;
+			real_t v = ax * cy - ay * cx;
+			real_t w = bx * ay - by * ax;
+
+			bool inside = ((u >= 0) & (v >= 0) & (w >= 0)) | ((u <= 0) & (v <= 0) & (w <= 0));
+
+			real_t det = u + v + w;
+			bool valid = (i < count_) & (det != 0);
+			real_t inv_det = 1 / (valid ? det : 1);
+			real_t t = shear_z * (u * az + v * bz + w * cz) * inv_det;
+
+			ts[i] = valid & inside & (t > 0) ? t : REAL_INFINITY;
+			b1s[i] = v * inv_det;
+			b2s[i] = w * inv_det;
+		}
+#else
+#	error Unknown RAYNI_RAY_TRIANGLE_INTERSECTION
+#endif
+
+		unsigned int hit_mask = 0;
+
+		for (unsigned int i = 0; i < BLOCK_SIZE; i++)
+			hit_mask |= unsigned(ts[i] < t_max) << i;
+
+		if (hit_mask == 0)
+			return false;
+
+		unsigned int nearest = unsigned(std::countr_zero(hit_mask));
+		real_t nearest_t = ts[nearest];
+
+		for (hit_mask &= hit_mask - 1; hit_mask != 0; hit_mask &= hit_mask - 1) {
+			auto i = unsigned(std::countr_zero(hit_mask));
+
+			if (ts[i] < nearest_t) {
+				nearest = i;
+				nearest_t = ts[i];
+			}
+		}
+
+		hit.lane = nearest;
+		hit.t = nearest_t;
+		hit.b1 = b1s[nearest];
+		hit.b2 = b2s[nearest];
+		hit.b0 = 1 - hit.b1 - hit.b2;
+
+		return true;
+	}
+}
@@ -0,0 +1,118 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_SHAPES_TRIANGLE_MESH_H
+#define RAYNI_LIB_SHAPES_TRIANGLE_MESH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "config.h"
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/math/aabb.h"
+#include "lib/math/math.h"
+#include "lib/math/ray.h"
+#include "lib/shapes/triangle_mesh_data.h"
+
+namespace Rayni
+{
+	// Triangles are grouped in blocks of spatially close triangles (sorted by
+	// Morton code of centroid). Vertices of a block are copied and stored as a
+	// structure of arrays so that a ray is tested against all triangles in a
+	// block in one pass (loops over triangles are vectorized by the compiler).
+	// Each block is an Intersectable, an intersection structure is built from
+	// intersectables() instead of from one Intersectable per triangle. Saves a
+	// virtual call and fetching vertices through indices for each triangle.
+	//
+	// Ray/triangle algorithm is selected with RAYNI_RAY_TRIANGLE_INTERSECTION.
+	class TriangleMesh
+	{
+	public:
+		// One 256 bit register (AVX) worth of real_t per vertex component.
+		static constexpr unsigned int BLOCK_SIZE = RAYNI_DOUBLE_PRECISION ? 4 : 8;
+
+		explicit TriangleMesh(TriangleMeshData &&data);
+
+		TriangleMesh(const TriangleMesh &other) = delete;
+		TriangleMesh(TriangleMesh &&other) = delete;
+		TriangleMesh &operator=(const TriangleMesh &other) = delete;
+		TriangleMesh &operator=(TriangleMesh &&other) = delete;
+
+		const TriangleMeshData &data() const
+		{
+			return data_;
+		}
+
+		std::vector<const Intersectable *> intersectables() const;
+
+	private:
+		struct Hit
+		{
+			unsigned int lane;
+			real_t t;
+
+			// Barycentric coordinates, weights of vertex 1, 2 and 3.
+			real_t b0;
+			real_t b1;
+			real_t b2;
+		};
+
+		class alignas(RAYNI_L1_CACHE_LINE_SIZE) Block : public Intersectable
+		{
+		public:
+			Block(const TriangleMesh &mesh, const std::uint32_t *triangles, unsigned int count);
+
+			AABB aabb() const override
+			{
+				return aabb_;
+			}
+
+			bool intersect(const Ray &ray) const override;
+			bool intersect(const Ray &ray, Intersection &intersection) const override;
+
+		private:
+			bool intersect_triangles(const Ray &ray, real_t t_max, Hit &hit) const;
+
+			const TriangleMesh &mesh_;
+
+			// Indexed by vertex, axis and lane. Unused lanes (lane >= count_)
+			// are degenerate triangles and are masked out when intersecting.
+			real_t vertices_[3][3][BLOCK_SIZE];
+
+			// Index of triangle in TriangleMeshData::indices for each lane.
+			std::uint32_t triangles_[BLOCK_SIZE];
+
+			unsigned int count_;
+
+			AABB aabb_;
+		};
+
+		void set_intersection(const Ray &ray,
+		                      std::uint32_t triangle,
+		                      const Hit &hit,
+		                      const Intersectable &intersectable,
+		                      Intersection &intersection) const;
+
+		TriangleMeshData data_;
+		std::vector<Block> blocks_;
+	};
+}
+
+#endif // RAYNI_LIB_SHAPES_TRIANGLE_MESH_H
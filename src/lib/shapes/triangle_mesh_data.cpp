@@ -19,15 +19,20 @@
 
 #include "lib/shapes/triangle_mesh_data.h"
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "lib/concurrency/parallel_for.h"
 #include "lib/containers/variant.h"
-#include "lib/io/binary_reader.h"
+#include "lib/log.h"
+#include "lib/math/aabb.h"
+#include "lib/math/morton.h"
 #include "lib/math/vector3.h"
 #include "lib/string/base85.h"
 
@@ -35,64 +40,81 @@ namespace Rayni
 {
 	namespace
 	{
+		// Base85 encoded data is decoded in blocks of DECODE_BLOCK_GROUPS * 4
+		// bytes straight into integers on the stack. A block is a whole number of
+		// values for all values decoded below (1, 2 or 3 integers of 1, 2 or 4
+		// bytes).
+		constexpr std::size_t DECODE_BLOCK_GROUPS = 96;
+
 		template <typename V, typename I, std::size_t INTS_PER_VALUE>
 		Result<std::vector<V>> decode_fixed_point_values(const Variant &v,
 		                                                 const std::string &key,
 		                                                 unsigned int denominator)
 		{
+			static constexpr std::size_t BLOCK_INTS = DECODE_BLOCK_GROUPS * 4 / sizeof(I);
+			static_assert(BLOCK_INTS % INTS_PER_VALUE == 0);
+
 			const Variant *vstr = v.get(key);
 			if (!vstr || !vstr->is_string())
 				return Error(v.path(), "missing " + key + " with string value");
 
-			auto data = base85_decode(vstr->as_string());
-			if (!data)
-				return Error(v.path(), "invalid base85 encoded string in " + key);
-
-			std::size_t number_of_values = data->size() / (sizeof(I) * INTS_PER_VALUE);
-			BinaryReader reader;
+			const std::string &str = vstr->as_string();
+			std::size_t number_of_groups = base85_groups(str);
+			std::array<I, BLOCK_INTS> integers;
+			std::array<real_t, BLOCK_INTS> reals;
 			std::vector<V> values;
 
-			reader.set_data(std::move(*data));
+			values.reserve(base85_decoded_size(str) / (sizeof(I) * INTS_PER_VALUE));
+
+			for (std::size_t group = 0; group < number_of_groups; group += DECODE_BLOCK_GROUPS) {
+				std::size_t num_groups = std::min(DECODE_BLOCK_GROUPS, number_of_groups - group);
+				auto count = base85_decode_big_endian(str, group, num_groups, integers.data());
+				if (!count)
+					return Error(v.path(), "invalid base85 encoded string in " + key);
 
-			for (std::size_t i = 0; i < number_of_values; i++) {
-				std::array<real_t, INTS_PER_VALUE> reals;
+				for (std::size_t i = 0; i < *count; i++)
+					reals[i] = real_t(integers[i]) / real_t(denominator);
 
-				for (auto &real : reals)
-					real = real_t(*reader.read_big_endian<I>()) / real_t(denominator);
+				// Integers at end that do not make up a whole value are ignored.
+				for (std::size_t i = 0; i + INTS_PER_VALUE <= *count; i += INTS_PER_VALUE) {
+					std::array<real_t, INTS_PER_VALUE> value_reals;
 
-				values.emplace_back(reals);
+					std::copy_n(&reals[i], INTS_PER_VALUE, value_reals.begin());
+					values.emplace_back(value_reals);
+				}
 			}
 
 			return values;
 		}
 
-		template <typename V, typename I, std::size_t INTS_PER_VALUE>
-		Result<std::vector<V>> decode_integer_values(const Variant &v, const std::string &key)
+		template <typename I>
+		Result<TriangleMeshData::IndexBuffer> decode_index_buffer(const Variant &v, const std::string &key)
 		{
+			static constexpr std::size_t BLOCK_INTS = DECODE_BLOCK_GROUPS * 4 / sizeof(I);
+			static_assert(BLOCK_INTS % 3 == 0);
+
 			const Variant *vstr = v.get(key);
 			if (!vstr || !vstr->is_string())
 				return Error(v.path(), "missing " + key + " with string value");
 
-			auto data = base85_decode(vstr->as_string());
-			if (!data)
-				return Error(v.path(), "invalid base85 encoded string in " + key);
-
-			std::size_t number_of_values = data->size() / (sizeof(I) * INTS_PER_VALUE);
-			BinaryReader reader;
-			std::vector<V> values;
-
-			reader.set_data(std::move(*data));
+			const std::string &str = vstr->as_string();
+			std::size_t number_of_groups = base85_groups(str);
+			std::array<I, BLOCK_INTS> integers;
+			TriangleMeshData::IndexBuffer indices;
 
-			for (std::size_t i = 0; i < number_of_values; i++) {
-				std::array<I, INTS_PER_VALUE> integers;
+			indices.reserve(base85_decoded_size(str) / (sizeof(I) * 3));
 
-				for (auto &integer : integers)
-					integer = *reader.read_big_endian<I>();
+			for (std::size_t group = 0; group < number_of_groups; group += DECODE_BLOCK_GROUPS) {
+				std::size_t num_groups = std::min(DECODE_BLOCK_GROUPS, number_of_groups - group);
+				auto count = base85_decode_big_endian(str, group, num_groups, integers.data());
+				if (!count)
+					return Error(v.path(), "invalid base85 encoded string in " + key);
 
-				values.emplace_back(integers);
+				for (std::size_t i = 0; i + 3 <= *count; i += 3)
+					indices.emplace_back(integers[i], integers[i + 1], integers[i + 2]);
 			}
 
-			return values;
+			return indices;
 		}
 
 		Result<std::vector<Vector3>> decode_points(const Variant &v)
@@ -107,23 +129,22 @@ namespace Rayni
 			return points;
 		}
 
-		Result<std::vector<TriangleMeshData::Indices>> decode_indices(const Variant &v, std::size_t num_points)
+		Result<TriangleMeshData::IndexBuffer> decode_indices(const Variant &v, std::size_t num_points)
 		{
-			using Indices = TriangleMeshData::Indices;
-			std::vector<Indices> indices;
+			TriangleMeshData::IndexBuffer indices;
 
 			if (num_points <= 0xff) {
-				auto is = decode_integer_values<Indices, std::uint8_t, 3>(v, "indices");
+				auto is = decode_index_buffer<std::uint8_t>(v, "indices");
 				if (!is)
 					return is.error();
 				indices = std::move(*is);
 			} else if (num_points <= 0xffff) {
-				auto is = decode_integer_values<Indices, std::uint16_t, 3>(v, "indices");
+				auto is = decode_index_buffer<std::uint16_t>(v, "indices");
 				if (!is)
 					return is.error();
 				indices = std::move(*is);
 			} else {
-				auto is = decode_integer_values<Indices, std::uint32_t, 3>(v, "indices");
+				auto is = decode_index_buffer<std::uint32_t>(v, "indices");
 				if (!is)
 					return is.error();
 				indices = std::move(*is);
@@ -132,7 +153,7 @@ namespace Rayni
 			if (indices.empty())
 				return Error(v.path(), "no indices specified");
 
-			for (const auto &idx : indices)
+			for (const TriangleMeshData::Indices idx : indices)
 				if (idx.index1 >= num_points || idx.index2 >= num_points || idx.index3 >= num_points)
 					return Error(v.path(), "found index >= point count");
 
@@ -160,48 +181,69 @@ namespace Rayni
 
 			return uvs;
 		}
-	}
 
-	Result<TriangleMeshData> TriangleMeshData::from_variant(const Variant &v)
-	{
-		TriangleMeshData data;
+		Result<TriangleMeshData> decode_mesh_data(const Variant &v, ThreadPool *thread_pool)
+		{
+			TriangleMeshData data;
 
-		auto points = decode_points(v);
-		if (!points)
-			return points.error();
-		data.points = std::move(*points);
+			auto points = decode_points(v);
+			if (!points)
+				return points.error();
+			data.points = std::move(*points);
+
+			auto indices = decode_indices(v, data.points.size());
+			if (!indices)
+				return indices.error();
+			data.indices = std::move(*indices);
+
+			if (const Variant *vn = v.get("normals"); vn) {
+				if (vn->is_string() && vn->as_string() == "calculate") {
+					if (thread_pool)
+						TriangleMeshData::calculate_normals(data, *thread_pool);
+					else
+						TriangleMeshData::calculate_normals(data);
+				} else {
+					auto normals = decode_normals(v, data.points.size());
+					if (!normals)
+						return normals.error();
+					data.normals = std::move(*normals);
+				}
+			}
 
-		auto indices = decode_indices(v, data.points.size());
-		if (!indices)
-			return indices.error();
-		data.indices = std::move(*indices);
+			if (v.has("uvs")) {
+				auto uvs = decode_uvs(v, data.points.size());
+				if (!uvs)
+					return uvs.error();
+				data.uvs = std::move(*uvs);
+			}
 
-		if (const Variant *vn = v.get("normals"); vn) {
-			if (vn->is_string() && vn->as_string() == "calculate") {
-				calculate_normals(data);
-			} else {
-				auto normals = decode_normals(v, data.points.size());
-				if (!normals)
-					return normals.error();
-				data.normals = std::move(*normals);
+			if (const Variant *vo = v.get("optimize_locality"); vo) {
+				if (!vo->is_bool())
+					return Error(v.path(), "optimize_locality must be a boolean");
+
+				if (vo->as_bool())
+					TriangleMeshData::optimize_locality(data);
 			}
-		}
 
-		if (v.has("uvs")) {
-			auto uvs = decode_uvs(v, data.points.size());
-			if (!uvs)
-				return uvs.error();
-			data.uvs = std::move(*uvs);
+			return data;
 		}
+	}
 
-		return data;
+	Result<TriangleMeshData> TriangleMeshData::from_variant(const Variant &v)
+	{
+		return decode_mesh_data(v, nullptr);
+	}
+
+	Result<TriangleMeshData> TriangleMeshData::from_variant(const Variant &v, ThreadPool &thread_pool)
+	{
+		return decode_mesh_data(v, &thread_pool);
 	}
 
 	void TriangleMeshData::calculate_normals(TriangleMeshData &data)
 	{
 		data.normals = std::vector<Vector3>(data.points.size());
 
-		for (const Indices &is : data.indices) {
+		for (const Indices is : data.indices) {
 			const Vector3 &point1 = data.points[is.index1];
 			const Vector3 &point2 = data.points[is.index2];
 			const Vector3 &point3 = data.points[is.index3];
@@ -218,4 +260,267 @@ namespace Rayni
 		for (Vector3 &n : data.normals)
 			n = n.normalize();
 	}
+
+	// Triangles are split in one chunk per thread. Each chunk accumulates
+	// triangle normals in a buffer of its own that covers the range of points
+	// referenced by its triangles. Vertex normals are then summed from the
+	// buffers in chunk order, result only depends on number of threads in pool.
+	// Falls back to serial version if buffers would use too much memory (points
+	// referenced by a chunk are spread out over the whole point array).
+	void TriangleMeshData::calculate_normals(TriangleMeshData &data, ThreadPool &thread_pool)
+	{
+		static constexpr std::size_t GRAIN_SIZE = 4096;
+		static constexpr std::size_t MAX_BUFFERED_NORMALS_PER_POINT = 4;
+
+		struct Chunk
+		{
+			Index min_index = MAX_INDEX;
+			Index max_index = 0;
+			std::vector<Vector3> normals;
+		};
+
+		const std::size_t num_points = data.points.size();
+		const std::size_t num_triangles = data.indices.size();
+		unsigned int num_chunks = parallel_for_num_chunks(thread_pool, num_triangles, GRAIN_SIZE);
+
+		if (num_chunks <= 1) {
+			calculate_normals(data);
+			return;
+		}
+
+		std::vector<Chunk> chunks(num_chunks);
+
+		auto find_index_range = [&](unsigned int c, std::size_t start, std::size_t end) {
+			Chunk &chunk = chunks[c];
+
+			for (std::size_t i = start; i < end; i++) {
+				Indices is = data.indices[i];
+				chunk.min_index = std::min({chunk.min_index, is.index1, is.index2, is.index3});
+				chunk.max_index = std::max({chunk.max_index, is.index1, is.index2, is.index3});
+			}
+		};
+
+		parallel_for_chunks(thread_pool, 0, num_triangles, num_chunks, find_index_range);
+
+		std::size_t num_buffered_normals = 0;
+
+		for (const Chunk &chunk : chunks)
+			num_buffered_normals += chunk.max_index - chunk.min_index + std::size_t(1);
+
+		if (num_buffered_normals > num_points * MAX_BUFFERED_NORMALS_PER_POINT) {
+			calculate_normals(data);
+			return;
+		}
+
+		auto accumulate_normals = [&](unsigned int c, std::size_t start, std::size_t end) {
+			Chunk &chunk = chunks[c];
+
+			chunk.normals.resize(chunk.max_index - chunk.min_index + std::size_t(1));
+
+			for (std::size_t i = start; i < end; i++) {
+				Indices is = data.indices[i];
+				const Vector3 &point1 = data.points[is.index1];
+				const Vector3 &point2 = data.points[is.index2];
+				const Vector3 &point3 = data.points[is.index3];
+				Vector3 normal = (point2 - point1).cross(point3 - point1);
+
+				chunk.normals[is.index1 - chunk.min_index] += normal;
+				chunk.normals[is.index2 - chunk.min_index] += normal;
+				chunk.normals[is.index3 - chunk.min_index] += normal;
+			}
+		};
+
+		parallel_for_chunks(thread_pool, 0, num_triangles, num_chunks, accumulate_normals);
+
+		data.normals = std::vector<Vector3>(num_points);
+
+		parallel_for(thread_pool, 0, num_points, GRAIN_SIZE, [&](std::size_t start, std::size_t end) {
+			for (const Chunk &chunk : chunks) {
+				std::size_t chunk_start = std::max<std::size_t>(start, chunk.min_index);
+				std::size_t chunk_end = std::min<std::size_t>(end, chunk.max_index + std::size_t(1));
+
+				for (std::size_t i = chunk_start; i < chunk_end; i++)
+					data.normals[i] += chunk.normals[i - chunk.min_index];
+			}
+
+			for (std::size_t i = start; i < end; i++)
+				data.normals[i] = data.normals[i].normalize();
+		});
+	}
+
+	std::vector<std::uint32_t> TriangleMeshData::triangles_in_morton_order(const TriangleMeshData &data)
+	{
+		auto centroid = [&](const Indices &is) {
+			const Vector3 &point1 = data.points[is.index1];
+			const Vector3 &point2 = data.points[is.index2];
+			const Vector3 &point3 = data.points[is.index3];
+			return (point1 + point2 + point3) * (real_t(1) / 3);
+		};
+
+		AABB centroids_aabb;
+
+		for (const Indices is : data.indices)
+			centroids_aabb.merge(centroid(is));
+
+		MortonEncoder encoder(centroids_aabb, MortonEncoder::MAX_BITS_PER_AXIS);
+		std::vector<std::pair<std::uint64_t, std::uint32_t>> codes;
+		codes.reserve(data.indices.size());
+
+		for (std::uint32_t i = 0; i < data.indices.size(); i++)
+			codes.emplace_back(encoder.code(centroid(data.indices[i])), i);
+
+		std::sort(codes.begin(), codes.end());
+
+		std::vector<std::uint32_t> triangles;
+		triangles.reserve(codes.size());
+
+		for (const auto &code : codes)
+			triangles.push_back(code.second);
+
+		return triangles;
+	}
+
+	double TriangleMeshData::average_cache_miss_ratio(const TriangleMeshData &data)
+	{
+		if (data.indices.empty())
+			return 0;
+
+		// Point is in cache if it was added less than VERTEX_CACHE_SIZE misses ago.
+		std::vector<std::uint64_t> added_at_miss(data.points.size(), 0);
+		std::uint64_t misses = 0;
+
+		for (const Indices is : data.indices) {
+			for (Index index : {is.index1, is.index2, is.index3}) {
+				if (added_at_miss[index] == 0 || misses - added_at_miss[index] >= VERTEX_CACHE_SIZE)
+					added_at_miss[index] = ++misses;
+			}
+		}
+
+		return double(misses) / double(data.indices.size());
+	}
+
+	void TriangleMeshData::optimize_locality(TriangleMeshData &data)
+	{
+		double miss_ratio_before = average_cache_miss_ratio(data);
+		std::vector<std::uint32_t> triangles = triangles_in_morton_order(data);
+
+		// Points never referenced by a triangle are kept last in original order.
+		std::vector<Index> new_index(data.points.size(), MAX_INDEX);
+		Index next_index = 0;
+		IndexBuffer indices;
+
+		indices.reserve(triangles.size());
+
+		for (std::uint32_t triangle : triangles) {
+			Indices is = data.indices[triangle];
+
+			for (Index index : {is.index1, is.index2, is.index3})
+				if (new_index[index] == MAX_INDEX)
+					new_index[index] = next_index++;
+
+			indices.emplace_back(new_index[is.index1], new_index[is.index2], new_index[is.index3]);
+		}
+
+		for (Index &index : new_index)
+			if (index == MAX_INDEX)
+				index = next_index++;
+
+		auto reorder = [&](auto &values) {
+			if (values.size() != new_index.size())
+				return;
+
+			std::remove_reference_t<decltype(values)> reordered(values.size());
+
+			for (std::size_t i = 0; i < values.size(); i++)
+				reordered[new_index[i]] = values[i];
+
+			values = std::move(reordered);
+		};
+
+		reorder(data.points);
+		reorder(data.normals);
+		reorder(data.uvs);
+		data.indices = std::move(indices);
+
+		log_info("Optimized mesh locality, average cache miss ratio %.3f before and %.3f after",
+		         miss_ratio_before,
+		         average_cache_miss_ratio(data));
+	}
+
+	TriangleMeshData::IndexBuffer::IndexBuffer(std::initializer_list<Indices> indices)
+	{
+		reserve(indices.size());
+
+		for (const Indices &is : indices)
+			push_back(is);
+	}
+
+	void TriangleMeshData::IndexBuffer::reserve(std::size_t size)
+	{
+		chunks_.reserve((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+		deltas_.reserve(size * 3);
+	}
+
+	void TriangleMeshData::IndexBuffer::clear()
+	{
+		*this = IndexBuffer();
+	}
+
+	void TriangleMeshData::IndexBuffer::emplace_back(Index index1, Index index2, Index index3)
+	{
+		Index min = std::min({index1, index2, index3});
+		Index max = std::max({index1, index2, index3});
+
+		if (size_ % CHUNK_SIZE == 0) {
+			chunks_.push_back({min, false, deltas_.size() / 3});
+			last_chunk_max_ = max;
+		}
+
+		Chunk &chunk = chunks_.back();
+
+		if (!chunk.wide) {
+			Index new_base = std::min(chunk.base, min);
+			Index new_max = std::max(last_chunk_max_, max);
+
+			if (new_max - new_base <= MAX_DELTA) {
+				if (new_base != chunk.base) {
+					auto offset = std::uint16_t(chunk.base - new_base);
+
+					for (std::size_t i = chunk.offset * 3; i < deltas_.size(); i++)
+						deltas_[i] = std::uint16_t(deltas_[i] + offset);
+
+					chunk.base = new_base;
+				}
+
+				last_chunk_max_ = new_max;
+
+				deltas_.push_back(std::uint16_t(index1 - chunk.base));
+				deltas_.push_back(std::uint16_t(index2 - chunk.base));
+				deltas_.push_back(std::uint16_t(index3 - chunk.base));
+				size_++;
+				return;
+			}
+
+			widen_last_chunk();
+		}
+
+		indices_.push_back(index1);
+		indices_.push_back(index2);
+		indices_.push_back(index3);
+		size_++;
+	}
+
+	void TriangleMeshData::IndexBuffer::widen_last_chunk()
+	{
+		Chunk &chunk = chunks_.back();
+		std::size_t start = chunk.offset * 3;
+		std::size_t wide_offset = indices_.size() / 3;
+
+		for (std::size_t i = start; i < deltas_.size(); i++)
+			indices_.push_back(chunk.base + deltas_[i]);
+
+		deltas_.resize(start);
+		chunk.wide = true;
+		chunk.offset = wide_offset;
+	}
 }
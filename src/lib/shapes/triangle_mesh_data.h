@@ -23,9 +23,11 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <initializer_list>
 #include <limits>
 #include <vector>
 
+#include "lib/concurrency/thread_pool.h"
 #include "lib/containers/variant.h"
 #include "lib/function/result.h"
 #include "lib/math/hash.h"
@@ -43,6 +45,85 @@ namespace Rayni
 
 		static constexpr Index MAX_INDEX = std::numeric_limits<Index>::max();
 
+		static constexpr unsigned int VERTEX_CACHE_SIZE = 32;
+
+		// Indices are stored in chunks of CHUNK_SIZE triangles. A chunk stores the
+		// smallest index in it and 16 bit deltas from it for each index, as long as
+		// all indices in the chunk are within 0xffff of the smallest one (always
+		// true for meshes with at most 0x10000 points). If a triangle that does
+		// not fit is added, indices of that chunk are converted to full width and
+		// stored separately. Other chunks are not affected.
+		//
+		// Triangles are accessed by value, use operator[] or iterate over buffer.
+		class IndexBuffer
+		{
+		public:
+			class Iterator;
+
+			static constexpr std::size_t CHUNK_SIZE = 64;
+			static constexpr Index MAX_DELTA = std::numeric_limits<std::uint16_t>::max();
+
+			IndexBuffer() = default;
+			IndexBuffer(std::initializer_list<Indices> indices);
+
+			Indices operator[](std::size_t i) const;
+
+			Iterator begin() const;
+			Iterator end() const;
+
+			std::size_t size() const
+			{
+				return size_;
+			}
+
+			bool empty() const
+			{
+				return size_ == 0;
+			}
+
+			// True if indices of all chunks are stored as 16 bit deltas.
+			bool compact() const
+			{
+				return indices_.empty();
+			}
+
+			// Number of bytes used to store indices.
+			std::size_t memory_size() const
+			{
+				return chunks_.size() * sizeof(Chunk) + deltas_.size() * sizeof(std::uint16_t) +
+				       indices_.size() * sizeof(Index);
+			}
+
+			void reserve(std::size_t size);
+			void clear();
+
+			void emplace_back(Index index1, Index index2, Index index3);
+			void push_back(const Indices &is);
+
+		private:
+			struct Chunk
+			{
+				Index base;
+				bool wide;
+
+				// Index of first triangle of chunk in deltas_, or in indices_ if wide.
+				std::size_t offset;
+			};
+
+			void widen_last_chunk();
+
+			std::size_t size_ = 0;
+			std::vector<Chunk> chunks_;
+
+			// Compact storage. Largest index in last chunk is kept to be able to
+			// tell if a new triangle fits in it.
+			std::vector<std::uint16_t> deltas_;
+			Index last_chunk_max_ = 0;
+
+			// Full width storage of chunks that do not fit in compact storage.
+			std::vector<Index> indices_;
+		};
+
 		TriangleMeshData() = default;
 		TriangleMeshData(const TriangleMeshData &) = delete;
 		TriangleMeshData(TriangleMeshData &&) noexcept = default;
@@ -51,13 +132,29 @@ namespace Rayni
 		TriangleMeshData &operator=(TriangleMeshData &&) noexcept = default;
 
 		static Result<TriangleMeshData> from_variant(const Variant &v);
+		static Result<TriangleMeshData> from_variant(const Variant &v, ThreadPool &thread_pool);
 
 		static void calculate_normals(TriangleMeshData &data);
+		static void calculate_normals(TriangleMeshData &data, ThreadPool &thread_pool);
+
+		// Indices of triangles sorted in Morton order of triangle centroids.
+		static std::vector<std::uint32_t> triangles_in_morton_order(const TriangleMeshData &data);
+
+		// Average number of points per triangle that are not in a simulated
+		// FIFO cache of the VERTEX_CACHE_SIZE most recently missed points when
+		// triangles are visited in order. Between 3 (worst) and about 0.5 (best
+		// possible for large meshes).
+		static double average_cache_miss_ratio(const TriangleMeshData &data);
+
+		// Reorders triangles in Morton order and points (and normals and uvs) in
+		// order of first use by triangles. Triangles and points close in space are
+		// then close in memory. Logs average cache miss ratio before and after.
+		static void optimize_locality(TriangleMeshData &data);
 
 		std::vector<Vector3> points;
 		std::vector<Vector3> normals;
 		std::vector<UV> uvs;
-		std::vector<Indices> indices;
+		IndexBuffer indices;
 	};
 
 	struct TriangleMeshData::Indices
@@ -70,19 +167,73 @@ namespace Rayni
 		{
 		}
 
-		explicit Indices(const std::array<std::uint16_t, 3> &is) : Indices(is[0], is[1], is[2])
+		Index index1;
+		Index index2;
+		Index index3;
+	};
+
+	class TriangleMeshData::IndexBuffer::Iterator
+	{
+	public:
+		Iterator(const IndexBuffer &buffer, std::size_t i) : buffer_(&buffer), i_(i)
 		{
 		}
 
-		explicit Indices(const std::array<std::uint8_t, 3> &is) : Indices(is[0], is[1], is[2])
+		Indices operator*() const
 		{
+			return (*buffer_)[i_];
 		}
 
-		Index index1;
-		Index index2;
-		Index index3;
+		Iterator &operator++()
+		{
+			i_++;
+			return *this;
+		}
+
+		bool operator==(const Iterator &other) const
+		{
+			return i_ == other.i_;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return i_ != other.i_;
+		}
+
+	private:
+		const IndexBuffer *buffer_;
+		std::size_t i_;
 	};
 
+	inline TriangleMeshData::Indices TriangleMeshData::IndexBuffer::operator[](std::size_t i) const
+	{
+		const Chunk &chunk = chunks_[i / CHUNK_SIZE];
+		std::size_t j = (chunk.offset + i % CHUNK_SIZE) * 3;
+
+		if (!chunk.wide) {
+			const std::uint16_t *deltas = &deltas_[j];
+			return {chunk.base + deltas[0], chunk.base + deltas[1], chunk.base + deltas[2]};
+		}
+
+		const Index *is = &indices_[j];
+		return {is[0], is[1], is[2]};
+	}
+
+	inline void TriangleMeshData::IndexBuffer::push_back(const Indices &is)
+	{
+		emplace_back(is.index1, is.index2, is.index3);
+	}
+
+	inline TriangleMeshData::IndexBuffer::Iterator TriangleMeshData::IndexBuffer::begin() const
+	{
+		return {*this, 0};
+	}
+
+	inline TriangleMeshData::IndexBuffer::Iterator TriangleMeshData::IndexBuffer::end() const
+	{
+		return {*this, size_};
+	}
+
 	struct TriangleMeshData::UV
 	{
 		UV() = default;
@@ -19,8 +19,12 @@
 
 #include "lib/string/base85.h"
 
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <type_traits>
 
 namespace
 {
@@ -48,43 +52,150 @@ namespace
 	}
 
 	constexpr Base85DecodingTable BASE85_DECODING_TABLE = base85_generate_decoding_table();
+
+	constexpr std::size_t BASE85_BLOCK_GROUPS = 64;
+
+	// Largest accumulated value of first 4 characters in a group that does not
+	// overflow 32 bits when multiplied by 85.
+	constexpr std::uint32_t BASE85_MAX_ACCUMULATOR = 0xffffffff / 85;
+
+	// Decodes num_groups (at most BASE85_BLOCK_GROUPS) groups of 5 characters
+	// into words. Returns false if any group is invalid.
+	//
+	// Table lookups are done in a separate pass. The loop that accumulates words
+	// then only does 32 bit arithmetic on contiguous digits and is vectorized.
+	bool base85_decode_block(const char *groups, std::size_t num_groups, std::uint32_t *words)
+	{
+		assert(num_groups <= BASE85_BLOCK_GROUPS);
+
+		std::uint8_t digits[5][BASE85_BLOCK_GROUPS];
+
+		for (std::size_t g = 0; g < num_groups; g++)
+			for (unsigned int i = 0; i < 5; i++)
+				digits[i][g] = BASE85_DECODING_TABLE[static_cast<std::uint8_t>(groups[g * 5 + i])];
+
+		unsigned int invalid = 0;
+
+		for (std::size_t g = 0; g < num_groups; g++) {
+			std::uint32_t accumulator = 0;
+			unsigned int zero = 0;
+
+			for (unsigned int i = 0; i < 4; i++) {
+				std::uint8_t digit = digits[i][g];
+
+				zero |= static_cast<unsigned int>(digit == 0);
+				accumulator = accumulator * 85 + static_cast<std::uint8_t>(digit - 1);
+			}
+
+			std::uint8_t last_digit = digits[4][g];
+			unsigned int overflow = static_cast<unsigned int>(accumulator > BASE85_MAX_ACCUMULATOR) |
+			                        (static_cast<unsigned int>(accumulator == BASE85_MAX_ACCUMULATOR) &
+			                         static_cast<unsigned int>(last_digit > 1));
+
+			zero |= static_cast<unsigned int>(last_digit == 0);
+			invalid |= zero | overflow;
+			words[g] = accumulator * 85 + static_cast<std::uint8_t>(last_digit - 1);
+		}
+
+		return invalid == 0;
+	}
 }
 
 namespace Rayni
 {
 	std::optional<std::vector<std::uint8_t>> base85_decode(const std::string &str)
 	{
-		std::vector<std::uint8_t> decoded_data;
+		std::vector<std::uint8_t> decoded_data(base85_decoded_size(str));
 
-		for (std::string::size_type pos = 0; pos < str.length(); pos += 5) {
-			std::uint32_t accumulator = 0;
+		if (!base85_decode_big_endian(str, 0, base85_groups(str), decoded_data.data()))
+			return std::nullopt;
+
+		return decoded_data;
+	}
+
+	std::size_t base85_groups(const std::string &str)
+	{
+		return (str.length() + 4) / 5;
+	}
+
+	std::size_t base85_decoded_size(const std::string &str)
+	{
+		std::size_t last_group_length = str.length() % 5;
 
-			for (unsigned int i = 0; i < 5; i++) {
-				auto c = static_cast<std::uint8_t>(pos + i < str.length() ? str[pos + i] : '~');
-				std::uint8_t decoded_byte = BASE85_DECODING_TABLE[c];
+		return str.length() / 5 * 4 + (last_group_length > 0 ? last_group_length - 1 : 0);
+	}
 
-				if (decoded_byte == 0)
-					return std::nullopt;
+	template <typename T>
+	std::optional<std::size_t> base85_decode_big_endian(const std::string &str,
+	                                                    std::size_t first_group,
+	                                                    std::size_t num_groups,
+	                                                    T *values)
+	{
+		static_assert(std::is_integral_v<T> && 4 % sizeof(T) == 0);
+		static constexpr unsigned int BITS = 8 * sizeof(T);
+		static constexpr unsigned int VALUES_PER_GROUP = 4 / sizeof(T);
 
-				decoded_byte--;
+		assert(first_group + num_groups <= base85_groups(str));
 
-				if (i == 4) {
-					if (accumulator > 0xffffffff / 85 ||
-					    accumulator * 85 > 0xffffffff - decoded_byte)
-						return std::nullopt;
-				}
+		std::size_t end_group = first_group + num_groups;
+		std::size_t full_end_group = std::min(end_group, str.length() / 5);
+		std::size_t num_full_groups = full_end_group > first_group ? full_end_group - first_group : 0;
+		const char *groups = str.data() + first_group * 5;
+		bool valid = true;
 
-				accumulator = accumulator * 85 + decoded_byte;
-			}
+		for (std::size_t block = 0; block < num_full_groups; block += BASE85_BLOCK_GROUPS) {
+			std::size_t block_groups = std::min(BASE85_BLOCK_GROUPS, num_full_groups - block);
+			std::uint32_t words[BASE85_BLOCK_GROUPS];
 
-			unsigned int num_bytes = str.length() - pos < 5 ? str.length() - pos - 1 : 4;
+			valid &= base85_decode_block(groups + block * 5, block_groups, words);
 
-			for (unsigned int i = 0; i < num_bytes; i++) {
-				decoded_data.emplace_back((accumulator >> 24) & 0xff);
-				accumulator = accumulator << 8;
-			}
+			for (std::size_t g = 0; g < block_groups; g++)
+				for (unsigned int i = 0; i < VALUES_PER_GROUP; i++)
+					values[(block + g) * VALUES_PER_GROUP + i] =
+					        static_cast<T>(words[g] >> (32 - BITS * (i + 1)));
 		}
 
-		return decoded_data;
+		std::size_t count = num_full_groups * VALUES_PER_GROUP;
+
+		if (num_full_groups < num_groups) {
+			std::size_t pos = full_end_group * 5;
+			std::size_t length = str.length() - pos;
+			char group[5] = {'~', '~', '~', '~', '~'};
+
+			std::copy(str.begin() + std::string::difference_type(pos), str.end(), group);
+
+			std::uint32_t word;
+
+			valid &= base85_decode_block(group, 1, &word);
+
+			for (unsigned int i = 0; i < (length - 1) / sizeof(T); i++)
+				values[count++] = static_cast<T>(word >> (32 - BITS * (i + 1)));
+		}
+
+		if (!valid)
+			return std::nullopt;
+
+		return count;
 	}
+
+	template std::optional<std::size_t> base85_decode_big_endian(const std::string &str,
+	                                                             std::size_t first_group,
+	                                                             std::size_t num_groups,
+	                                                             std::uint8_t *values);
+	template std::optional<std::size_t> base85_decode_big_endian(const std::string &str,
+	                                                             std::size_t first_group,
+	                                                             std::size_t num_groups,
+	                                                             std::uint16_t *values);
+	template std::optional<std::size_t> base85_decode_big_endian(const std::string &str,
+	                                                             std::size_t first_group,
+	                                                             std::size_t num_groups,
+	                                                             std::uint32_t *values);
+	template std::optional<std::size_t> base85_decode_big_endian(const std::string &str,
+	                                                             std::size_t first_group,
+	                                                             std::size_t num_groups,
+	                                                             std::int16_t *values);
+	template std::optional<std::size_t> base85_decode_big_endian(const std::string &str,
+	                                                             std::size_t first_group,
+	                                                             std::size_t num_groups,
+	                                                             std::int32_t *values);
 }
@@ -20,6 +20,7 @@
 #ifndef RAYNI_LIB_STRING_BASE85_H
 #define RAYNI_LIB_STRING_BASE85_H
 
+#include <cstddef>
 #include <cstdint>
 #include <optional>
 #include <string>
@@ -28,6 +29,26 @@
 namespace Rayni
 {
 	std::optional<std::vector<std::uint8_t>> base85_decode(const std::string &str);
+
+	// Number of groups of 5 characters in str (last group may be shorter) and
+	// number of bytes str decodes to. A group decodes to 4 bytes, a shorter last
+	// group of n characters decodes to n - 1 bytes.
+	std::size_t base85_groups(const std::string &str);
+	std::size_t base85_decoded_size(const std::string &str);
+
+	// Decodes num_groups groups starting at first_group straight into values as
+	// big endian integers of type T (1, 2 or 4 bytes). Bytes at end of a shorter
+	// last group that do not make up a whole integer are skipped. Returns number
+	// of integers written to values, or std::nullopt if str is not valid base85.
+	//
+	// Avoids going through a vector of bytes when decoding e.g. fixed point
+	// values. Groups are decoded in blocks where table lookups are done before
+	// the arithmetic, so the latter can be vectorized.
+	template <typename T>
+	std::optional<std::size_t> base85_decode_big_endian(const std::string &str,
+	                                                    std::size_t first_group,
+	                                                    std::size_t num_groups,
+	                                                    T *values);
 }
 
 #endif // RAYNI_LIB_STRING_BASE85_H
@@ -0,0 +1,263 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/system/linux/cpu_topology.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+
+#include "lib/function/scope_exit.h"
+#include "lib/string/split.h"
+#include "lib/string/string.h"
+
+namespace Rayni
+{
+	namespace
+	{
+		Result<std::string> read_line(const std::string &path)
+		{
+			std::FILE *file = std::fopen(path.c_str(), "r");
+			if (!file)
+				return Error(path, "failed to open file for reading");
+			auto file_close = scope_exit([&] { std::fclose(file); });
+
+			char buffer[4096];
+			if (!std::fgets(buffer, sizeof buffer, file))
+				return Error(path, "failed to read from file");
+
+			std::string line = buffer;
+			while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+				line.pop_back();
+
+			return line;
+		}
+
+		Result<unsigned int> read_number(const std::string &path)
+		{
+			Result<std::string> line = read_line(path);
+			if (!line)
+				return line.error();
+
+			std::optional<unsigned int> number = string_to_number<unsigned int>(*line);
+			if (!number)
+				return Error(path, "invalid number \"" + *line + "\"");
+
+			return Result<unsigned int>(std::move(*number));
+		}
+
+		// CPU directory has a link named node<id> to its NUMA node if kernel has
+		// NUMA support. All CPUs are in node 0 otherwise.
+		unsigned int read_node_id(const std::string &cpu_path)
+		{
+			constexpr std::string_view PREFIX = "node";
+			std::error_code error_code;
+			std::filesystem::directory_iterator i(cpu_path, error_code);
+
+			for (; !error_code && i != std::filesystem::directory_iterator(); i.increment(error_code)) {
+				const std::string name = i->path().filename().string();
+
+				if (!name.starts_with(PREFIX))
+					continue;
+
+				std::string_view id_str = std::string_view(name).substr(PREFIX.size());
+
+				if (std::optional<unsigned int> id = string_to_number<unsigned int>(id_str))
+					return *id;
+			}
+
+			return 0;
+		}
+
+		Result<std::vector<unsigned int>> allowed_cpu_ids()
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+
+			if (sched_getaffinity(0, sizeof set, &set) != 0) {
+				std::error_code error_code(errno, std::system_category());
+				return Error("sched_getaffinity() failed", error_code);
+			}
+
+			std::vector<unsigned int> ids;
+
+			for (unsigned int id = 0; id < CPU_SETSIZE; id++)
+				if (CPU_ISSET(id, &set))
+					ids.push_back(id);
+
+			return ids;
+		}
+	}
+
+	Result<CPUTopology> CPUTopology::read()
+	{
+		Result<CPUTopology> topology = read(SYS_CPU_PATH);
+		if (!topology)
+			return topology.error();
+
+		Result<std::vector<unsigned int>> allowed = allowed_cpu_ids();
+		if (!allowed)
+			return allowed.error();
+
+		std::erase_if(topology->cpus_, [&](const CPU &cpu) {
+			return !std::binary_search(allowed->cbegin(), allowed->cend(), cpu.id);
+		});
+
+		if (topology->cpus_.empty())
+			return Error("no online CPU in affinity mask of process");
+
+		return topology;
+	}
+
+	Result<CPUTopology> CPUTopology::read(const std::string &sys_cpu_path)
+	{
+		Result<std::string> online = read_line(sys_cpu_path + "/online");
+		if (!online)
+			return online.error();
+
+		Result<std::vector<unsigned int>> ids = parse_cpu_list(*online);
+		if (!ids)
+			return Error(sys_cpu_path + "/online", ids.error().message());
+
+		CPUTopology topology;
+
+		for (unsigned int id : *ids) {
+			const std::string cpu_path = sys_cpu_path + "/cpu" + std::to_string(id);
+			const std::string topology_path = cpu_path + "/topology/";
+
+			Result<unsigned int> core_id = read_number(topology_path + "core_id");
+			if (!core_id)
+				return core_id.error();
+
+			Result<unsigned int> package_id = read_number(topology_path + "physical_package_id");
+			if (!package_id)
+				return package_id.error();
+
+			topology.cpus_.push_back({id, *core_id, *package_id, read_node_id(cpu_path)});
+		}
+
+		if (topology.cpus_.empty())
+			return Error(sys_cpu_path, "no online CPUs");
+
+		std::sort(topology.cpus_.begin(), topology.cpus_.end(), [](const CPU &cpu1, const CPU &cpu2) {
+			return std::tie(cpu1.package_id, cpu1.core_id, cpu1.id) <
+			       std::tie(cpu2.package_id, cpu2.core_id, cpu2.id);
+		});
+
+		return topology;
+	}
+
+	Result<std::vector<unsigned int>> CPUTopology::parse_cpu_list(std::string_view cpu_list)
+	{
+		std::vector<unsigned int> ids;
+
+		for (const std::string &range : string_split(cpu_list, ',')) {
+			const bool is_range = range.find('-') != std::string::npos;
+			auto [first_str, last_str] = string_split_to_array<std::string_view, 2>(range, '-');
+			std::optional<unsigned int> first = string_to_number<unsigned int>(first_str);
+			std::optional<unsigned int> last = is_range ? string_to_number<unsigned int>(last_str) : first;
+
+			if (!first || !last || *first > *last)
+				return Error("invalid CPU list \"" + std::string(cpu_list) + "\"");
+
+			for (unsigned int id = *first; id <= *last; id++)
+				ids.push_back(id);
+		}
+
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+		return ids;
+	}
+
+	std::vector<unsigned int> CPUTopology::package_ids() const
+	{
+		std::vector<unsigned int> ids;
+
+		for (const CPU &cpu : cpus_)
+			if (ids.empty() || ids.back() != cpu.package_id)
+				ids.push_back(cpu.package_id);
+
+		return ids;
+	}
+
+	std::vector<unsigned int> CPUTopology::node_ids() const
+	{
+		std::vector<unsigned int> ids;
+
+		for (const CPU &cpu : cpus_)
+			ids.push_back(cpu.node_id);
+
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+		return ids;
+	}
+
+	std::vector<unsigned int> CPUTopology::cpu_ids(SMT smt) const
+	{
+		std::vector<unsigned int> ids;
+		const CPU *previous = nullptr;
+
+		for (const CPU &cpu : cpus_) {
+			bool sibling = previous && previous->package_id == cpu.package_id &&
+			               previous->core_id == cpu.core_id;
+
+			if (smt == SMT::INCLUDE || !sibling)
+				ids.push_back(cpu.id);
+
+			previous = &cpu;
+		}
+
+		return ids;
+	}
+
+	std::vector<unsigned int> CPUTopology::package_cpu_ids(unsigned int package_id, SMT smt) const
+	{
+		CPUTopology package;
+
+		std::copy_if(cpus_.cbegin(),
+		             cpus_.cend(),
+		             std::back_inserter(package.cpus_),
+		             [&](const CPU &cpu) { return cpu.package_id == package_id; });
+
+		return package.cpu_ids(smt);
+	}
+
+	std::vector<unsigned int> CPUTopology::node_cpu_ids(unsigned int node_id, SMT smt) const
+	{
+		CPUTopology node;
+
+		std::copy_if(cpus_.cbegin(),
+		             cpus_.cend(),
+		             std::back_inserter(node.cpus_),
+		             [&](const CPU &cpu) { return cpu.node_id == node_id; });
+
+		return node.cpu_ids(smt);
+	}
+}
@@ -0,0 +1,86 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_LIB_SYSTEM_LINUX_CPU_TOPOLOGY_H
+#define RAYNI_LIB_SYSTEM_LINUX_CPU_TOPOLOGY_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lib/function/result.h"
+
+namespace Rayni
+{
+	// Logical CPUs with the physical core, package (socket) and NUMA node they
+	// belong to, read from sysfs. CPU ids can be used to pin threads, see
+	// ThreadPool. E.g. a pool with CPUs from node_cpu_ids() only runs tasks on
+	// CPUs close to memory that was first touched by its threads.
+	class CPUTopology
+	{
+	public:
+		struct CPU
+		{
+			unsigned int id = 0;
+			unsigned int core_id = 0;
+			unsigned int package_id = 0;
+			unsigned int node_id = 0;
+		};
+
+		enum class SMT
+		{
+			// All logical CPUs. SMT siblings are adjacent.
+			INCLUDE,
+
+			// First logical CPU of each physical core.
+			EXCLUDE
+		};
+
+		static constexpr const char *SYS_CPU_PATH = "/sys/devices/system/cpu";
+
+		// Online CPUs that calling process is allowed to run on.
+		static Result<CPUTopology> read();
+
+		// All online CPUs in sys_cpu_path, which has same layout as SYS_CPU_PATH.
+		static Result<CPUTopology> read(const std::string &sys_cpu_path);
+
+		// Parses list in format used by sysfs and cpuset, e.g. "0-3,8,10-11".
+		static Result<std::vector<unsigned int>> parse_cpu_list(std::string_view cpu_list);
+
+		// Sorted by package, core and id.
+		const std::vector<CPU> &cpus() const
+		{
+			return cpus_;
+		}
+
+		std::vector<unsigned int> package_ids() const;
+
+		// Sorted. Only node 0 if kernel does not have NUMA support.
+		std::vector<unsigned int> node_ids() const;
+
+		std::vector<unsigned int> cpu_ids(SMT smt) const;
+		std::vector<unsigned int> package_cpu_ids(unsigned int package_id, SMT smt) const;
+		std::vector<unsigned int> node_cpu_ids(unsigned int node_id, SMT smt) const;
+
+	private:
+		std::vector<CPU> cpus_;
+	};
+}
+
+#endif // RAYNI_LIB_SYSTEM_LINUX_CPU_TOPOLOGY_H
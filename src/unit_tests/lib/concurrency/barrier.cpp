@@ -21,13 +21,83 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
 #include <thread>
 #include <vector>
 
+#include "lib/stopwatch.h"
+
 namespace Rayni
 {
+	namespace
+	{
+		// Previous implementation, for comparison in benchmark.
+		class MutexBarrier
+		{
+		public:
+			explicit MutexBarrier(unsigned int num_threads) : num_threads_(num_threads)
+			{
+			}
+
+			void arrive_and_wait()
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+
+				arrived_++;
+
+				if (arrived_ == num_threads_) {
+					arrived_ = 0;
+					generation_++;
+					condition_.notify_all();
+				} else {
+					unsigned int current_generation = generation_;
+
+					while (current_generation == generation_)
+						condition_.wait(lock);
+				}
+			}
+
+		private:
+			std::mutex mutex_;
+			std::condition_variable condition_;
+			unsigned int num_threads_;
+			unsigned int arrived_ = 0;
+			unsigned int generation_ = 0;
+		};
+
+		// Average time for all threads to pass barrier, calling thread included.
+		template <typename BarrierType>
+		std::chrono::nanoseconds barrier_round_time(unsigned int num_threads, unsigned int rounds)
+		{
+			BarrierType barrier(num_threads);
+			std::vector<std::thread> threads;
+
+			for (unsigned int i = 0; i < num_threads - 1; i++)
+				threads.emplace_back([&] {
+					for (unsigned int r = 0; r < rounds; r++)
+						barrier.arrive_and_wait();
+				});
+
+			auto stopwatch = Stopwatch().start();
+
+			for (unsigned int r = 0; r < rounds; r++)
+				barrier.arrive_and_wait();
+
+			stopwatch.stop();
+
+			for (auto &thread : threads)
+				thread.join();
+
+			return stopwatch.duration() / rounds;
+		}
+	}
+
 	TEST(Barrier, ArriveAndWait)
 	{
 		constexpr unsigned int NUM_THREADS = 16;
@@ -95,4 +165,56 @@ namespace Rayni
 		for (auto &thread : threads)
 			thread.join();
 	}
+
+	// Main thread only arrives, and may arrive again before other thread has
+	// noticed that a generation is done. Each generation other thread is in
+	// needs an arrival by main thread, so other thread must not have passed the
+	// barrier more times than main thread has arrived.
+	TEST(Barrier, ArriveAgainBeforeOthersHaveWoken)
+	{
+		constexpr unsigned int ROUNDS = 10000;
+		Barrier barrier(2);
+		std::atomic<unsigned int> arrived{0};
+		std::atomic<unsigned int> passed_too_early{0};
+		std::atomic<bool> done{false};
+
+		std::thread thread([&] {
+			for (unsigned int passed = 1; passed <= ROUNDS; passed++) {
+				barrier.arrive_and_wait();
+				if (passed > arrived.load())
+					passed_too_early++;
+			}
+
+			done = true;
+		});
+
+		while (!done) {
+			arrived++;
+			barrier.arrive();
+			std::this_thread::yield();
+		}
+
+		thread.join();
+
+		EXPECT_EQ(0, passed_too_early);
+	}
+
+	// Run with --gtest_also_run_disabled_tests. Numbers are only meaningful with
+	// at least as many CPUs as threads.
+	TEST(Barrier, DISABLED_Benchmark)
+	{
+		constexpr unsigned int ROUNDS = 10000;
+
+		std::printf("%u CPUs\n", std::thread::hardware_concurrency());
+
+		for (unsigned int num_threads : {2U, 4U, std::max(std::thread::hardware_concurrency(), 2U)}) {
+			long long spinning = barrier_round_time<Barrier>(num_threads, ROUNDS).count();
+			long long mutex = barrier_round_time<MutexBarrier>(num_threads, ROUNDS).count();
+
+			std::printf("%3u threads: Barrier %6lld ns, mutex/condition variable %6lld ns per round\n",
+			            num_threads,
+			            spinning,
+			            mutex);
+		}
+	}
 }
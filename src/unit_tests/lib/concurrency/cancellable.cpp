@@ -21,6 +21,8 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 namespace Rayni
 {
 	TEST(Cancellable, NotCancelledByDefault)
@@ -47,4 +49,152 @@ namespace Rayni
 		cancellable.reset();
 		EXPECT_FALSE(cancellable.cancelled());
 	}
+
+	TEST(Cancellable, ResetChildOfCancelledParent)
+	{
+		Cancellable parent;
+		Cancellable child(&parent);
+		Cancellable grandchild(&child);
+
+		parent.cancel();
+		child.reset();
+		grandchild.reset();
+
+		EXPECT_TRUE(child.cancelled());
+		EXPECT_TRUE(grandchild.cancelled());
+
+		parent.reset();
+		child.reset();
+
+		EXPECT_FALSE(child.cancelled());
+		EXPECT_TRUE(grandchild.cancelled());
+
+		grandchild.reset();
+
+		EXPECT_FALSE(grandchild.cancelled());
+	}
+
+	TEST(Cancellable, ChildCancelledWithParent)
+	{
+		Cancellable parent;
+		Cancellable child(&parent);
+		Cancellable grandchild(&child);
+
+		EXPECT_FALSE(child.cancelled());
+		EXPECT_FALSE(grandchild.cancelled());
+
+		parent.cancel();
+
+		EXPECT_TRUE(child.cancelled());
+		EXPECT_TRUE(grandchild.cancelled());
+	}
+
+	TEST(Cancellable, ChildCancelDoesNotCancelParent)
+	{
+		Cancellable parent;
+		Cancellable child1(&parent);
+		Cancellable child2(&parent);
+
+		child1.cancel();
+
+		EXPECT_TRUE(child1.cancelled());
+		EXPECT_FALSE(child2.cancelled());
+		EXPECT_FALSE(parent.cancelled());
+	}
+
+	TEST(Cancellable, ChildOfCancelledParentIsCancelled)
+	{
+		Cancellable parent;
+		parent.cancel();
+
+		Cancellable child(&parent);
+
+		EXPECT_TRUE(child.cancelled());
+	}
+
+	TEST(Cancellable, ChildDestroyedBeforeParentCancelled)
+	{
+		Cancellable parent;
+
+		{
+			Cancellable child(&parent);
+		}
+
+		parent.cancel();
+
+		EXPECT_TRUE(parent.cancelled());
+	}
+
+	TEST(Cancellable, Callback)
+	{
+		Cancellable cancellable;
+		unsigned int calls = 0;
+		Cancellable::Callback callback(cancellable, [&] { calls++; });
+
+		EXPECT_EQ(0, calls);
+
+		cancellable.cancel();
+		EXPECT_EQ(1, calls);
+
+		cancellable.cancel();
+		EXPECT_EQ(1, calls);
+
+		cancellable.reset();
+		cancellable.cancel();
+		EXPECT_EQ(2, calls);
+	}
+
+	TEST(Cancellable, CallbackAlreadyCancelled)
+	{
+		Cancellable cancellable;
+		unsigned int calls = 0;
+
+		cancellable.cancel();
+
+		Cancellable::Callback callback(cancellable, [&] { calls++; });
+
+		EXPECT_EQ(1, calls);
+	}
+
+	TEST(Cancellable, CallbackDestroyed)
+	{
+		Cancellable cancellable;
+		unsigned int calls = 0;
+
+		{
+			Cancellable::Callback callback(cancellable, [&] { calls++; });
+		}
+
+		cancellable.cancel();
+
+		EXPECT_EQ(0, calls);
+	}
+
+	TEST(Cancellable, CallbackOfChild)
+	{
+		Cancellable parent;
+		Cancellable child(&parent);
+		bool called = false;
+		Cancellable::Callback callback(child, [&] { called = true; });
+
+		parent.cancel();
+
+		EXPECT_TRUE(called);
+	}
+
+	TEST(Cancellable, CancelFromOtherThread)
+	{
+		Cancellable parent;
+		Cancellable child(&parent);
+		bool called = false;
+
+		{
+			Cancellable::Callback callback(child, [&] { called = true; });
+			std::thread thread([&] { parent.cancel(); });
+			thread.join();
+		}
+
+		EXPECT_TRUE(called);
+		EXPECT_TRUE(child.cancelled());
+	}
 }
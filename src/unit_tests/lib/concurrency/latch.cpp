@@ -21,11 +21,97 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
 #include <thread>
+#include <vector>
+
+#include "lib/stopwatch.h"
 
 namespace Rayni
 {
+	namespace
+	{
+		// Previous implementation, for comparison in benchmark.
+		class MutexLatch
+		{
+		public:
+			explicit MutexLatch(unsigned int count) : count_(count)
+			{
+			}
+
+			void count_down()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				count_--;
+
+				if (count_ == 0)
+					condition_.notify_one();
+			}
+
+			void wait()
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+
+				while (count_ != 0)
+					condition_.wait(lock);
+			}
+
+		private:
+			std::mutex mutex_;
+			std::condition_variable condition_;
+			unsigned int count_ = 0;
+		};
+
+		// Average time for calling thread to start other threads with a latch per
+		// thread (previous implementation only wakes one waiting thread) and wait
+		// for them to finish with another latch, like a fork-join.
+		template <typename LatchType>
+		std::chrono::nanoseconds latch_round_time(unsigned int num_threads, unsigned int rounds)
+		{
+			std::deque<LatchType> start;
+			std::deque<LatchType> finish;
+			std::vector<std::thread> threads;
+
+			for (unsigned int r = 0; r < rounds; r++) {
+				for (unsigned int i = 0; i < num_threads - 1; i++)
+					start.emplace_back(1);
+
+				finish.emplace_back(num_threads - 1);
+			}
+
+			for (unsigned int i = 0; i < num_threads - 1; i++)
+				threads.emplace_back([&, i] {
+					for (unsigned int r = 0; r < rounds; r++) {
+						start[r * (num_threads - 1) + i].wait();
+						finish[r].count_down();
+					}
+				});
+
+			auto stopwatch = Stopwatch().start();
+
+			for (unsigned int r = 0; r < rounds; r++) {
+				for (unsigned int i = 0; i < num_threads - 1; i++)
+					start[r * (num_threads - 1) + i].count_down();
+
+				finish[r].wait();
+			}
+
+			stopwatch.stop();
+
+			for (auto &thread : threads)
+				thread.join();
+
+			return stopwatch.duration() / rounds;
+		}
+	}
+
 	TEST(Latch, CountDownAndWait)
 	{
 		constexpr unsigned int NUM_THREADS = 16;
@@ -48,4 +134,23 @@ namespace Rayni
 		for (auto &thread : threads)
 			thread.join();
 	}
+
+	// Run with --gtest_also_run_disabled_tests. Numbers are only meaningful with
+	// at least as many CPUs as threads.
+	TEST(Latch, DISABLED_Benchmark)
+	{
+		constexpr unsigned int ROUNDS = 10000;
+
+		std::printf("%u CPUs\n", std::thread::hardware_concurrency());
+
+		for (unsigned int num_threads : {2U, 4U, std::max(std::thread::hardware_concurrency(), 2U)}) {
+			long long spinning = latch_round_time<Latch>(num_threads, ROUNDS).count();
+			long long mutex = latch_round_time<MutexLatch>(num_threads, ROUNDS).count();
+
+			std::printf("%3u threads: Latch %6lld ns, mutex/condition variable %6lld ns per round\n",
+			            num_threads,
+			            spinning,
+			            mutex);
+		}
+	}
 }
@@ -0,0 +1,150 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/concurrency/parallel_for.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/concurrency/barrier.h"
+#include "lib/concurrency/thread_pool.h"
+
+namespace Rayni
+{
+	TEST(ParallelFor, ChunksCoverRange)
+	{
+		ThreadPool thread_pool(4);
+
+		for (unsigned int chunks : {1U, 2U, 3U, 7U, 16U}) {
+			std::vector<std::atomic<unsigned int>> visited(100);
+			std::vector<std::atomic<unsigned int>> chunk_visited(chunks);
+
+			parallel_for_chunks(thread_pool,
+			                    10,
+			                    std::size_t(110),
+			                    chunks,
+			                    [&](unsigned int chunk, std::size_t start, std::size_t end) {
+				                    chunk_visited[chunk]++;
+				                    for (std::size_t i = start; i < end; i++)
+					                    visited[i - 10]++;
+			                    });
+
+			for (auto &v : visited)
+				EXPECT_EQ(1, v);
+			for (auto &v : chunk_visited)
+				EXPECT_EQ(1, v);
+		}
+	}
+
+	TEST(ParallelFor, EmptyRange)
+	{
+		ThreadPool thread_pool(2);
+		std::atomic<unsigned int> calls{0};
+
+		parallel_for(thread_pool, 0, 0U, 1, [&](unsigned int start, unsigned int end) {
+			EXPECT_EQ(start, end);
+			calls++;
+		});
+
+		EXPECT_EQ(1, calls);
+	}
+
+	TEST(ParallelFor, NumChunks)
+	{
+		ThreadPool thread_pool(4);
+
+		EXPECT_EQ(1, parallel_for_num_chunks(thread_pool, 0, 10));
+		EXPECT_EQ(1, parallel_for_num_chunks(thread_pool, 19, 10));
+		EXPECT_EQ(2, parallel_for_num_chunks(thread_pool, 20, 10));
+		EXPECT_EQ(4, parallel_for_num_chunks(thread_pool, 1000, 10));
+	}
+
+	TEST(ParallelFor, CalledFromAllThreadsInPool)
+	{
+		// All threads in pool are busy calling parallel_for() at the same time,
+		// chunks must still be run (by calling threads).
+		constexpr unsigned int NUM_THREADS = 4;
+		ThreadPool thread_pool(NUM_THREADS);
+		Barrier barrier(NUM_THREADS);
+		std::atomic<std::uint64_t> sum{0};
+
+		for (unsigned int t = 0; t < NUM_THREADS; t++)
+			thread_pool.add_task([&] {
+				barrier.arrive_and_wait();
+				parallel_for(thread_pool, 0, 1000U, 1, [&](unsigned int start, unsigned int end) {
+					for (unsigned int i = start; i < end; i++)
+						sum += i;
+				});
+			});
+
+		thread_pool.wait();
+
+		EXPECT_EQ(NUM_THREADS * (1000 * 999 / 2), sum);
+	}
+
+	TEST(ParallelFor, Reduce)
+	{
+		ThreadPool thread_pool(4);
+
+		std::uint64_t sum = parallel_reduce(
+		        thread_pool,
+		        0,
+		        std::uint64_t(100000),
+		        100,
+		        std::uint64_t(0),
+		        [](std::uint64_t start, std::uint64_t end) {
+			        std::uint64_t s = 0;
+			        for (std::uint64_t i = start; i < end; i++)
+				        s += i;
+			        return s;
+		        },
+		        [](std::uint64_t a, std::uint64_t b) { return a + b; });
+
+		EXPECT_EQ(std::uint64_t(100000) * 99999 / 2, sum);
+	}
+
+	TEST(ParallelFor, ReduceDeterministicOrder)
+	{
+		ThreadPool thread_pool(4);
+		std::vector<std::vector<unsigned int>> results;
+
+		for (unsigned int i = 0; i < 10; i++)
+			results.push_back(parallel_reduce(
+			        thread_pool,
+			        0,
+			        100U,
+			        1,
+			        std::vector<unsigned int>(),
+			        [](unsigned int start, unsigned int) { return std::vector<unsigned int>{start}; },
+			        [](std::vector<unsigned int> a, const std::vector<unsigned int> &b) {
+				        a.insert(a.end(), b.begin(), b.end());
+				        return a;
+			        }));
+
+		ASSERT_EQ(4, results[0].size());
+		EXPECT_EQ((std::vector<unsigned int>{0, 25, 50, 75}), results[0]);
+
+		for (const auto &result : results)
+			EXPECT_EQ(results[0], result);
+	}
+}
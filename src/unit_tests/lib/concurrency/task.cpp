@@ -0,0 +1,164 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/concurrency/task.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace
+{
+	struct Counted
+	{
+		explicit Counted(int &c) : count(&c)
+		{
+			(*count)++;
+		}
+
+		Counted(const Counted &other) = delete;
+		Counted &operator=(const Counted &other) = delete;
+
+		Counted(Counted &&other) noexcept : count(other.count)
+		{
+			(*count)++;
+		}
+
+		Counted &operator=(Counted &&other) = delete;
+
+		~Counted()
+		{
+			(*count)--;
+		}
+
+		int *count;
+	};
+}
+
+namespace Rayni
+{
+	TEST(Task, Empty)
+	{
+		Task task;
+		EXPECT_FALSE(task);
+	}
+
+	TEST(Task, Call)
+	{
+		int value = 0;
+		Task task([&value] { value++; });
+
+		ASSERT_TRUE(task);
+		task();
+		task();
+
+		EXPECT_EQ(2, value);
+	}
+
+	TEST(Task, SmallFunctionStoredInBuffer)
+	{
+		auto small = [a = 0, b = 0.0] { static_cast<void>(a + b); };
+		auto large = [a = std::array<std::byte, Task::BUFFER_SIZE + 1>()] { static_cast<void>(a); };
+
+		EXPECT_TRUE(Task::stored_in_buffer<decltype(small)>());
+		EXPECT_FALSE(Task::stored_in_buffer<decltype(large)>());
+	}
+
+	TEST(Task, MoveOnlyFunction)
+	{
+		int value = 0;
+		Task task([&value, p = std::make_unique<int>(123)] { value = *p; });
+
+		task();
+
+		EXPECT_EQ(123, value);
+	}
+
+	TEST(Task, Move)
+	{
+		for (bool large : {false, true}) {
+			int value = 0;
+			Task task1;
+
+			if (large)
+				task1 = [&value, a = std::array<int, Task::BUFFER_SIZE>({1})] { value = a[0]; };
+			else
+				task1 = [&value] { value = 1; };
+
+			Task task2(std::move(task1));
+			// NOLINTNEXTLINE(bugprone-use-after-move, clang-analyzer-cplusplus.Move) Tests move.
+			EXPECT_FALSE(task1);
+			ASSERT_TRUE(task2);
+
+			Task task3;
+			task3 = std::move(task2);
+			// NOLINTNEXTLINE(bugprone-use-after-move, clang-analyzer-cplusplus.Move) Tests move.
+			EXPECT_FALSE(task2);
+			ASSERT_TRUE(task3);
+
+			task3();
+			EXPECT_EQ(1, value);
+		}
+	}
+
+	TEST(Task, Destroy)
+	{
+		int count = 0;
+
+		{
+			Task task1([c = Counted(count)] { static_cast<void>(c); });
+			EXPECT_EQ(1, count);
+
+			Task task2(std::move(task1));
+			EXPECT_EQ(1, count);
+		}
+
+		EXPECT_EQ(0, count);
+
+		Task task([c = Counted(count)] { static_cast<void>(c); });
+		EXPECT_EQ(1, count);
+		task.reset();
+		EXPECT_EQ(0, count);
+		EXPECT_FALSE(task);
+	}
+
+	TEST(Task, Emplace)
+	{
+		struct Function
+		{
+			void operator()()
+			{
+				value++;
+			}
+
+			int value = 0;
+		};
+
+		Task task;
+		Function &function = task.emplace<Function>();
+
+		task();
+		task();
+
+		EXPECT_EQ(2, function.value);
+	}
+}
@@ -0,0 +1,163 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/concurrency/task_group.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "lib/concurrency/thread_pool.h"
+
+namespace
+{
+	unsigned int fibonacci(Rayni::ThreadPool &thread_pool, unsigned int n)
+	{
+		if (n < 2)
+			return n;
+
+		unsigned int a = 0;
+		unsigned int b = 0;
+
+		Rayni::parallel_invoke(
+		        thread_pool,
+		        [&] { a = fibonacci(thread_pool, n - 1); },
+		        [&] { b = fibonacci(thread_pool, n - 2); });
+
+		return a + b;
+	}
+}
+
+namespace Rayni
+{
+	TEST(TaskGroup, RunAndWait)
+	{
+		ThreadPool thread_pool;
+		TaskGroup task_group(thread_pool);
+		std::atomic<unsigned int> counter{0};
+
+		for (unsigned int i = 0; i < 100; i++)
+			task_group.run([&counter] { counter++; });
+
+		task_group.wait();
+
+		EXPECT_EQ(100, counter);
+	}
+
+	TEST(TaskGroup, WaitInDestructor)
+	{
+		ThreadPool thread_pool;
+		std::atomic<unsigned int> counter{0};
+
+		{
+			TaskGroup task_group(thread_pool);
+
+			for (unsigned int i = 0; i < 100; i++)
+				task_group.run([&counter] { counter++; });
+		}
+
+		EXPECT_EQ(100, counter);
+	}
+
+	TEST(TaskGroup, WaitInTaskDoesNotBlockThread)
+	{
+		// Would never finish if waiting blocked the only thread in pool.
+		ThreadPool thread_pool(1);
+		std::atomic<unsigned int> counter{0};
+
+		thread_pool.add_task([&] {
+			TaskGroup task_group(thread_pool);
+
+			for (unsigned int i = 0; i < 10; i++)
+				task_group.run([&counter] { counter++; });
+
+			task_group.wait();
+			counter += 10;
+		});
+
+		thread_pool.wait();
+
+		EXPECT_EQ(20, counter);
+	}
+
+	TEST(TaskGroup, WaitOutsidePoolDoesNotRunTasks)
+	{
+		ThreadPool thread_pool(1);
+		TaskGroup task_group(thread_pool);
+		std::mutex mutex;
+		std::vector<std::thread::id> ids;
+
+		for (unsigned int i = 0; i < 100; i++)
+			task_group.run([&] {
+				std::lock_guard<std::mutex> lock(mutex);
+				ids.push_back(std::this_thread::get_id());
+			});
+
+		task_group.wait();
+
+		ASSERT_EQ(100, ids.size());
+
+		for (const std::thread::id &id : ids)
+			EXPECT_NE(std::this_thread::get_id(), id);
+	}
+
+	TEST(TaskGroup, RunOn)
+	{
+		constexpr unsigned int NUM_THREADS = 4;
+		ThreadPool thread_pool(NUM_THREADS);
+		TaskGroup task_group(thread_pool);
+		std::optional<unsigned int> indices[NUM_THREADS];
+
+		for (unsigned int t = 0; t < NUM_THREADS; t++)
+			task_group.run_on(
+			        t,
+			        [&, t] { indices[t] = thread_pool.current_thread_index(); },
+			        ThreadPool::Affinity::ONLY);
+
+		task_group.wait();
+
+		for (unsigned int t = 0; t < NUM_THREADS; t++)
+			EXPECT_EQ(t, indices[t]);
+	}
+
+	TEST(TaskGroup, ParallelInvokeRecursive)
+	{
+		for (unsigned int threads : {1U, 2U, 8U}) {
+			ThreadPool thread_pool(threads);
+			EXPECT_EQ(6765, fibonacci(thread_pool, 20));
+		}
+	}
+
+	TEST(TaskGroup, ParallelInvokeFromTasks)
+	{
+		ThreadPool thread_pool(2);
+		std::atomic<unsigned int> sum{0};
+
+		for (unsigned int i = 0; i < 8; i++)
+			thread_pool.add_task([&] { sum += fibonacci(thread_pool, 15); });
+
+		thread_pool.wait();
+
+		EXPECT_EQ(8 * 610, sum);
+	}
+}
@@ -20,15 +20,18 @@
 #include "lib/concurrency/thread_pool.h"
 
 #include <gtest/gtest.h>
+#include <sched.h>
 
 #include <array>
 #include <atomic>
-#include <functional>
-#include <future>
+#include <memory>
+#include <optional>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "lib/concurrency/barrier.h"
+#include "lib/system/linux/cpu_topology.h"
 
 namespace
 {
@@ -60,7 +63,7 @@ namespace Rayni
 	{
 		ThreadPool thread_pool;
 		std::atomic<unsigned int> counter{0};
-		std::vector<std::function<void()>> tasks;
+		std::vector<Task> tasks;
 
 		for (unsigned int i = 0; i < SUM_TERM_COUNT; i++)
 			tasks.emplace_back([&counter, i] { counter += i; });
@@ -77,10 +80,12 @@ namespace Rayni
 
 	TEST(ThreadPool, CustomNumberOfThreads)
 	{
-		// Do not want to add a size()/thread_count() method to ThreadPool so use a barrier
-		// and atomics to test that correct number of threads are actually created.
+		// Use a barrier and atomics to test that correct number of threads are actually
+		// created and not just that size() returns expected value.
 		constexpr unsigned int NUM_THREADS = 20;
 		ThreadPool thread_pool(NUM_THREADS);
+		EXPECT_EQ(NUM_THREADS, thread_pool.size());
+
 		Barrier barrier(NUM_THREADS + 1);
 		std::atomic<unsigned int> counter1{0};
 		std::atomic<unsigned int> counter2{0};
@@ -108,11 +113,107 @@ namespace Rayni
 		EXPECT_EQ(NUM_THREADS * 2, counter2);
 	}
 
+	TEST(ThreadPool, AddTaskFromTask)
+	{
+		ThreadPool thread_pool;
+		std::atomic<unsigned int> counter{0};
+
+		for (unsigned int i = 0; i < SUM_TERM_COUNT; i++)
+			thread_pool.add_task([&thread_pool, &counter, i] {
+				for (unsigned int j = 0; j < SUM_TERM_COUNT; j++)
+					thread_pool.add_task([&counter, j] { counter += j; });
+				counter += i;
+			});
+
+		thread_pool.wait();
+
+		EXPECT_EQ(SUM * (SUM_TERM_COUNT + 1), counter);
+	}
+
+	TEST(ThreadPool, AddTaskToOnly)
+	{
+		constexpr unsigned int NUM_THREADS = 4;
+		ThreadPool thread_pool(NUM_THREADS);
+		std::array<std::vector<std::thread::id>, NUM_THREADS> ids;
+
+		for (unsigned int i = 0; i < SUM_TERM_COUNT; i++)
+			for (unsigned int t = 0; t < NUM_THREADS; t++)
+				thread_pool.add_task_to(
+				        t,
+				        [&ids, t] { ids[t].push_back(std::this_thread::get_id()); },
+				        ThreadPool::Affinity::ONLY);
+
+		thread_pool.wait();
+
+		for (unsigned int t = 0; t < NUM_THREADS; t++) {
+			ASSERT_EQ(SUM_TERM_COUNT, ids[t].size());
+
+			for (const std::thread::id &id : ids[t])
+				EXPECT_EQ(ids[t][0], id);
+
+			for (unsigned int u = 0; u < t; u++)
+				EXPECT_NE(ids[u][0], ids[t][0]);
+		}
+	}
+
+	TEST(ThreadPool, AddTaskToPreferred)
+	{
+		constexpr unsigned int NUM_THREADS = 4;
+		ThreadPool thread_pool(NUM_THREADS);
+		std::atomic<unsigned int> counter{0};
+
+		for (unsigned int i = 0; i < SUM_TERM_COUNT; i++)
+			thread_pool.add_task_to(i % NUM_THREADS, [&counter, i] { counter += i; });
+
+		thread_pool.wait();
+
+		EXPECT_EQ(SUM, counter);
+	}
+
+	TEST(ThreadPool, RunTaggedTask)
+	{
+		ThreadPool thread_pool(1);
+		Barrier barrier(1 + 1);
+		int tag;
+		int other_tag;
+		std::vector<std::thread::id> ids;
+		std::atomic<unsigned int> other_counter{0};
+
+		auto add_id = [&ids] { ids.push_back(std::this_thread::get_id()); };
+		auto count = [&other_counter] { other_counter++; };
+
+		thread_pool.add_task([&] {
+			barrier.arrive_and_wait(); // Wait for "thread busy".
+			barrier.arrive_and_wait(); // Wait for tagged tasks run.
+		});
+
+		barrier.arrive_and_wait(); // Thread busy.
+
+		thread_pool.add_task_to(0, add_id, ThreadPool::Affinity::PREFERRED, &tag);
+		thread_pool.add_task_to(0, count, ThreadPool::Affinity::PREFERRED, &other_tag);
+		thread_pool.add_task_to(0, add_id, ThreadPool::Affinity::PREFERRED, &tag);
+
+		EXPECT_TRUE(thread_pool.run_tagged_task(0, &tag));
+		EXPECT_TRUE(thread_pool.run_tagged_task(0, &tag));
+		EXPECT_FALSE(thread_pool.run_tagged_task(0, &tag));
+
+		ASSERT_EQ(2, ids.size());
+		EXPECT_EQ(std::this_thread::get_id(), ids[0]);
+		EXPECT_EQ(std::this_thread::get_id(), ids[1]);
+		EXPECT_EQ(0, other_counter);
+
+		barrier.arrive_and_wait(); // Tagged tasks run.
+		thread_pool.wait();
+
+		EXPECT_EQ(2, ids.size());
+		EXPECT_EQ(1, other_counter);
+	}
+
 	TEST(ThreadPool, Async)
 	{
 		ThreadPool thread_pool;
 		std::atomic<unsigned int> counter{0};
-		std::array<std::future<unsigned int>, SUM_TERM_COUNT> futures;
+		std::array<ThreadPool::Future<unsigned int>, SUM_TERM_COUNT> futures;
 
 		for (auto &future : futures)
 			future = thread_pool.async([&] { return counter.fetch_add(1); });
@@ -129,7 +230,7 @@ namespace Rayni
 		ThreadPool thread_pool;
 		std::atomic<unsigned int> counter{0};
 		std::atomic<unsigned int> sum{0};
-		std::array<std::future<void>, SUM_TERM_COUNT> futures;
+		std::array<ThreadPool::Future<void>, SUM_TERM_COUNT> futures;
 
 		for (auto &future : futures)
 			future = thread_pool.async([&] { sum += counter.fetch_add(1); });
@@ -140,37 +241,139 @@ namespace Rayni
 		EXPECT_EQ(SUM, sum);
 	}
 
-	TEST(ThreadPool, ThreadsAvailable)
+	TEST(ThreadPool, AsyncMoveOnlyResult)
 	{
-		constexpr unsigned int NUM_THREADS = 2;
-		ThreadPool thread_pool(NUM_THREADS);
-		Barrier barrier_one(1 + 1);
-		Barrier barrier_all(NUM_THREADS + 1);
+		ThreadPool thread_pool;
+
+		auto func = [value = std::make_unique<int>(123)]() mutable { return std::move(value); };
+		auto future = thread_pool.async(std::move(func));
+
+		EXPECT_TRUE(future.valid());
+		std::unique_ptr<int> value = future.get();
+		EXPECT_FALSE(future.valid());
+
+		ASSERT_TRUE(value);
+		EXPECT_EQ(123, *value);
+	}
+
+	TEST(ThreadPool, AsyncGetInTaskDoesNotBlockThread)
+	{
+		// Would never finish if get() blocked the only thread in pool.
+		ThreadPool thread_pool(1);
+		auto future = thread_pool.async([&] { return thread_pool.async([] { return 123; }).get() + 1; });
+
+		EXPECT_EQ(124, future.get());
+	}
+
+	TEST(ThreadPool, AsyncFutureDestroyedBeforeTaskRun)
+	{
+		ThreadPool thread_pool(1);
+		Barrier barrier(1 + 1);
+		std::atomic<unsigned int> counter{0};
+
+		thread_pool.add_task([&] { barrier.arrive_and_wait(); });
+
+		thread_pool.async([&] { return counter.fetch_add(1); });
+
+		barrier.arrive_and_wait();
+		thread_pool.wait();
+
+		EXPECT_EQ(1, counter);
+	}
 
-		EXPECT_EQ(NUM_THREADS, thread_pool.threads_available());
+	TEST(ThreadPool, HighPriorityRunBeforeNormal)
+	{
+		ThreadPool thread_pool(1);
+		Barrier barrier(1 + 1);
+		std::vector<unsigned int> order;
 
 		thread_pool.add_task([&] {
-			barrier_one.arrive_and_wait(); // Wait for pre "1 thread busy?".
-			barrier_all.arrive_and_wait(); // Wait for pre "all threads busy?".
-			barrier_all.arrive_and_wait(); // Wait for post "all threads_busy?".
+			barrier.arrive_and_wait(); // Wait for thread to be busy.
+			barrier.arrive_and_wait(); // Wait for all tasks to be added.
 		});
 
-		barrier_one.arrive_and_wait(); // pre "1 thread busy?".
-		EXPECT_EQ(1, thread_pool.threads_available());
+		barrier.arrive_and_wait(); // Thread busy, tasks below are queued.
+
+		for (unsigned int i = 0; i < 3; i++)
+			thread_pool.add_task([&, i] { order.push_back(i); });
+
+		thread_pool.add_task([&] { order.push_back(3); }, ThreadPool::Priority::HIGH);
+		ThreadPool::Future<void> future = thread_pool.async([&] { order.push_back(4); },
+		                                                    ThreadPool::Priority::HIGH);
+
+		barrier.arrive_and_wait(); // All tasks added.
+
+		future.get();
+		thread_pool.wait();
+
+		EXPECT_EQ(std::vector<unsigned int>({3, 4, 0, 1, 2}), order);
+	}
+
+	TEST(ThreadPool, HighPriorityFromTaskRunBeforeNormal)
+	{
+		ThreadPool thread_pool(1);
+		std::vector<unsigned int> order;
 
 		thread_pool.add_task([&] {
-			barrier_all.arrive_and_wait(); // Wait for pre "all threads busy?".
-			barrier_all.arrive_and_wait(); // Wait for post "all threads busy?".
+			for (unsigned int i = 0; i < 3; i++)
+				thread_pool.add_task([&, i] { order.push_back(i); });
+
+			thread_pool.add_task([&] { order.push_back(3); }, ThreadPool::Priority::HIGH);
 		});
 
-		barrier_all.arrive_and_wait(); // pre "all threads busy?"
+		thread_pool.wait();
+
+		EXPECT_EQ(std::vector<unsigned int>({3, 2, 1, 0}), order);
+	}
+
+	TEST(ThreadPool, CurrentThreadIndex)
+	{
+		constexpr unsigned int NUM_THREADS = 4;
+		ThreadPool thread_pool(NUM_THREADS);
+		ThreadPool other_thread_pool(1);
+		std::array<std::optional<unsigned int>, NUM_THREADS> indices;
+		std::optional<unsigned int> other_index = 0;
+
+		EXPECT_FALSE(thread_pool.current_thread_index());
+
+		for (unsigned int t = 0; t < NUM_THREADS; t++)
+			thread_pool.add_task_to(
+			        t,
+			        [&, t] { indices[t] = thread_pool.current_thread_index(); },
+			        ThreadPool::Affinity::ONLY);
+
+		other_thread_pool.add_task([&] { other_index = thread_pool.current_thread_index(); });
+
+		thread_pool.wait();
+		other_thread_pool.wait();
+
+		for (unsigned int t = 0; t < NUM_THREADS; t++)
+			EXPECT_EQ(t, indices[t]);
+
+		EXPECT_FALSE(other_index);
+	}
+
+	TEST(ThreadPool, PinnedToCPUs)
+	{
+		Result<CPUTopology> topology = CPUTopology::read();
+		if (!topology)
+			GTEST_SKIP() << topology.error().message();
+
+		std::vector<unsigned int> cpu_ids = topology->cpu_ids(CPUTopology::SMT::INCLUDE);
+		ThreadPool thread_pool(cpu_ids);
+		std::vector<int> cpus_run_on(cpu_ids.size(), -1);
 
-		EXPECT_EQ(0, thread_pool.threads_available());
+		ASSERT_EQ(cpu_ids.size(), thread_pool.size());
 
-		barrier_all.arrive_and_wait(); // post "all threds busy?"
+		for (unsigned int t = 0; t < thread_pool.size(); t++)
+			thread_pool.add_task_to(
+			        t,
+			        [&, t] { cpus_run_on[t] = sched_getcpu(); },
+			        ThreadPool::Affinity::ONLY);
 
 		thread_pool.wait();
 
-		EXPECT_EQ(NUM_THREADS, thread_pool.threads_available());
+		for (unsigned int t = 0; t < thread_pool.size(); t++)
+			EXPECT_EQ(int(cpu_ids[t]), cpus_run_on[t]);
 	}
 }
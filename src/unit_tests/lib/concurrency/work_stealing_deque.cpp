@@ -0,0 +1,110 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/concurrency/work_stealing_deque.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace Rayni
+{
+	TEST(WorkStealingDeque, PushPopIsLifo)
+	{
+		WorkStealingDeque<int> deque;
+
+		for (int i = 0; i < 3; i++)
+			deque.push(i);
+
+		EXPECT_EQ(3, deque.size());
+		EXPECT_EQ(2, deque.pop());
+		EXPECT_EQ(1, deque.pop());
+		EXPECT_EQ(0, deque.pop());
+		EXPECT_EQ(std::nullopt, deque.pop());
+		EXPECT_EQ(0, deque.size());
+	}
+
+	TEST(WorkStealingDeque, StealIsFifo)
+	{
+		WorkStealingDeque<int> deque;
+
+		for (int i = 0; i < 3; i++)
+			deque.push(i);
+
+		EXPECT_EQ(0, deque.steal());
+		EXPECT_EQ(1, deque.steal());
+		EXPECT_EQ(2, deque.pop());
+		EXPECT_EQ(std::nullopt, deque.steal());
+	}
+
+	TEST(WorkStealingDeque, Grow)
+	{
+		WorkStealingDeque<int> deque(2);
+
+		for (int i = 0; i < 100; i++)
+			deque.push(i);
+
+		EXPECT_EQ(0, deque.steal());
+
+		for (int i = 99; i > 0; i--)
+			EXPECT_EQ(i, deque.pop());
+
+		EXPECT_EQ(std::nullopt, deque.pop());
+	}
+
+	TEST(WorkStealingDeque, ConcurrentStealing)
+	{
+		constexpr unsigned int NUM_THIEVES = 4;
+		constexpr int NUM_ITEMS = 100000;
+		WorkStealingDeque<int> deque(4);
+		std::vector<std::atomic<int>> taken(NUM_ITEMS);
+		std::atomic<bool> done{false};
+		std::vector<std::thread> thieves;
+
+		for (unsigned int t = 0; t < NUM_THIEVES; t++)
+			thieves.emplace_back([&] {
+				while (!done)
+					if (std::optional<int> item = deque.steal())
+						taken[std::size_t(*item)]++;
+			});
+
+		for (int i = 0; i < NUM_ITEMS; i++) {
+			deque.push(i);
+
+			if (i % 3 == 0)
+				if (std::optional<int> item = deque.pop())
+					taken[std::size_t(*item)]++;
+		}
+
+		while (std::optional<int> item = deque.pop())
+			taken[std::size_t(*item)]++;
+
+		done = true;
+
+		for (auto &thief : thieves)
+			thief.join();
+
+		for (auto &t : taken)
+			EXPECT_EQ(1, t);
+	}
+}
@@ -0,0 +1,145 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/containers/arena.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+namespace Rayni
+{
+	TEST(Arena, Allocate)
+	{
+		Arena arena(64);
+
+		auto *a = arena.allocate<std::uint8_t>(3);
+		auto *b = arena.allocate<std::uint32_t>(4);
+
+		EXPECT_EQ(0U, std::uintptr_t(b) % alignof(std::uint32_t));
+		EXPECT_LE(std::uintptr_t(a + 3), std::uintptr_t(b));
+		EXPECT_EQ(64U, arena.capacity());
+
+		for (unsigned int i = 0; i < 4; i++)
+			b[i] = i;
+
+		auto *c = arena.allocate<std::uint32_t>(16);
+		EXPECT_EQ(128U, arena.capacity());
+		EXPECT_NE(c, b + 4);
+
+		for (unsigned int i = 0; i < 4; i++)
+			EXPECT_EQ(i, b[i]);
+	}
+
+	TEST(Arena, AllocateLargerThanBlockSize)
+	{
+		Arena arena(64);
+
+		arena.allocate<std::uint8_t>(100);
+		EXPECT_EQ(100U, arena.capacity());
+
+		arena.allocate<std::uint8_t>(1);
+		EXPECT_EQ(164U, arena.capacity());
+	}
+
+	TEST(Arena, RewindReusesMemory)
+	{
+		Arena arena(64);
+
+		arena.allocate<std::uint8_t>(10);
+		Arena::Marker marker = arena.marker();
+		auto *a = arena.allocate<std::uint8_t>(40);
+		arena.allocate<std::uint8_t>(40);
+
+		arena.rewind(marker);
+		EXPECT_EQ(a, arena.allocate<std::uint8_t>(40));
+		arena.allocate<std::uint8_t>(40);
+		EXPECT_EQ(128U, arena.capacity());
+	}
+
+	TEST(Arena, RewindKeepsTooSmallBlocks)
+	{
+		Arena arena(64);
+
+		Arena::Marker marker = arena.marker();
+		arena.allocate<std::uint8_t>(64);
+		arena.allocate<std::uint8_t>(64);
+
+		arena.rewind(marker);
+		arena.allocate<std::uint8_t>(64);
+		arena.allocate<std::uint8_t>(100);
+		EXPECT_EQ(228U, arena.capacity());
+
+		auto *a = arena.allocate<std::uint8_t>(64);
+		arena.rewind(marker);
+		arena.allocate<std::uint8_t>(64);
+		arena.allocate<std::uint8_t>(100);
+		EXPECT_EQ(a, arena.allocate<std::uint8_t>(64));
+		EXPECT_EQ(228U, arena.capacity());
+	}
+
+	TEST(Arena, RewindFreesLargeBlocks)
+	{
+		Arena arena(64);
+
+		arena.allocate<std::uint8_t>(10);
+		Arena::Marker marker = arena.marker();
+		arena.allocate<std::uint8_t>(100);
+		arena.allocate<std::uint8_t>(64);
+		arena.allocate<std::uint8_t>(200);
+		EXPECT_EQ(428U, arena.capacity());
+
+		arena.rewind(marker);
+		EXPECT_EQ(128U, arena.capacity());
+
+		arena.rewind(Arena::Marker());
+		EXPECT_EQ(128U, arena.capacity());
+
+		marker = arena.marker();
+		arena.allocate<std::uint8_t>(100);
+		arena.rewind(marker);
+		EXPECT_EQ(128U, arena.capacity());
+	}
+
+	TEST(Arena, ShrinkLast)
+	{
+		Arena arena(64);
+
+		arena.allocate<std::uint8_t>(10);
+		auto *a = arena.allocate<std::uint32_t>(10);
+		arena.shrink_last(a, 2);
+		EXPECT_EQ(a + 2, arena.allocate<std::uint32_t>(4));
+
+		auto *b = arena.allocate<std::uint32_t>(100);
+		arena.shrink_last(b, 0);
+		EXPECT_EQ(b, arena.allocate<std::uint32_t>(1));
+	}
+
+	TEST(Arena, Release)
+	{
+		Arena arena(64);
+
+		arena.allocate<std::uint8_t>(100);
+		arena.release();
+		EXPECT_EQ(0U, arena.capacity());
+
+		arena.allocate<std::uint8_t>(1);
+		EXPECT_EQ(64U, arena.capacity());
+	}
+}
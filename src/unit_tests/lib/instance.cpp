@@ -0,0 +1,182 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2013-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/instance.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <memory>
+
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/math/aabb.h"
+#include "lib/math/animated_transform.h"
+#include "lib/math/math.h"
+#include "lib/math/ray.h"
+#include "lib/math/transform.h"
+#include "lib/math/vector3.h"
+
+namespace Rayni
+{
+	namespace
+	{
+		// Sphere with radius 1 centered at origin.
+		class UnitSphere : public Intersectable
+		{
+		public:
+			AABB aabb() const override
+			{
+				return AABB({-1, -1, -1}, {1, 1, 1});
+			}
+
+			bool intersect(const Ray &ray) const override
+			{
+				real_t t;
+				return intersect_t(ray, t);
+			}
+
+			bool intersect(const Ray &ray, Intersection &intersection) const override
+			{
+				real_t t;
+
+				if (!intersect_t(ray, t) || t >= intersection.t)
+					return false;
+
+				intersection.t = t;
+				intersection.point = ray.origin + ray.direction * t;
+				intersection.point_error = Vector3(0, 0, 0);
+				intersection.normal = intersection.point;
+				intersection.incident = -ray.direction;
+				intersection.intersectable = this;
+
+				return true;
+			}
+
+		private:
+			static bool intersect_t(const Ray &ray, real_t &t)
+			{
+				real_t a = ray.direction.dot(ray.direction);
+				real_t b = 2 * ray.direction.dot(ray.origin);
+				real_t c = ray.origin.dot(ray.origin) - 1;
+				real_t discriminant = b * b - 4 * a * c;
+
+				if (discriminant < 0)
+					return false;
+
+				t = (-b - std::sqrt(discriminant)) / (2 * a);
+
+				return t > 0;
+			}
+		};
+
+		testing::AssertionResult vector3_near(const char *v1_expr,
+		                                      const char *v2_expr,
+		                                      const char *abs_error_expr,
+		                                      const Vector3 &v1,
+		                                      const Vector3 &v2,
+		                                      real_t abs_error)
+		{
+			for (unsigned int i = 0; i < 3; i++)
+				if (std::abs(v1[i] - v2[i]) > abs_error)
+					return testing::AssertionFailure()
+					       << v1_expr << " and " << v2_expr << " differ more than "
+					       << abs_error_expr << " in component " << i << ".";
+
+			return testing::AssertionSuccess();
+		}
+	}
+
+	TEST(Instance, AABB)
+	{
+		auto sphere = std::make_shared<UnitSphere>();
+		const Transform transform = Transform::combine(Transform::translate(1, 2, 3), Transform::scale(2));
+		AABB aabb = Instance(sphere, transform).aabb();
+
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(-1, 0, 1), aabb.minimum(), 1e-6);
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(3, 4, 5), aabb.maximum(), 1e-6);
+	}
+
+	TEST(Instance, Intersect)
+	{
+		auto sphere = std::make_shared<UnitSphere>();
+		const Instance instance1(sphere, Transform::translate(10, 0, 0));
+		const Transform transform2 = Transform::combine(Transform::translate(-10, 0, 0), Transform::scale(2));
+		const Instance instance2(sphere, transform2);
+
+		EXPECT_TRUE(instance1.intersect(Ray({0, 0, 0}, {1, 0, 0}, 0)));
+		EXPECT_FALSE(instance1.intersect(Ray({0, 0, 0}, {-1, 0, 0}, 0)));
+		EXPECT_FALSE(instance1.intersect(Ray({0, 2, 0}, {1, 0, 0}, 0)));
+
+		EXPECT_TRUE(instance2.intersect(Ray({0, 1.5, 0}, {-1, 0, 0}, 0)));
+		EXPECT_FALSE(instance2.intersect(Ray({0, 2.5, 0}, {-1, 0, 0}, 0)));
+	}
+
+	TEST(Instance, IntersectIntersection)
+	{
+		auto sphere = std::make_shared<UnitSphere>();
+		const Transform transform = Transform::combine(Transform::translate(-10, 0, 0), Transform::scale(2));
+		const Instance instance(sphere, transform);
+		const Ray ray({0, 0, 0}, {-2, 0, 0}, 0);
+		Intersection intersection;
+
+		ASSERT_TRUE(instance.intersect(ray, intersection));
+		EXPECT_NEAR(4, intersection.t, 1e-6);
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(-8, 0, 0), intersection.point, 1e-6);
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(1, 0, 0), intersection.normal.normalize(), 1e-6);
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(2, 0, 0), intersection.incident, 1e-6);
+		EXPECT_EQ(sphere.get(), intersection.intersectable);
+
+		Intersection closer_intersection;
+		closer_intersection.t = 1;
+		EXPECT_FALSE(instance.intersect(ray, closer_intersection));
+	}
+
+	TEST(AnimatedInstance, AABB)
+	{
+		auto sphere = std::make_shared<UnitSphere>();
+		AABB aabb = AnimatedInstance(sphere,
+		                             AnimatedTransform(0,
+		                                               Transform::translate(-5, 0, 0),
+		                                               1,
+		                                               Transform::translate(5, 0, 0)))
+		                    .aabb();
+
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(-6, -1, -1), aabb.minimum(), 1e-6);
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(6, 1, 1), aabb.maximum(), 1e-6);
+	}
+
+	TEST(AnimatedInstance, Intersect)
+	{
+		auto sphere = std::make_shared<UnitSphere>();
+		const AnimatedInstance instance(
+		        sphere,
+		        AnimatedTransform(0, Transform::translate(0, -5, 0), 1, Transform::translate(0, 5, 0)));
+
+		EXPECT_TRUE(instance.intersect(Ray({0, -5, -10}, {0, 0, 1}, 0)));
+		EXPECT_FALSE(instance.intersect(Ray({0, -5, -10}, {0, 0, 1}, 1)));
+		EXPECT_TRUE(instance.intersect(Ray({0, 5, -10}, {0, 0, 1}, 1)));
+		EXPECT_TRUE(instance.intersect(Ray({0, 0, -10}, {0, 0, 1}, 0.5)));
+
+		Intersection intersection;
+		ASSERT_TRUE(instance.intersect(Ray({0, 5, -10}, {0, 0, 1}, 1), intersection));
+		EXPECT_NEAR(9, intersection.t, 1e-6);
+		EXPECT_PRED_FORMAT3(vector3_near, Vector3(0, 5, -1), intersection.point, 1e-6);
+	}
+}
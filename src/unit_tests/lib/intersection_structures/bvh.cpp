@@ -0,0 +1,316 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/intersection_structures/bvh.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lib/concurrency/cancellable.h"
+#include "lib/concurrency/thread_pool.h"
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/intersection_structure.h"
+#include "lib/math/aabb.h"
+#include "lib/math/math.h"
+#include "lib/math/ray.h"
+#include "lib/math/vector3.h"
+#include "lib/system/scoped_temp_dir.h"
+#include "unit_tests/lib/intersection_structures/test_helpers.h"
+
+namespace Rayni
+{
+	namespace
+	{
+		const BVHNodeLayout NODE_LAYOUTS[] = {BVHNodeLayout::BINARY,
+		                                      BVHNodeLayout::WIDE4,
+		                                      BVHNodeLayout::WIDE8,
+		                                      BVHNodeLayout::WIDE4_QUANTIZED,
+		                                      BVHNodeLayout::WIDE8_QUANTIZED};
+
+		// All combinations of build method and node layout.
+		std::vector<BVHBuildOptions> all_build_options()
+		{
+			std::vector<BVHBuildOptions> options;
+
+			for (BVHBuildMethod build_method : {BVHBuildMethod::BINNED_SAH,
+			                                    BVHBuildMethod::BINNED_SAH_ALL_AXES,
+			                                    BVHBuildMethod::LBVH,
+			                                    BVHBuildMethod::SBVH})
+				for (BVHNodeLayout node_layout : NODE_LAYOUTS)
+					options.push_back({.build_method = build_method, .node_layout = node_layout});
+
+			return options;
+		}
+
+		std::string options_string(const BVHBuildOptions &options)
+		{
+			return "build method " + std::to_string(int(options.build_method)) + ", node layout " +
+			       std::to_string(int(options.node_layout));
+		}
+	}
+
+	TEST(BVH, Intersect)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(20000);
+		const std::vector<Ray> rays = random_rays(300);
+		const std::vector<Ray> camera_rays = coherent_rays(16);
+		const std::vector<Intersection> expected = brute_force(pointers(boxes), rays);
+		const std::vector<Intersection> camera_expected = brute_force(pointers(boxes), camera_rays);
+
+		for (const BVHBuildOptions &options : all_build_options()) {
+			SCOPED_TRACE(options_string(options));
+
+			std::unique_ptr<Intersectable> bvh =
+			        bvh_build(pointers(boxes), cancellable, thread_pool, options);
+			ASSERT_TRUE(bvh);
+
+			EXPECT_TRUE(same_intersections(*bvh, rays, expected));
+			EXPECT_TRUE(same_intersections(*bvh, camera_rays, camera_expected));
+		}
+	}
+
+	TEST(BVH, IntersectFewIntersectables)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Ray> rays = random_rays(100);
+
+		for (std::size_t count : {1U, 2U, 5U}) {
+			SCOPED_TRACE(std::to_string(count) + " intersectables");
+			const std::vector<Box> boxes = random_boxes(count);
+			const std::vector<Intersection> expected = brute_force(pointers(boxes), rays);
+
+			for (const BVHBuildOptions &options : all_build_options()) {
+				SCOPED_TRACE(options_string(options));
+
+				std::unique_ptr<Intersectable> bvh =
+				        bvh_build(pointers(boxes), cancellable, thread_pool, options);
+				ASSERT_TRUE(bvh);
+
+				EXPECT_TRUE(same_intersections(*bvh, rays, expected));
+			}
+		}
+	}
+
+	TEST(BVH, IntersectManyCoincidentCentroids)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		std::vector<Box> boxes = random_boxes(100);
+
+		// More intersectables with same centroid than fit in one leaf, both
+		// nested boxes and identical boxes.
+		for (unsigned int i = 0; i < 300; i++) {
+			real_t size = 1 + real_t(i) / 10;
+			boxes.emplace_back(AABB({5 - size, 5 - size, 5 - size}, {5 + size, 5 + size, 5 + size}));
+			boxes.emplace_back(AABB({-50, -50, -50}, {-45, -45, -45}));
+		}
+
+		const std::vector<Ray> rays = random_rays(300);
+		const std::vector<Intersection> expected = brute_force(pointers(boxes), rays);
+
+		for (const BVHBuildOptions &options : all_build_options()) {
+			SCOPED_TRACE(options_string(options));
+
+			std::unique_ptr<Intersectable> bvh =
+			        bvh_build(pointers(boxes), cancellable, thread_pool, options);
+			ASSERT_TRUE(bvh);
+
+			EXPECT_TRUE(same_intersections(*bvh, rays, expected));
+		}
+	}
+
+	TEST(BVH, LBVHDepthIsLimited)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const Box origin_box(AABB({0, 0, 0}, {0, 0, 0}));
+		std::vector<Box> boxes(1 << 20, origin_box);
+
+		// Enough intersectables for 63 bit Morton codes. Centroids are in [0, 2^20],
+		// which gives 2 cells per unit, so each of these gets a code with only one
+		// bit set. Every bit may add a level, and splitting all intersectables at
+		// origin into leafs adds more levels on top of that.
+		for (unsigned int axis = 0; axis < 3; axis++) {
+			for (unsigned int bit = 0; bit < 21; bit++) {
+				Vector3 p(0, 0, 0);
+				p[axis] = real_t(1U << bit) / 2;
+				boxes.emplace_back(AABB(p, p));
+			}
+		}
+
+		boxes.emplace_back(AABB({1 << 20, 1 << 20, 1 << 20}, {1 << 20, 1 << 20, 1 << 20}));
+
+		const std::vector<Ray> rays = {Ray({-1, 0.25, 0.25}, {1, -0.25, -0.25}, 0),
+		                               Ray({0.25, 0.25, -1}, {0.125, 0, 1}, 0),
+		                               Ray({1000, 1000, 1000}, {-1, -1, -1}, 0)};
+		const BVHBuildOptions options = {.build_method = BVHBuildMethod::LBVH};
+
+		std::unique_ptr<BVH> bvh = bvh_build(pointers(boxes), cancellable, thread_pool, options);
+		ASSERT_TRUE(bvh);
+
+		EXPECT_TRUE(same_intersections(*bvh, rays, brute_force(pointers(boxes), rays)));
+	}
+
+	TEST(BVH, Refit)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Ray> rays = random_rays(300);
+		std::mt19937 generator;
+		std::uniform_real_distribution<real_t> offset(-10, 10);
+
+		for (const BVHBuildOptions &options : all_build_options()) {
+			SCOPED_TRACE(options_string(options));
+			std::vector<Box> boxes = random_boxes(5000);
+
+			std::unique_ptr<BVH> bvh = bvh_build(pointers(boxes), cancellable, thread_pool, options);
+			ASSERT_TRUE(bvh);
+
+			for (std::size_t i = 0; i < boxes.size(); i += 2)
+				boxes[i].move(Vector3(offset(generator), offset(generator), offset(generator)));
+
+			bvh->refit(thread_pool);
+
+			EXPECT_TRUE(same_intersections(*bvh, rays, brute_force(pointers(boxes), rays)));
+		}
+	}
+
+	TEST(BVH, SaveAndLoad)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(5000);
+		const std::vector<Ray> rays = random_rays(300);
+		const std::vector<Intersection> expected = brute_force(pointers(boxes), rays);
+
+		for (BVHNodeLayout node_layout : NODE_LAYOUTS) {
+			SCOPED_TRACE(testing::Message() << "node layout " << int(node_layout));
+			const std::string path = temp_dir.path() / "bvh";
+			const BVHBuildOptions options = {.node_layout = node_layout};
+
+			std::unique_ptr<BVH> bvh = bvh_build(pointers(boxes), cancellable, thread_pool, options);
+			ASSERT_TRUE(bvh);
+			ASSERT_TRUE(bvh->save(path, 123, pointers(boxes)));
+
+			auto loaded_bvh = bvh_load(path, 123, pointers(boxes), node_layout);
+			ASSERT_TRUE(loaded_bvh);
+			EXPECT_TRUE(same_intersections(**loaded_bvh, rays, expected));
+
+			EXPECT_FALSE(bvh_load(path, 124, pointers(boxes), node_layout));
+
+			BVHNodeLayout other_layout = node_layout == BVHNodeLayout::BINARY ? BVHNodeLayout::WIDE4
+			                                                                  : BVHNodeLayout::BINARY;
+			EXPECT_FALSE(bvh_load(path, 123, pointers(boxes), other_layout));
+		}
+	}
+
+	TEST(BVH, LoadCorrupt)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(5000);
+		const std::string path = temp_dir.path() / "bvh";
+
+		for (BVHNodeLayout node_layout : NODE_LAYOUTS) {
+			SCOPED_TRACE(testing::Message() << "node layout " << int(node_layout));
+			const BVHBuildOptions options = {.node_layout = node_layout};
+			std::unique_ptr<BVH> bvh = bvh_build(pointers(boxes), cancellable, thread_pool, options);
+			ASSERT_TRUE(bvh);
+
+			for (bool repeat_first : {true, false}) {
+				SCOPED_TRACE(testing::Message() << "repeat first " << repeat_first);
+				ASSERT_TRUE(bvh->save(path, 123, pointers(boxes)));
+				ASSERT_TRUE(corrupt_cache_file_nodes(path, repeat_first));
+
+				EXPECT_FALSE(bvh_load(path, 123, pointers(boxes), node_layout));
+			}
+		}
+	}
+
+	TEST(BVH, BuildCached)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		Cancellable cancelled;
+		cancelled.cancel();
+		const std::vector<Box> boxes = random_boxes(5000);
+		const std::vector<Ray> rays = random_rays(300);
+		const std::vector<Intersection> expected = brute_force(pointers(boxes), rays);
+
+		for (IntersectionStructureType type : {IntersectionStructureType::BVH,
+		                                       IntersectionStructureType::BVH4,
+		                                       IntersectionStructureType::BVH8,
+		                                       IntersectionStructureType::BVH4_QUANTIZED,
+		                                       IntersectionStructureType::BVH8_QUANTIZED,
+		                                       IntersectionStructureType::BVH_ALL_AXES,
+		                                       IntersectionStructureType::LBVH,
+		                                       IntersectionStructureType::SBVH}) {
+			SCOPED_TRACE(testing::Message() << "type " << int(type));
+
+			std::unique_ptr<Intersectable> built = intersection_structure_build_cached(type,
+			                                                                           pointers(boxes),
+			                                                                           temp_dir.path(),
+			                                                                           cancellable,
+			                                                                           thread_pool);
+			ASSERT_TRUE(built);
+			EXPECT_TRUE(same_intersections(*built, rays, expected));
+
+			// A cancelled build returns nullptr, so structure must come from cache.
+			std::unique_ptr<Intersectable> loaded = intersection_structure_build_cached(type,
+			                                                                            pointers(boxes),
+			                                                                            temp_dir.path(),
+			                                                                            cancelled,
+			                                                                            thread_pool);
+			ASSERT_TRUE(loaded);
+			EXPECT_TRUE(same_intersections(*loaded, rays, expected));
+		}
+	}
+
+	TEST(BVH, Cancelled)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		cancellable.cancel();
+		const std::vector<Box> boxes = random_boxes(20000);
+
+		for (const BVHBuildOptions &options : all_build_options())
+			EXPECT_FALSE(bvh_build(pointers(boxes), cancellable, thread_pool, options))
+			        << options_string(options);
+
+		EXPECT_FALSE(intersection_structure_build(IntersectionStructureType::DEFAULT,
+		                                          pointers(boxes),
+		                                          cancellable,
+		                                          thread_pool));
+	}
+}
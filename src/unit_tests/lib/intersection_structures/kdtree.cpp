@@ -0,0 +1,192 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/intersection_structures/kdtree.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lib/concurrency/cancellable.h"
+#include "lib/concurrency/thread_pool.h"
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/intersection_structure.h"
+#include "lib/math/ray.h"
+#include "lib/system/scoped_temp_dir.h"
+#include "unit_tests/lib/intersection_structures/test_helpers.h"
+
+namespace Rayni
+{
+	TEST(KdTree, Intersect)
+	{
+		ThreadPool thread_pool(1);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(5000);
+		const std::vector<Ray> rays = random_rays(300);
+		const std::vector<Ray> camera_rays = coherent_rays(16);
+
+		std::unique_ptr<KdTree> kdtree = kdtree_build(pointers(boxes), cancellable, thread_pool);
+		ASSERT_TRUE(kdtree);
+
+		EXPECT_TRUE(same_intersections(*kdtree, rays, brute_force(pointers(boxes), rays)));
+		EXPECT_TRUE(same_intersections(*kdtree, camera_rays, brute_force(pointers(boxes), camera_rays)));
+	}
+
+	TEST(KdTree, IntersectThreadedHorizontally)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(30000);
+		const std::vector<Ray> rays = random_rays(300);
+		const std::vector<Ray> camera_rays = coherent_rays(16);
+
+		std::unique_ptr<KdTree> kdtree = kdtree_build(pointers(boxes), cancellable, thread_pool);
+		ASSERT_TRUE(kdtree);
+
+		EXPECT_TRUE(same_intersections(*kdtree, rays, brute_force(pointers(boxes), rays)));
+		EXPECT_TRUE(same_intersections(*kdtree, camera_rays, brute_force(pointers(boxes), camera_rays)));
+	}
+
+	TEST(KdTree, BuildInTask)
+	{
+		// Preparing build must not wait for tasks in pool other than its own.
+		ThreadPool thread_pool(2);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(20000);
+		const std::vector<Ray> rays = random_rays(300);
+
+		auto build = [&] { return kdtree_build(pointers(boxes), cancellable, thread_pool); };
+
+		std::unique_ptr<KdTree> kdtree = thread_pool.async(build).get();
+		ASSERT_TRUE(kdtree);
+
+		EXPECT_TRUE(same_intersections(*kdtree, rays, brute_force(pointers(boxes), rays)));
+	}
+
+	TEST(KdTree, IntersectFewIntersectables)
+	{
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Ray> rays = random_rays(100);
+
+		for (std::size_t count : {1U, 2U, 5U}) {
+			SCOPED_TRACE(std::to_string(count) + " intersectables");
+			const std::vector<Box> boxes = random_boxes(count);
+
+			std::unique_ptr<KdTree> kdtree = kdtree_build(pointers(boxes), cancellable, thread_pool);
+			ASSERT_TRUE(kdtree);
+
+			EXPECT_TRUE(same_intersections(*kdtree, rays, brute_force(pointers(boxes), rays)));
+		}
+	}
+
+	TEST(KdTree, SaveAndLoad)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(5000);
+		const std::vector<Ray> rays = random_rays(300);
+		const std::string path = temp_dir.path() / "kdtree";
+
+		std::unique_ptr<KdTree> kdtree = kdtree_build(pointers(boxes), cancellable, thread_pool);
+		ASSERT_TRUE(kdtree);
+		ASSERT_TRUE(kdtree->save(path, 123));
+
+		auto loaded_kdtree = kdtree_load(path, 123, pointers(boxes));
+		ASSERT_TRUE(loaded_kdtree);
+		EXPECT_TRUE(same_intersections(**loaded_kdtree, rays, brute_force(pointers(boxes), rays)));
+
+		EXPECT_FALSE(kdtree_load(path, 124, pointers(boxes)));
+	}
+
+	TEST(KdTree, LoadCorrupt)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		const std::vector<Box> boxes = random_boxes(5000);
+		const std::string path = temp_dir.path() / "kdtree";
+
+		std::unique_ptr<KdTree> kdtree = kdtree_build(pointers(boxes), cancellable, thread_pool);
+		ASSERT_TRUE(kdtree);
+
+		for (bool repeat_first : {true, false}) {
+			SCOPED_TRACE(testing::Message() << "repeat first " << repeat_first);
+			ASSERT_TRUE(kdtree->save(path, 123));
+			ASSERT_TRUE(corrupt_cache_file_nodes(path, repeat_first));
+
+			EXPECT_FALSE(kdtree_load(path, 123, pointers(boxes)));
+		}
+	}
+
+	TEST(KdTree, BuildCached)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		ThreadPool thread_pool(4);
+		Cancellable cancellable;
+		Cancellable cancelled;
+		cancelled.cancel();
+		const std::vector<Box> boxes = random_boxes(5000);
+		const std::vector<Ray> rays = random_rays(300);
+		const std::vector<Intersection> expected = brute_force(pointers(boxes), rays);
+		const IntersectionStructureType type = IntersectionStructureType::KDTREE;
+
+		std::unique_ptr<Intersectable> built = intersection_structure_build_cached(type,
+		                                                                           pointers(boxes),
+		                                                                           temp_dir.path(),
+		                                                                           cancellable,
+		                                                                           thread_pool);
+		ASSERT_TRUE(built);
+		EXPECT_TRUE(same_intersections(*built, rays, expected));
+
+		// A cancelled build returns nullptr, so kd-tree must come from cache.
+		std::unique_ptr<Intersectable> loaded = intersection_structure_build_cached(type,
+		                                                                            pointers(boxes),
+		                                                                            temp_dir.path(),
+		                                                                            cancelled,
+		                                                                            thread_pool);
+		ASSERT_TRUE(loaded);
+		EXPECT_TRUE(same_intersections(*loaded, rays, expected));
+	}
+
+	TEST(KdTree, Cancelled)
+	{
+		Cancellable cancellable;
+		cancellable.cancel();
+		const std::vector<Box> boxes = random_boxes(30000);
+
+		for (unsigned int threads : {1U, 4U}) {
+			ThreadPool thread_pool(threads);
+
+			EXPECT_FALSE(kdtree_build(pointers(boxes), cancellable, thread_pool));
+			EXPECT_FALSE(intersection_structure_build(IntersectionStructureType::KDTREE,
+			                                          pointers(boxes),
+			                                          cancellable,
+			                                          thread_pool));
+		}
+	}
+}
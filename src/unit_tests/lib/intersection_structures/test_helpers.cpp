@@ -0,0 +1,201 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "unit_tests/lib/intersection_structures/test_helpers.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lib/function/result.h"
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/io/file.h"
+#include "lib/math/aabb.h"
+#include "lib/math/math.h"
+#include "lib/math/ray.h"
+#include "lib/math/vector3.h"
+
+namespace Rayni
+{
+	bool Box::intersect(const Ray &ray) const
+	{
+		real_t t_min;
+		real_t t_max;
+		return aabb_.intersects(ray, t_min, t_max);
+	}
+
+	bool Box::intersect(const Ray &ray, Intersection &intersection) const
+	{
+		real_t t_min;
+		real_t t_max;
+
+		if (!aabb_.intersects(ray, t_min, t_max) || t_min >= intersection.t)
+			return false;
+
+		intersection.t = t_min;
+		intersection.intersectable = this;
+
+		return true;
+	}
+
+	std::vector<Box> random_boxes(std::size_t count)
+	{
+		std::mt19937 generator;
+		std::uniform_real_distribution<real_t> position(-100, 100);
+		std::uniform_real_distribution<real_t> size(0, 4);
+		std::vector<Box> boxes;
+
+		for (std::size_t i = 0; i < count; i++) {
+			Vector3 p(position(generator), position(generator), position(generator));
+			Vector3 s(size(generator), size(generator), i % 7 == 0 ? 0 : size(generator));
+
+			if (i % 3 == 0)
+				p = Vector3(std::round(p.x()), std::round(p.y()), std::round(p.z()));
+
+			boxes.emplace_back(AABB(p, p + s));
+		}
+
+		return boxes;
+	}
+
+	std::vector<const Intersectable *> pointers(const std::vector<Box> &boxes)
+	{
+		std::vector<const Intersectable *> intersectables;
+
+		for (const Box &box : boxes)
+			intersectables.push_back(&box);
+
+		return intersectables;
+	}
+
+	std::vector<Ray> random_rays(std::size_t count)
+	{
+		std::mt19937 generator(1);
+		std::uniform_real_distribution<real_t> coordinate(-120, 120);
+		std::uniform_real_distribution<real_t> component(-1, 1);
+		std::vector<Ray> rays;
+
+		for (std::size_t i = 0; i < count; i++) {
+			Vector3 origin(coordinate(generator), coordinate(generator), coordinate(generator));
+			Vector3 direction(component(generator), component(generator), component(generator));
+			rays.emplace_back(origin, direction, 0);
+		}
+
+		return rays;
+	}
+
+	std::vector<Ray> coherent_rays(unsigned int size)
+	{
+		const Vector3 origin(10, 20, -200);
+		std::vector<Ray> rays;
+
+		for (unsigned int y = 0; y < size; y++) {
+			for (unsigned int x = 0; x < size; x++) {
+				real_t u = (real_t(x) + real_t(0.5)) / real_t(size);
+				real_t v = (real_t(y) + real_t(0.5)) / real_t(size);
+				Vector3 target(-100 + 200 * u, -100 + 200 * v, 0);
+				rays.emplace_back(origin, target - origin, 0);
+			}
+		}
+
+		return rays;
+	}
+
+	std::vector<Intersection> brute_force(const std::vector<const Intersectable *> &intersectables,
+	                                      const std::vector<Ray> &rays)
+	{
+		std::vector<Intersection> intersections(rays.size());
+
+		for (std::size_t i = 0; i < rays.size(); i++)
+			for (const Intersectable *intersectable : intersectables)
+				intersectable->intersect(rays[i], intersections[i]);
+
+		return intersections;
+	}
+
+	testing::AssertionResult same_intersections(const Intersectable &structure,
+	                                            const std::vector<Ray> &rays,
+	                                            const std::vector<Intersection> &expected)
+	{
+		auto batch_hits = std::make_unique<bool[]>(rays.size());
+		auto batch_any_hits = std::make_unique<bool[]>(rays.size());
+		std::vector<Intersection> batch_intersections(rays.size());
+
+		structure.intersect_batch(rays.data(), batch_any_hits.get(), rays.size());
+		structure.intersect_batch(rays.data(),
+		                          batch_intersections.data(),
+		                          batch_hits.get(),
+		                          rays.size());
+
+		for (std::size_t i = 0; i < rays.size(); i++) {
+			const Ray &ray = rays[i];
+			bool expected_hit = expected[i].intersectable;
+			Intersection intersection;
+			bool hit = structure.intersect(ray, intersection);
+
+			auto failure = [&](const char *what) {
+				return testing::AssertionFailure() << what << " differs for ray " << i;
+			};
+
+			if (structure.intersect(ray) != expected_hit)
+				return failure("any hit");
+			if (hit != expected_hit || intersection.t != expected[i].t)
+				return failure("intersection");
+			if (batch_any_hits[i] != expected_hit)
+				return failure("batch any hit");
+			if (batch_hits[i] != expected_hit || batch_intersections[i].t != expected[i].t)
+				return failure("batch intersection");
+		}
+
+		return testing::AssertionSuccess();
+	}
+
+	testing::AssertionResult corrupt_cache_file_nodes(const std::string &path, bool repeat_first)
+	{
+		// Cache file header is 48 bytes followed by offset, size and element size
+		// of each array as 64 bit integers.
+		Result<std::vector<std::uint8_t>> data = file_read(path);
+		if (!data)
+			return testing::AssertionFailure() << data.error().message();
+
+		std::uint64_t info[3];
+		std::memcpy(info, data->data() + 48 + sizeof(info), sizeof(info));
+		std::uint8_t *nodes = data->data() + info[0];
+
+		for (std::uint64_t i = 0; i < info[1]; i++) {
+			if (repeat_first)
+				std::memcpy(nodes + i * info[2], nodes, info[2]);
+			else
+				std::memset(nodes + i * info[2], 0xff, info[2]);
+		}
+
+		if (auto r = file_write(path, *data); !r)
+			return testing::AssertionFailure() << r.error().message();
+
+		return testing::AssertionSuccess();
+	}
+}
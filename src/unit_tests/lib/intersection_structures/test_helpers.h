@@ -0,0 +1,88 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RAYNI_UNIT_TESTS_LIB_INTERSECTION_STRUCTURES_TEST_HELPERS_H
+#define RAYNI_UNIT_TESTS_LIB_INTERSECTION_STRUCTURES_TEST_HELPERS_H
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/math/aabb.h"
+#include "lib/math/ray.h"
+#include "lib/math/vector3.h"
+
+// Scenes, rays and checks shared by BVH and kd-tree unit tests.
+namespace Rayni
+{
+	class Box : public Intersectable
+	{
+	public:
+		explicit Box(const AABB &aabb) : aabb_(aabb)
+		{
+		}
+
+		AABB aabb() const override
+		{
+			return aabb_;
+		}
+
+		bool intersect(const Ray &ray) const override;
+		bool intersect(const Ray &ray, Intersection &intersection) const override;
+
+		void move(const Vector3 &offset)
+		{
+			aabb_ = AABB(aabb_.minimum() + offset, aabb_.maximum() + offset);
+		}
+
+	private:
+		AABB aabb_;
+	};
+
+	// Random boxes, some of them flat and some with positions on a grid to get
+	// many shared split candidates.
+	std::vector<Box> random_boxes(std::size_t count);
+
+	std::vector<const Intersectable *> pointers(const std::vector<Box> &boxes);
+
+	std::vector<Ray> random_rays(std::size_t count);
+
+	// Rays from a common origin through a grid, like camera rays for a tile.
+	std::vector<Ray> coherent_rays(unsigned int size);
+
+	std::vector<Intersection> brute_force(const std::vector<const Intersectable *> &intersectables,
+	                                      const std::vector<Ray> &rays);
+
+	// Checks single ray and batch intersection, with and without Intersection,
+	// against expected intersections from brute_force().
+	testing::AssertionResult same_intersections(const Intersectable &structure,
+	                                            const std::vector<Ray> &rays,
+	                                            const std::vector<Intersection> &expected);
+
+	// Overwrites nodes (array 1) in a saved cache file, with the first node
+	// repeated (children out of range or not after parent) or with 0xff bytes
+	// (leafs out of range).
+	testing::AssertionResult corrupt_cache_file_nodes(const std::string &path, bool repeat_first);
+}
+
+#endif // RAYNI_UNIT_TESTS_LIB_INTERSECTION_STRUCTURES_TEST_HELPERS_H
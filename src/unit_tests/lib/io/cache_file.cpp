@@ -0,0 +1,212 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2013-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/io/cache_file.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "lib/io/file.h"
+#include "lib/system/scoped_temp_dir.h"
+
+namespace Rayni
+{
+	namespace
+	{
+		struct Element
+		{
+			std::uint32_t a;
+			float b;
+		};
+
+		const std::vector<std::uint8_t> BYTES = {1, 2, 3};
+		const std::vector<Element> ELEMENTS = {{4, 5.0F}, {6, 7.0F}};
+
+		Result<void> write_cache_file(const std::string &path)
+		{
+			std::vector<CacheFile::Array> arrays = {CacheFile::Array(BYTES), CacheFile::Array(ELEMENTS)};
+			return CacheFile::write(path, "test", 1, 0x1234, arrays);
+		}
+	}
+
+	TEST(CacheFile, WriteAndMap)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		const std::string path = temp_dir.path() / "cache";
+		ASSERT_TRUE(write_cache_file(path));
+
+		CacheFile file;
+		ASSERT_TRUE(file.map(path, "test", 1, 0x1234, {sizeof(std::uint8_t), sizeof(Element)}));
+
+		ASSERT_EQ(3, file.array_size(0));
+		EXPECT_EQ(1, file.array_data<std::uint8_t>(0)[0]);
+		EXPECT_EQ(2, file.array_data<std::uint8_t>(0)[1]);
+		EXPECT_EQ(3, file.array_data<std::uint8_t>(0)[2]);
+
+		ASSERT_EQ(2, file.array_size(1));
+		EXPECT_EQ(4, file.array_data<Element>(1)[0].a);
+		EXPECT_EQ(5.0F, file.array_data<Element>(1)[0].b);
+		EXPECT_EQ(6, file.array_data<Element>(1)[1].a);
+		EXPECT_EQ(7.0F, file.array_data<Element>(1)[1].b);
+
+		for (std::size_t i = 0; i < 2; i++) {
+			auto address = reinterpret_cast<std::uintptr_t>(file.array_data<void>(i));
+			EXPECT_EQ(0, address % RAYNI_L1_CACHE_LINE_SIZE);
+		}
+	}
+
+	TEST(CacheFile, WriteAndMapEmptyArray)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		const std::string path = temp_dir.path() / "cache";
+		ASSERT_TRUE(CacheFile::write(path, "test", 1, 0, {CacheFile::Array(std::vector<Element>())}));
+
+		CacheFile file;
+		ASSERT_TRUE(file.map(path, "test", 1, 0, {sizeof(Element)}));
+		EXPECT_EQ(0, file.array_size(0));
+	}
+
+	TEST(CacheFile, ConcurrentWrites)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		const std::string path = temp_dir.path() / "cache";
+		std::vector<std::thread> threads;
+		std::atomic<unsigned int> failed_writes = 0;
+
+		for (unsigned int t = 0; t < 4; t++)
+			threads.emplace_back([&] {
+				for (unsigned int i = 0; i < 20; i++)
+					if (!write_cache_file(path))
+						failed_writes++;
+			});
+
+		for (std::thread &thread : threads)
+			thread.join();
+
+		EXPECT_EQ(0, failed_writes);
+
+		CacheFile file;
+		EXPECT_TRUE(file.map(path, "test", 1, 0x1234, {sizeof(std::uint8_t), sizeof(Element)}));
+
+		auto dir_iterator = std::filesystem::directory_iterator(temp_dir.path());
+		EXPECT_EQ(1, std::distance(std::filesystem::begin(dir_iterator), std::filesystem::end(dir_iterator)));
+	}
+
+	TEST(CacheFile, PermissionsSameAsOtherFiles)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		const std::string path = temp_dir.path() / "cache";
+		const std::string other_path = temp_dir.path() / "other";
+		ASSERT_TRUE(write_cache_file(path));
+		ASSERT_TRUE(file_write(other_path, {1, 2, 3}));
+
+		EXPECT_EQ(std::filesystem::status(other_path).permissions(),
+		          std::filesystem::status(path).permissions());
+	}
+
+	TEST(CacheFile, MapMismatch)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		const std::string path = temp_dir.path() / "cache";
+		ASSERT_TRUE(write_cache_file(path));
+
+		CacheFile file;
+		EXPECT_FALSE(file.map(path, "tesT", 1, 0x1234, {sizeof(std::uint8_t), sizeof(Element)}));
+		EXPECT_FALSE(file.map(path, "test", 2, 0x1234, {sizeof(std::uint8_t), sizeof(Element)}));
+		EXPECT_FALSE(file.map(path, "test", 1, 0x1235, {sizeof(std::uint8_t), sizeof(Element)}));
+		EXPECT_FALSE(file.map(path, "test", 1, 0x1234, {sizeof(std::uint8_t)}));
+		EXPECT_FALSE(file.map(path, "test", 1, 0x1234, {sizeof(std::uint16_t), sizeof(Element)}));
+		EXPECT_TRUE(file.map(path, "test", 1, 0x1234, {sizeof(std::uint8_t), sizeof(Element)}));
+	}
+
+	TEST(CacheFile, MapInvalidFile)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		const std::string path = temp_dir.path() / "cache";
+
+		CacheFile file;
+		EXPECT_FALSE(file.map(path, "test", 1, 0, {}));
+
+		ASSERT_TRUE(file_write(path, {1, 2, 3}));
+		EXPECT_FALSE(file.map(path, "test", 1, 0, {}));
+
+		ASSERT_TRUE(write_cache_file(path));
+		Result<std::vector<std::uint8_t>> truncated = file_read(path);
+		ASSERT_TRUE(truncated);
+		truncated->resize(truncated->size() - 1);
+		ASSERT_TRUE(file_write(path, *truncated));
+		EXPECT_FALSE(file.map(path, "test", 1, 0x1234, {sizeof(std::uint8_t), sizeof(Element)}));
+	}
+
+	TEST(CacheFile, WriteTooLongTypeFails)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+
+		EXPECT_FALSE(CacheFile::write(temp_dir.path() / "cache", std::string(16, 'a'), 1, 0, {}));
+	}
+
+	TEST(CacheableVector, Owned)
+	{
+		CacheableVector<int> vector(std::vector<int>{1, 2});
+
+		EXPECT_FALSE(vector.in_cache_file());
+		ASSERT_EQ(2, vector.size());
+		EXPECT_EQ(1, vector[0]);
+		EXPECT_EQ(vector.data(), vector.mutable_data());
+	}
+
+	TEST(CacheableVector, InCacheFile)
+	{
+		ScopedTempDir temp_dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(temp_dir.path().empty());
+		const std::string path = temp_dir.path() / "cache";
+		ASSERT_TRUE(write_cache_file(path));
+
+		CacheFile file;
+		ASSERT_TRUE(file.map(path, "test", 1, 0x1234, {sizeof(std::uint8_t), sizeof(Element)}));
+
+		CacheableVector<std::uint8_t> vector(file, 0);
+		EXPECT_TRUE(vector.in_cache_file());
+		ASSERT_EQ(3, vector.size());
+		EXPECT_EQ(file.array_data<std::uint8_t>(0), vector.data());
+		EXPECT_EQ(2, vector[1]);
+
+		std::uint8_t *data = vector.mutable_data();
+		EXPECT_FALSE(vector.in_cache_file());
+		EXPECT_NE(file.array_data<std::uint8_t>(0), data);
+		data[1] = 10;
+		EXPECT_EQ(10, vector[1]);
+		EXPECT_EQ(2, file.array_data<std::uint8_t>(0)[1]);
+	}
+}
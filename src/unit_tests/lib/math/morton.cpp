@@ -0,0 +1,76 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2015-2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/math/morton.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "lib/math/aabb.h"
+
+namespace Rayni
+{
+	TEST(Morton, ExpandBits)
+	{
+		EXPECT_EQ(0, morton_expand_bits(0));
+		EXPECT_EQ(0b1, morton_expand_bits(0b1));
+		EXPECT_EQ(0b1001, morton_expand_bits(0b11));
+		EXPECT_EQ(0b1000001, morton_expand_bits(0b101));
+		EXPECT_EQ(0x1249249249249249, morton_expand_bits(0x1fffff));
+		EXPECT_EQ(0x1249249249249249, morton_expand_bits(0xffffffff));
+	}
+
+	TEST(Morton, Code)
+	{
+		EXPECT_EQ(0b100, morton_code(1, 0, 0));
+		EXPECT_EQ(0b010, morton_code(0, 1, 0));
+		EXPECT_EQ(0b001, morton_code(0, 0, 1));
+		EXPECT_EQ(0b001001, morton_code(0, 0, 3));
+		EXPECT_EQ(0x7fffffffffffffff, morton_code(0x1fffff, 0x1fffff, 0x1fffff));
+	}
+
+	TEST(Morton, CodeBitAxis)
+	{
+		EXPECT_EQ(0, morton_code_bit_axis(2));
+		EXPECT_EQ(1, morton_code_bit_axis(1));
+		EXPECT_EQ(2, morton_code_bit_axis(0));
+		EXPECT_EQ(0, morton_code_bit_axis(62));
+		EXPECT_EQ(2, morton_code_bit_axis(60));
+	}
+
+	TEST(Morton, Encoder)
+	{
+		const MortonEncoder encoder(AABB({-1, -1, -1}, {1, 1, 1}), 2);
+
+		EXPECT_EQ(morton_code(0, 0, 0), encoder.code({-1, -1, -1}));
+		EXPECT_EQ(morton_code(3, 3, 3), encoder.code({1, 1, 1}));
+		EXPECT_EQ(morton_code(1, 2, 3), encoder.code({-0.25, 0.25, 0.75}));
+		EXPECT_EQ(morton_code(0, 0, 0), encoder.code({-2, -2, -2}));
+		EXPECT_EQ(morton_code(3, 3, 3), encoder.code({2, 2, 2}));
+	}
+
+	TEST(Morton, EncoderPlanar)
+	{
+		const MortonEncoder encoder(AABB({0, 0, 0}, {1, 0, 1}), 1);
+
+		EXPECT_EQ(morton_code(1, 0, 0), encoder.code({0.75, 0, 0.25}));
+		EXPECT_EQ(morton_code(0, 0, 1), encoder.code({0.25, 0, 0.75}));
+	}
+}
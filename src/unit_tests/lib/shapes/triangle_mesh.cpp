@@ -0,0 +1,328 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/shapes/triangle_mesh.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "lib/intersectable.h"
+#include "lib/intersection.h"
+#include "lib/math/math.h"
+#include "lib/math/ray.h"
+#include "lib/math/vector3.h"
+#include "lib/shapes/triangle_mesh_data.h"
+
+namespace Rayni
+{
+	namespace
+	{
+		// Unit square in xy plane at z made up of two triangles facing +z.
+		void add_square(TriangleMeshData &data, real_t z)
+		{
+			auto index = TriangleMeshData::Index(data.points.size());
+
+			data.points.emplace_back(0, 0, z);
+			data.points.emplace_back(1, 0, z);
+			data.points.emplace_back(1, 1, z);
+			data.points.emplace_back(0, 1, z);
+
+			data.indices.emplace_back(index, index + 1, index + 2);
+			data.indices.emplace_back(index, index + 2, index + 3);
+		}
+
+		const Intersectable *intersect(const std::vector<const Intersectable *> &intersectables,
+		                               const Ray &ray,
+		                               Intersection &intersection)
+		{
+			const Intersectable *hit = nullptr;
+
+			for (const Intersectable *intersectable : intersectables)
+				if (intersectable->intersect(ray, intersection))
+					hit = intersectable;
+
+			return hit;
+		}
+
+		bool intersect(const std::vector<const Intersectable *> &intersectables, const Ray &ray)
+		{
+			for (const Intersectable *intersectable : intersectables)
+				if (intersectable->intersect(ray))
+					return true;
+
+			return false;
+		}
+
+		// Rays from random points around center towards random points close to
+		// center. Directions are not axis aligned.
+		std::vector<Ray> random_oblique_rays(const Vector3 &center, std::size_t count)
+		{
+			std::mt19937 generator(1);
+			std::uniform_real_distribution<real_t> origin_offset(-10, 10);
+			std::uniform_real_distribution<real_t> target_offset(-2, 2);
+			std::vector<Ray> rays;
+
+			while (rays.size() < count) {
+				Vector3 origin = center + Vector3(origin_offset(generator),
+				                                  origin_offset(generator),
+				                                  origin_offset(generator));
+				Vector3 target = center + Vector3(target_offset(generator),
+				                                  target_offset(generator),
+				                                  target_offset(generator));
+				Vector3 direction = target - origin;
+
+				if (direction.dot(direction) > real_t(0.01))
+					rays.emplace_back(origin, direction.normalize(), 0);
+			}
+
+			return rays;
+		}
+
+		// Möller-Trumbore in double precision without masking or
+		// vectorization. Returns false if ray is too close to an edge of
+		// triangle (or to plane of triangle) to tell if it is a hit or not.
+		bool reference_intersect(const Ray &ray, const Vector3 points[3], bool &hit, double &t)
+		{
+			static constexpr double MARGIN = 1e-3;
+			auto sub = [](const Vector3 &a, const Vector3 &b, double out[3]) {
+				for (unsigned int axis = 0; axis < 3; axis++)
+					out[axis] = double(a[axis]) - double(b[axis]);
+			};
+			auto cross = [](const double a[3], const double b[3], double out[3]) {
+				out[0] = a[1] * b[2] - a[2] * b[1];
+				out[1] = a[2] * b[0] - a[0] * b[2];
+				out[2] = a[0] * b[1] - a[1] * b[0];
+			};
+			auto dot = [](const double a[3], const double b[3]) {
+				return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+			};
+
+			double e1[3], e2[3], s[3], p[3], q[3];
+			double d[3] = {ray.direction.x(), ray.direction.y(), ray.direction.z()};
+			sub(points[1], points[0], e1);
+			sub(points[2], points[0], e2);
+			sub(ray.origin, points[0], s);
+			cross(d, e2, p);
+			cross(s, e1, q);
+
+			double det = dot(e1, p);
+			if (std::abs(det) < MARGIN)
+				return false;
+
+			double b1 = dot(s, p) / det;
+			double b2 = dot(d, q) / det;
+			double b0 = 1 - b1 - b2;
+			t = dot(e2, q) / det;
+
+			if (std::abs(b0) < MARGIN || std::abs(b1) < MARGIN || std::abs(b2) < MARGIN ||
+			    std::abs(t) < MARGIN)
+				return false;
+
+			hit = b0 > 0 && b1 > 0 && b2 > 0 && t > 0;
+
+			return true;
+		}
+	}
+
+	TEST(TriangleMesh, Intersectables)
+	{
+		EXPECT_TRUE(TriangleMesh(TriangleMeshData()).intersectables().empty());
+
+		for (unsigned int count : {1U, TriangleMesh::BLOCK_SIZE, TriangleMesh::BLOCK_SIZE + 1}) {
+			TriangleMeshData data;
+
+			for (unsigned int i = 0; i < count; i++) {
+				auto index = TriangleMeshData::Index(data.points.size());
+				data.points.emplace_back(i, 0, 0);
+				data.points.emplace_back(i + 1, 0, 0);
+				data.points.emplace_back(i, 1, 0);
+				data.indices.emplace_back(index, index + 1, index + 2);
+			}
+
+			TriangleMesh mesh(std::move(data));
+			std::vector<const Intersectable *> intersectables = mesh.intersectables();
+			unsigned int expected_size = (count + TriangleMesh::BLOCK_SIZE - 1) / TriangleMesh::BLOCK_SIZE;
+
+			ASSERT_EQ(expected_size, intersectables.size());
+			EXPECT_NEAR(0, intersectables.front()->aabb().minimum().x(), 1e-6);
+			EXPECT_NEAR(count, intersectables.back()->aabb().maximum().x(), 1e-6);
+		}
+	}
+
+	TEST(TriangleMesh, Intersect)
+	{
+		TriangleMeshData data;
+		add_square(data, 0);
+		TriangleMesh mesh(std::move(data));
+		std::vector<const Intersectable *> intersectables = mesh.intersectables();
+
+		const Ray ray(Vector3(0.25, 0.75, 2), Vector3(0, 0, -1), 0);
+		Intersection intersection;
+
+		EXPECT_TRUE(intersect(intersectables, ray));
+		ASSERT_NE(nullptr, intersect(intersectables, ray, intersection));
+
+		EXPECT_NEAR(2, intersection.t, 1e-6);
+		EXPECT_NEAR(0.25, intersection.point.x(), 1e-6);
+		EXPECT_NEAR(0.75, intersection.point.y(), 1e-6);
+		EXPECT_NEAR(0, intersection.point.z(), 1e-6);
+		EXPECT_NEAR(0, intersection.normal.x(), 1e-6);
+		EXPECT_NEAR(0, intersection.normal.y(), 1e-6);
+		EXPECT_NEAR(1, intersection.normal.z(), 1e-6);
+		EXPECT_NEAR(0, intersection.incident.x(), 1e-6);
+		EXPECT_NEAR(0, intersection.incident.y(), 1e-6);
+		EXPECT_NEAR(1, intersection.incident.z(), 1e-6);
+	}
+
+	TEST(TriangleMesh, IntersectMiss)
+	{
+		TriangleMeshData data;
+		add_square(data, 0);
+		TriangleMesh mesh(std::move(data));
+		std::vector<const Intersectable *> intersectables = mesh.intersectables();
+
+		const Ray outside(Vector3(1.5, 0.5, 2), Vector3(0, 0, -1), 0);
+		const Ray away(Vector3(0.5, 0.5, 2), Vector3(0, 0, 1), 0);
+		const Ray parallel(Vector3(-1, 0.5, 0), Vector3(1, 0, 0), 0);
+		Intersection intersection;
+
+		for (const Ray &ray : {outside, away, parallel}) {
+			EXPECT_FALSE(intersect(intersectables, ray));
+			EXPECT_EQ(nullptr, intersect(intersectables, ray, intersection));
+		}
+	}
+
+	TEST(TriangleMesh, IntersectNearest)
+	{
+		TriangleMeshData data;
+
+		for (unsigned int i = 0; i < TriangleMesh::BLOCK_SIZE * 2 + 1; i++)
+			add_square(data, real_t(i));
+
+		TriangleMesh mesh(std::move(data));
+		std::vector<const Intersectable *> intersectables = mesh.intersectables();
+
+		const Ray down(Vector3(0.5, 0.25, 100), Vector3(0, 0, -1), 0);
+		Intersection intersection;
+		ASSERT_NE(nullptr, intersect(intersectables, down, intersection));
+		EXPECT_NEAR(100 - TriangleMesh::BLOCK_SIZE * 2, intersection.t, 1e-4);
+
+		const Ray up(Vector3(0.5, 0.25, -100), Vector3(0, 0, 1), 0);
+		intersection = Intersection();
+		ASSERT_NE(nullptr, intersect(intersectables, up, intersection));
+		EXPECT_NEAR(100, intersection.t, 1e-4);
+	}
+
+	TEST(TriangleMesh, IntersectOnlyCloserThanIntersectionT)
+	{
+		TriangleMeshData data;
+		add_square(data, 0);
+		TriangleMesh mesh(std::move(data));
+		std::vector<const Intersectable *> intersectables = mesh.intersectables();
+
+		const Ray ray(Vector3(0.5, 0.25, 2), Vector3(0, 0, -1), 0);
+		Intersection intersection;
+		intersection.t = 1;
+
+		EXPECT_EQ(nullptr, intersect(intersectables, ray, intersection));
+		EXPECT_EQ(1, intersection.t);
+	}
+
+	TEST(TriangleMesh, IntersectInterpolatesNormalsAndUVs)
+	{
+		TriangleMeshData data;
+		add_square(data, 0);
+		data.normals = {Vector3(0, 0, 1), Vector3(1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1)};
+		data.uvs = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+		TriangleMesh mesh(std::move(data));
+		std::vector<const Intersectable *> intersectables = mesh.intersectables();
+
+		const Ray ray(Vector3(0.5, 0.25, 2), Vector3(0, 0, -1), 0);
+		Intersection intersection;
+		ASSERT_NE(nullptr, intersect(intersectables, ray, intersection));
+
+		// Barycentric coordinates are (0.5, 0.25, 0.25) in first triangle.
+		const Vector3 expected_normal = Vector3(0.25, 0.25, 0.5).normalize();
+		EXPECT_NEAR(expected_normal.x(), intersection.normal.x(), 1e-6);
+		EXPECT_NEAR(expected_normal.y(), intersection.normal.y(), 1e-6);
+		EXPECT_NEAR(expected_normal.z(), intersection.normal.z(), 1e-6);
+		EXPECT_NEAR(0.5, intersection.u, 1e-6);
+		EXPECT_NEAR(0.25, intersection.v, 1e-6);
+	}
+
+	TEST(TriangleMesh, IntersectObliquePartialBlock)
+	{
+		// One triangle, the other lanes in the block are unused.
+		const Vector3 points[3] = {Vector3(0.3, 0.1, 0.2), Vector3(1.7, 0.4, -0.5), Vector3(0.6, 1.8, 0.9)};
+		TriangleMeshData data;
+		data.points.assign(points, points + 3);
+		data.indices.emplace_back(0, 1, 2);
+		TriangleMesh mesh(std::move(data));
+		std::vector<const Intersectable *> intersectables = mesh.intersectables();
+		unsigned int hits = 0;
+		unsigned int misses = 0;
+
+		for (const Ray &ray : random_oblique_rays(Vector3(0.8, 0.7, 0.2), 20000)) {
+			bool expected_hit = false;
+			double expected_t = 0;
+
+			if (!reference_intersect(ray, points, expected_hit, expected_t))
+				continue;
+
+			Intersection intersection;
+			const Intersectable *hit = intersect(intersectables, ray, intersection);
+
+			ASSERT_EQ(expected_hit, intersect(intersectables, ray));
+			ASSERT_EQ(expected_hit, hit != nullptr);
+
+			if (expected_hit) {
+				EXPECT_NEAR(expected_t, intersection.t, 1e-3);
+				hits++;
+			} else {
+				misses++;
+			}
+		}
+
+		EXPECT_LT(1000U, hits);
+		EXPECT_LT(1000U, misses);
+	}
+
+	TEST(TriangleMesh, IntersectDegenerateTriangle)
+	{
+		TriangleMeshData data;
+		data.points.emplace_back(0.3, 0.1, 0.2);
+		data.points.emplace_back(1.7, 0.4, -0.5);
+		data.points.emplace_back(3.1, 0.7, -1.2);
+		data.indices.emplace_back(0, 0, 0); // Point.
+		data.indices.emplace_back(0, 1, 2); // Line.
+		TriangleMesh mesh(std::move(data));
+		std::vector<const Intersectable *> intersectables = mesh.intersectables();
+
+		for (const Ray &ray : random_oblique_rays(Vector3(0.3, 0.1, 0.2), 20000)) {
+			Intersection intersection;
+
+			ASSERT_FALSE(intersect(intersectables, ray));
+			ASSERT_EQ(nullptr, intersect(intersectables, ray, intersection));
+		}
+	}
+}
@@ -21,11 +21,16 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
+#include <random>
 #include <string>
 #include <vector>
 
+#include "lib/concurrency/thread_pool.h"
+#include "lib/containers/variant.h"
 #include "lib/math/vector3.h"
 
 namespace Rayni
@@ -64,6 +69,45 @@ namespace Rayni
 		}
 	}
 
+	TEST(TriangleMeshData, FromVariant)
+	{
+		// Points (0, 0, 0), (1, 0, 0) and (0, -2, 0.5) as 16.16 fixed point,
+		// indices (0, 1, 2) as 8 bit, normals (0, 0, 1), (0, 0, -1), (1, 0, 0) and
+		// uvs (0, 0), (1, 0), (0, 1) as 1.15 fixed point.
+		const Variant v = Variant::map("points",
+		                               "00000000000000000961000000000000000|NZ~~004jh",
+		                               "indices",
+		                               "009C",
+		                               "normals",
+		                               "00000fBygg004jifBygg000",
+		                               "uvs",
+		                               "00000fBygg004jg");
+
+		Result<TriangleMeshData> data = TriangleMeshData::from_variant(v);
+		ASSERT_TRUE(data) << data.error().message();
+
+		const std::vector<Vector3> expected_points = {{0, 0, 0}, {1, 0, 0}, {0, -2, 0.5}};
+		EXPECT_PRED_FORMAT3(normals_near, data->points, expected_points, 0);
+
+		ASSERT_EQ(1, data->indices.size());
+		EXPECT_EQ(0, data->indices[0].index1);
+		EXPECT_EQ(1, data->indices[0].index2);
+		EXPECT_EQ(2, data->indices[0].index3);
+
+		const std::vector<Vector3> expected_normals = {{0, 0, 1}, {0, 0, -1}, {1, 0, 0}};
+		EXPECT_PRED_FORMAT3(normals_near, data->normals, expected_normals, 0);
+
+		ASSERT_EQ(3, data->uvs.size());
+		EXPECT_EQ(0, data->uvs[0].u);
+		EXPECT_EQ(0, data->uvs[0].v);
+		EXPECT_EQ(1, data->uvs[1].u);
+		EXPECT_EQ(0, data->uvs[1].v);
+		EXPECT_EQ(0, data->uvs[2].u);
+		EXPECT_EQ(1, data->uvs[2].v);
+
+		EXPECT_FALSE(TriangleMeshData::from_variant(Variant::map("points", "000 0", "indices", "009C")));
+	}
+
 	TEST(TriangleMeshData, CalculateNormalsFacingCorrectlyForRightHandSystem)
 	{
 		TriangleMeshData data;
@@ -158,4 +202,229 @@ namespace Rayni
 		TriangleMeshData::calculate_normals(data);
 		EXPECT_PRED_FORMAT3(normals_near, data.normals, expected_normals, 1e-7);
 	}
+
+	TEST(TriangleMeshData, CalculateNormalsParallel)
+	{
+		ThreadPool thread_pool(4);
+		std::mt19937 generator;
+		std::uniform_real_distribution<real_t> distribution(-10, 10);
+		TriangleMeshData data;
+		const TriangleMeshData::Index num_points = 50000;
+
+		for (TriangleMeshData::Index i = 0; i < num_points; i++)
+			data.points.emplace_back(distribution(generator),
+			                         distribution(generator),
+			                         distribution(generator));
+
+		for (TriangleMeshData::Index i = 0; i + 2 < num_points; i++) {
+			data.indices.emplace_back(i, i + 1, i + 2);
+			data.indices.emplace_back(i, i + 2, std::min(i + 7, num_points - 1));
+		}
+
+		TriangleMeshData::calculate_normals(data);
+		std::vector<Vector3> expected_normals = data.normals;
+
+		TriangleMeshData::calculate_normals(data, thread_pool);
+		EXPECT_PRED_FORMAT3(normals_near, data.normals, expected_normals, 1e-4);
+	}
+
+	TEST(TriangleMeshData, AverageCacheMissRatio)
+	{
+		TriangleMeshData data;
+		data.points = {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}};
+		EXPECT_EQ(0, TriangleMeshData::average_cache_miss_ratio(data));
+
+		data.indices = {{0, 1, 2}};
+		EXPECT_EQ(3, TriangleMeshData::average_cache_miss_ratio(data));
+
+		data.indices = {{0, 1, 2}, {0, 2, 3}};
+		EXPECT_EQ(2, TriangleMeshData::average_cache_miss_ratio(data));
+
+		data.indices = {{0, 1, 2}, {0, 1, 2}, {0, 1, 2}};
+		EXPECT_EQ(1, TriangleMeshData::average_cache_miss_ratio(data));
+	}
+
+	TEST(TriangleMeshData, OptimizeLocality)
+	{
+		const TriangleMeshData::Index size = 100;
+		std::mt19937 generator;
+		TriangleMeshData data;
+
+		// Grid with points and triangles in random order.
+		std::vector<TriangleMeshData::Index> point_order(size * size);
+
+		for (TriangleMeshData::Index i = 0; i < point_order.size(); i++)
+			point_order[i] = i;
+
+		std::shuffle(point_order.begin(), point_order.end(), generator);
+
+		data.points.resize(point_order.size());
+		data.uvs.resize(point_order.size());
+
+		for (TriangleMeshData::Index y = 0; y < size; y++) {
+			for (TriangleMeshData::Index x = 0; x < size; x++) {
+				data.points[point_order[y * size + x]] = Vector3(real_t(x), real_t(y), 0);
+				data.uvs[point_order[y * size + x]] = {real_t(x), real_t(y)};
+			}
+		}
+
+		std::vector<TriangleMeshData::Indices> triangles;
+
+		for (TriangleMeshData::Index y = 0; y + 1 < size; y++) {
+			for (TriangleMeshData::Index x = 0; x + 1 < size; x++) {
+				TriangleMeshData::Index p00 = point_order[y * size + x];
+				TriangleMeshData::Index p10 = point_order[y * size + x + 1];
+				TriangleMeshData::Index p01 = point_order[(y + 1) * size + x];
+				TriangleMeshData::Index p11 = point_order[(y + 1) * size + x + 1];
+
+				triangles.emplace_back(p00, p10, p11);
+				triangles.emplace_back(p00, p11, p01);
+			}
+		}
+
+		std::shuffle(triangles.begin(), triangles.end(), generator);
+
+		for (const TriangleMeshData::Indices &is : triangles)
+			data.indices.push_back(is);
+
+		auto triangle_points = [](const TriangleMeshData &d) {
+			std::vector<std::array<real_t, 9>> points;
+
+			for (const TriangleMeshData::Indices is : d.indices) {
+				const Vector3 &p1 = d.points[is.index1];
+				const Vector3 &p2 = d.points[is.index2];
+				const Vector3 &p3 = d.points[is.index3];
+				points.push_back({p1.x(), p1.y(), p1.z(),
+				                  p2.x(), p2.y(), p2.z(),
+				                  p3.x(), p3.y(), p3.z()});
+			}
+
+			std::sort(points.begin(), points.end());
+
+			return points;
+		};
+
+		std::vector<std::array<real_t, 9>> triangle_points_before = triangle_points(data);
+		double miss_ratio_before = TriangleMeshData::average_cache_miss_ratio(data);
+
+		TriangleMeshData::optimize_locality(data);
+
+		EXPECT_EQ(triangle_points_before, triangle_points(data));
+		EXPECT_GT(miss_ratio_before / 2, TriangleMeshData::average_cache_miss_ratio(data));
+		EXPECT_TRUE(data.indices.compact());
+
+		ASSERT_EQ(data.points.size(), data.uvs.size());
+
+		for (std::size_t i = 0; i < data.points.size(); i++) {
+			EXPECT_EQ(data.points[i].x(), data.uvs[i].u);
+			EXPECT_EQ(data.points[i].y(), data.uvs[i].v);
+		}
+	}
+
+	TEST(TriangleMeshData, IndexBufferCompact)
+	{
+		TriangleMeshData::IndexBuffer indices;
+		std::vector<TriangleMeshData::Indices> expected;
+
+		for (TriangleMeshData::Index i = 0; i < 1000; i++) {
+			expected.emplace_back(i, i + 1, (i * 67) % 0x10000);
+			indices.push_back(expected.back());
+		}
+
+		EXPECT_TRUE(indices.compact());
+		EXPECT_GT(expected.size() * 3 * sizeof(TriangleMeshData::Index), indices.memory_size());
+		ASSERT_EQ(expected.size(), indices.size());
+
+		for (std::size_t i = 0; i < expected.size(); i++) {
+			EXPECT_EQ(expected[i].index1, indices[i].index1);
+			EXPECT_EQ(expected[i].index2, indices[i].index2);
+			EXPECT_EQ(expected[i].index3, indices[i].index3);
+		}
+	}
+
+	TEST(TriangleMeshData, IndexBufferCompactWithChunkBase)
+	{
+		TriangleMeshData::IndexBuffer indices;
+		std::vector<TriangleMeshData::Indices> expected;
+
+		// Smallest index in chunk decreases after first triangle, deltas of
+		// earlier triangles in chunk must be adjusted.
+		for (TriangleMeshData::Index i = 0; i < TriangleMeshData::IndexBuffer::CHUNK_SIZE * 3; i++) {
+			TriangleMeshData::Index base = 1000000 - i * 100;
+			expected.emplace_back(base, base + 1, base + 0xfff);
+			indices.push_back(expected.back());
+		}
+
+		EXPECT_TRUE(indices.compact());
+		ASSERT_EQ(expected.size(), indices.size());
+
+		std::size_t i = 0;
+
+		for (const TriangleMeshData::Indices is : indices) {
+			EXPECT_EQ(expected[i].index1, is.index1);
+			EXPECT_EQ(expected[i].index2, is.index2);
+			EXPECT_EQ(expected[i].index3, is.index3);
+			i++;
+		}
+
+		EXPECT_EQ(expected.size(), i);
+	}
+
+	TEST(TriangleMeshData, IndexBufferWidenedWhenChunkDoesNotFit)
+	{
+		TriangleMeshData::IndexBuffer indices;
+		std::vector<TriangleMeshData::Indices> expected;
+
+		for (TriangleMeshData::Index i = 0; i < 10; i++) {
+			expected.emplace_back(i, i + 1, i + 2);
+			indices.push_back(expected.back());
+		}
+
+		EXPECT_TRUE(indices.compact());
+
+		expected.emplace_back(0, 1, TriangleMeshData::IndexBuffer::MAX_DELTA + 1);
+		indices.push_back(expected.back());
+		EXPECT_FALSE(indices.compact());
+
+		expected.emplace_back(TriangleMeshData::MAX_INDEX, 0, 1);
+		indices.push_back(expected.back());
+		ASSERT_EQ(expected.size(), indices.size());
+
+		for (std::size_t i = 0; i < expected.size(); i++) {
+			EXPECT_EQ(expected[i].index1, indices[i].index1);
+			EXPECT_EQ(expected[i].index2, indices[i].index2);
+			EXPECT_EQ(expected[i].index3, indices[i].index3);
+		}
+
+		indices.clear();
+		EXPECT_TRUE(indices.empty());
+		EXPECT_TRUE(indices.compact());
+	}
+
+	TEST(TriangleMeshData, IndexBufferOnlyWidensChunksThatDoNotFit)
+	{
+		TriangleMeshData::IndexBuffer indices;
+		std::vector<TriangleMeshData::Indices> expected;
+
+		// Strip of triangles with a few seam triangles that refer back to the
+		// first point, like a ring that is closed.
+		for (TriangleMeshData::Index i = 0; i < 100000; i++) {
+			if (i == 500 || i == 50000 || i == 99999)
+				expected.emplace_back(i, i + 1, 0);
+			else
+				expected.emplace_back(i, i + 1, i + 2);
+
+			indices.push_back(expected.back());
+		}
+
+		EXPECT_FALSE(indices.compact());
+		EXPECT_GT(expected.size() * 3 * sizeof(TriangleMeshData::Index) * 2 / 3, indices.memory_size());
+		ASSERT_EQ(expected.size(), indices.size());
+
+		for (std::size_t i = 0; i < expected.size(); i++) {
+			EXPECT_EQ(expected[i].index1, indices[i].index1);
+			EXPECT_EQ(expected[i].index2, indices[i].index2);
+			EXPECT_EQ(expected[i].index3, indices[i].index3);
+		}
+	}
 }
@@ -21,7 +21,9 @@
 
 #include <gtest/gtest.h>
 
+#include <array>
 #include <cstdint>
+#include <string>
 #include <vector>
 
 namespace Rayni
@@ -72,4 +74,66 @@ namespace Rayni
 		EXPECT_FALSE(base85_decode("|OsC0").has_value());
 		EXPECT_FALSE(base85_decode("}NsC0").has_value());
 	}
+
+	TEST(Base85, DecodedSize)
+	{
+		EXPECT_EQ(0, base85_groups(""));
+		EXPECT_EQ(0, base85_decoded_size(""));
+		EXPECT_EQ(1, base85_groups("0"));
+		EXPECT_EQ(0, base85_decoded_size("0"));
+		EXPECT_EQ(1, base85_groups("00000"));
+		EXPECT_EQ(4, base85_decoded_size("00000"));
+		EXPECT_EQ(2, base85_groups("00000000"));
+		EXPECT_EQ(6, base85_decoded_size("00000000"));
+	}
+
+	TEST(Base85, DecodeBigEndian)
+	{
+		std::array<std::int16_t, 4> int16s = {};
+		EXPECT_EQ(3, base85_decode_big_endian<std::int16_t>("00IC05;O", 0, 2, int16s.data()).value());
+		EXPECT_EQ(1, int16s[0]);
+		EXPECT_EQ(-2, int16s[1]);
+		EXPECT_EQ(0x1234, int16s[2]);
+
+		EXPECT_EQ(1, base85_decode_big_endian<std::int16_t>("00IC05;O", 1, 1, int16s.data()).value());
+		EXPECT_EQ(0x1234, int16s[0]);
+
+		std::array<std::uint32_t, 2> uint32s = {};
+		EXPECT_EQ(2, base85_decode_big_endian<std::uint32_t>("0V73ciL1@;", 0, 2, uint32s.data()).value());
+		EXPECT_EQ(0x01234567, uint32s[0]);
+		EXPECT_EQ(0x89abcdef, uint32s[1]);
+
+		// Bytes in shorter last group that do not make up a whole integer.
+		EXPECT_EQ(1, base85_decode_big_endian<std::uint32_t>("0V73ciL1>", 0, 2, uint32s.data()).value());
+		EXPECT_EQ(0x01234567, uint32s[0]);
+
+		std::array<std::uint8_t, 8> uint8s = {};
+		EXPECT_EQ(7, base85_decode_big_endian<std::uint8_t>("0V73ciL1>", 0, 2, uint8s.data()).value());
+		EXPECT_EQ(0xcd, uint8s[6]);
+	}
+
+	TEST(Base85, DecodeBigEndianManyGroups)
+	{
+		std::string str;
+		for (unsigned int i = 0; i < 150; i++)
+			str += std::string("0000") + static_cast<char>('0' + i % 10);
+
+		std::vector<std::uint32_t> uint32s(150);
+		EXPECT_EQ(150, base85_decode_big_endian<std::uint32_t>(str, 0, 150, uint32s.data()).value());
+		for (unsigned int i = 0; i < 150; i++)
+			EXPECT_EQ(i % 10, uint32s[i]);
+
+		str[130 * 5 + 2] = ' ';
+		EXPECT_FALSE(base85_decode_big_endian<std::uint32_t>(str, 0, 150, uint32s.data()).has_value());
+		EXPECT_TRUE(base85_decode_big_endian<std::uint32_t>(str, 0, 130, uint32s.data()).has_value());
+	}
+
+	TEST(Base85, DecodeBigEndianInvalid)
+	{
+		std::array<std::uint32_t, 2> uint32s = {};
+		EXPECT_FALSE(base85_decode_big_endian<std::uint32_t>("000 000000", 0, 2, uint32s.data()).has_value());
+		EXPECT_FALSE(base85_decode_big_endian<std::uint32_t>("00000|NsC1", 0, 2, uint32s.data()).has_value());
+		EXPECT_FALSE(base85_decode_big_endian<std::uint32_t>("00000 ", 0, 2, uint32s.data()).has_value());
+		EXPECT_TRUE(base85_decode_big_endian<std::uint32_t>("00000 ", 0, 1, uint32s.data()).has_value());
+	}
 }
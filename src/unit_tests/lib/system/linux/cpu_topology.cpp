@@ -0,0 +1,215 @@
+// This file is part of Rayni.
+//
+// Copyright (C) 2021 Martin Ejdestig <marejde@gmail.com>
+//
+// Rayni is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Rayni is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rayni. If not, see <http://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lib/system/linux/cpu_topology.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "lib/function/result.h"
+#include "lib/io/file.h"
+#include "lib/system/scoped_temp_dir.h"
+
+namespace Rayni
+{
+	namespace
+	{
+		struct FakeCPU
+		{
+			unsigned int id;
+			unsigned int core_id;
+			unsigned int package_id;
+			unsigned int node_id = 0;
+		};
+
+		Result<void> write_string(const std::filesystem::path &path, const std::string &str)
+		{
+			return file_write(path, std::vector<std::uint8_t>(str.cbegin(), str.cend()));
+		}
+
+		// Node links are only created if with_nodes, like without NUMA support.
+		Result<void> write_sys_cpu(const std::filesystem::path &path,
+		                           const std::string &online,
+		                           const std::vector<FakeCPU> &cpus,
+		                           bool with_nodes = false)
+		{
+			if (auto r = write_string(path / "online", online + "\n"); !r)
+				return r.error();
+
+			for (const FakeCPU &cpu : cpus) {
+				std::filesystem::path topology_path =
+				        path / ("cpu" + std::to_string(cpu.id)) / "topology";
+				std::filesystem::create_directories(topology_path);
+
+				if (auto r = write_string(topology_path / "core_id",
+				                          std::to_string(cpu.core_id) + "\n");
+				    !r)
+					return r.error();
+
+				if (auto r = write_string(topology_path / "physical_package_id",
+				                          std::to_string(cpu.package_id) + "\n");
+				    !r)
+					return r.error();
+
+				if (with_nodes)
+					std::filesystem::create_directory(topology_path.parent_path() /
+					                                  ("node" + std::to_string(cpu.node_id)));
+			}
+
+			return {};
+		}
+	}
+
+	TEST(CPUTopology, ParseCPUList)
+	{
+		using IdVector = std::vector<unsigned int>;
+
+		EXPECT_EQ(IdVector({0}), CPUTopology::parse_cpu_list("0").value_or({}));
+		EXPECT_EQ(IdVector({0, 1, 2, 3}), CPUTopology::parse_cpu_list("0-3").value_or({}));
+		EXPECT_EQ(IdVector({0, 1, 4, 6, 7}), CPUTopology::parse_cpu_list("0-1,4,6-7").value_or({}));
+		EXPECT_EQ(IdVector({1, 2, 3}), CPUTopology::parse_cpu_list("3,1-2,2").value_or({}));
+
+		EXPECT_EQ(IdVector(), CPUTopology::parse_cpu_list("").value_or({0}));
+
+		EXPECT_FALSE(CPUTopology::parse_cpu_list("a"));
+		EXPECT_FALSE(CPUTopology::parse_cpu_list("1-"));
+		EXPECT_FALSE(CPUTopology::parse_cpu_list("3-1"));
+		EXPECT_FALSE(CPUTopology::parse_cpu_list("0,,1"));
+	}
+
+	TEST(CPUTopology, Read)
+	{
+		ScopedTempDir dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(dir.path().empty());
+
+		// 2 packages with 2 cores each, SMT siblings numbered like on most x86 systems.
+		ASSERT_TRUE(write_sys_cpu(dir.path(),
+		                          "0-7",
+		                          {{0, 0, 0},
+		                           {1, 1, 0},
+		                           {2, 0, 1},
+		                           {3, 1, 1},
+		                           {4, 0, 0},
+		                           {5, 1, 0},
+		                           {6, 0, 1},
+		                           {7, 1, 1}}));
+
+		Result<CPUTopology> topology = CPUTopology::read(dir.path());
+		ASSERT_TRUE(topology);
+
+		using IdVector = std::vector<unsigned int>;
+		using SMT = CPUTopology::SMT;
+
+		EXPECT_EQ(8, topology->cpus().size());
+		EXPECT_EQ(IdVector({0, 1}), topology->package_ids());
+
+		EXPECT_EQ(IdVector({0, 4, 1, 5, 2, 6, 3, 7}), topology->cpu_ids(SMT::INCLUDE));
+		EXPECT_EQ(IdVector({0, 1, 2, 3}), topology->cpu_ids(SMT::EXCLUDE));
+
+		EXPECT_EQ(IdVector({0, 4, 1, 5}), topology->package_cpu_ids(0, SMT::INCLUDE));
+		EXPECT_EQ(IdVector({2, 3}), topology->package_cpu_ids(1, SMT::EXCLUDE));
+		EXPECT_TRUE(topology->package_cpu_ids(2, SMT::INCLUDE).empty());
+	}
+
+	TEST(CPUTopology, ReadNodes)
+	{
+		ScopedTempDir dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(dir.path().empty());
+
+		// 1 package with 2 nodes (e.g. sub-NUMA clustering), 2 cores per node.
+		ASSERT_TRUE(write_sys_cpu(dir.path(),
+		                          "0-7",
+		                          {{0, 0, 0, 0},
+		                           {1, 1, 0, 0},
+		                           {2, 2, 0, 1},
+		                           {3, 3, 0, 1},
+		                           {4, 0, 0, 0},
+		                           {5, 1, 0, 0},
+		                           {6, 2, 0, 1},
+		                           {7, 3, 0, 1}},
+		                          true));
+
+		Result<CPUTopology> topology = CPUTopology::read(dir.path());
+		ASSERT_TRUE(topology);
+
+		using IdVector = std::vector<unsigned int>;
+		using SMT = CPUTopology::SMT;
+
+		EXPECT_EQ(IdVector({0}), topology->package_ids());
+		EXPECT_EQ(IdVector({0, 1}), topology->node_ids());
+
+		EXPECT_EQ(IdVector({0, 4, 1, 5}), topology->node_cpu_ids(0, SMT::INCLUDE));
+		EXPECT_EQ(IdVector({2, 3}), topology->node_cpu_ids(1, SMT::EXCLUDE));
+		EXPECT_TRUE(topology->node_cpu_ids(2, SMT::INCLUDE).empty());
+	}
+
+	TEST(CPUTopology, ReadWithoutNodes)
+	{
+		ScopedTempDir dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(dir.path().empty());
+
+		ASSERT_TRUE(write_sys_cpu(dir.path(), "0-1", {{0, 0, 0}, {1, 1, 0}}));
+
+		Result<CPUTopology> topology = CPUTopology::read(dir.path());
+		ASSERT_TRUE(topology);
+
+		EXPECT_EQ(std::vector<unsigned int>({0}), topology->node_ids());
+		EXPECT_EQ(std::vector<unsigned int>({0, 1}), topology->node_cpu_ids(0, CPUTopology::SMT::INCLUDE));
+	}
+
+	TEST(CPUTopology, ReadOnlyOnlineCPUs)
+	{
+		ScopedTempDir dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(dir.path().empty());
+
+		ASSERT_TRUE(write_sys_cpu(dir.path(), "0,2", {{0, 0, 0}, {1, 1, 0}, {2, 2, 0}}));
+
+		Result<CPUTopology> topology = CPUTopology::read(dir.path());
+		ASSERT_TRUE(topology);
+
+		EXPECT_EQ(std::vector<unsigned int>({0, 2}), topology->cpu_ids(CPUTopology::SMT::INCLUDE));
+	}
+
+	TEST(CPUTopology, ReadError)
+	{
+		ScopedTempDir dir = ScopedTempDir::create().value_or({});
+		ASSERT_FALSE(dir.path().empty());
+
+		EXPECT_FALSE(CPUTopology::read(dir.path()));
+
+		ASSERT_TRUE(write_sys_cpu(dir.path(), "0-1", {{0, 0, 0}}));
+		EXPECT_FALSE(CPUTopology::read(dir.path()));
+	}
+
+	TEST(CPUTopology, ReadSystem)
+	{
+		Result<CPUTopology> topology = CPUTopology::read();
+		if (!topology)
+			GTEST_SKIP() << topology.error().message();
+
+		EXPECT_FALSE(topology->cpus().empty());
+		EXPECT_FALSE(topology->cpu_ids(CPUTopology::SMT::EXCLUDE).empty());
+		EXPECT_LE(topology->cpu_ids(CPUTopology::SMT::EXCLUDE).size(),
+		          topology->cpu_ids(CPUTopology::SMT::INCLUDE).size());
+		EXPECT_FALSE(topology->node_ids().empty());
+	}
+}